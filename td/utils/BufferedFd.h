@@ -6,6 +6,7 @@
 #include "td/utils/logging.h"
 #include "td/utils/port/detail/PollableFd.h"
 #include "td/utils/port/IoSlice.h"
+#include "td/utils/port/PollFlags.h"
 #include "td/utils/Slice.h"
 #include "td/utils/Span.h"
 #include "td/utils/Status.h"
@@ -23,6 +24,8 @@ class BufferedFdBase : public FdT {
 
   Result<size_t> flush_read(size_t max_read = std::numeric_limits<size_t>::max()) TD_WARN_UNUSED_RESULT;
   Result<size_t> flush_write() TD_WARN_UNUSED_RESULT;
+  // like flush_write, but sends large buffers without copying them through FdT::write_zero_copy
+  Result<size_t> flush_write_zero_copy() TD_WARN_UNUSED_RESULT;
 
   bool need_flush_write(size_t at_least = 0) {
     return ready_for_flush_write() > at_least;
@@ -42,9 +45,37 @@ class BufferedFdBase : public FdT {
     write_ = write;
   }
 
+  // in adaptive mode data is read with readv to several buffers, sized by the recent read sizes
+  // if use_pending_read_size is true, then the size of the next read is taken from FdT::get_pending_read_size
+  void set_adaptive_read(bool is_enabled, bool use_pending_read_size = false) {
+    is_adaptive_read_ = is_enabled;
+    use_pending_read_size_ = use_pending_read_size;
+  }
+
+  // in completion read mode data is appended to the input writer by the poll, for example, by
+  // detail::IoUring::subscribe_with_completion_read, so flush_read doesn't read from the fd
+  void set_completion_read(bool is_enabled) {
+    is_completion_read_ = is_enabled;
+  }
+  bool is_completion_read() const {
+    return is_completion_read_;
+  }
+  ChainBufferWriter *get_input_writer() const {
+    return read_;
+  }
+
  private:
   ChainBufferWriter *read_ = nullptr;
   ChainBufferReader *write_ = nullptr;
+
+  static constexpr size_t MIN_ADAPTIVE_READ_SIZE = 1 << 12;
+  static constexpr size_t MAX_ADAPTIVE_READ_SIZE = 1 << 20;
+  bool is_adaptive_read_ = false;
+  bool use_pending_read_size_ = false;
+  size_t adaptive_read_size_ = MIN_ADAPTIVE_READ_SIZE;
+  bool is_completion_read_ = false;
+
+  Result<size_t> flush_read_adaptive(size_t max_read);
 };
 
 template <class FdT>
@@ -93,6 +124,13 @@ BufferedFdBase<FdT>::BufferedFdBase(FdT &&fd_) : FdT(std::move(fd_)) {
 template <class FdT>
 Result<size_t> BufferedFdBase<FdT>::flush_read(size_t max_read) {
   CHECK(read_);
+  if (is_completion_read_) {
+    this->get_poll_info().clear_flags(PollFlags::Read());
+    return 0;
+  }
+  if (is_adaptive_read_) {
+    return flush_read_adaptive(max_read);
+  }
   size_t result = 0;
   while (::td::can_read_local(*this) && max_read) {
     MutableSlice slice = read_->prepare_append().truncate(max_read);
@@ -105,26 +143,97 @@ Result<size_t> BufferedFdBase<FdT>::flush_read(size_t max_read) {
   return result;
 }
 
+template <class FdT>
+constexpr size_t BufferedFdBase<FdT>::MIN_ADAPTIVE_READ_SIZE;
+template <class FdT>
+constexpr size_t BufferedFdBase<FdT>::MAX_ADAPTIVE_READ_SIZE;
+
+template <class FdT>
+Result<size_t> BufferedFdBase<FdT>::flush_read_adaptive(size_t max_read) {
+  size_t result = 0;
+  while (::td::can_read_local(*this) && max_read) {
+    auto read_size = adaptive_read_size_;
+    size_t pending_read_size = 0;
+    if (use_pending_read_size_) {
+      TRY_RESULT_ASSIGN(pending_read_size, FdT::get_pending_read_size());
+      if (pending_read_size != 0) {
+        read_size = min(pending_read_size, MAX_ADAPTIVE_READ_SIZE);
+      }
+    }
+    read_size = min(read_size, max_read);
+
+    constexpr size_t BUF_SIZE = 8;
+    IoSlice buf[BUF_SIZE];
+    auto buf_i = read_->prepare_append_io_slices(buf, read_size);
+    size_t prepared_size = 0;
+    for (size_t i = 0; i < buf_i; i++) {
+      auto slice = as_slice(buf[i]);
+      if (slice.size() > max_read - prepared_size) {
+        buf[i] = as_io_slice(slice.truncate(max_read - prepared_size));
+      }
+      prepared_size += as_slice(buf[i]).size();
+    }
+    TRY_RESULT(x, FdT::readv(Span<IoSlice>(buf, buf_i)));
+    read_->confirm_append_io_slices(x);
+    result += x;
+    max_read -= x;
+
+    // the buffers are grown if they were filled and shrunk if they were mostly unused or there was no data
+    if (x == prepared_size) {
+      adaptive_read_size_ = min(max(adaptive_read_size_, x) * 2, MAX_ADAPTIVE_READ_SIZE);
+    } else if (x < adaptive_read_size_ / 4) {
+      adaptive_read_size_ = max(adaptive_read_size_ / 2, MIN_ADAPTIVE_READ_SIZE);
+    }
+
+    if (pending_read_size != 0 && x >= pending_read_size && x < prepared_size) {
+      // all pending data has been read, so there is no need to wait for EAGAIN;
+      // the poll will set the flag again when new data arrives
+      this->get_poll_info().clear_flags(PollFlags::Read());
+    }
+  }
+  return result;
+}
+
 template <class FdT>
 Result<size_t> BufferedFdBase<FdT>::flush_write() {
   // TODO: sync on demand
   write_->sync_with_writer();
   size_t result = 0;
   while (!write_->empty() && ::td::can_write_local(*this)) {
-    constexpr size_t BUF_SIZE = 20;
+    constexpr size_t BUF_SIZE = 64;
     IoSlice buf[BUF_SIZE];
+    auto buf_i = write_->fill_io_slices(buf);
+    TRY_RESULT(x, FdT::writev(Span<IoSlice>(buf, buf_i)));
+    write_->advance(x);
+    result += x;
+  }
+  return result;
+}
 
-    auto it = write_->clone();
-    size_t buf_i;
-    for (buf_i = 0; buf_i < BUF_SIZE; buf_i++) {
-      Slice slice = it.prepare_read();
-      if (slice.empty()) {
-        break;
+template <class FdT>
+Result<size_t> BufferedFdBase<FdT>::flush_write_zero_copy() {
+  write_->sync_with_writer();
+  size_t result = 0;
+  while (!write_->empty() && ::td::can_write_local(*this)) {
+    size_t x;
+    auto head_size = write_->prepare_read().size();
+    if (FdT::can_write_zero_copy(head_size)) {
+      // the written buffer is referenced by the fd until the kernel stops using it
+      auto head = write_->clone().read_as_buffer_slice(head_size);
+      TRY_RESULT_ASSIGN(x, FdT::write_zero_copy(head));
+    } else {
+      constexpr size_t BUF_SIZE = 64;
+      IoSlice buf[BUF_SIZE];
+      auto buf_i = write_->fill_io_slices(buf);
+      // large buffers after the head are left for the next zero-copy write
+      for (size_t i = 1; i < buf_i; i++) {
+        if (FdT::can_write_zero_copy(as_slice(buf[i]).size())) {
+          buf_i = i;
+          break;
+        }
       }
-      buf[buf_i] = as_io_slice(slice);
-      it.confirm_read(slice.size());
+      TRY_RESULT_ASSIGN(x, FdT::writev(Span<IoSlice>(buf, buf_i)));
     }
-    TRY_RESULT(x, FdT::writev(Span<IoSlice>(buf, buf_i)));
     write_->advance(x);
     result += x;
   }
@@ -185,9 +294,16 @@ void BufferedFd<FdT>::close() {
 template <class FdT>
 Result<size_t> BufferedFd<FdT>::flush_read(size_t max_read) {
   TRY_RESULT(result, Parent::flush_read(max_read));
-  if (result) {
+  if (this->is_completion_read()) {
+    // the data has already been appended to input_writer_ by the poll
+    auto old_size = input_reader_.size();
+    input_reader_.sync_with_writer();
+    result = input_reader_.size() - old_size;
+  } else if (result) {
     // TODO: faster sync is possible if you owns writer.
     input_reader_.sync_with_writer();
+  }
+  if (result) {
     LOG(DEBUG) << "Flush read: +" << format::as_size(result) << tag("total", format::as_size(input_reader_.size()));
   }
   return result;
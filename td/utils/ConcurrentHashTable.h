@@ -1,13 +1,19 @@
 #pragma once
 
+#include "td/utils/bits.h"
 #include "td/utils/common.h"
+#include "td/utils/Hash.h"
 #include "td/utils/HazardPointers.h"
 #include "td/utils/logging.h"
+#include "td/utils/port/thread.h"
 #include "td/utils/port/thread_local.h"
+#include "td/utils/ThreadSafeCounter.h"
 
 #include <atomic>
-#include <condition_variable>
+#include <functional>
 #include <mutex>
+#include <new>
+#include <utility>
 
 namespace td {
 
@@ -87,230 +93,577 @@ class AtomicHashArray {
   std::vector<Node> nodes_;
 };
 
-// Simple concurrent hash map with multiple limitations
-template <class KeyT, class ValueT>
+// Concurrent hash map with arbitrary hashable keys
+//
+// Supports insert (if absent), find, erase and for_each.
+// KeyT must be default constructible. ValueT is stored in std::atomic, so it must be trivially copyable,
+// but all its values can be stored.
+//
+// A slot is claimed for a key forever, and erase just leaves a tombstone in it, which is reused if the same key
+// is inserted again. Values are read without locking with the help of the version in the slot state.
+//
+// When a probe sequence becomes too long and at least half of the slots are used, the table is migrated to a new one,
+// sized by the number of live entries, so tombstones are compacted away. The numbers of live entries and used slots
+// are maintained in per-thread counters, so they are found without scanning the table. The migration is incremental
+// and cooperative: every operation, which finds the table migrating, initializes one chunk of slots of the new table
+// or, after all of them are initialized, moves one chunk of slots of the old table, so the migration is started
+// in constant time, and the old table remains usable until the last chunk is moved. New keys aren't added to either
+// table during the migration; such insertions help to finish it instead, so the new table receives only the moved
+// entries, which were counted when it was created, and can't overflow.
+//
+// If a probe sequence is too long in a sparse table, then keys collide and a bigger table wouldn't help, so the key
+// is added to an overflow list, protected by a mutex. A key is never both in the list and in a table, because it is
+// added to the list only if all slots of its probe sequence are used by other keys, and the list is checked before
+// a slot is claimed in a newer table.
+template <class KeyT, class ValueT, class HashT = Hash<KeyT>, class EqT = std::equal_to<KeyT>>
 class ConcurrentHashMap {
-  using HashMap = AtomicHashArray<KeyT, std::atomic<ValueT>>;
-  static HazardPointers<HashMap> hp_;
+  static constexpr uint64 FREE_HASH = 0;
+  static constexpr uint64 SEALED_HASH = 1;
+
+  // state of a slot is (version << 3) | tag
+  static constexpr uint64 NO_KEY = 0;
+  static constexpr uint64 ERASED = 1;
+  static constexpr uint64 PRESENT = 2;
+  static constexpr uint64 LOCKED = 3;
+  static constexpr uint64 MOVED = 4;
+  static constexpr uint64 TAG_MASK = 7;
+
+  static constexpr size_t MIN_CAPACITY = 16;
+  static constexpr size_t MAX_PROBES = 64;
+  static constexpr size_t MIGRATE_CHUNK_SIZE = 256;
+
+  struct Slot {
+    std::atomic<uint64> hash{FREE_HASH};
+    std::atomic<uint64> state{NO_KEY};
+    KeyT key{};
+    std::atomic<ValueT> value{};
+  };
+
+  struct Table {
+    explicit Table(size_t capacity)
+        : slots(static_cast<Slot *>(::operator new(capacity * sizeof(Slot))))
+        , capacity(capacity)
+        , mask(capacity - 1)
+        , shift(64 - count_trailing_zeroes64(capacity))
+        , chunks_n((capacity + MIGRATE_CHUNK_SIZE - 1) / MIGRATE_CHUNK_SIZE) {
+    }
+    Table(const Table &) = delete;
+    Table &operator=(const Table &) = delete;
+    Table(Table &&) = delete;
+    Table &operator=(Table &&) = delete;
+    ~Table() {
+      // all claimed chunks are initialized, because nobody uses the table
+      auto end = td::min(td::min(next_init_chunk.load(), chunks_n) * MIGRATE_CHUNK_SIZE, capacity);
+      for (size_t i = 0; i < end; i++) {
+        slots[i].~Slot();
+      }
+      ::operator delete(slots);
+    }
+
+    Slot *slots;
+    size_t capacity;
+    size_t mask;
+    int32 shift;
+    size_t chunks_n;
+    // the value of used_slots_ before the table was created
+    int64 used_slots_base{0};
+
+    std::atomic<Table *> next{nullptr};
+    std::atomic<bool> is_migrating{false};
+    std::atomic<size_t> next_chunk{0};
+    std::atomic<size_t> migrated_chunks{0};
+    std::atomic<size_t> next_init_chunk{0};
+    std::atomic<size_t> initialized_chunks{0};
+
+    size_t start_pos(uint64 hash) const {
+      return static_cast<size_t>((hash * 0x9e3779b97f4a7c15ull) >> shift);
+    }
+
+    // initializes one chunk of slots; returns false if there are no more chunks to initialize
+    bool init_chunk() {
+      auto chunk = next_init_chunk.fetch_add(1, std::memory_order_relaxed);
+      if (chunk >= chunks_n) {
+        return false;
+      }
+      auto begin = chunk * MIGRATE_CHUNK_SIZE;
+      auto end = td::min(begin + MIGRATE_CHUNK_SIZE, capacity);
+      for (auto i = begin; i < end; i++) {
+        new (&slots[i]) Slot();
+      }
+      initialized_chunks.fetch_add(1, std::memory_order_release);
+      return true;
+    }
+
+    bool is_initialized() const {
+      return initialized_chunks.load(std::memory_order_acquire) == chunks_n;
+    }
+  };
+  // tables are big and retired rarely, so a retired table is freed by the next retire of the thread,
+  // which retired it, unless it is still protected; a thread keeps at most 4 retired tables per other thread
+  // pointers 0 and 1 are used by operations and pointers 2 and 3 by for_each, so f can modify the map
+  using HazardPointersT = HazardPointers<Table, 4>;
+  static HazardPointersT hp_;
+
+  enum class Result : int32 { Done, Next };
 
  public:
   explicit ConcurrentHashMap(size_t n = 32) {
-    n = 1;
-    hash_map_.store(make_unique<HashMap>(n).release());
+    auto table = make_unique<Table>(get_capacity(n));
+    while (table->init_chunk()) {
+    }
+    root_.store(table.release());
   }
   ConcurrentHashMap(const ConcurrentHashMap &) = delete;
   ConcurrentHashMap &operator=(const ConcurrentHashMap &) = delete;
   ConcurrentHashMap(ConcurrentHashMap &&) = delete;
   ConcurrentHashMap &operator=(ConcurrentHashMap &&) = delete;
   ~ConcurrentHashMap() {
-    unique_ptr<HashMap>(hash_map_.load()).reset();
+    auto table = root_.load();
+    unique_ptr<Table>(table->next.load()).reset();
+    unique_ptr<Table>(table).reset();
   }
 
   static std::string get_name() {
     return "ConcurrrentHashMap";
   }
 
-  static KeyT empty_key() {
-    return KeyT{};
-  }
-  static ValueT empty_value() {
-    return ValueT{};
-  }
-  static ValueT migrate_value() {
-    return (ValueT)(1);  // c-style conversion because reinterpret_cast<int>(1) is CE in MSVC
+  // inserts the value if there is no value for the key; returns the value stored in the map
+  ValueT insert(const KeyT &key, ValueT value) {
+    auto hash = calc_hash(key);
+    ValueT result{};
+    run_operation(true, [&](Table &table, bool is_root) {
+      auto can_create = is_root && !table.is_migrating.load(std::memory_order_relaxed);
+      if (can_create && overflow_size_.load() != 0 && find_overflow(key, result)) {
+        return Result::Done;
+      }
+      auto slot = find_slot(table, key, hash, can_create, MAX_PROBES);
+      if (slot == nullptr) {
+        // in a sparse table the probe sequence is too long only due to colliding keys
+        if (can_create && is_sparse(table) && insert_overflow(table, key, value, result)) {
+          return Result::Done;
+        }
+        return Result::Next;
+      }
+      while (true) {
+        auto state = slot->state.load(std::memory_order_acquire);
+        switch (state & TAG_MASK) {
+          case PRESENT:
+            if (read_value(*slot, state, result)) {
+              return Result::Done;
+            }
+            break;
+          case ERASED:
+            if (slot->state.compare_exchange_weak(state, with_tag(state, LOCKED))) {
+              // the entry is counted before is_migrating is checked, so start_migration never misses it
+              size_.add(1);
+              std::atomic_thread_fence(std::memory_order_seq_cst);
+              if (table.is_migrating.load()) {
+                // the entry wasn't counted by start_migration, so it must not become present
+                slot->state.store(state, std::memory_order_release);
+                size_.add(-1);
+                return Result::Next;
+              }
+              slot->value.store(value, std::memory_order_release);
+              slot->state.store(next_state(state, PRESENT), std::memory_order_release);
+              result = value;
+              return Result::Done;
+            }
+            break;
+          case MOVED:
+            return Result::Next;
+          default:
+            this_thread::yield();
+        }
+      }
+    });
+    return result;
   }
 
-  ValueT insert(KeyT key, ValueT value) {
-    CHECK(key != empty_key());
-    CHECK(value != migrate_value());
-    typename HazardPointers<HashMap>::Holder holder(hp_, get_thread_id(), 0);
-    while (true) {
-      auto hash_map = holder.protect(hash_map_);
-      if (!hash_map) {
-        do_migrate(nullptr);
-        continue;
+  // returns the value for the key or default_value if there is no value
+  ValueT find(const KeyT &key, ValueT default_value) {
+    auto hash = calc_hash(key);
+    ValueT result = default_value;
+    bool is_found = false;
+    run_operation(false, [&](Table &table, bool) {
+      auto slot = find_slot(table, key, hash, false, MAX_PROBES);
+      if (slot == nullptr) {
+        return get_next_result(table);
       }
-
-      bool ok = false;
-      ValueT inserted_value;
-      hash_map->with_value(key, true, [&](auto &node_value) {
-        ValueT expected_value = this->empty_value();
-        if (node_value.compare_exchange_strong(expected_value, value, std::memory_order_release,
-                                               std::memory_order_acquire)) {
-          ok = true;
-          inserted_value = value;
-        } else {
-          if (expected_value == this->migrate_value()) {
-            ok = false;
-          } else {
-            ok = true;
-            inserted_value = expected_value;
-          }
+      while (true) {
+        auto state = slot->state.load(std::memory_order_acquire);
+        switch (state & TAG_MASK) {
+          case PRESENT:
+            if (read_value(*slot, state, result)) {
+              is_found = true;
+              return Result::Done;
+            }
+            break;
+          case ERASED:
+            return Result::Done;
+          case MOVED:
+            return Result::Next;
+          default:
+            this_thread::yield();
         }
-      });
-      if (ok) {
-        return inserted_value;
       }
-      do_migrate(hash_map);
+    });
+    if (!is_found && overflow_size_.load() != 0) {
+      find_overflow(key, result);
     }
+    return result;
   }
 
-  ValueT find(KeyT key, ValueT value) {
-    typename HazardPointers<HashMap>::Holder holder(hp_, get_thread_id(), 0);
-    while (true) {
-      auto hash_map = holder.protect(hash_map_);
-      if (!hash_map) {
-        do_migrate(nullptr);
-        continue;
+  // returns the number of erased values
+  size_t erase(const KeyT &key) {
+    auto hash = calc_hash(key);
+    size_t result = 0;
+    run_operation(false, [&](Table &table, bool) {
+      auto slot = find_slot(table, key, hash, false, MAX_PROBES);
+      if (slot == nullptr) {
+        return get_next_result(table);
       }
-
-      bool has_value = hash_map->with_value(
-          key, false, [&](auto &node_value) { value = node_value.load(std::memory_order_acquire); });
-      if (!has_value || value != migrate_value()) {
-        return value;
+      while (true) {
+        auto state = slot->state.load(std::memory_order_acquire);
+        switch (state & TAG_MASK) {
+          case PRESENT:
+            if (slot->state.compare_exchange_weak(state, next_state(state, ERASED), std::memory_order_acq_rel)) {
+              size_.add(-1);
+              result = 1;
+              return Result::Done;
+            }
+            break;
+          case ERASED:
+            return Result::Done;
+          case MOVED:
+            return Result::Next;
+          default:
+            this_thread::yield();
+        }
       }
-      do_migrate(hash_map);
+    });
+    if (result == 0 && overflow_size_.load() != 0) {
+      result = erase_overflow(key);
     }
+    return result;
   }
 
+  // calls f(key, value) for every value; values changed concurrently may be skipped or visited twice
+  // f may modify the map, but must not call for_each of a map with the same type
   template <class F>
   void for_each(F &&f) {
-    auto hash_map = hash_map_.load();
-    CHECK(hash_map);
-    auto size = hash_map->size();
-    for (size_t i = 0; i < size; i++) {
-      auto &node = hash_map->node_at(i);
-      auto key = node.key.load(std::memory_order_relaxed);
-      auto value = node.value.load(std::memory_order_relaxed);
-
-      if (key != empty_key()) {
-        CHECK(value != migrate_value());
-        if (value != empty_value()) {
-          f(key, value);
-        }
+    typename HazardPointersT::Holder holder(hp_, get_thread_id(), 2);
+    typename HazardPointersT::Holder next_holder(hp_, get_thread_id(), 3);
+    auto table = holder.protect(root_);
+    for_each_in_table(*table, f);
+    auto next = next_holder.protect(table->next);
+    // nothing is moved to the next table before it is initialized
+    if (next != nullptr && is_reachable(table, next) && next->is_initialized()) {
+      for_each_in_table(*next, f);
+    }
+    if (overflow_size_.load() != 0) {
+      vector<std::pair<KeyT, ValueT>> overflow;
+      {
+        std::lock_guard<std::mutex> guard(overflow_mutex_);
+        overflow = overflow_;
+      }
+      for (auto &entry : overflow) {
+        f(entry.first, entry.second);
       }
     }
   }
 
  private:
   // use no padding intentionally
-  std::atomic<HashMap *> hash_map_{nullptr};
-
+  std::atomic<Table *> root_{nullptr};
   std::mutex migrate_mutex_;
-  std::condition_variable migrate_cv_;
-
-  int migrate_cnt_{0};
-  int migrate_generation_{0};
-  HashMap *migrate_from_hash_map_{nullptr};
-  HashMap *migrate_to_hash_map_{nullptr};
-  struct Task {
-    size_t begin;
-    size_t end;
-    bool empty() const {
-      return begin >= end;
+  // an upper bound for the number of present entries in tables
+  ThreadSafeCounter size_;
+  // the number of slots claimed in all tables
+  ThreadSafeCounter used_slots_;
+  std::mutex overflow_mutex_;
+  vector<std::pair<KeyT, ValueT>> overflow_;
+  std::atomic<size_t> overflow_size_{0};
+  HashT hash_;
+  EqT eq_;
+
+  static size_t get_capacity(size_t n) {
+    size_t capacity = MIN_CAPACITY;
+    while (capacity < n * 2) {
+      capacity *= 2;
     }
-    size_t size() const {
-      if (empty()) {
-        return 0;
+    return capacity;
+  }
+
+  uint64 calc_hash(const KeyT &key) const {
+    auto hash = static_cast<uint64>(hash_(key));
+    if (hash <= SEALED_HASH) {
+      hash += 2;
+    }
+    return hash;
+  }
+
+  static uint64 with_tag(uint64 state, uint64 tag) {
+    return (state & ~TAG_MASK) | tag;
+  }
+  static uint64 next_state(uint64 state, uint64 tag) {
+    return ((state | TAG_MASK) + 1) | tag;
+  }
+
+  static bool read_value(Slot &slot, uint64 state, ValueT &value) {
+    value = slot.value.load(std::memory_order_acquire);
+    return slot.state.load(std::memory_order_relaxed) == state;
+  }
+
+  // returns the slot claimed for the key, or nullptr if the key must be looked for in the next table
+  // if should_create is false, then nullptr is also returned if there is no slot for the key
+  // a new slot is claimed only among the first max_probes slots, but keys moved by migration can be farther
+  Slot *find_slot(Table &table, const KeyT &key, uint64 hash, bool should_create, size_t max_probes) {
+    auto pos = table.start_pos(hash);
+    for (size_t i = 0; i < table.capacity; i++, pos = (pos + 1) & table.mask) {
+      auto &slot = table.slots[pos];
+      auto slot_hash = slot.hash.load(std::memory_order_acquire);
+      if (slot_hash == FREE_HASH) {
+        if (!should_create || i >= max_probes) {
+          return nullptr;
+        }
+        if (slot.hash.compare_exchange_strong(slot_hash, hash, std::memory_order_acq_rel)) {
+          used_slots_.add(1);
+          slot.key = key;
+          slot.state.store(ERASED, std::memory_order_release);
+          return &slot;
+        }
+      }
+      if (slot_hash == SEALED_HASH) {
+        return nullptr;
+      }
+      if (slot_hash == hash) {
+        while ((slot.state.load(std::memory_order_acquire) & TAG_MASK) == NO_KEY) {
+          this_thread::yield();
+        }
+        if (eq_(slot.key, key)) {
+          return &slot;
+        }
       }
-      return end - begin;
     }
-  };
+    return nullptr;
+  }
+
+  // the key wasn't found without creation of a slot; checks whether it can be in the next table
+  static Result get_next_result(const Table &table) {
+    return table.next.load(std::memory_order_acquire) == nullptr ? Result::Done : Result::Next;
+  }
+
+  // checks whether less than half of the slots are used; slots claimed in the previous table can be also counted
+  bool is_sparse(const Table &table) const {
+    return 2 * (used_slots_.sum() - table.used_slots_base) < static_cast<int64>(table.capacity);
+  }
 
-  struct TaskCreator {
-    size_t chunk_size;
-    size_t size;
-    std::atomic<size_t> pos{0};
-    Task create() {
-      auto i = pos++;
-      auto begin = i * chunk_size;
-      auto end = begin + chunk_size;
-      if (end > size) {
-        end = size;
+  bool find_overflow(const KeyT &key, ValueT &value) {
+    std::lock_guard<std::mutex> guard(overflow_mutex_);
+    for (auto &entry : overflow_) {
+      if (eq_(entry.first, key)) {
+        value = entry.second;
+        return true;
       }
-      return {begin, end};
     }
-  };
-  TaskCreator task_creator;
+    return false;
+  }
 
-  void do_migrate(HashMap *ptr) {
-    //LOG(ERROR) << "In do_migrate: " << ptr;
-    std::unique_lock<std::mutex> lock(migrate_mutex_);
-    if (hash_map_.load() != ptr) {
-      return;
+  // adds the key, which has no free slot in the table, to the overflow list, unless it is already there
+  // returns false if the table is migrating, so the key must be inserted into the next table
+  bool insert_overflow(Table &table, const KeyT &key, ValueT value, ValueT &result) {
+    std::lock_guard<std::mutex> guard(overflow_mutex_);
+    for (auto &entry : overflow_) {
+      if (eq_(entry.first, key)) {
+        result = entry.second;
+        return true;
+      }
     }
-    init_migrate();
-    CHECK(!ptr || migrate_from_hash_map_ == ptr);
-    migrate_cnt_++;
-    auto migrate_generation = migrate_generation_;
-    lock.unlock();
-
-    run_migrate();
-
-    lock.lock();
-    migrate_cnt_--;
-    if (migrate_cnt_ == 0) {
-      finish_migrate();
+    // the entry is counted before is_migrating is checked, so insertions into the next table see it
+    overflow_size_.fetch_add(1);
+    if (table.is_migrating.load()) {
+      overflow_size_.fetch_sub(1);
+      return false;
     }
-    migrate_cv_.wait(lock, [&] { return migrate_generation_ != migrate_generation; });
+    overflow_.emplace_back(key, value);
+    result = value;
+    return true;
   }
 
-  void finish_migrate() {
-    //LOG(ERROR) << "In finish_migrate";
-    hash_map_.store(migrate_to_hash_map_);
-    hp_.retire(get_thread_id(), migrate_from_hash_map_);
-    migrate_from_hash_map_ = nullptr;
-    migrate_to_hash_map_ = nullptr;
-    migrate_generation_++;
-    migrate_cv_.notify_all();
+  size_t erase_overflow(const KeyT &key) {
+    std::lock_guard<std::mutex> guard(overflow_mutex_);
+    for (auto &entry : overflow_) {
+      if (eq_(entry.first, key)) {
+        entry = std::move(overflow_.back());
+        overflow_.pop_back();
+        overflow_size_.fetch_sub(1);
+        return 1;
+      }
+    }
+    return 0;
   }
 
-  void init_migrate() {
-    if (migrate_from_hash_map_ != nullptr) {
-      return;
+  template <class F>
+  void run_operation(bool should_create, F &&f) {
+    typename HazardPointersT::Holder holder0(hp_, get_thread_id(), 0);
+    typename HazardPointersT::Holder holder1(hp_, get_thread_id(), 1);
+    typename HazardPointersT::Holder *holders[2] = {&holder0, &holder1};
+    while (true) {
+      Table *table = holders[0]->protect(root_);
+      Table *prev = nullptr;
+      size_t holder_i = 0;
+      bool restart = false;
+      while (!restart) {
+        if (table->next.load(std::memory_order_acquire) != nullptr) {
+          help_migrate(table);
+        }
+        if (f(*table, prev == nullptr) == Result::Done) {
+          return;
+        }
+        if (table->next.load(std::memory_order_acquire) == nullptr) {
+          CHECK(should_create);
+          if (!start_migration(table, prev)) {
+            restart = true;
+            continue;
+          }
+        }
+        holder_i ^= 1;
+        auto next = holders[holder_i]->protect(table->next);
+        if (!is_reachable(table, next)) {
+          restart = true;
+          continue;
+        }
+        while (!next->is_initialized()) {
+          if (!help_migrate(table)) {
+            this_thread::yield();
+          }
+        }
+        prev = table;
+        table = next;
+      }
+    }
+  }
+
+  // checks that the next table isn't retired yet after it was protected by a hazard pointer
+  bool is_reachable(Table *table, Table *next) const {
+    auto root = root_.load();
+    return root == table || root == next;
+  }
+
+  // returns false if the operation must be restarted from the root
+  bool start_migration(Table *table, Table *prev) {
+    if (prev != nullptr) {
+      // only the root table can be migrated, so finish migration of the previous table first
+      while (root_.load() == prev) {
+        if (!help_migrate(prev)) {
+          this_thread::yield();
+        }
+      }
+      return false;
+    }
+
+    std::lock_guard<std::mutex> guard(migrate_mutex_);
+    if (table->next.load() == nullptr) {
+      CHECK(root_.load() == table);
+      // after is_migrating is set, no entry can become present, so all entries to be moved are counted
+      table->is_migrating.store(true);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      auto size = static_cast<size_t>(td::max(size_.sum(), static_cast<int64>(0)));
+      auto next = make_unique<Table>(get_capacity(size * 2));
+      next->used_slots_base = used_slots_.sum();
+      table->next.store(next.release(), std::memory_order_release);
+    }
+    return true;
+  }
+
+  // initializes one chunk of the next table or migrates one chunk of the table
+  // returns false if there are no more chunks to process now
+  bool help_migrate(Table *table) {
+    auto next = table->next.load(std::memory_order_acquire);
+    if (next->init_chunk()) {
+      return true;
+    }
+    if (!next->is_initialized()) {
+      // the remaining chunks are being initialized by other threads
+      return false;
+    }
+    auto chunk = table->next_chunk.fetch_add(1, std::memory_order_relaxed);
+    if (chunk >= table->chunks_n) {
+      return false;
     }
-    //LOG(ERROR) << "In init_migrate";
-    CHECK(migrate_cnt_ == 0);
-    migrate_generation_++;
-    migrate_from_hash_map_ = hash_map_.exchange(nullptr);
-    auto new_size = migrate_from_hash_map_->size() * 2;
-    migrate_to_hash_map_ = make_unique<HashMap>(new_size).release();
-    task_creator.chunk_size = 100;
-    task_creator.size = migrate_from_hash_map_->size();
-    task_creator.pos = 0;
+    auto begin = chunk * MIGRATE_CHUNK_SIZE;
+    auto end = td::min(begin + MIGRATE_CHUNK_SIZE, table->capacity);
+    for (auto i = begin; i < end; i++) {
+      migrate_slot(table->slots[i], *next);
+    }
+    if (table->migrated_chunks.fetch_add(1, std::memory_order_acq_rel) + 1 == table->chunks_n) {
+      auto expected = table;
+      CHECK(root_.compare_exchange_strong(expected, next));
+      hp_.retire(get_thread_id(), table);
+    }
+    return true;
   }
 
-  void run_migrate() {
-    //LOG(ERROR) << "In run_migrate";
-    size_t cnt = 0;
+  void migrate_slot(Slot &slot, Table &to) {
+    auto slot_hash = slot.hash.load(std::memory_order_acquire);
+    if (slot_hash == FREE_HASH && slot.hash.compare_exchange_strong(slot_hash, SEALED_HASH)) {
+      return;
+    }
+    CHECK(slot_hash != SEALED_HASH);
+
     while (true) {
-      auto task = task_creator.create();
-      cnt += task.size();
-      if (task.empty()) {
-        break;
+      auto state = slot.state.load(std::memory_order_acquire);
+      auto tag = state & TAG_MASK;
+      if (tag == NO_KEY || tag == LOCKED) {
+        this_thread::yield();
+        continue;
+      }
+      CHECK(tag != MOVED);
+      if (!slot.state.compare_exchange_weak(state, with_tag(state, LOCKED), std::memory_order_acquire)) {
+        continue;
+      }
+      if (tag == PRESENT) {
+        // nobody can access the key in the new table until the slot is marked as moved
+        // the new table has a free slot, because it receives only entries counted by start_migration
+        auto to_slot = find_slot(to, slot.key, slot_hash, true, to.capacity);
+        LOG_CHECK(to_slot != nullptr) << "Migration overflow";
+        to_slot->value.store(slot.value.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        to_slot->state.store(next_state(ERASED, PRESENT), std::memory_order_release);
       }
-      run_task(task);
+      slot.state.store(next_state(state, MOVED), std::memory_order_release);
+      return;
     }
-    //LOG(ERROR) << "In run_migrate " << cnt;
   }
 
-  void run_task(Task task) {
-    for (auto i = task.begin; i < task.end; i++) {
-      auto &node = migrate_from_hash_map_->node_at(i);
-      auto old_value = node.value.exchange(migrate_value(), std::memory_order_acq_rel);
-      if (old_value == 0) {
+  template <class F>
+  static void for_each_in_table(Table &table, F &f) {
+    for (size_t i = 0; i < table.capacity; i++) {
+      auto &slot = table.slots[i];
+      if (slot.hash.load(std::memory_order_acquire) <= SEALED_HASH) {
         continue;
       }
-      auto node_key = node.key.load(std::memory_order_relaxed);
-      //LOG(ERROR) << node_key << " " << node_key;
-      auto ok = migrate_to_hash_map_->with_value(
-          node_key, true, [&](auto &node_value) { node_value.store(old_value, std::memory_order_relaxed); });
-      LOG_CHECK(ok) << "Migration overflow";
+      while (true) {
+        auto state = slot.state.load(std::memory_order_acquire);
+        auto tag = state & TAG_MASK;
+        if (tag == NO_KEY || tag == LOCKED) {
+          this_thread::yield();
+          continue;
+        }
+        ValueT value;
+        if (tag == PRESENT) {
+          if (!read_value(slot, state, value)) {
+            continue;
+          }
+          f(slot.key, value);
+        }
+        break;
+      }
     }
   }
 };
 
-template <class KeyT, class ValueT>
-HazardPointers<typename ConcurrentHashMap<KeyT, ValueT>::HashMap> ConcurrentHashMap<KeyT, ValueT>::hp_(64);
+template <class KeyT, class ValueT, class HashT, class EqT>
+typename ConcurrentHashMap<KeyT, ValueT, HashT, EqT>::HazardPointersT
+    ConcurrentHashMap<KeyT, ValueT, HashT, EqT>::hp_(128, 1);
 
 }  // namespace td
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "td/utils/FlatHashTable.h"
+#include "td/utils/Hash.h"
+
+#include <functional>
+
+namespace td {
+
+template <class KeyT, class ValueT, class HashT = Hash<KeyT>, class EqT = std::equal_to<KeyT>>
+using FlatHashMap = FlatHashTable<MapNode<KeyT, ValueT>, HashT, EqT>;
+
+}  // namespace td
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "td/utils/FlatHashTable.h"
+#include "td/utils/Hash.h"
+
+#include <functional>
+
+namespace td {
+
+template <class KeyT, class HashT = Hash<KeyT>, class EqT = std::equal_to<KeyT>>
+using FlatHashSet = FlatHashTable<SetNode<KeyT>, HashT, EqT>;
+
+}  // namespace td
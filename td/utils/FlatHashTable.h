@@ -0,0 +1,608 @@
+#pragma once
+
+#include "td/utils/bits.h"
+#include "td/utils/common.h"
+
+#if TD_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+#include <cstring>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <new>
+#include <utility>
+
+namespace td {
+
+template <class KeyT, class ValueT>
+struct MapNode {
+  using public_key_type = KeyT;
+  using public_type = MapNode<KeyT, ValueT>;
+  using insert_type = std::pair<KeyT, ValueT>;
+
+  KeyT first;
+  ValueT second;
+
+  template <class... ArgsT>
+  explicit MapNode(KeyT key, ArgsT &&... args) : first(std::move(key)), second(std::forward<ArgsT>(args)...) {
+  }
+  explicit MapNode(insert_type &&value) : first(std::move(value.first)), second(std::move(value.second)) {
+  }
+
+  const KeyT &key() const {
+    return first;
+  }
+  static const KeyT &key_of(const insert_type &value) {
+    return value.first;
+  }
+  public_type &get_public() {
+    return *this;
+  }
+  const public_type &get_public() const {
+    return *this;
+  }
+};
+
+template <class KeyT>
+struct SetNode {
+  using public_key_type = KeyT;
+  using public_type = const KeyT;
+  using insert_type = KeyT;
+
+  KeyT first;
+
+  explicit SetNode(KeyT key) : first(std::move(key)) {
+  }
+
+  const KeyT &key() const {
+    return first;
+  }
+  static const KeyT &key_of(const insert_type &value) {
+    return value;
+  }
+  public_type &get_public() const {
+    return first;
+  }
+};
+
+namespace detail {
+
+// A group of consecutive control bytes, which are checked simultaneously.
+// A control byte is either EMPTY, or contains 7 lower bits of the hash of the key stored in the slot.
+#if TD_HAVE_SSE2
+class FlatHashTableGroup {
+ public:
+  static constexpr size_t WIDTH = 16;
+  static constexpr int32 SHIFT = 0;
+
+  explicit FlatHashTableGroup(const int8 *ctrl) : ctrl_(_mm_loadu_si128(reinterpret_cast<const __m128i *>(ctrl))) {
+  }
+
+  uint64 match(int8 h2) const {
+    return static_cast<uint32>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h2), ctrl_)));
+  }
+
+  uint64 match_empty() const {
+    return static_cast<uint32>(_mm_movemask_epi8(ctrl_));
+  }
+
+ private:
+  __m128i ctrl_;
+};
+#else
+// NB: works only for little-endian systems
+class FlatHashTableGroup {
+ public:
+  static constexpr size_t WIDTH = 8;
+  static constexpr int32 SHIFT = 3;
+
+  explicit FlatHashTableGroup(const int8 *ctrl) {
+    std::memcpy(&ctrl_, ctrl, sizeof(ctrl_));
+  }
+
+  // can have false positives, which are filtered out by comparison of keys
+  uint64 match(int8 h2) const {
+    auto x = ctrl_ ^ (LSBS * static_cast<uint8>(h2));
+    return (x - LSBS) & ~x & MSBS;
+  }
+
+  uint64 match_empty() const {
+    return ctrl_ & MSBS;
+  }
+
+ private:
+  static constexpr uint64 LSBS = 0x0101010101010101ull;
+  static constexpr uint64 MSBS = 0x8080808080808080ull;
+  uint64 ctrl_;
+};
+#endif
+
+}  // namespace detail
+
+// Open addressing hash table with linear probing and backward shift deletion, so no tombstones are ever left.
+// Control bytes are stored separately from the nodes, so a whole group of them is checked at once.
+// Pointers and references to the elements are invalidated by any insertion, which leads to resize, and by any erase.
+template <class NodeT, class HashT, class EqT = std::equal_to<typename NodeT::public_key_type>>
+class FlatHashTable {
+  using Group = detail::FlatHashTableGroup;
+  static constexpr int8 EMPTY = -128;
+  static constexpr size_t MIN_CAPACITY = Group::WIDTH;
+
+ public:
+  using KeyT = typename NodeT::public_key_type;
+  using key_type = KeyT;
+  using value_type = typename NodeT::public_type;
+  using hasher = HashT;
+  using key_equal = EqT;
+  using size_type = size_t;
+
+  template <class TableT, class PublicT>
+  class IteratorImpl {
+   public:
+    using iterator_category = std::forward_iterator_tag;
+    using difference_type = std::ptrdiff_t;
+    using value_type = PublicT;
+    using pointer = PublicT *;
+    using reference = PublicT &;
+
+    IteratorImpl() = default;
+    IteratorImpl(TableT *table, size_t pos) : table_(table), pos_(pos) {
+    }
+    template <class OtherTableT, class OtherPublicT>
+    IteratorImpl(const IteratorImpl<OtherTableT, OtherPublicT> &other)
+        : table_(other.get_table()), pos_(other.get_pos()) {
+    }
+
+    IteratorImpl &operator++() {
+      pos_ = table_->next_used(pos_ + 1);
+      return *this;
+    }
+    IteratorImpl operator++(int) {
+      auto res = *this;
+      ++*this;
+      return res;
+    }
+    reference operator*() const {
+      return table_->nodes_[pos_].get_public();
+    }
+    pointer operator->() const {
+      return &**this;
+    }
+    bool operator==(const IteratorImpl &other) const {
+      return pos_ == other.pos_;
+    }
+    bool operator!=(const IteratorImpl &other) const {
+      return pos_ != other.pos_;
+    }
+
+    TableT *get_table() const {
+      return table_;
+    }
+    size_t get_pos() const {
+      return pos_;
+    }
+
+   private:
+    TableT *table_{nullptr};
+    size_t pos_{0};
+  };
+  using Iterator = IteratorImpl<FlatHashTable, typename NodeT::public_type>;
+  using ConstIterator = IteratorImpl<const FlatHashTable, const typename NodeT::public_type>;
+  using iterator = Iterator;
+  using const_iterator = ConstIterator;
+
+  FlatHashTable() = default;
+  explicit FlatHashTable(size_t expected_size) {
+    reserve(expected_size);
+  }
+  FlatHashTable(std::initializer_list<typename NodeT::insert_type> nodes) {
+    reserve(nodes.size());
+    for (auto &node : nodes) {
+      insert(node);
+    }
+  }
+  FlatHashTable(const FlatHashTable &other) : hash_(other.hash_), eq_(other.eq_) {
+    assign(other);
+  }
+  FlatHashTable &operator=(const FlatHashTable &other) {
+    if (this != &other) {
+      clear_and_free();
+      hash_ = other.hash_;
+      eq_ = other.eq_;
+      assign(other);
+    }
+    return *this;
+  }
+  FlatHashTable(FlatHashTable &&other) noexcept
+      : ctrl_(other.ctrl_)
+      , nodes_(other.nodes_)
+      , capacity_(other.capacity_)
+      , size_(other.size_)
+      , hash_(std::move(other.hash_))
+      , eq_(std::move(other.eq_)) {
+    other.reset_storage();
+  }
+  FlatHashTable &operator=(FlatHashTable &&other) noexcept {
+    if (this != &other) {
+      clear_and_free();
+      swap(other);
+    }
+    return *this;
+  }
+  ~FlatHashTable() {
+    clear_and_free();
+  }
+
+  void swap(FlatHashTable &other) noexcept {
+    using std::swap;
+    swap(ctrl_, other.ctrl_);
+    swap(nodes_, other.nodes_);
+    swap(capacity_, other.capacity_);
+    swap(size_, other.size_);
+    swap(hash_, other.hash_);
+    swap(eq_, other.eq_);
+  }
+
+  size_t size() const {
+    return size_;
+  }
+  bool empty() const {
+    return size_ == 0;
+  }
+  size_t bucket_count() const {
+    return capacity_;
+  }
+
+  Iterator begin() {
+    return Iterator(this, next_used(0));
+  }
+  Iterator end() {
+    return Iterator(this, capacity_);
+  }
+  ConstIterator begin() const {
+    return ConstIterator(this, next_used(0));
+  }
+  ConstIterator end() const {
+    return ConstIterator(this, capacity_);
+  }
+
+  Iterator find(const KeyT &key) {
+    return Iterator(this, find_pos(key));
+  }
+  ConstIterator find(const KeyT &key) const {
+    return ConstIterator(this, find_pos(key));
+  }
+  size_t count(const KeyT &key) const {
+    return find_pos(key) == capacity_ ? 0 : 1;
+  }
+
+  template <class... ArgsT>
+  std::pair<Iterator, bool> emplace(KeyT key, ArgsT &&... args) {
+    auto pos = find_or_prepare_insert(key);
+    if (pos.second) {
+      new (&nodes_[pos.first]) NodeT(std::move(key), std::forward<ArgsT>(args)...);
+    }
+    return {Iterator(this, pos.first), pos.second};
+  }
+
+  std::pair<Iterator, bool> insert(typename NodeT::insert_type value) {
+    auto pos = find_or_prepare_insert(NodeT::key_of(value));
+    if (pos.second) {
+      new (&nodes_[pos.first]) NodeT(std::move(value));
+    }
+    return {Iterator(this, pos.first), pos.second};
+  }
+
+  template <class ItT>
+  void insert(ItT begin, ItT end) {
+    for (; begin != end; ++begin) {
+      insert(*begin);
+    }
+  }
+
+  template <class T = NodeT>
+  decltype(std::declval<T &>().second) &operator[](const KeyT &key) {
+    auto pos = find_or_prepare_insert(key);
+    if (pos.second) {
+      new (&nodes_[pos.first]) NodeT(key);
+    }
+    return nodes_[pos.first].second;
+  }
+
+  size_t erase(const KeyT &key) {
+    auto pos = find_pos(key);
+    if (pos == capacity_) {
+      return 0;
+    }
+    erase_pos(pos);
+    return 1;
+  }
+
+  // unlike std::unordered_map::erase, doesn't return the next iterator, because elements can be moved during erase
+  // use remove_if to erase elements while iterating over the table
+  void erase(ConstIterator it) {
+    DCHECK(it.get_table() == this);
+    DCHECK(it.get_pos() < capacity_);
+    erase_pos(it.get_pos());
+  }
+
+  template <class F>
+  size_t remove_if(F &&f) {
+    if (empty()) {
+      return 0;
+    }
+    // start right after an empty slot, so elements moved by backward shift are never skipped and never checked twice
+    size_t start = 0;
+    while (!is_empty(ctrl_[start])) {
+      start++;
+    }
+    size_t removed = 0;
+    for (size_t i = 1; i < capacity_;) {
+      auto pos = (start + i) & mask();
+      if (!is_empty(ctrl_[pos]) && f(nodes_[pos].get_public())) {
+        erase_pos(pos);
+        removed++;
+        continue;  // check the element, which was shifted to the current slot
+      }
+      i++;
+    }
+    return removed;
+  }
+
+  void clear() {
+    if (capacity_ > 128) {
+      clear_and_free();
+      return;
+    }
+    destroy_nodes();
+    reset_ctrl();
+    size_ = 0;
+  }
+
+  // makes the table able to hold at least expected_size elements without resize
+  void reserve(size_t expected_size) {
+    auto want_capacity = capacity_for(expected_size);
+    if (want_capacity > capacity_) {
+      resize(want_capacity);
+    }
+  }
+
+  // sets capacity to the minimum possible capacity for at least max(new_size, size()) elements
+  void rehash(size_t new_size) {
+    auto want_capacity = capacity_for(td::max(new_size, size_));
+    if (want_capacity != capacity_) {
+      resize(want_capacity);
+    }
+  }
+
+  hasher hash_function() const {
+    return hash_;
+  }
+  key_equal key_eq() const {
+    return eq_;
+  }
+
+ private:
+  int8 *ctrl_{nullptr};
+  NodeT *nodes_{nullptr};
+  size_t capacity_{0};
+  size_t size_{0};
+  HashT hash_;
+  EqT eq_;
+
+  static bool is_empty(int8 ctrl) {
+    return ctrl == EMPTY;
+  }
+
+  size_t mask() const {
+    return capacity_ - 1;
+  }
+
+  uint64 calc_hash(const KeyT &key) const {
+    // the hash function can be weak, for example identity function, so mix its bits
+    auto h = static_cast<uint64>(hash_(key));
+    h ^= h >> 32;
+    h *= 0xd6e8feb86659fd93ull;
+    h ^= h >> 32;
+    return h;
+  }
+  static size_t h1(uint64 hash) {
+    return static_cast<size_t>(hash >> 7);
+  }
+  static int8 h2(uint64 hash) {
+    return static_cast<int8>(hash & 0x7F);
+  }
+
+  // max load factor is 3/4; capacity is a power of two
+  static size_t capacity_for(size_t size) {
+    if (size == 0) {
+      return 0;
+    }
+    size_t capacity = MIN_CAPACITY;
+    while (capacity - capacity / 4 < size + 1) {
+      capacity *= 2;
+    }
+    return capacity;
+  }
+
+  void set_ctrl(size_t pos, int8 value) {
+    ctrl_[pos] = value;
+    if (pos < Group::WIDTH - 1) {
+      ctrl_[pos + capacity_] = value;  // the cloned control bytes allow to load a group starting from any position
+    }
+  }
+
+  size_t next_used(size_t pos) const {
+    while (pos < capacity_ && is_empty(ctrl_[pos])) {
+      pos++;
+    }
+    return pos;
+  }
+
+  size_t find_pos(const KeyT &key) const {
+    if (size_ == 0) {
+      return capacity_;
+    }
+    auto hash = calc_hash(key);
+    auto h = h2(hash);
+    auto pos = h1(hash) & mask();
+    while (true) {
+      Group group(ctrl_ + pos);
+      for (auto bits = group.match(h); bits != 0; bits &= bits - 1) {
+        auto i = (pos + (count_trailing_zeroes_non_zero64(bits) >> Group::SHIFT)) & mask();
+        if (eq_(nodes_[i].key(), key)) {
+          return i;
+        }
+      }
+      if (group.match_empty() != 0) {
+        return capacity_;
+      }
+      pos = (pos + Group::WIDTH) & mask();
+    }
+  }
+
+  // returns position of the key and whether a node must be constructed there
+  std::pair<size_t, bool> find_or_prepare_insert(const KeyT &key) {
+    if (capacity_for(size_ + 1) > capacity_) {
+      auto pos = find_pos(key);
+      if (pos != capacity_) {
+        return {pos, false};
+      }
+      resize(capacity_for(size_ + 1));
+    }
+    auto hash = calc_hash(key);
+    auto h = h2(hash);
+    auto pos = h1(hash) & mask();
+    while (true) {
+      Group group(ctrl_ + pos);
+      for (auto bits = group.match(h); bits != 0; bits &= bits - 1) {
+        auto i = (pos + (count_trailing_zeroes_non_zero64(bits) >> Group::SHIFT)) & mask();
+        if (eq_(nodes_[i].key(), key)) {
+          return {i, false};
+        }
+      }
+      auto empty_bits = group.match_empty();
+      if (empty_bits != 0) {
+        auto i = (pos + (count_trailing_zeroes_non_zero64(empty_bits) >> Group::SHIFT)) & mask();
+        set_ctrl(i, h);
+        size_++;
+        return {i, true};
+      }
+      pos = (pos + Group::WIDTH) & mask();
+    }
+  }
+
+  // the table must have a free slot and must not contain the node
+  void insert_new_node(NodeT &&node) {
+    auto hash = calc_hash(node.key());
+    auto pos = h1(hash) & mask();
+    while (true) {
+      auto empty_bits = Group(ctrl_ + pos).match_empty();
+      if (empty_bits != 0) {
+        auto i = (pos + (count_trailing_zeroes_non_zero64(empty_bits) >> Group::SHIFT)) & mask();
+        set_ctrl(i, h2(hash));
+        new (&nodes_[i]) NodeT(std::move(node));
+        size_++;
+        return;
+      }
+      pos = (pos + Group::WIDTH) & mask();
+    }
+  }
+
+  void erase_pos(size_t pos) {
+    nodes_[pos].~NodeT();
+    size_--;
+    // shift back all nodes, which can be found only through the freed slot
+    for (size_t next = (pos + 1) & mask(); !is_empty(ctrl_[next]); next = (next + 1) & mask()) {
+      auto home = h1(calc_hash(nodes_[next].key())) & mask();
+      if (((next - home) & mask()) >= ((next - pos) & mask())) {
+        new (&nodes_[pos]) NodeT(std::move(nodes_[next]));
+        nodes_[next].~NodeT();
+        set_ctrl(pos, ctrl_[next]);
+        pos = next;
+      }
+    }
+    set_ctrl(pos, EMPTY);
+  }
+
+  void allocate(size_t capacity) {
+    DCHECK(capacity >= MIN_CAPACITY);
+    DCHECK((capacity & (capacity - 1)) == 0);
+    capacity_ = capacity;
+    ctrl_ = new int8[capacity + Group::WIDTH - 1];
+    nodes_ = static_cast<NodeT *>(::operator new(sizeof(NodeT) * capacity));
+    reset_ctrl();
+  }
+
+  void reset_ctrl() {
+    if (ctrl_ != nullptr) {
+      std::memset(ctrl_, EMPTY, capacity_ + Group::WIDTH - 1);
+    }
+  }
+
+  void resize(size_t new_capacity) {
+    CHECK(new_capacity >= size_);
+    auto old_ctrl = ctrl_;
+    auto old_nodes = nodes_;
+    auto old_capacity = capacity_;
+    if (new_capacity == 0) {
+      reset_storage();
+    } else {
+      allocate(new_capacity);
+    }
+    size_ = 0;
+    for (size_t i = 0; i < old_capacity; i++) {
+      if (!is_empty(old_ctrl[i])) {
+        insert_new_node(std::move(old_nodes[i]));
+        old_nodes[i].~NodeT();
+      }
+    }
+    delete[] old_ctrl;
+    ::operator delete(old_nodes);
+  }
+
+  void assign(const FlatHashTable &other) {
+    if (other.size_ == 0) {
+      return;
+    }
+    allocate(other.capacity_);
+    for (size_t i = 0; i < other.capacity_; i++) {
+      if (!is_empty(other.ctrl_[i])) {
+        new (&nodes_[i]) NodeT(other.nodes_[i]);
+        set_ctrl(i, other.ctrl_[i]);
+      }
+    }
+    size_ = other.size_;
+  }
+
+  void destroy_nodes() {
+    for (size_t i = 0; i < capacity_; i++) {
+      if (!is_empty(ctrl_[i])) {
+        nodes_[i].~NodeT();
+      }
+    }
+  }
+
+  void clear_and_free() {
+    destroy_nodes();
+    delete[] ctrl_;
+    ::operator delete(nodes_);
+    reset_storage();
+  }
+
+  void reset_storage() {
+    ctrl_ = nullptr;
+    nodes_ = nullptr;
+    capacity_ = 0;
+    size_ = 0;
+  }
+};
+
+template <class NodeT, class HashT, class EqT>
+void swap(FlatHashTable<NodeT, HashT, EqT> &lhs, FlatHashTable<NodeT, HashT, EqT> &rhs) noexcept {
+  lhs.swap(rhs);
+}
+
+}  // namespace td
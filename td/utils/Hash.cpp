@@ -0,0 +1,92 @@
+#include "td/utils/Hash.h"
+
+#include <cstring>
+
+namespace td {
+
+namespace {
+
+constexpr uint64 P1 = 0x9e3779b185ebca87ull;
+constexpr uint64 P2 = 0xc2b2ae3d27d4eb4full;
+constexpr uint64 P3 = 0x165667b19e3779f9ull;
+constexpr uint64 P4 = 0x85ebca77c2b2ae63ull;
+constexpr uint64 P5 = 0x27d4eb2f165667c5ull;
+
+inline uint64 rotl(uint64 x, int shift) {
+  return (x << shift) | (x >> (64 - shift));
+}
+
+inline uint64 read64(const unsigned char *ptr) {
+  uint64 res;
+  std::memcpy(&res, ptr, sizeof(res));
+  return res;
+}
+
+inline uint32 read32(const unsigned char *ptr) {
+  uint32 res;
+  std::memcpy(&res, ptr, sizeof(res));
+  return res;
+}
+
+inline uint64 hash_round(uint64 acc, uint64 input) {
+  return rotl(acc + input * P2, 31) * P1;
+}
+
+inline uint64 merge_round(uint64 acc, uint64 value) {
+  return (acc ^ hash_round(0, value)) * P1 + P4;
+}
+
+}  // namespace
+
+// xxHash64-like: 4 independent lanes consume 32 bytes per step; the final avalanche is done by Hasher::finalize
+uint64 Hasher::hash_bytes(Slice data, uint64 seed) {
+  auto ptr = data.ubegin();
+  auto size = data.size();
+
+  uint64 h;
+  if (size >= 32) {
+    uint64 v1 = seed + P1 + P2;
+    uint64 v2 = seed + P2;
+    uint64 v3 = seed;
+    uint64 v4 = seed - P1;
+    do {
+      v1 = hash_round(v1, read64(ptr));
+      v2 = hash_round(v2, read64(ptr + 8));
+      v3 = hash_round(v3, read64(ptr + 16));
+      v4 = hash_round(v4, read64(ptr + 24));
+      ptr += 32;
+      size -= 32;
+    } while (size >= 32);
+
+    h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+    h = merge_round(h, v1);
+    h = merge_round(h, v2);
+    h = merge_round(h, v3);
+    h = merge_round(h, v4);
+  } else {
+    h = seed + P5;
+  }
+  h += data.size();
+
+  while (size >= 8) {
+    h ^= hash_round(0, read64(ptr));
+    h = rotl(h, 27) * P1 + P4;
+    ptr += 8;
+    size -= 8;
+  }
+  if (size >= 4) {
+    h ^= read32(ptr) * P1;
+    h = rotl(h, 23) * P2 + P3;
+    ptr += 4;
+    size -= 4;
+  }
+  while (size > 0) {
+    h ^= *ptr * P5;
+    h = rotl(h, 11) * P1;
+    ptr++;
+    size--;
+  }
+  return h;
+}
+
+}  // namespace td
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "td/utils/common.h"
+#include "td/utils/Slice.h"
 
 #if TD_HAVE_ABSL
 #include <absl/hash/hash.h>
@@ -9,24 +10,40 @@
 #include <utility>
 
 namespace td {
-// A simple wrapper for absl::flat_hash_map, std::unordered_map and probably some our implementaion of hash map in
-// the future
+// A simple wrapper for absl::flat_hash_map and our own FlatHashMap, which is used when abseil isn't available
 
-// We will introduce out own Hashing utility like an absl one.
+// Our own hashing utility, which is compatible with the absl one.
+// Values are mixed in with a multiply-rotate step, strings are hashed 32 bytes at a time,
+// and the result is finalized with a full avalanche, so it can be used even with power-of-two sized tables.
 class Hasher {
  public:
   Hasher() = default;
   explicit Hasher(size_t init_value) : hash_(init_value) {
   }
   std::size_t finalize() const {
-    return hash_;
+    auto h = hash_;
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ull;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebull;
+    h ^= h >> 31;
+    return static_cast<std::size_t>(h);
   }
 
-  static Hasher combine(Hasher hasher, size_t value) {
-    hasher.hash_ ^= value;
+  static Hasher combine(Hasher hasher, uint64 value) {
+    hasher.hash_ = (rotl(hasher.hash_, 23) ^ value) * 0x9e3779b97f4a7c15ull;
     return hasher;
   }
 
+  static Hasher combine(Hasher hasher, Slice value) {
+    hasher.hash_ = hash_bytes(value, hasher.hash_);
+    return hasher;
+  }
+
+  static Hasher combine(Hasher hasher, const string &value) {
+    return combine(std::move(hasher), Slice(value));
+  }
+
   template <class A, class B>
   static Hasher combine(Hasher hasher, const std::pair<A, B> &value) {
     hasher = AbslHashValue(std::move(hasher), value.first);
@@ -34,8 +51,14 @@ class Hasher {
     return hasher;
   }
 
+  static uint64 hash_bytes(Slice data, uint64 seed);
+
  private:
-  std::size_t hash_{0};
+  uint64 hash_{0};
+
+  static uint64 rotl(uint64 x, int shift) {
+    return (x << shift) | (x >> (64 - shift));
+  }
 };
 
 template <class IgnoreT>
@@ -5,7 +5,7 @@
 #if TD_HAVE_ABSL
 #include <absl/container/flat_hash_map.h>
 #else
-#include <unordered_map>
+#include "td/utils/FlatHashMap.h"
 #endif
 
 namespace td {
@@ -15,7 +15,7 @@ template <class Key, class Value, class H = Hash<Key>>
 using HashMap = absl::flat_hash_map<Key, Value, H>;
 #else
 template <class Key, class Value, class H = Hash<Key>>
-using HashMap = std::unordered_map<Key, Value, H>;
+using HashMap = FlatHashMap<Key, Value, H>;
 #endif
 
 }  // namespace td
@@ -5,7 +5,7 @@
 #if TD_HAVE_ABSL
 #include <absl/container/flat_hash_set.h>
 #else
-#include <unordered_set>
+#include "td/utils/FlatHashSet.h"
 #endif
 
 namespace td {
@@ -15,7 +15,7 @@ template <class Key, class H = Hash<Key>>
 using HashSet = absl::flat_hash_set<Key, H>;
 #else
 template <class Key, class H = Hash<Key>>
-using HashSet = std::unordered_set<Key, H>;
+using HashSet = FlatHashSet<Key, H>;
 #endif
 
 }  // namespace td
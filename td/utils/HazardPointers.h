@@ -1,27 +1,30 @@
 #pragma once
 
 #include "td/utils/common.h"
+#include "td/utils/ThreadLocalStorage.h"
 
+#include <algorithm>
 #include <array>
 #include <atomic>
 #include <memory>
 
 namespace td {
 
+// Retired pointers are accumulated per thread and reclaimed in bulk: when a thread has retired
+// scan_threshold pointers since its previous scan, all hazard pointers are copied once into a sorted snapshot,
+// and every retired pointer, which isn't in the snapshot, is deleted.
+// Data of threads is stored in a ThreadLocalStorage, so thread identifiers aren't limited by threads_n, which is
+// the expected number of threads, used only to choose the default threshold threads_n * MaxPointersN.
+// If H is the number of hazard pointers of all threads, which have ever used the object, then a scan costs
+// O(H log H). Pointers left by a scan are protected, so there are at most H of them, and a thread keeps at most
+// H + scan_threshold - 1 retired pointers. If there are more threads than expected, then H exceeds the threshold,
+// so scans become more frequent than once per H calls to retire. Users retiring big objects should pass
+// a smaller threshold.
 template <class T, int MaxPointersN = 1, class Deleter = std::default_delete<T>>
 class HazardPointers {
  public:
-  explicit HazardPointers(size_t threads_n) : threads_(threads_n) {
-    for (auto &data : threads_) {
-      for (auto &ptr : data.hazard_) {
-// workaround for https://gcc.gnu.org/bugzilla/show_bug.cgi?id=64658
-#if TD_GCC && GCC_VERSION <= 40902
-        ptr = nullptr;
-#else
-        std::atomic_init(&ptr, static_cast<T *>(nullptr));
-#endif
-      }
-    }
+  explicit HazardPointers(size_t threads_n, size_t scan_threshold = 0)
+      : scan_threshold_(scan_threshold != 0 ? scan_threshold : max(threads_n * MaxPointersN, static_cast<size_t>(1))) {
   }
   HazardPointers(const HazardPointers &other) = delete;
   HazardPointers &operator=(const HazardPointers &other) = delete;
@@ -56,20 +59,17 @@ class HazardPointers {
     std::atomic<T *> &hazard_ptr_;
   };
 
+  // retire(thread_id) without a pointer forces reclamation of all unprotected pointers retired by the thread
   void retire(size_t thread_id, T *ptr = nullptr) {
-    CHECK(thread_id < threads_.size());
-    auto &data = threads_[thread_id];
+    auto &data = get_thread_data(thread_id);
     if (ptr) {
       data.to_delete_.push_back(std::unique_ptr<T, Deleter>(ptr));
-    }
-    for (auto it = data.to_delete_.begin(); it != data.to_delete_.end();) {
-      if (!is_protected(it->get())) {
-        it->reset();
-        it = data.to_delete_.erase(it);
-      } else {
-        ++it;
+      if (++data.retired_since_scan_ < scan_threshold_) {
+        return;
       }
     }
+    scan(data);
+    data.retired_since_scan_ = 0;
   }
 
   // old inteface
@@ -82,23 +82,25 @@ class HazardPointers {
 
   size_t to_delete_size_unsafe() const {
     size_t res = 0;
-    for (auto &thread : threads_) {
-      res += thread.to_delete_.size();
-    }
+    threads_.for_each([&res](const ThreadData &thread) { res += thread.to_delete_.size(); });
     return res;
   }
 
  private:
+  // value-initialized by ThreadLocalStorage, so all hazard pointers are initially null
   struct ThreadData {
     std::array<std::atomic<T *>, MaxPointersN> hazard_;
     char pad[TD_CONCURRENCY_PAD - sizeof(std::array<std::atomic<T *>, MaxPointersN>)];
 
-    // stupid gc
     std::vector<std::unique_ptr<T, Deleter>> to_delete_;
-    char pad2[TD_CONCURRENCY_PAD - sizeof(std::vector<std::unique_ptr<T, Deleter>>)];
+    std::vector<T *> hazard_snapshot_;
+    size_t retired_since_scan_;
+    char pad2[TD_CONCURRENCY_PAD - sizeof(std::vector<std::unique_ptr<T, Deleter>>) - sizeof(std::vector<T *>) -
+              sizeof(size_t)];
   };
-  std::vector<ThreadData> threads_;
-  char pad2[TD_CONCURRENCY_PAD - sizeof(std::vector<ThreadData>)];
+  size_t scan_threshold_;
+  ThreadLocalStorage<ThreadData> threads_;
+  char pad2[TD_CONCURRENCY_PAD];
 
   template <class S>
   static S *do_protect(std::atomic<T *> &hazard_ptr, std::atomic<S *> &to_protect) {
@@ -115,20 +117,42 @@ class HazardPointers {
     hazard_ptr.store(nullptr, std::memory_order_release);
   }
 
-  bool is_protected(T *ptr) {
-    for (auto &thread : threads_) {
+  void scan(ThreadData &data) {
+    if (data.to_delete_.empty()) {
+      return;
+    }
+
+    // retired pointers must be unreachable before hazard pointers are read
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto &snapshot = data.hazard_snapshot_;
+    snapshot.clear();
+    threads_.for_each([&snapshot](const ThreadData &thread) {
       for (auto &hazard_ptr : thread.hazard_) {
-        if (hazard_ptr.load() == ptr) {
-          return true;
+        auto *ptr = hazard_ptr.load();
+        if (ptr != nullptr) {
+          snapshot.push_back(ptr);
         }
       }
+    });
+    std::sort(snapshot.begin(), snapshot.end());
+
+    size_t left = 0;
+    for (auto &ptr : data.to_delete_) {
+      if (std::binary_search(snapshot.begin(), snapshot.end(), ptr.get())) {
+        data.to_delete_[left++] = std::move(ptr);
+      } else {
+        ptr.reset();
+      }
     }
-    return false;
+    data.to_delete_.resize(left);
+  }
+
+  ThreadData &get_thread_data(size_t thread_id) {
+    return threads_.get(static_cast<int32>(thread_id));
   }
 
   std::atomic<T *> &get_hazard_ptr(size_t thread_id, size_t pos) {
-    CHECK(thread_id < threads_.size());
-    return threads_[thread_id].hazard_[pos];
+    return get_thread_data(thread_id).hazard_[pos];
   }
 };
 
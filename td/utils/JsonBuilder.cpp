@@ -329,7 +329,7 @@ Status json_string_skip(Parser &parser) {
   return Status::OK();
 }
 
-Result<JsonValue> do_json_decode(Parser &parser, int32 max_depth) {
+Result<JsonValue> do_json_decode(Parser &parser, int32 max_depth, MonotonicArena *arena) {
   if (max_depth < 0) {
     return Status::Error("Too big object depth");
   }
@@ -358,7 +358,7 @@ Result<JsonValue> do_json_decode(Parser &parser, int32 max_depth) {
     case '[': {
       parser.skip('[');
       parser.skip_whitespaces();
-      std::vector<JsonValue> res;
+      JsonArray res{ArenaAllocator<JsonValue>(arena)};
       if (parser.try_skip(']')) {
         return JsonValue::create_array(std::move(res));
       }
@@ -366,7 +366,7 @@ Result<JsonValue> do_json_decode(Parser &parser, int32 max_depth) {
         if (parser.empty()) {
           return Status::Error("Unexpected string end");
         }
-        TRY_RESULT(value, do_json_decode(parser, max_depth - 1));
+        TRY_RESULT(value, do_json_decode(parser, max_depth - 1, arena));
         res.emplace_back(std::move(value));
 
         parser.skip_whitespaces();
@@ -387,7 +387,7 @@ Result<JsonValue> do_json_decode(Parser &parser, int32 max_depth) {
     case '{': {
       parser.skip('{');
       parser.skip_whitespaces();
-      std::vector<std::pair<MutableSlice, JsonValue> > res;
+      JsonObject res{ArenaAllocator<std::pair<MutableSlice, JsonValue>>(arena)};
       if (parser.try_skip('}')) {
         return JsonValue::make_object(std::move(res));
       }
@@ -400,7 +400,7 @@ Result<JsonValue> do_json_decode(Parser &parser, int32 max_depth) {
         if (!parser.try_skip(':')) {
           return Status::Error("':' expected");
         }
-        TRY_RESULT(value, do_json_decode(parser, max_depth - 1));
+        TRY_RESULT(value, do_json_decode(parser, max_depth - 1, arena));
         res.emplace_back(std::move(key), std::move(value));
 
         parser.skip_whitespaces();
@@ -2,15 +2,18 @@
 
 #include "td/utils/common.h"
 #include "td/utils/logging.h"
+#include "td/utils/MonotonicArena.h"
 #include "td/utils/Parser.h"
 #include "td/utils/Slice.h"
 #include "td/utils/StackAllocator.h"
 #include "td/utils/Status.h"
 #include "td/utils/StringBuilder.h"
 
+#include <iterator>
 #include <new>
 #include <type_traits>
 #include <utility>
+#include <vector>
 
 namespace td {
 
@@ -439,8 +442,12 @@ inline JsonArrayScope JsonBuilder::enter_array() {
 
 class JsonValue;
 
-using JsonObject = vector<std::pair<MutableSlice, JsonValue>>;
-using JsonArray = vector<JsonValue>;
+// JsonArray and JsonObject use an ArenaAllocator, so arrays and objects decoded into a MonotonicArena use its memory
+// A default-constructed ArenaAllocator uses the heap, so JsonArray and JsonObject are still created as before, and
+// td::vector can be passed to create_array and make_object, but they are no longer td::vector, so results of get_array
+// and get_object must be bound to JsonArray, JsonObject or auto instead of td::vector
+using JsonObject = std::vector<std::pair<MutableSlice, JsonValue>, ArenaAllocator<std::pair<MutableSlice, JsonValue>>>;
+using JsonArray = std::vector<JsonValue, ArenaAllocator<JsonValue>>;
 
 class JsonValue : public Jsonable {
  public:
@@ -545,6 +552,17 @@ class JsonValue : public Jsonable {
     return res;
   }
 
+  // heap-allocated vectors with another allocator are moved into a JsonArray or a JsonObject element by element
+  template <class AllocatorT>
+  static JsonValue create_array(std::vector<JsonValue, AllocatorT> v) {
+    return create_array(JsonArray(std::make_move_iterator(v.begin()), std::make_move_iterator(v.end())));
+  }
+
+  template <class AllocatorT>
+  static JsonValue make_object(std::vector<std::pair<MutableSlice, JsonValue>, AllocatorT> c) {
+    return make_object(JsonObject(std::make_move_iterator(c.begin()), std::make_move_iterator(c.end())));
+  }
+
   void store(JsonValueScope *scope) const {
     switch (type_) {
       case Type::Null:
@@ -649,10 +667,10 @@ class JsonValue : public Jsonable {
         string_.~MutableSlice();
         break;
       case Type::Array:
-        array_.~vector<JsonValue>();
+        array_.~JsonArray();
         break;
       case Type::Object:
-        object_.~vector<std::pair<MutableSlice, JsonValue>>();
+        object_.~JsonObject();
         break;
     }
     type_ = Type::Null;
@@ -729,7 +747,8 @@ class VirtuallyJsonableString : public VirtuallyJsonable {
 Result<MutableSlice> json_string_decode(Parser &parser) TD_WARN_UNUSED_RESULT;
 Status json_string_skip(Parser &parser) TD_WARN_UNUSED_RESULT;
 
-Result<JsonValue> do_json_decode(Parser &parser, int32 max_depth) TD_WARN_UNUSED_RESULT;
+Result<JsonValue> do_json_decode(Parser &parser, int32 max_depth,
+                                 MonotonicArena *arena = nullptr) TD_WARN_UNUSED_RESULT;
 Status do_json_skip(Parser &parser, int32 max_depth) TD_WARN_UNUSED_RESULT;
 
 inline Result<JsonValue> json_decode(MutableSlice json) {
@@ -745,6 +764,19 @@ inline Result<JsonValue> json_decode(MutableSlice json) {
   return result;
 }
 
+// decodes the whole JsonValue tree into the arena; the tree is valid until the arena is reset and needn't be destroyed
+// strings in the tree point to the json, as usual
+inline Result<JsonValue *> json_decode(MutableSlice json, MonotonicArena &arena) {
+  Parser parser(json);
+  const int32 DEFAULT_MAX_DEPTH = 100;
+  TRY_RESULT(value, do_json_decode(parser, DEFAULT_MAX_DEPTH, &arena));
+  parser.skip_whitespaces();
+  if (!parser.empty()) {
+    return Status::Error("Expected string end");
+  }
+  return arena.create<JsonValue>(std::move(value));
+}
+
 template <class StrT, class ValT>
 StrT json_encode(const ValT &val, bool pretty = false) {
   auto buf_len = 1 << 18;
@@ -0,0 +1,89 @@
+#include "td/utils/MonotonicArena.h"
+
+#include "td/utils/misc.h"
+
+namespace td {
+
+namespace {
+constexpr size_t MAX_CHUNK_SIZE = 1 << 20;
+}  // namespace
+
+MonotonicArena::MonotonicArena(size_t first_chunk_size)
+    : next_chunk_size_(clamp(first_chunk_size, static_cast<size_t>(64), MAX_CHUNK_SIZE)) {
+}
+
+MonotonicArena::~MonotonicArena() {
+  while (last_chunk_ != nullptr) {
+    auto *prev = last_chunk_->prev;
+    ::operator delete(last_chunk_);
+    last_chunk_ = prev;
+  }
+}
+
+void *MonotonicArena::allocate_slow(size_t size, size_t alignment) {
+  CHECK(size <= std::numeric_limits<size_t>::max() / 2);
+  auto chunk_size = size + alignment + sizeof(Chunk);
+  if (chunk_size > next_chunk_size_ / 4) {
+    // big allocations get their own chunk, so the rest of the current chunk isn't wasted
+    auto *chunk = create_chunk(chunk_size);
+    auto begin = (reinterpret_cast<std::uintptr_t>(chunk + 1) + alignment - 1) & ~(alignment - 1);
+    allocated_size_ += size;
+    if (current_chunk_ == nullptr) {
+      set_current_chunk(chunk);
+      pos_ = reinterpret_cast<char *>(begin + size);
+    }
+    return reinterpret_cast<void *>(begin);
+  }
+
+  set_current_chunk(create_chunk(next_chunk_size_));
+  next_chunk_size_ = min(next_chunk_size_ * 2, MAX_CHUNK_SIZE);
+  return allocate(size, alignment);
+}
+
+MonotonicArena::Chunk *MonotonicArena::create_chunk(size_t size) {
+  auto *chunk = static_cast<Chunk *>(::operator new(size));
+  chunk->prev = last_chunk_;
+  chunk->size = size;
+  last_chunk_ = chunk;
+  reserved_size_ += size;
+  return chunk;
+}
+
+void MonotonicArena::set_current_chunk(Chunk *chunk) {
+  current_chunk_ = chunk;
+  pos_ = reinterpret_cast<char *>(chunk + 1);
+  end_ = reinterpret_cast<char *>(chunk) + chunk->size;
+}
+
+void MonotonicArena::reset() {
+  Chunk *largest_chunk = nullptr;
+  while (last_chunk_ != nullptr) {
+    auto *prev = last_chunk_->prev;
+    // dedicated chunks of huge allocations aren't kept
+    auto is_regular = last_chunk_->size <= MAX_CHUNK_SIZE;
+    if (is_regular && (largest_chunk == nullptr || last_chunk_->size > largest_chunk->size)) {
+      if (largest_chunk != nullptr) {
+        reserved_size_ -= largest_chunk->size;
+        ::operator delete(largest_chunk);
+      }
+      largest_chunk = last_chunk_;
+    } else {
+      reserved_size_ -= last_chunk_->size;
+      ::operator delete(last_chunk_);
+    }
+    last_chunk_ = prev;
+  }
+
+  allocated_size_ = 0;
+  if (largest_chunk == nullptr) {
+    current_chunk_ = nullptr;
+    pos_ = nullptr;
+    end_ = nullptr;
+    return;
+  }
+  largest_chunk->prev = nullptr;
+  last_chunk_ = largest_chunk;
+  set_current_chunk(largest_chunk);
+}
+
+}  // namespace td
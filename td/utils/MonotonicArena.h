@@ -0,0 +1,132 @@
+#pragma once
+
+#include "td/utils/common.h"
+#include "td/utils/logging.h"
+#include "td/utils/Slice.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace td {
+
+// Bump allocator
+// Memory is allocated from chunks of growing size and is freed only all at once by reset() or by the destructor.
+// Destructors of objects, created in the arena, aren't called.
+class MonotonicArena {
+ public:
+  explicit MonotonicArena(size_t first_chunk_size = 1 << 12);
+  MonotonicArena(const MonotonicArena &) = delete;
+  MonotonicArena &operator=(const MonotonicArena &) = delete;
+  MonotonicArena(MonotonicArena &&) = delete;
+  MonotonicArena &operator=(MonotonicArena &&) = delete;
+  ~MonotonicArena();
+
+  // alignment must be a power of 2
+  void *allocate(size_t size, size_t alignment = alignof(std::max_align_t)) {
+    auto begin = (reinterpret_cast<std::uintptr_t>(pos_) + alignment - 1) & ~(alignment - 1);
+    auto end = reinterpret_cast<std::uintptr_t>(end_);
+    if (begin > end || end - begin < size) {
+      return allocate_slow(size, alignment);
+    }
+    pos_ = reinterpret_cast<char *>(begin + size);
+    allocated_size_ += size;
+    return reinterpret_cast<void *>(begin);
+  }
+
+  template <class T, class... ArgsT>
+  T *create(ArgsT &&... args) {
+    return new (allocate(sizeof(T), alignof(T))) T(std::forward<ArgsT>(args)...);
+  }
+
+  MutableSlice copy(Slice slice) {
+    auto *ptr = static_cast<char *>(allocate(slice.size(), 1));
+    MutableSlice result(ptr, slice.size());
+    result.copy_from(slice);
+    return result;
+  }
+
+  // frees all allocated memory; the largest chunk of at most 1 MB is kept for reuse
+  void reset();
+
+  // returns total size of allocations since the last reset
+  size_t get_allocated_size() const {
+    return allocated_size_;
+  }
+
+  // returns total size of chunks
+  size_t get_reserved_size() const {
+    return reserved_size_;
+  }
+
+ private:
+  struct Chunk {
+    Chunk *prev;
+    size_t size;
+  };
+  Chunk *last_chunk_{nullptr};
+  // chunk, from which memory is allocated
+  Chunk *current_chunk_{nullptr};
+  char *pos_{nullptr};
+  char *end_{nullptr};
+  size_t next_chunk_size_;
+  size_t allocated_size_{0};
+  size_t reserved_size_{0};
+
+  void *allocate_slow(size_t size, size_t alignment);
+  Chunk *create_chunk(size_t size);
+  void set_current_chunk(Chunk *chunk);
+};
+
+// Allocator for standard containers, which allocates memory from a MonotonicArena like std::pmr::polymorphic_allocator
+// A default-constructed allocator uses the global heap
+template <class T>
+class ArenaAllocator {
+ public:
+  using value_type = T;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+
+  ArenaAllocator() = default;
+  explicit ArenaAllocator(MonotonicArena *arena) : arena_(arena) {
+  }
+  template <class U>
+  ArenaAllocator(const ArenaAllocator<U> &other) : arena_(other.get_arena()) {
+  }
+
+  T *allocate(size_t n) {
+    CHECK(n <= std::numeric_limits<size_t>::max() / sizeof(T));
+    if (arena_ == nullptr) {
+      return static_cast<T *>(::operator new(n * sizeof(T)));
+    }
+    return static_cast<T *>(arena_->allocate(n * sizeof(T), alignof(T)));
+  }
+
+  void deallocate(T *ptr, size_t) {
+    if (arena_ == nullptr) {
+      ::operator delete(ptr);
+    }
+  }
+
+  MonotonicArena *get_arena() const {
+    return arena_;
+  }
+
+ private:
+  MonotonicArena *arena_{nullptr};
+};
+
+template <class T, class U>
+bool operator==(const ArenaAllocator<T> &lhs, const ArenaAllocator<U> &rhs) {
+  return lhs.get_arena() == rhs.get_arena();
+}
+
+template <class T, class U>
+bool operator!=(const ArenaAllocator<T> &lhs, const ArenaAllocator<U> &rhs) {
+  return lhs.get_arena() != rhs.get_arena();
+}
+
+}  // namespace td
@@ -13,6 +13,7 @@
 
 #include <array>
 #include <atomic>
+#include <utility>
 
 namespace td {
 
@@ -389,6 +390,57 @@ class MpmcQueue {
     }
   }
 
+  // pushes n values, reserving positions for all of them in a block with one atomic operation
+  // values, whose positions were taken by readers, are pushed again, so the order of the values can change
+  void push_n(T *values, size_t n, size_t thread_id) {
+    SCOPE_EXIT {
+      hazard_pointers_.clear(thread_id, 0);
+    };
+    while (n > 0) {
+      auto node = hazard_pointers_.protect(thread_id, 0, write_pos_);
+      auto &block = node->block;
+      auto pos = block.write_pos.fetch_add(n);
+      if (pos >= block.data.size()) {
+        auto next = node->next.load();
+        if (next == nullptr) {
+          auto new_node = new Node{};
+          auto count = td::min(n, new_node->block.data.size());
+          new_node->block.write_pos = count;
+          for (size_t i = 0; i < count; i++) {
+            new_node->block.data[i].set_value(values[i]);
+          }
+          Node *null = nullptr;
+          if (node->next.compare_exchange_strong(null, new_node)) {
+            write_pos_.compare_exchange_strong(node, new_node);
+            values += count;
+            n -= count;
+          } else {
+            for (size_t i = 0; i < count; i++) {
+              new_node->block.data[i].get_value(values[i]);
+            }
+            delete new_node;
+          }
+        } else {
+          write_pos_.compare_exchange_strong(node, next);
+        }
+        continue;
+      }
+
+      auto count = td::min(n, block.data.size() - static_cast<size_t>(pos));
+      size_t left_n = 0;
+      for (size_t i = 0; i < n; i++) {
+        if (i < count && block.data[static_cast<size_t>(pos) + i].set_value(values[i])) {
+          continue;
+        }
+        if (left_n != i) {
+          values[left_n] = std::move(values[i]);
+        }
+        left_n++;
+      }
+      n = left_n;
+    }
+  }
+
   bool try_pop(T &value, size_t thread_id) {
     SCOPE_EXIT {
       hazard_pointers_.clear(thread_id, 0);
@@ -427,6 +479,25 @@ class MpmcQueue {
     }
   }
 
+  // push, which wakes up a consumer parked in the waiter
+  template <class WaiterT>
+  void push(T value, size_t thread_id, WaiterT &waiter) {
+    push(std::move(value), thread_id);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    waiter.notify();
+  }
+
+  // blocking pop, which parks the thread through the waiter instead of yielding
+  template <class WaiterT>
+  T pop(size_t thread_id, WaiterT &waiter, typename WaiterT::Slot &slot) {
+    T value;
+    while (!try_pop(value, thread_id)) {
+      waiter.wait(slot);
+    }
+    waiter.stop_wait(slot);
+    return value;
+  }
+
  private:
   struct Block {
     std::atomic<uint64> write_pos{0};
@@ -0,0 +1,201 @@
+#pragma once
+
+// Bounded MPMC queue
+// Fixed-size ring of cells, each with a sequence number, so no memory is allocated after construction.
+// Pushes fail when the queue is full, which gives backpressure to producers.
+// In blocking mode push and pop park the thread through MpmcWaiter.
+// To close the queue, one should send as much sentinel elements as there are readers.
+
+#include "td/utils/common.h"
+#include "td/utils/logging.h"
+#include "td/utils/MpmcWaiter.h"
+
+#include <atomic>
+#include <utility>
+
+namespace td {
+
+template <class T>
+class MpmcRingQueue {
+ public:
+  using WaiterSlot = MpmcWaiter::Slot;
+
+  // capacity is rounded up to a power of two
+  explicit MpmcRingQueue(size_t capacity, bool is_blocking = false)
+      : cells_(calc_size(capacity)), mask_(cells_.size() - 1), is_blocking_(is_blocking) {
+    for (size_t i = 0; i < cells_.size(); i++) {
+      cells_[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  MpmcRingQueue(const MpmcRingQueue &other) = delete;
+  MpmcRingQueue &operator=(const MpmcRingQueue &other) = delete;
+  MpmcRingQueue(MpmcRingQueue &&other) = delete;
+  MpmcRingQueue &operator=(MpmcRingQueue &&other) = delete;
+  ~MpmcRingQueue() = default;
+
+  static std::string get_description() {
+    return "Bounded mpmc queue (ring of sequenced cells)";
+  }
+
+  size_t capacity() const {
+    return cells_.size();
+  }
+
+  // moves value into the queue; returns false and leaves value untouched if the queue is full
+  bool try_push(T &value) {
+    return try_push_n(&value, 1) == 1;
+  }
+
+  // moves a prefix of values into the queue; returns its length
+  size_t try_push_n(T *values, size_t n) {
+    auto pos = write_pos_.load(std::memory_order_relaxed);
+    size_t count;
+    while (true) {
+      count = 0;
+      while (count < n && cells_[(pos + count) & mask_].seq.load(std::memory_order_acquire) == pos + count) {
+        count++;
+      }
+      if (count == 0) {
+        auto seq = cells_[pos & mask_].seq.load(std::memory_order_acquire);
+        if (static_cast<int64>(seq - pos) < 0) {
+          return 0;
+        }
+        // the cell is already taken by another writer
+        pos = write_pos_.load(std::memory_order_relaxed);
+        continue;
+      }
+      if (write_pos_.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed)) {
+        break;
+      }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+      auto &cell = cells_[(pos + i) & mask_];
+      cell.value = std::move(values[i]);
+      cell.seq.store(pos + i + 1, std::memory_order_release);
+    }
+    if (is_blocking_) {
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      pop_waiter_.notify();
+    }
+    return count;
+  }
+
+  // returns false if the queue is empty
+  bool try_pop(T &value) {
+    return try_pop_n(&value, 1) == 1;
+  }
+
+  // pops at most n values into values; returns their number
+  size_t try_pop_n(T *values, size_t n) {
+    auto pos = read_pos_.load(std::memory_order_relaxed);
+    size_t count;
+    while (true) {
+      count = 0;
+      while (count < n && cells_[(pos + count) & mask_].seq.load(std::memory_order_acquire) == pos + count + 1) {
+        count++;
+      }
+      if (count == 0) {
+        auto seq = cells_[pos & mask_].seq.load(std::memory_order_acquire);
+        if (static_cast<int64>(seq - (pos + 1)) < 0) {
+          return 0;
+        }
+        // the cell is already taken by another reader
+        pos = read_pos_.load(std::memory_order_relaxed);
+        continue;
+      }
+      if (read_pos_.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed)) {
+        break;
+      }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+      auto &cell = cells_[(pos + i) & mask_];
+      values[i] = std::move(cell.value);
+      cell.seq.store(pos + i + cells_.size(), std::memory_order_release);
+    }
+    if (is_blocking_) {
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      push_waiter_.notify();
+    }
+    return count;
+  }
+
+  // a slot must be initialized once per thread before the first blocking call
+  // the same slot can be used both for push and pop, because push_n and pop_n leave it in the Work state
+  void init_slot(WaiterSlot &slot, int32 worker_id) {
+    CHECK(is_blocking_);
+    push_waiter_.init_slot(slot, worker_id);
+    pop_waiter_.init_slot(slot, worker_id);
+  }
+
+  void push(T value, WaiterSlot &slot) {
+    push_n(&value, 1, slot);
+  }
+
+  // blocks until all values are pushed
+  void push_n(T *values, size_t n, WaiterSlot &slot) {
+    DCHECK(is_blocking_);
+    while (n > 0) {
+      auto pushed = try_push_n(values, n);
+      if (pushed == 0) {
+        push_waiter_.wait(slot);
+        continue;
+      }
+      push_waiter_.stop_wait(slot);
+      values += pushed;
+      n -= pushed;
+    }
+  }
+
+  T pop(WaiterSlot &slot) {
+    T value;
+    pop_n(&value, 1, slot);
+    return value;
+  }
+
+  // blocks until at least one value is popped; returns the number of popped values
+  size_t pop_n(T *values, size_t n, WaiterSlot &slot) {
+    DCHECK(is_blocking_);
+    CHECK(n > 0);
+    while (true) {
+      auto popped = try_pop_n(values, n);
+      if (popped == 0) {
+        pop_waiter_.wait(slot);
+        continue;
+      }
+      pop_waiter_.stop_wait(slot);
+      return popped;
+    }
+  }
+
+ private:
+  struct Cell {
+    std::atomic<uint64> seq{0};
+    T value{};
+  };
+
+  static size_t calc_size(size_t capacity) {
+    size_t size = 2;
+    while (size < capacity) {
+      size *= 2;
+    }
+    return size;
+  }
+
+  std::atomic<uint64> write_pos_{0};
+  char pad[TD_CONCURRENCY_PAD - sizeof(std::atomic<uint64>)];
+  std::atomic<uint64> read_pos_{0};
+  char pad2[TD_CONCURRENCY_PAD - sizeof(std::atomic<uint64>)];
+  vector<Cell> cells_;
+  uint64 mask_;
+  bool is_blocking_;
+  char pad3[TD_CONCURRENCY_PAD];
+
+  // producers wait for free cells, consumers wait for values
+  MpmcWaiter push_waiter_;
+  MpmcWaiter pop_waiter_;
+};
+
+}  // namespace td
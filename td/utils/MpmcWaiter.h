@@ -2,15 +2,46 @@
 
 #include "td/utils/common.h"
 #include "td/utils/logging.h"
+#include "td/utils/port/Futex.h"
+#include "td/utils/port/platform.h"
 #include "td/utils/port/thread.h"
 
 #include <algorithm>
 #include <atomic>
-#include <condition_variable>
 #include <mutex>
 
+#if TD_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
 namespace td {
 
+namespace detail {
+inline void cpu_relax() {
+#if TD_HAVE_SSE2
+  _mm_pause();
+#else
+  std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+}
+}  // namespace detail
+
+// Describes what a worker, which found no work, does before it goes to sleep
+// Every call to wait during the first spin_rounds calls spins spin_pauses times,
+// during the next yield_rounds calls yields, and after that the worker is parked
+struct MpmcWaiterSchedule {
+  int32 spin_rounds = 0;
+  int32 spin_pauses = 64;
+  int32 yield_rounds = 0;
+};
+
+struct MpmcWaiterStats {
+  uint64 spins = 0;
+  uint64 yields = 0;
+  uint64 parks = 0;
+  uint64 wakeups = 0;
+};
+
 class MpmcEagerWaiter {
  public:
   struct Slot {
@@ -57,9 +88,11 @@ class MpmcEagerWaiter {
     } else {
       auto state = state_.load(std::memory_order_acquire);
       if (State::still_sleepy(state, slot.worker_id)) {
-        std::unique_lock<std::mutex> lock(mutex_);
+        auto wakeup_count = wakeup_count_.load(std::memory_order_acquire);
         if (state_.compare_exchange_strong(state, State::asleep(), std::memory_order_acq_rel)) {
-          condition_variable_.wait(lock);
+          while (wakeup_count_.load(std::memory_order_acquire) == wakeup_count) {
+            wakeup_count_.wait(wakeup_count);
+          }
         }
       }
       slot.yields = 0;
@@ -110,14 +143,13 @@ class MpmcEagerWaiter {
   enum { RoundsTillSleepy = 32, RoundsTillAsleep = 64 };
   // enum { RoundsTillSleepy = 1, RoundsTillAsleep = 2 };
   std::atomic<uint32> state_{State::awake()};
-  std::mutex mutex_;
-  std::condition_variable condition_variable_;
+  Futex wakeup_count_;
 
   void notify_cold() {
     auto old_state = state_.exchange(State::awake(), std::memory_order_release);
     if (State::is_asleep(old_state)) {
-      std::lock_guard<std::mutex> guard(mutex_);
-      condition_variable_.notify_all();
+      wakeup_count_.fetch_add(1, std::memory_order_release);
+      wakeup_count_.wake_all();
     }
   }
 };
@@ -131,29 +163,27 @@ class MpmcSleepyWaiter {
     enum State { Search, Work, Sleep } state_{Work};
 
     void park() {
-      std::unique_lock<std::mutex> guard(mutex_);
-      condition_variable_.wait(guard, [&] { return unpark_flag_; });
-      unpark_flag_ = false;
+      while (unpark_flag_.load(std::memory_order_acquire) == 0) {
+        unpark_flag_.wait(0);
+      }
+      unpark_flag_.store(0, std::memory_order_relaxed);
     }
 
     bool cancel_park() {
-      auto res = unpark_flag_;
-      unpark_flag_ = false;
-      return res;
+      return unpark_flag_.exchange(0, std::memory_order_acquire) != 0;
     }
 
+    // wakes up exactly this worker
     void unpark() {
-      //TODO: try to unlock guard before notify_all
-      std::unique_lock<std::mutex> guard(mutex_);
-      unpark_flag_ = true;
-      condition_variable_.notify_all();
+      // the parked thread can destroy the slot as soon as it sees the flag
+      unpark_flag_.store_and_wake_one(1);
     }
 
-    std::mutex mutex_;
-    std::condition_variable condition_variable_;
-    bool unpark_flag_{false};  // TODO: move out of lock
+    Futex unpark_flag_;
     int yield_cnt{0};
     int32 worker_id{0};
+    uint64 spins{0};
+    uint64 yields{0};
 
    public:
     char padding[TD_CONCURRENCY_PAD];
@@ -189,10 +219,16 @@ class MpmcSleepyWaiter {
   // If possible - in Search state
   //
 
+  MpmcSleepyWaiter() = default;
+  explicit MpmcSleepyWaiter(MpmcWaiterSchedule schedule) : schedule_(schedule) {
+  }
+
   void init_slot(Slot &slot, int32 worker_id) {
     slot.state_ = Slot::State::Work;
-    slot.unpark_flag_ = false;
+    slot.unpark_flag_.store(0, std::memory_order_relaxed);
     slot.worker_id = worker_id;
+    slot.spins = 0;
+    slot.yields = 0;
     VLOG(waiter) << "Init slot " << worker_id;
   }
 
@@ -206,11 +242,22 @@ class MpmcSleepyWaiter {
       return;
     }
     if (slot.state_ == Slot::Search) {
-      if (slot.yield_cnt++ < 10 && false) {
+      if (slot.yield_cnt < schedule_.spin_rounds) {
+        slot.yield_cnt++;
+        slot.spins++;
+        for (int32 i = 0; i < schedule_.spin_pauses; i++) {
+          detail::cpu_relax();
+        }
+        return;
+      }
+      if (slot.yield_cnt < schedule_.spin_rounds + schedule_.yield_rounds) {
+        slot.yield_cnt++;
+        slot.yields++;
         td::this_thread::yield();
         return;
       }
 
+      flush_stats(slot);
       slot.state_ = Slot::State::Sleep;
       std::unique_lock<std::mutex> guard(sleepers_mutex_);
       auto state_view = StateView(state_.fetch_add((1 << PARKING_SHIFT) - 1));
@@ -220,7 +267,7 @@ class MpmcSleepyWaiter {
         return;
       }
       sleepers_.push_back(&slot);
-      LOG_CHECK(slot.unpark_flag_ == false) << slot.worker_id;
+      LOG_CHECK(slot.unpark_flag_.load(std::memory_order_relaxed) == 0) << slot.worker_id;
       VLOG(waiter) << "Add to sleepers " << slot.worker_id;
       //guard.unlock();
       if (should_search) {
@@ -232,6 +279,7 @@ class MpmcSleepyWaiter {
 
     CHECK(slot.state_ == Slot::State::Sleep);
     VLOG(waiter) << "Park " << slot.worker_id;
+    parks_.fetch_add(1, std::memory_order_relaxed);
     slot.park();
     VLOG(waiter) << "Resume " << slot.worker_id;
     slot.state_ = Slot::State::Search;
@@ -242,6 +290,7 @@ class MpmcSleepyWaiter {
     if (slot.state_ == Slot::State::Work) {
       return;
     }
+    flush_stats(slot);
     if (slot.state_ == Slot::State::Sleep) {
       VLOG(waiter) << "Search once, then Sleep -> Work/Search " << slot.worker_id;
       slot.state_ = Slot::State::Work;
@@ -299,9 +348,19 @@ class MpmcSleepyWaiter {
     sleepers_.pop_back();
     state_.fetch_sub((1 << PARKING_SHIFT) - 1);
     VLOG(waiter) << "Unpark " << sleeper->worker_id;
+    wakeups_.fetch_add(1, std::memory_order_relaxed);
     sleeper->unpark();
   }
 
+  MpmcWaiterStats get_stats() const {
+    MpmcWaiterStats stats;
+    stats.spins = spins_.load(std::memory_order_relaxed);
+    stats.yields = yields_.load(std::memory_order_relaxed);
+    stats.parks = parks_.load(std::memory_order_relaxed);
+    stats.wakeups = wakeups_.load(std::memory_order_relaxed);
+    return stats;
+  }
+
   void close() {
     StateView state(state_.load());
     LOG_CHECK(state.parked_count == 0) << state.parked_count;
@@ -324,6 +383,23 @@ class MpmcSleepyWaiter {
   vector<Slot *> sleepers_;
 
   bool closed_ = false;
+
+  MpmcWaiterSchedule schedule_;
+  std::atomic<uint64> spins_{0};
+  std::atomic<uint64> yields_{0};
+  std::atomic<uint64> parks_{0};
+  std::atomic<uint64> wakeups_{0};
+
+  void flush_stats(Slot &slot) {
+    if (slot.spins != 0) {
+      spins_.fetch_add(slot.spins, std::memory_order_relaxed);
+      slot.spins = 0;
+    }
+    if (slot.yields != 0) {
+      yields_.fetch_add(slot.yields, std::memory_order_relaxed);
+      slot.yields = 0;
+    }
+  }
 };
 
 using MpmcWaiter = MpmcSleepyWaiter;
@@ -2,18 +2,27 @@
 
 #include "td/utils/common.h"
 #include "td/utils/logging.h"
+#include "td/utils/port/thread_local.h"
+#include "td/utils/SpinLock.h"
+#include "td/utils/ThreadLocalStorage.h"
 
 #include <atomic>
 #include <memory>
 #include <utility>
 
 namespace td {
-// It is draft object pool implementaion
+// Object pool with weak pointers
 //
 // Compared with std::shared_ptr:
 // + WeakPtr are much faster. Just pointer copy. No barriers, no atomics.
 // - We can't destroy object, because we don't know if it is pointed to by some weak pointer
 //
+// Storages are allocated in chunks and are never freed before the pool is destroyed.
+// Free storages are kept in per-thread lists; excess storages are returned to a shared lock-free list in batches,
+// from which a thread takes all storages at once, when its own list is empty.
+// Objects can be created and released from any thread. Threads with a zero thread identifier, i.e. the main thread and
+// threads, which weren't created by td::thread, release storages directly to the shared list and create objects
+// from one list protected by a lock.
 template <class DataT>
 class ObjectPool {
   struct Storage;
@@ -84,6 +93,7 @@ class ObjectPool {
     }
     OwnerPtr &operator=(OwnerPtr &&other) {
       if (this != &other) {
+        reset();
         storage_ = other.storage_;
         parent_ = other.parent_;
         other.storage_ = nullptr;
@@ -177,13 +187,24 @@ class ObjectPool {
   ObjectPool(ObjectPool &&other) = delete;
   ObjectPool &operator=(ObjectPool &&other) = delete;
   ~ObjectPool() {
-    while (head_.load()) {
-      auto to_delete = head_.load();
-      head_ = to_delete->next;
-      delete to_delete;
-      storage_count_--;
+    size_t free_count = 0;
+    local_lists_.for_each([&free_count](const LocalList &list) { free_count += list.size; });
+    free_count += shared_list_.size;
+    for (auto *storage = head_.load(std::memory_order_acquire); storage != nullptr; storage = storage->next) {
+      free_count++;
     }
-    LOG_CHECK(storage_count_.load() == 0) << storage_count_.load();
+    LOG_CHECK(free_count == storage_count_.load()) << free_count << ' ' << storage_count_.load();
+    auto *chunk = chunks_.load(std::memory_order_acquire);
+    while (chunk != nullptr) {
+      auto *next = chunk->next;
+      delete chunk;
+      chunk = next;
+    }
+  }
+
+  // returns total number of allocated storages
+  size_t get_storage_count() const {
+    return storage_count_.load(std::memory_order_relaxed);
   }
 
  private:
@@ -200,44 +221,142 @@ class ObjectPool {
       data = DataT(std::forward<ArgsT>(args)...);
     }
     void destroy_data() {
-      generation.fetch_add(1, std::memory_order_relaxed);
+      // only the owner changes generation, so there is no need in atomic read-modify-write
+      generation.store(generation.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
       std::atomic_thread_fence(std::memory_order_release);
       data.clear();
     }
   };
 
-  std::atomic<int32> storage_count_{0};
-  std::atomic<Storage *> head_{static_cast<Storage *>(nullptr)};
+  static constexpr size_t CHUNK_SIZE = 32;
+  struct Chunk {
+    Chunk *next = nullptr;
+    Storage storages[CHUNK_SIZE];
+  };
+
+  // a thread keeps no more than 2 * BATCH_SIZE free storages
+  static constexpr size_t BATCH_SIZE = 64;
+  struct LocalList {
+    Storage *head = nullptr;
+    size_t size = 0;
+  };
+
+  std::atomic<size_t> storage_count_{0};
+  // list of free storages shared by all threads
+  std::atomic<Storage *> head_{nullptr};
+  std::atomic<Chunk *> chunks_{nullptr};
+  ThreadLocalStorage<LocalList> local_lists_;
+  // local list of all threads with zero thread identifier
+  SpinLock shared_list_lock_;
+  LocalList shared_list_;
+  // unique identifier of the pool; unlike the address, it is never reused
+  const uint64 pool_id_ = get_next_pool_id();
   bool check_empty_flag_ = false;
 
-  // TODO(perf): allocation Storages in chunks? Anyway we won't be able to release them.
-  // TODO(perf): memory order
-  // TODO(perf): use another non lockfree list for release on the same thread
-  // only one thread, so no aba problem
+  // the local list of the last pool used by the current thread
+  static TD_THREAD_LOCAL uint64 last_pool_id_;
+  static TD_THREAD_LOCAL LocalList *last_local_list_;
+
+  static uint64 get_next_pool_id() {
+    static std::atomic<uint64> next_pool_id{1};
+    return next_pool_id.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  LocalList &get_local_list() {
+    if (last_pool_id_ != pool_id_) {
+      last_local_list_ = &local_lists_.get();
+      last_pool_id_ = pool_id_;
+    }
+    return *last_local_list_;
+  }
+
   Storage *get_storage() {
-    if (head_.load() == nullptr) {
-      storage_count_++;
-      return new Storage();
-    }
-    Storage *res;
-    while (true) {
-      res = head_.load();
-      auto *next = res->next;
-      if (head_.compare_exchange_weak(res, next)) {
-        break;
-      }
+    if (get_thread_id() == 0) {
+      auto lock = shared_list_lock_.lock();
+      return pop_storage(shared_list_);
+    }
+    return pop_storage(get_local_list());
+  }
+
+  Storage *pop_storage(LocalList &list) {
+    if (list.head == nullptr) {
+      fill_local_list(list);
     }
-    return res;
+    auto *storage = list.head;
+    list.head = storage->next;
+    list.size--;
+    return storage;
   }
-  // release can be called from other thread
+
   void release_storage(Storage *storage) {
-    while (true) {
-      auto *save_head = head_.load();
-      storage->next = save_head;
-      if (head_.compare_exchange_weak(save_head, storage)) {
-        break;
+    if (get_thread_id() == 0) {
+      storage->next = head_.load(std::memory_order_relaxed);
+      while (
+          !head_.compare_exchange_weak(storage->next, storage, std::memory_order_release, std::memory_order_relaxed)) {
+      }
+      return;
+    }
+
+    auto &list = get_local_list();
+    storage->next = list.head;
+    list.head = storage;
+    list.size++;
+    if (list.size > 2 * BATCH_SIZE) {
+      flush_local_list(list);
+    }
+  }
+
+  void fill_local_list(LocalList &list) {
+    // the whole shared list is taken, so there is no ABA problem
+    auto *head = head_.exchange(nullptr, std::memory_order_acquire);
+    if (head != nullptr) {
+      list.head = head;
+      for (auto *storage = head; storage != nullptr; storage = storage->next) {
+        list.size++;
       }
+      return;
+    }
+
+    auto *chunk = new Chunk();
+    for (size_t i = 0; i + 1 < CHUNK_SIZE; i++) {
+      chunk->storages[i].next = &chunk->storages[i + 1];
+    }
+    list.head = &chunk->storages[0];
+    list.size = CHUNK_SIZE;
+    storage_count_.fetch_add(CHUNK_SIZE, std::memory_order_relaxed);
+
+    chunk->next = chunks_.load(std::memory_order_relaxed);
+    while (!chunks_.compare_exchange_weak(chunk->next, chunk, std::memory_order_release, std::memory_order_relaxed)) {
+    }
+  }
+
+  // moves all storages except the first BATCH_SIZE, which were released last, to the shared list
+  void flush_local_list(LocalList &list) {
+    auto *last_kept = list.head;
+    for (size_t i = 1; i < BATCH_SIZE; i++) {
+      last_kept = last_kept->next;
+    }
+    auto *first = last_kept->next;
+    auto *last = first;
+    while (last->next != nullptr) {
+      last = last->next;
+    }
+    last_kept->next = nullptr;
+    list.size = BATCH_SIZE;
+
+    last->next = head_.load(std::memory_order_relaxed);
+    while (!head_.compare_exchange_weak(last->next, first, std::memory_order_release, std::memory_order_relaxed)) {
     }
   }
 };
+
+template <class DataT>
+constexpr size_t ObjectPool<DataT>::CHUNK_SIZE;
+template <class DataT>
+constexpr size_t ObjectPool<DataT>::BATCH_SIZE;
+template <class DataT>
+TD_THREAD_LOCAL uint64 ObjectPool<DataT>::last_pool_id_;
+template <class DataT>
+TD_THREAD_LOCAL typename ObjectPool<DataT>::LocalList *ObjectPool<DataT>::last_local_list_;
+
 }  // namespace td
@@ -0,0 +1,159 @@
+#pragma once
+
+#include "td/utils/common.h"
+#include "td/utils/EpochBasedMemoryReclamation.h"
+#include "td/utils/logging.h"
+
+#include <atomic>
+#include <mutex>
+#include <utility>
+
+namespace td {
+
+template <class T>
+class RcuPtr;
+
+// Read-only view of the value stored in RcuPtr
+// The value can't be destroyed while the snapshot is alive, even if RcuPtr is updated
+// A thread can have at most one snapshot at a time and mustn't update the RcuPtr while holding it
+template <class T>
+class RcuSnapshot {
+ public:
+  RcuSnapshot() = default;
+  RcuSnapshot(const RcuSnapshot &other) = delete;
+  RcuSnapshot &operator=(const RcuSnapshot &other) = delete;
+  RcuSnapshot(RcuSnapshot &&other) noexcept : locker_(other.locker_), value_(other.value_) {
+    other.locker_ = nullptr;
+    other.value_ = nullptr;
+  }
+  RcuSnapshot &operator=(RcuSnapshot &&other) noexcept {
+    if (this != &other) {
+      reset();
+      locker_ = other.locker_;
+      value_ = other.value_;
+      other.locker_ = nullptr;
+      other.value_ = nullptr;
+    }
+    return *this;
+  }
+  ~RcuSnapshot() {
+    reset();
+  }
+
+  const T *get() const {
+    return value_;
+  }
+  const T *operator->() const {
+    return value_;
+  }
+  const T &operator*() const {
+    DCHECK(value_ != nullptr);
+    return *value_;
+  }
+  explicit operator bool() const {
+    return value_ != nullptr;
+  }
+
+  void reset() {
+    if (locker_ != nullptr) {
+      locker_->unlock();
+      locker_ = nullptr;
+      value_ = nullptr;
+    }
+  }
+
+ private:
+  friend class RcuPtr<T>;
+  using Locker = typename EpochBasedMemoryReclamation<T>::Locker;
+
+  RcuSnapshot(Locker *locker, const T *value) : locker_(locker), value_(value) {
+  }
+
+  Locker *locker_{nullptr};
+  const T *value_{nullptr};
+};
+
+// Pointer to read-mostly data
+// Readers get a snapshot of the current value without locks and without writes to shared memory
+// Writers replace the value with a new version, usually a modified copy of the current one
+// Replaced versions are destroyed by EpochBasedMemoryReclamation after all snapshots, which could see them, are released
+// Thread identifiers must be less than threads_n
+template <class T>
+class RcuPtr {
+ public:
+  explicit RcuPtr(size_t threads_n, unique_ptr<T> value = nullptr) : ebmr_(threads_n), value_(value.release()) {
+    lockers_.reserve(threads_n);
+    for (size_t i = 0; i < threads_n; i++) {
+      lockers_.push_back(ebmr_.get_locker(i));
+    }
+  }
+  RcuPtr(const RcuPtr &other) = delete;
+  RcuPtr &operator=(const RcuPtr &other) = delete;
+  RcuPtr(RcuPtr &&other) = delete;
+  RcuPtr &operator=(RcuPtr &&other) = delete;
+  ~RcuPtr() {
+    // lockers wait for the destruction of all retired versions
+    lockers_.clear();
+    delete value_.load(std::memory_order_relaxed);
+  }
+
+  // wait-free
+  RcuSnapshot<T> get_snapshot(size_t thread_id) {
+    auto &locker = get_locker(thread_id);
+    locker.lock();
+    // the load must not be reordered before the epoch is published
+    return RcuSnapshot<T>(&locker, value_.load(std::memory_order_seq_cst));
+  }
+
+  void set(size_t thread_id, unique_ptr<T> value) {
+    std::lock_guard<std::mutex> guard(write_mutex_);
+    replace(thread_id, value.release());
+  }
+
+  // copies the current value, applies f to the copy and publishes it
+  // updates are serialized, so no update is lost
+  template <class F>
+  void update(size_t thread_id, F &&f) {
+    std::lock_guard<std::mutex> guard(write_mutex_);
+    auto *old_value = value_.load(std::memory_order_relaxed);
+    CHECK(old_value != nullptr);
+    auto new_value = make_unique<T>(*old_value);
+    f(*new_value);
+    replace(thread_id, new_value.release());
+  }
+
+  // blocks until all versions replaced by the thread are destroyed
+  void synchronize(size_t thread_id) {
+    get_locker(thread_id).retire_sync();
+  }
+
+  size_t to_delete_size_unsafe() const {
+    return ebmr_.to_delete_size_unsafe();
+  }
+
+ private:
+  using Locker = typename EpochBasedMemoryReclamation<T>::Locker;
+
+  EpochBasedMemoryReclamation<T> ebmr_;
+  vector<Locker> lockers_;
+  std::atomic<T *> value_;
+  std::mutex write_mutex_;
+
+  Locker &get_locker(size_t thread_id) {
+    CHECK(thread_id < lockers_.size());
+    return lockers_[thread_id];
+  }
+
+  void replace(size_t thread_id, T *new_value) {
+    auto *old_value = value_.exchange(new_value, std::memory_order_acq_rel);
+    auto &locker = get_locker(thread_id);
+    if (old_value != nullptr) {
+      locker.retire(old_value);
+    }
+    // advance the epoch if possible and destroy sufficiently old versions
+    locker.retire();
+    locker.unlock();
+  }
+};
+
+}  // namespace td
@@ -2,7 +2,8 @@
 
 #include "td/utils/common.h"
 #include "td/utils/logging.h"
-#include "td/utils/MpscLinkQueue.h"
+#include "td/utils/SpinLock.h"
+#include "td/utils/ThreadLocalStorage.h"
 
 #include <atomic>
 #include <memory>
@@ -31,9 +32,7 @@ class AtomicRefCnt {
 };
 
 template <class DataT, class DeleterT>
-class SharedPtrRaw
-    : public DeleterT
-    , private MpscLinkQueueImpl::Node {
+class SharedPtrRaw : public DeleterT {
  public:
   explicit SharedPtrRaw(DeleterT deleter) : DeleterT(std::move(deleter)), ref_cnt_{0}, option_magic_(Magic) {
   }
@@ -62,12 +61,6 @@ class SharedPtrRaw
   DataT &data() {
     return option_data_;
   }
-  static SharedPtrRaw *from_mpsc_link_queue_node(MpscLinkQueueImpl::Node *node) {
-    return static_cast<SharedPtrRaw<DataT, DeleterT> *>(node);
-  }
-  MpscLinkQueueImpl::Node *to_mpsc_link_queue_node() {
-    return static_cast<MpscLinkQueueImpl::Node *>(this);
-  }
 
  private:
   AtomicRefCnt ref_cnt_;
@@ -170,6 +163,12 @@ class SharedPtr {
 
 }  // namespace detail
 
+// Pool of objects owned by shared pointers
+// Objects are allocated and freed mostly in per-thread magazines, each of which is a fixed-size stack of free objects.
+// Each thread has two magazines; when both are full or both are empty, the thread exchanges one of them
+// with a full or an empty magazine from the depot, which is shared by all threads.
+// Objects can be allocated and freed from any thread. Threads with a zero thread identifier, i.e. the main thread and
+// threads, which weren't created by td::thread, share one cache, which is protected by a lock.
 template <class DataT>
 class SharedObjectPool {
   class Deleter;
@@ -177,17 +176,24 @@ class SharedObjectPool {
  public:
   using Ptr = detail::SharedPtr<DataT, Deleter>;
 
+  struct Stats {
+    uint64 alloc_count = 0;
+    // number of allocations served by magazines of the allocating thread
+    uint64 local_alloc_count = 0;
+    // number of allocations served by full magazines from the depot
+    uint64 depot_alloc_count = 0;
+    uint64 free_count = 0;
+    // number of frees served by magazines of the freeing thread
+    uint64 local_free_count = 0;
+  };
+
   SharedObjectPool() = default;
   SharedObjectPool(const SharedObjectPool &other) = delete;
   SharedObjectPool &operator=(const SharedObjectPool &other) = delete;
   SharedObjectPool(SharedObjectPool &&other) = delete;
   SharedObjectPool &operator=(SharedObjectPool &&other) = delete;
   ~SharedObjectPool() {
-    free_queue_.pop_all(free_queue_reader_);
-    size_t free_cnt = 0;
-    while (free_queue_reader_.read()) {
-      free_cnt++;
-    }
+    auto free_cnt = calc_free_size();
     LOG_CHECK(free_cnt == allocated_.size()) << free_cnt << " " << allocated_.size();
   }
 
@@ -198,11 +204,38 @@ class SharedObjectPool {
     return Ptr(raw);
   }
   size_t total_size() const {
+    auto lock = allocated_lock_.lock();
     return allocated_.size();
   }
+
+  //non thread safe
   uint64 calc_free_size() {
-    free_queue_.pop_all(free_queue_reader_);
-    return free_queue_reader_.calc_size();
+    uint64 result = 0;
+    auto add_cache = [&result](const LocalCache &cache) {
+      for (auto &magazine : cache.magazines) {
+        if (magazine != nullptr) {
+          result += magazine->size;
+        }
+      }
+    };
+    local_caches_.for_each(add_cache);
+    add_cache(shared_cache_);
+    result += full_magazines_.size() * MAGAZINE_SIZE;
+    return result;
+  }
+
+  Stats get_stats() const {
+    Stats stats;
+    auto add_cache = [&stats](const LocalCache &cache) {
+      stats.alloc_count += cache.alloc_count.load(std::memory_order_relaxed);
+      stats.local_alloc_count += cache.local_alloc_count.load(std::memory_order_relaxed);
+      stats.depot_alloc_count += cache.depot_alloc_count.load(std::memory_order_relaxed);
+      stats.free_count += cache.free_count.load(std::memory_order_relaxed);
+      stats.local_free_count += cache.local_free_count.load(std::memory_order_relaxed);
+    };
+    local_caches_.for_each(add_cache);
+    add_cache(shared_cache_);
+    return stats;
   }
 
   //non thread safe
@@ -217,42 +250,117 @@ class SharedObjectPool {
 
  private:
   using Raw = typename Ptr::Raw;
-  Raw *alloc_raw() {
-    free_queue_.pop_all(free_queue_reader_);
-    auto *raw = free_queue_reader_.read().get();
-    if (raw) {
-      return raw;
-    }
-    allocated_.push_back(make_unique<Raw>(deleter()));
-    return allocated_.back().get();
+
+  static constexpr size_t MAGAZINE_SIZE = 32;
+  struct Magazine {
+    size_t size = 0;
+    Raw *raws[MAGAZINE_SIZE];
+  };
+
+  struct LocalCache {
+    // magazines[0] is used first; magazines[1] is used when magazines[0] is full or empty
+    unique_ptr<Magazine> magazines[2];
+
+    // statistics; changed only by the owner thread or under shared_cache_lock_
+    std::atomic<uint64> alloc_count{0};
+    std::atomic<uint64> local_alloc_count{0};
+    std::atomic<uint64> depot_alloc_count{0};
+    std::atomic<uint64> free_count{0};
+    std::atomic<uint64> local_free_count{0};
+  };
+
+  static void inc_counter(std::atomic<uint64> &counter) {
+    counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
   }
 
-  void free_raw(Raw *raw) {
-    free_queue_.push(Node{raw});
+  static LocalCache &init_cache(LocalCache &cache) {
+    if (cache.magazines[0] == nullptr) {
+      cache.magazines[0] = make_unique<Magazine>();
+      cache.magazines[1] = make_unique<Magazine>();
+    }
+    return cache;
   }
 
-  class Node {
-   public:
-    Node() = default;
-    explicit Node(Raw *raw) : raw_(raw) {
+  Raw *alloc_raw() {
+    auto thread_id = get_thread_id();
+    if (thread_id == 0) {
+      auto lock = shared_cache_lock_.lock();
+      return alloc_raw(init_cache(shared_cache_));
     }
+    return alloc_raw(init_cache(local_caches_.get(thread_id)));
+  }
 
-    MpscLinkQueueImpl::Node *to_mpsc_link_queue_node() {
-      return raw_->to_mpsc_link_queue_node();
+  Raw *alloc_raw(LocalCache &cache) {
+    inc_counter(cache.alloc_count);
+    auto *magazine = cache.magazines[0].get();
+    if (magazine->size == 0) {
+      std::swap(cache.magazines[0], cache.magazines[1]);
+      magazine = cache.magazines[0].get();
+      if (magazine->size == 0) {
+        if (!load_full_magazine(cache)) {
+          auto lock = allocated_lock_.lock();
+          allocated_.push_back(make_unique<Raw>(deleter()));
+          return allocated_.back().get();
+        }
+        inc_counter(cache.depot_alloc_count);
+        magazine = cache.magazines[0].get();
+        return magazine->raws[--magazine->size];
+      }
     }
-    static Node from_mpsc_link_queue_node(MpscLinkQueueImpl::Node *node) {
-      return Node{Raw::from_mpsc_link_queue_node(node)};
+    inc_counter(cache.local_alloc_count);
+    return magazine->raws[--magazine->size];
+  }
+
+  void free_raw(Raw *raw) {
+    auto thread_id = get_thread_id();
+    if (thread_id == 0) {
+      auto lock = shared_cache_lock_.lock();
+      free_raw(init_cache(shared_cache_), raw);
+      return;
     }
-    Raw *get() const {
-      return raw_;
+    free_raw(init_cache(local_caches_.get(thread_id)), raw);
+  }
+
+  void free_raw(LocalCache &cache, Raw *raw) {
+    inc_counter(cache.free_count);
+    auto *magazine = cache.magazines[0].get();
+    if (magazine->size == MAGAZINE_SIZE) {
+      std::swap(cache.magazines[0], cache.magazines[1]);
+      magazine = cache.magazines[0].get();
+      if (magazine->size == MAGAZINE_SIZE) {
+        load_empty_magazine(cache);
+        magazine = cache.magazines[0].get();
+        magazine->raws[magazine->size++] = raw;
+        return;
+      }
     }
-    explicit operator bool() const {
-      return raw_ != nullptr;
+    inc_counter(cache.local_free_count);
+    magazine->raws[magazine->size++] = raw;
+  }
+
+  // both magazines of the cache are empty
+  bool load_full_magazine(LocalCache &cache) {
+    auto lock = depot_lock_.lock();
+    if (full_magazines_.empty()) {
+      return false;
     }
+    empty_magazines_.push_back(std::move(cache.magazines[0]));
+    cache.magazines[0] = std::move(full_magazines_.back());
+    full_magazines_.pop_back();
+    return true;
+  }
 
-   private:
-    Raw *raw_{nullptr};
-  };
+  // both magazines of the cache are full
+  void load_empty_magazine(LocalCache &cache) {
+    auto lock = depot_lock_.lock();
+    full_magazines_.push_back(std::move(cache.magazines[0]));
+    if (empty_magazines_.empty()) {
+      cache.magazines[0] = make_unique<Magazine>();
+    } else {
+      cache.magazines[0] = std::move(empty_magazines_.back());
+      empty_magazines_.pop_back();
+    }
+  }
 
   class Deleter {
    public:
@@ -271,9 +379,21 @@ class SharedObjectPool {
     return Deleter(this);
   }
 
+  mutable SpinLock allocated_lock_;
   std::vector<unique_ptr<Raw>> allocated_;
-  MpscLinkQueue<Node> free_queue_;
-  typename MpscLinkQueue<Node>::Reader free_queue_reader_;
+
+  SpinLock depot_lock_;
+  std::vector<unique_ptr<Magazine>> full_magazines_;
+  std::vector<unique_ptr<Magazine>> empty_magazines_;
+
+  ThreadLocalStorage<LocalCache> local_caches_;
+
+  // cache of all threads with zero thread identifier
+  SpinLock shared_cache_lock_;
+  LocalCache shared_cache_;
 };
 
+template <class DataT>
+constexpr size_t SharedObjectPool<DataT>::MAGAZINE_SIZE;
+
 }  // namespace td
@@ -1,13 +1,185 @@
 #include "td/utils/StackAllocator.h"
 
+#include "td/utils/port/memory.h"
 #include "td/utils/port/thread_local.h"
 
+#include <atomic>
+
 namespace td {
 
+namespace {
+// segments are mapped lazily, so the first segment takes only address space until it is used
+constexpr size_t FIRST_SEGMENT_SIZE = 1 << 20;
+
+// unused memory is released periodically only if there is at least MIN_RELEASE_SIZE bytes of it
+constexpr size_t MIN_RELEASE_SIZE = 1 << 16;
+
+std::atomic<size_t> total_reserved_size{0};
+std::atomic<size_t> total_released_size{0};
+std::atomic<size_t> max_high_water_size{0};
+
+size_t round_up_to_page_size(size_t size) {
+  auto page_size = get_page_size();
+  if (page_size == 0) {
+    return size;
+  }
+  return (size + page_size - 1) / page_size * page_size;
+}
+}  // namespace
+
+constexpr size_t StackAllocator::Impl::MAX_SEGMENTS;
+constexpr size_t StackAllocator::Impl::RELEASE_PERIOD;
+
+StackAllocator::Impl::~Impl() {
+  for (auto &segment : segments_) {
+    free_segment(segment);
+  }
+}
+
+char *StackAllocator::Impl::alloc_slow(size_t size) {
+  while (true) {
+    auto &segment = segments_[current_segment_];
+    if (segment.size - segment.pos >= size) {
+      break;
+    }
+    if (segment.pos == 0) {
+      // the segment is empty, so it can be replaced with a bigger one
+      free_segment(segment);
+      create_segment(segment, max(FIRST_SEGMENT_SIZE << current_segment_, size));
+      continue;
+    }
+    if (current_segment_ + 1 == MAX_SEGMENTS) {
+      std::abort();  // unreachable, because segment sizes grow exponentially
+    }
+    base_used_size_ += segment.pos;
+    current_segment_++;
+  }
+
+  auto &segment = segments_[current_segment_];
+  char *res = segment.begin + segment.pos;
+  segment.pos += size;
+  if (segment.pos > segment.max_pos) {
+    on_new_max_pos();
+  }
+  return res;
+}
+
+void StackAllocator::Impl::on_new_max_pos() {
+  auto &segment = segments_[current_segment_];
+  segment.max_pos = segment.pos;
+  auto used_size = base_used_size_ + segment.pos;
+  if (used_size > high_water_size_) {
+    high_water_size_ = used_size;
+    auto old_max = max_high_water_size.load(std::memory_order_relaxed);
+    while (old_max < used_size &&
+           !max_high_water_size.compare_exchange_weak(old_max, used_size, std::memory_order_relaxed)) {
+    }
+  }
+}
+
+void StackAllocator::Impl::on_segment_empty() {
+  if (current_segment_ > 0) {
+    while (current_segment_ > 0 && segments_[current_segment_].pos == 0) {
+      current_segment_--;
+      base_used_size_ -= segments_[current_segment_].pos;
+    }
+    if (current_segment_ != 0 || segments_[0].pos != 0 || ++empty_count_ < RELEASE_PERIOD) {
+      return;
+    }
+  }
+  empty_count_ = 0;
+  release_memory(false);
+}
+
+void StackAllocator::Impl::release_memory(bool release_all) {
+  for (size_t i = 0; i < MAX_SEGMENTS; i++) {
+    auto &segment = segments_[i];
+    if (segment.size == 0) {
+      continue;
+    }
+    // memory below the current position is in use and memory below max_pos was used recently
+    auto keep_pos = release_all ? segment.pos : segment.max_pos;
+    if (i > current_segment_ && keep_pos == 0) {
+      free_segment(segment);
+      continue;
+    }
+    segment.dirty_pos = max(segment.dirty_pos, segment.max_pos);
+    segment.max_pos = segment.pos;
+    keep_pos = round_up_to_page_size(keep_pos);
+    if (!segment.is_mapped || segment.dirty_pos <= keep_pos ||
+        (!release_all && segment.dirty_pos - keep_pos < MIN_RELEASE_SIZE)) {
+      continue;
+    }
+    auto release_size = segment.dirty_pos - keep_pos;
+    if (release_memory_pages(MutableSlice(segment.begin + keep_pos, release_size)).is_ok()) {
+      segment.dirty_pos = keep_pos;
+      released_size_ += release_size;
+      total_released_size.fetch_add(release_size, std::memory_order_relaxed);
+    }
+  }
+}
+
+void StackAllocator::Impl::create_segment(Segment &segment, size_t size) {
+  size = round_up_to_page_size(size);
+  auto r_memory = map_anonymous_memory(size);
+  if (r_memory.is_ok()) {
+    segment.begin = r_memory.ok().data();
+    segment.is_mapped = true;
+  } else {
+    segment.begin = new char[size];
+    segment.is_mapped = false;
+  }
+  segment.size = size;
+  segment.pos = 0;
+  segment.max_pos = 0;
+  segment.dirty_pos = 0;
+  total_reserved_size.fetch_add(size, std::memory_order_relaxed);
+}
+
+void StackAllocator::Impl::free_segment(Segment &segment) {
+  if (segment.size == 0) {
+    return;
+  }
+  if (segment.is_mapped) {
+    unmap_memory(MutableSlice(segment.begin, segment.size));
+  } else {
+    delete[] segment.begin;
+  }
+  total_reserved_size.fetch_sub(segment.size, std::memory_order_relaxed);
+  segment = Segment();
+}
+
+StackAllocator::Stats StackAllocator::Impl::get_stats() const {
+  Stats stats;
+  stats.used_size = base_used_size_ + segments_[current_segment_].pos;
+  stats.high_water_size = high_water_size_;
+  for (auto &segment : segments_) {
+    stats.reserved_size += segment.size;
+  }
+  stats.released_size = released_size_;
+  return stats;
+}
+
 StackAllocator::Impl &StackAllocator::impl() {
   static TD_THREAD_LOCAL StackAllocator::Impl *impl;  // static zero-initialized
   init_thread_local<Impl>(impl);
   return *impl;
 }
 
+StackAllocator::Stats StackAllocator::get_thread_stats() {
+  return impl().get_stats();
+}
+
+StackAllocator::Stats StackAllocator::get_total_stats() {
+  Stats stats;
+  stats.high_water_size = max_high_water_size.load(std::memory_order_relaxed);
+  stats.reserved_size = total_reserved_size.load(std::memory_order_relaxed);
+  stats.released_size = total_released_size.load(std::memory_order_relaxed);
+  return stats;
+}
+
+void StackAllocator::release_unused_memory() {
+  impl().release_memory(true);
+}
+
 }  // namespace td
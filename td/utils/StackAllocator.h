@@ -4,12 +4,14 @@
 #include "td/utils/MovableValue.h"
 #include "td/utils/Slice.h"
 
-#include <array>
 #include <cstdlib>
 #include <memory>
 
 namespace td {
 
+// Per-thread LIFO allocator
+// Memory is allocated in segments of growing size, which are mapped on demand, so untouched memory isn't resident.
+// Pages above the recent maximum usage are periodically returned to the system when all memory is freed.
 class StackAllocator {
   class Deleter {
    public:
@@ -18,7 +20,6 @@ class StackAllocator {
     }
   };
 
-  // TODO: alloc memory with mmap and unload unused pages
   // memory still can be corrupted, but it is better than explicit free function
   // TODO: use pointer that can't be even copied
   using PtrImpl = std::unique_ptr<char, Deleter>;
@@ -40,30 +41,86 @@ class StackAllocator {
     impl().free_ptr(ptr);
   }
 
-  struct Impl {
-    static const size_t MEM_SIZE = 1024 * 1024;
-    std::array<char, MEM_SIZE> mem;
+ public:
+  struct Stats {
+    // size of currently allocated memory
+    size_t used_size = 0;
+    // maximum size of simultaneously allocated memory
+    size_t high_water_size = 0;
+    // size of all segments
+    size_t reserved_size = 0;
+    // total size of memory returned to the system
+    size_t released_size = 0;
+  };
+
+ private:
+  class Impl {
+   public:
+    Impl() = default;
+    Impl(const Impl &) = delete;
+    Impl &operator=(const Impl &) = delete;
+    Impl(Impl &&) = delete;
+    Impl &operator=(Impl &&) = delete;
+    ~Impl();
 
-    size_t pos{0};
     char *alloc(size_t size) {
-      if (size == 0) {
-        size = 1;
+      size = (max(size, static_cast<size_t>(1)) + 7) & -8;
+      auto &segment = segments_[current_segment_];
+      if (segment.size - segment.pos < size) {
+        return alloc_slow(size);
       }
-      char *res = mem.data() + pos;
-      size = (size + 7) & -8;
-      pos += size;
-      if (pos > MEM_SIZE) {
-        std::abort();  // memory is over
+      char *res = segment.begin + segment.pos;
+      segment.pos += size;
+      if (segment.pos > segment.max_pos) {
+        on_new_max_pos();
       }
       return res;
     }
+
     void free_ptr(char *ptr) {
-      size_t new_pos = ptr - mem.data();
-      if (new_pos >= pos) {
+      auto &segment = segments_[current_segment_];
+      if (ptr < segment.begin || ptr >= segment.begin + segment.pos) {
         std::abort();  // shouldn't happen
       }
-      pos = new_pos;
+      segment.pos = static_cast<size_t>(ptr - segment.begin);
+      if (segment.pos == 0 && (current_segment_ != 0 || ++empty_count_ == RELEASE_PERIOD)) {
+        on_segment_empty();
+      }
     }
+
+    Stats get_stats() const;
+
+    // releases unused pages; if release_all is false, recently used pages are kept
+    void release_memory(bool release_all);
+
+   private:
+    struct Segment {
+      char *begin{nullptr};
+      size_t size{0};
+      // position after the last allocated byte
+      size_t pos{0};
+      // maximum position since the last release of unused memory
+      size_t max_pos{0};
+      // position, after which all pages were released
+      size_t dirty_pos{0};
+      bool is_mapped{false};
+    };
+    static constexpr size_t MAX_SEGMENTS = 40;
+    // unused memory is released every RELEASE_PERIOD times all memory of the thread is freed
+    static constexpr size_t RELEASE_PERIOD = 128;
+    Segment segments_[MAX_SEGMENTS];
+    size_t current_segment_{0};
+    // total size of memory allocated in segments before the current one
+    size_t base_used_size_{0};
+    size_t high_water_size_{0};
+    size_t released_size_{0};
+    size_t empty_count_{0};
+
+    char *alloc_slow(size_t size);
+    void on_new_max_pos();
+    void on_segment_empty();
+    static void create_segment(Segment &segment, size_t size);
+    static void free_segment(Segment &segment);
   };
 
   static Impl &impl();
@@ -72,6 +129,15 @@ class StackAllocator {
   static Ptr alloc(size_t size) {
     return Ptr(impl().alloc(size), size);
   }
+
+  // returns statistics of the current thread
+  static Stats get_thread_stats();
+
+  // returns statistics of all threads; used_size is always 0 and high_water_size is the maximum over all threads
+  static Stats get_total_stats();
+
+  // returns all unused memory of the current thread to the system, for example, before the thread becomes idle
+  static void release_unused_memory();
 };
 
 }  // namespace td
@@ -2,6 +2,7 @@
 
 #include "td/utils/common.h"
 #include "td/utils/misc.h"
+#include "td/utils/Span.h"
 
 #include <array>
 #include <atomic>
@@ -13,14 +14,15 @@ class StealingQueue {
  public:
   static_assert(N > 0 && (N & (N - 1)) == 0, "");
 
-  // tries to put a value
-  // returns if succeeded
+  // puts a value
+  // if the queue is full, the older half of values together with the new value is passed to overflow_f as MutableSpan<T>
   // only owner is allowed to to do this
   template <class F>
   void local_push(T value, F &&overflow_f) {
     while (true) {
       auto tail = tail_.load(std::memory_order_relaxed);
-      auto head = head_.load();  // TODO: memory order
+      // acquire pairs with release in the CAS of stealers, so they have finished reading values before reuse
+      auto head = head_.load(std::memory_order_acquire);
 
       if (static_cast<size_t>(tail - head) < N) {
         buf_[tail & MASK].store(value, std::memory_order_relaxed);
@@ -29,17 +31,19 @@ class StealingQueue {
       }
 
       // queue is full
-      // TODO: batch insert into global queue?
-      auto n = N / 2 + 1;
+      constexpr size_t n = N / 2 + 1;
       auto new_head = head + n;
-      if (!head_.compare_exchange_strong(head, new_head)) {
+      if (!head_.compare_exchange_strong(head, new_head, std::memory_order_acq_rel)) {
         continue;
       }
 
+      // values can be overwritten only by the owner, so they can be read after the CAS
+      std::array<T, n + 1> batch;
       for (size_t i = 0; i < n; i++) {
-        overflow_f(buf_[(i + head) & MASK].load(std::memory_order_relaxed));
+        batch[i] = buf_[(i + head) & MASK].load(std::memory_order_relaxed);
       }
-      overflow_f(value);
+      batch[n] = value;
+      overflow_f(MutableSpan<T>(batch));
 
       return;
     }
@@ -50,22 +54,54 @@ class StealingQueue {
   // only owner is allowed to do this
   bool local_pop(T &value) {
     auto tail = tail_.load(std::memory_order_relaxed);
-    auto head = head_.load();
+    auto head = head_.load(std::memory_order_relaxed);
 
-    if (head == tail) {
-      return false;
+    while (head != tail) {
+      // values are written only by the owner, so a relaxed read is enough
+      value = buf_[head & MASK].load(std::memory_order_relaxed);
+      if (head_.compare_exchange_weak(head, head + 1, std::memory_order_relaxed)) {
+        return true;
+      }
     }
-
-    value = buf_[head & MASK].load(std::memory_order_relaxed);
-    return head_.compare_exchange_strong(head, head + 1);
+    return false;
   }
 
+  // moves about half of values of the other queue to this queue and pops one of them
+  // returns if succeeded
+  // only owner is allowed to do this
   bool steal(T &value, StealingQueue<T, N> &other) {
     while (true) {
       auto tail = tail_.load(std::memory_order_relaxed);
-      auto head = head_.load();  // TODO: memory order
+      auto head = head_.load(std::memory_order_acquire);
+
+      auto n = static_cast<size_t>(head + N - tail);
+      if (n == 0) {
+        return false;
+      }
+      std::array<T, N> values;
+      auto stolen = steal_n(MutableSpan<T>(values.data(), n), other);
+      if (stolen.empty()) {
+        return false;
+      }
 
-      auto other_head = other.head_.load();
+      // only the owner can add values, so there is still enough space
+      auto last = stolen.size() - 1;
+      for (size_t i = 0; i < last; i++) {
+        buf_[(i + tail) & MASK].store(stolen[i], std::memory_order_relaxed);
+      }
+      value = stolen[last];
+      tail_.store(tail + last, std::memory_order_release);
+      return true;
+    }
+  }
+
+  // moves about half of values of the other queue, but no more than values.size(), to values
+  // returns the stolen prefix of values
+  // any thread is allowed to do this
+  MutableSpan<T> steal_n(MutableSpan<T> values, StealingQueue<T, N> &other) {
+    while (true) {
+      // acquire on tail pairs with release in local_push, so stored values are visible
+      auto other_head = other.head_.load(std::memory_order_acquire);
       auto other_tail = other.tail_.load(std::memory_order_acquire);
 
       if (other_tail < other_head) {
@@ -76,24 +112,19 @@ class StealingQueue {
         continue;
       }
       n -= n / 2;
-      n = td::min(n, static_cast<size_t>(head + N - tail));
+      n = td::min(n, values.size());
       if (n == 0) {
-        return false;
+        return MutableSpan<T>(values.data(), 0);
       }
 
       for (size_t i = 0; i < n; i++) {
-        buf_[(i + tail) & MASK].store(other.buf_[(i + other_head) & MASK].load(std::memory_order_relaxed),
-                                      std::memory_order_relaxed);
+        values[i] = other.buf_[(i + other_head) & MASK].load(std::memory_order_relaxed);
       }
 
-      if (!other.head_.compare_exchange_strong(other_head, other_head + n)) {
-        continue;
+      // release keeps the reads above before the owner can reuse the cells
+      if (other.head_.compare_exchange_strong(other_head, other_head + n, std::memory_order_acq_rel)) {
+        return MutableSpan<T>(values.data(), n);
       }
-
-      n--;
-      value = buf_[(tail + n) & MASK].load(std::memory_order_relaxed);
-      tail_.store(tail + n, std::memory_order_release);
-      return true;
     }
   }
 
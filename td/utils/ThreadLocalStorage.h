@@ -1,33 +1,55 @@
 #pragma once
 
+#include "td/utils/bits.h"
 #include "td/utils/common.h"
+#include "td/utils/logging.h"
 #include "td/utils/port/thread_local.h"
 
-#include <array>
 #include <atomic>
 
 namespace td {
 
+// Value per thread identifier
+// Values are stored in segments of exponentially growing size, which are allocated on the first access,
+// so the memory usage is proportional to the maximum identifier of a thread, which has used the storage.
+// Thread identifiers are reused after the threads exit, so they are bounded by the number of simultaneously
+// running threads.
 template <class T>
 class ThreadLocalStorage {
  public:
+  ThreadLocalStorage() = default;
+  ThreadLocalStorage(const ThreadLocalStorage &) = delete;
+  ThreadLocalStorage &operator=(const ThreadLocalStorage &) = delete;
+  ThreadLocalStorage(ThreadLocalStorage &&) = delete;
+  ThreadLocalStorage &operator=(ThreadLocalStorage &&) = delete;
+  ~ThreadLocalStorage() {
+    for (auto &segment : segments_) {
+      delete[] segment.load(std::memory_order_relaxed);
+    }
+  }
+
   T &get() {
-    return thread_local_node().value;
+    return get_node(get_thread_id()).value;
+  }
+
+  // returns the value of a thread with the given identifier
+  T &get(int32 thread_id) {
+    return get_node(thread_id).value;
   }
 
   template <class F>
   void for_each(F &&f) {
-    int32 n = max_thread_id_.load();
-    for (int32 i = 0; i < n; i++) {
-      f(nodes_[i].value);
-    }
+    for_each_node(segments_, [&f](int32, Node &node) { f(node.value); });
   }
   template <class F>
   void for_each(F &&f) const {
-    int32 n = max_thread_id_.load();
-    for (int32 i = 0; i < n; i++) {
-      f(nodes_[i].value);
-    }
+    for_each_node(segments_, [&f](int32, const Node &node) { f(node.value); });
+  }
+
+  // calls f(thread_id, value) for all allocated values
+  template <class F>
+  void for_each_with_thread_id(F &&f) {
+    for_each_node(segments_, [&f](int32 thread_id, Node &node) { f(thread_id, node.value); });
   }
 
  private:
@@ -35,14 +57,51 @@ class ThreadLocalStorage {
     T value{};
     char padding[TD_CONCURRENCY_PAD];
   };
-  static constexpr int32 MAX_THREAD_ID = 128;
-  std::atomic<int32> max_thread_id_{MAX_THREAD_ID};
-  std::array<Node, MAX_THREAD_ID> nodes_;
-
-  Node &thread_local_node() {
-    auto thread_id = get_thread_id();
-    CHECK(0 <= thread_id && static_cast<size_t>(thread_id) < nodes_.size());
-    return nodes_[thread_id];
+
+  // segment i contains values for thread identifiers in [FIRST_SEGMENT_SIZE * (2^i - 1), FIRST_SEGMENT_SIZE * (2^(i+1) - 1))
+  static constexpr int32 FIRST_SEGMENT_SIZE_LOG = 4;
+  static constexpr uint32 FIRST_SEGMENT_SIZE = 1u << FIRST_SEGMENT_SIZE_LOG;
+  static constexpr int32 MAX_SEGMENTS = 32 - FIRST_SEGMENT_SIZE_LOG;
+  std::atomic<Node *> segments_[MAX_SEGMENTS]{};
+
+  static uint32 get_segment_size(int32 segment_id) {
+    return FIRST_SEGMENT_SIZE << segment_id;
+  }
+
+  Node &get_node(int32 thread_id) {
+    CHECK(thread_id >= 0);
+    auto shifted_id = static_cast<uint32>(thread_id) + FIRST_SEGMENT_SIZE;
+    auto segment_id = 31 - count_leading_zeroes_non_zero32(shifted_id) - FIRST_SEGMENT_SIZE_LOG;
+    auto *segment = segments_[segment_id].load(std::memory_order_acquire);
+    if (segment == nullptr) {
+      segment = create_segment(segment_id);
+    }
+    return segment[shifted_id - get_segment_size(segment_id)];
+  }
+
+  Node *create_segment(int32 segment_id) {
+    auto *segment = new Node[get_segment_size(segment_id)];
+    Node *expected = nullptr;
+    if (!segments_[segment_id].compare_exchange_strong(expected, segment, std::memory_order_acq_rel)) {
+      delete[] segment;
+      return expected;
+    }
+    return segment;
+  }
+
+  template <class SegmentsT, class F>
+  static void for_each_node(SegmentsT &segments, F &&f) {
+    for (int32 segment_id = 0; segment_id < MAX_SEGMENTS; segment_id++) {
+      auto *segment = segments[segment_id].load(std::memory_order_acquire);
+      if (segment == nullptr) {
+        continue;
+      }
+      auto segment_size = get_segment_size(segment_id);
+      auto first_thread_id = static_cast<int32>(segment_size - FIRST_SEGMENT_SIZE);
+      for (uint32 i = 0; i < segment_size; i++) {
+        f(first_thread_id + static_cast<int32>(i), segment[i]);
+      }
+    }
   }
 };
 
@@ -5,8 +5,8 @@
 #include "td/utils/logging.h"
 #include "td/utils/port/thread_local.h"
 #include "td/utils/Slice.h"
+#include "td/utils/ThreadLocalStorage.h"
 
-#include <array>
 #include <atomic>
 #include <limits>
 #include <mutex>
@@ -20,17 +20,12 @@ class TsFileLog : public LogInterface {
     path_ = std::move(path);
     rotate_threshold_ = rotate_threshold;
     redirect_stderr_ = redirect_stderr;
-    for (size_t i = 0; i < logs_.size(); i++) {
-      logs_[i].id = i;
-    }
-    return init_info(&logs_[0]);
+    return init_info(&logs_.get(0), 0);
   }
 
   vector<string> get_file_paths() override {
     vector<string> res;
-    for (auto &log : logs_) {
-      res.push_back(get_path(&log));
-    }
+    logs_.for_each_with_thread_id([&](int32 thread_id, const Info &) { res.push_back(get_path(thread_id)); });
     return res;
   }
 
@@ -42,50 +37,46 @@ class TsFileLog : public LogInterface {
   struct Info {
     FileLog log;
     std::atomic<bool> is_inited{false};
-    size_t id;
   };
 
-  static constexpr size_t MAX_THREAD_ID = 128;
   int64 rotate_threshold_;
   bool redirect_stderr_;
   std::string path_;
-  std::array<Info, MAX_THREAD_ID> logs_;
+  ThreadLocalStorage<Info> logs_;
   std::mutex init_mutex_;
 
   LogInterface *get_current_logger() {
-    auto *info = get_current_info();
+    auto thread_id = get_thread_id();
+    auto *info = &logs_.get(thread_id);
     if (!info->is_inited.load(std::memory_order_relaxed)) {
       std::unique_lock<std::mutex> lock(init_mutex_);
       if (!info->is_inited.load(std::memory_order_relaxed)) {
-        init_info(info).ensure();
+        init_info(info, thread_id).ensure();
       }
     }
     return &info->log;
   }
 
-  Info *get_current_info() {
-    return &logs_[get_thread_id()];
-  }
-
-  Status init_info(Info *info) {
-    TRY_STATUS(info->log.init(get_path(info), std::numeric_limits<int64>::max(), info->id == 0 && redirect_stderr_));
+  Status init_info(Info *info, int32 thread_id) {
+    TRY_STATUS(
+        info->log.init(get_path(thread_id), std::numeric_limits<int64>::max(), thread_id == 0 && redirect_stderr_));
     info->is_inited = true;
     return Status::OK();
   }
 
-  string get_path(const Info *info) const {
-    if (info->id == 0) {
+  string get_path(int32 thread_id) const {
+    if (thread_id == 0) {
       return path_;
     }
-    return PSTRING() << path_ << ".thread" << info->id << ".log";
+    return PSTRING() << path_ << ".thread" << thread_id << ".log";
   }
 
   void rotate() override {
-    for (auto &info : logs_) {
+    logs_.for_each([](Info &info) {
       if (info.is_inited.load(std::memory_order_acquire)) {
         info.log.lazy_rotate();
       }
-    }
+    });
   }
 };
 }  // namespace detail
@@ -0,0 +1,177 @@
+#include "td/utils/WorkStealingScheduler.h"
+
+#if !TD_THREAD_UNSUPPORTED
+
+#include "td/utils/logging.h"
+#include "td/utils/port/thread_local.h"
+#include "td/utils/Random.h"
+
+namespace td {
+
+namespace {
+class StopTask final : public WorkStealingScheduler::Task {
+ public:
+  void run() final {
+    UNREACHABLE();
+  }
+};
+StopTask stop_task;
+
+TD_THREAD_LOCAL const WorkStealingScheduler *current_scheduler;
+TD_THREAD_LOCAL int32 current_worker_id;
+}  // namespace
+
+constexpr int32 WorkStealingScheduler::NO_AFFINITY;
+constexpr size_t WorkStealingScheduler::INBOX_SIZE;
+
+// the number of threads is used only to choose the hazard pointer scan threshold of the global queue,
+// which can be used by threads with any identifiers
+WorkStealingScheduler::WorkStealingScheduler(size_t threads_n) : global_queue_(threads_n + 1) {
+  CHECK(threads_n > 0);
+  for (size_t i = 0; i < threads_n; i++) {
+    workers_.push_back(make_unique<Worker>(static_cast<int32>(i)));
+  }
+  for (auto &worker : workers_) {
+    worker->thread = td::thread([this, worker = worker.get()] { run_worker(*worker); });
+  }
+}
+
+WorkStealingScheduler::~WorkStealingScheduler() {
+  close();
+}
+
+void WorkStealingScheduler::post_task(unique_ptr<Task> task, int32 affinity) {
+  DCHECK(!is_closed_);
+  pending_tasks_.fetch_add(1, std::memory_order_relaxed);
+  auto *ptr = task.release();
+
+  auto *worker = get_current_worker();
+  if (affinity != NO_AFFINITY) {
+    auto id = static_cast<size_t>(affinity) % workers_.size();
+    if (worker == nullptr || worker != workers_[id].get()) {
+      if (!workers_[id]->inbox.try_push(ptr)) {
+        push_global(ptr);
+      }
+      notify();
+      return;
+    }
+  }
+  if (worker != nullptr) {
+    worker->local_queue.local_push(ptr, [&](MutableSpan<Task *> overflow_tasks) { push_global(overflow_tasks); });
+  } else {
+    push_global(ptr);
+  }
+  notify();
+}
+
+void WorkStealingScheduler::close() {
+  if (is_closed_) {
+    return;
+  }
+  CHECK(get_current_worker() == nullptr);
+  {
+    std::unique_lock<std::mutex> guard(mutex_);
+    is_closing_.store(true);
+    condition_variable_.wait(guard, [&] { return pending_tasks_.load() == 0; });
+  }
+  is_closed_ = true;
+
+  // every worker exits after it takes a stop task
+  for (size_t i = 0; i < workers_.size(); i++) {
+    push_global(&stop_task);
+    notify();
+  }
+  for (auto &worker : workers_) {
+    worker->thread.join();
+  }
+  waiter_.close();
+}
+
+int32 WorkStealingScheduler::get_worker_id() const {
+  if (current_scheduler != this) {
+    return NO_AFFINITY;
+  }
+  return current_worker_id;
+}
+
+WorkStealingScheduler::Worker *WorkStealingScheduler::get_current_worker() {
+  if (current_scheduler != this) {
+    return nullptr;
+  }
+  return workers_[current_worker_id].get();
+}
+
+void WorkStealingScheduler::run_worker(Worker &worker) {
+  current_scheduler = this;
+  current_worker_id = worker.id;
+  waiter_.init_slot(worker.slot, worker.id);
+  while (true) {
+    auto *task = find_task(worker);
+    if (task == nullptr) {
+      waiter_.wait(worker.slot);
+      continue;
+    }
+    waiter_.stop_wait(worker.slot);
+    if (task == &stop_task) {
+      break;
+    }
+    task->run();
+    delete task;
+    on_task_finished();
+  }
+  current_scheduler = nullptr;
+}
+
+WorkStealingScheduler::Task *WorkStealingScheduler::find_task(Worker &worker) {
+  Task *task;
+  if (worker.local_queue.local_pop(task)) {
+    return task;
+  }
+  if (worker.inbox.try_pop(task)) {
+    return task;
+  }
+  if (global_queue_.try_pop(task, get_thread_id())) {
+    return task;
+  }
+
+  auto workers_n = workers_.size();
+  auto offset = static_cast<size_t>(Random::fast_uint32()) % workers_n;
+  for (size_t i = 0; i < workers_n; i++) {
+    auto &victim = *workers_[(i + offset) % workers_n];
+    if (&victim == &worker) {
+      continue;
+    }
+    if (worker.local_queue.steal(task, victim.local_queue)) {
+      return task;
+    }
+    if (victim.inbox.try_pop(task)) {
+      return task;
+    }
+  }
+  return nullptr;
+}
+
+void WorkStealingScheduler::push_global(Task *task) {
+  global_queue_.push(task, get_thread_id());
+}
+
+void WorkStealingScheduler::push_global(MutableSpan<Task *> tasks) {
+  global_queue_.push_n(tasks.data(), tasks.size(), get_thread_id());
+}
+
+void WorkStealingScheduler::notify() {
+  // the task must be visible before the check for searching workers
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  waiter_.notify();
+}
+
+void WorkStealingScheduler::on_task_finished() {
+  if (pending_tasks_.fetch_sub(1) == 1 && is_closing_.load()) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    condition_variable_.notify_all();
+  }
+}
+
+}  // namespace td
+
+#endif
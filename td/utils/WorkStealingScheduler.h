@@ -0,0 +1,127 @@
+#pragma once
+
+#include "td/utils/port/thread.h"
+
+#if !TD_THREAD_UNSUPPORTED
+
+#include "td/utils/common.h"
+#include "td/utils/MpmcQueue.h"
+#include "td/utils/MpmcRingQueue.h"
+#include "td/utils/MpmcWaiter.h"
+#include "td/utils/Span.h"
+#include "td/utils/StealingQueue.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+
+namespace td {
+
+// Thread pool with work stealing
+//
+// Every worker has a local StealingQueue. Tasks posted from a worker go to its local queue,
+// tasks posted from other threads and local queue overflows go to the global MpmcQueue.
+// A worker looks for a task in its local queue, in its inbox, in the global queue, and then steals
+// from other workers. Workers which found nothing park through MpmcWaiter.
+//
+// Affinity is a hint: a task posted with an affinity goes to the inbox of the chosen worker,
+// but it can still be stolen by an idle worker.
+class WorkStealingScheduler {
+ public:
+  class Task {
+   public:
+    Task() = default;
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
+    Task(Task &&) = delete;
+    Task &operator=(Task &&) = delete;
+    virtual ~Task() = default;
+
+    virtual void run() = 0;
+  };
+
+  static constexpr int32 NO_AFFINITY = -1;
+
+  explicit WorkStealingScheduler(size_t threads_n);
+  WorkStealingScheduler(const WorkStealingScheduler &) = delete;
+  WorkStealingScheduler &operator=(const WorkStealingScheduler &) = delete;
+  WorkStealingScheduler(WorkStealingScheduler &&) = delete;
+  WorkStealingScheduler &operator=(WorkStealingScheduler &&) = delete;
+  ~WorkStealingScheduler();
+
+  size_t get_threads_n() const {
+    return workers_.size();
+  }
+
+  template <class F>
+  void post(F &&f, int32 affinity = NO_AFFINITY) {
+    post_task(make_unique<LambdaTask<std::decay_t<F>>>(std::forward<F>(f)), affinity);
+  }
+
+  void post_task(unique_ptr<Task> task, int32 affinity = NO_AFFINITY);
+
+  // waits until all tasks, including the tasks posted by them, are completed and stops all workers
+  // no tasks can be posted from other threads after the call
+  void close();
+
+  // returns the worker identifier of the current thread or NO_AFFINITY if it isn't a worker of the scheduler
+  int32 get_worker_id() const;
+
+ private:
+  template <class F>
+  class LambdaTask final : public Task {
+   public:
+    template <class FromF>
+    explicit LambdaTask(FromF &&f) : f_(std::forward<FromF>(f)) {
+    }
+    void run() final {
+      f_();
+    }
+
+   private:
+    F f_;
+  };
+
+  static constexpr size_t INBOX_SIZE = 1024;
+
+  struct Worker {
+    explicit Worker(int32 id) : id(id), inbox(INBOX_SIZE) {
+    }
+    int32 id;
+    StealingQueue<Task *> local_queue;
+    MpmcRingQueue<Task *> inbox;
+    MpmcWaiter::Slot slot;
+    td::thread thread;
+  };
+
+  vector<unique_ptr<Worker>> workers_;
+  MpmcQueue<Task *> global_queue_;
+  MpmcWaiter waiter_;
+
+  std::atomic<int64> pending_tasks_{0};
+  std::atomic<bool> is_closing_{false};
+  bool is_closed_{false};
+  std::mutex mutex_;
+  std::condition_variable condition_variable_;
+
+  Worker *get_current_worker();
+
+  void run_worker(Worker &worker);
+
+  Task *find_task(Worker &worker);
+
+  void push_global(Task *task);
+
+  // pushes a batch of tasks with one reservation in the global queue; the caller notifies workers once
+  void push_global(MutableSpan<Task *> tasks);
+
+  void notify();
+
+  void on_task_finished();
+};
+
+}  // namespace td
+
+#endif
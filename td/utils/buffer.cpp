@@ -1,11 +1,21 @@
 #include "td/utils/buffer.h"
 
+#include "td/utils/bits.h"
+#include "td/utils/logging.h"
+#include "td/utils/misc.h"
+#include "td/utils/port/memory.h"
 #include "td/utils/port/thread_local.h"
-#include "td/utils/ThreadSafeCounter.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cstddef>
+#include <mutex>
 #include <new>
 
+#if TD_LINUX && defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
 // fixes https://bugs.llvm.org/show_bug.cgi?id=33723 for clang >= 3.6 + c++11 + libc++
 #if TD_CLANG && _LIBCPP_VERSION
 #define TD_OFFSETOF __builtin_offsetof
@@ -15,26 +25,562 @@
 
 namespace td {
 
+namespace {
+constexpr size_t BUFFER_RAW_HEADER_SIZE = TD_OFFSETOF(BufferRaw, data_);
+
+// Buffers with at most MAX_POOLED_DATA_SIZE bytes of data are allocated from size classes.
+// There are 4 size classes for data sizes between consecutive powers of two, so at most 25% of memory is wasted.
+// Free blocks are cached in per-thread magazines. A thread moves a half of its full magazine to the global depot,
+// and refills its empty magazine from the depot, so blocks released by other threads are returned through the depot.
+constexpr size_t MAX_POOLED_DATA_SIZE = 1 << 16;
+constexpr size_t MIN_POOLED_DATA_SIZE = 1 << 6;
+constexpr size_t BUFFER_SIZE_CLASSES_N = 41;
+constexpr size_t MAX_MAGAZINE_SIZE = 64;
+constexpr size_t MAGAZINE_MEMORY = 1 << 17;
+constexpr size_t DEPOT_SIZE_CLASS_MEMORY = 1 << 20;
+
+size_t get_size_class(size_t data_size) {
+  if (data_size <= MIN_POOLED_DATA_SIZE) {
+    return 0;
+  }
+  // 2^power < data_size <= 2^(power + 1)
+  auto power = static_cast<size_t>(63 - count_leading_zeroes_non_zero64(data_size - 1));
+  auto quarter = (data_size - 1) >> (power - 2);
+  return (power - 6) * 4 + quarter - 3;
+}
+
+size_t get_size_class_data_size(size_t size_class) {
+  if (size_class == 0) {
+    return MIN_POOLED_DATA_SIZE;
+  }
+  auto power = (size_class - 1) / 4 + 6;
+  auto quarter = (size_class - 1) % 4 + 5;
+  return quarter << (power - 2);
+}
+
+size_t get_size_class_block_size(size_t size_class) {
+  return BUFFER_RAW_HEADER_SIZE + get_size_class_data_size(size_class);
+}
+
+size_t get_magazine_capacity(size_t size_class) {
+  return clamp(MAGAZINE_MEMORY / get_size_class_block_size(size_class), static_cast<size_t>(2), MAX_MAGAZINE_SIZE);
+}
+
+size_t get_buffer_raw_size(size_t data_size, BufferBacking backing) {
+  switch (backing) {
+    case BufferBacking::Heap:
+      if (data_size <= MAX_POOLED_DATA_SIZE) {
+        return get_size_class_block_size(get_size_class(data_size));
+      }
+      return max(sizeof(BufferRaw), BUFFER_RAW_HEADER_SIZE + data_size);
+    case BufferBacking::Mmap:
+    case BufferBacking::TransparentHugePages: {
+      auto page_size = get_page_size();
+      return (BUFFER_RAW_HEADER_SIZE + data_size + page_size - 1) / page_size * page_size;
+    }
+    case BufferBacking::HugePages: {
+      auto huge_page_size = get_huge_page_size();
+      return (BUFFER_RAW_HEADER_SIZE + data_size + huge_page_size - 1) / huge_page_size * huge_page_size;
+    }
+    default:
+      UNREACHABLE();
+      return 0;
+  }
+}
+
+// the options are read on every allocation of a large buffer, so they are stored in atomics instead of under a lock
+// the fields are changed independently, which is fine, because any combination of them is valid
+class LargeBufferOptionsStorage {
+ public:
+  LargeBufferOptionsStorage() {
+    set(BufferAllocator::LargeBufferOptions());
+  }
+
+  void set(const BufferAllocator::LargeBufferOptions &options) {
+    mmap_threshold_.store(options.mmap_threshold, std::memory_order_relaxed);
+    use_transparent_huge_pages_.store(options.use_transparent_huge_pages, std::memory_order_relaxed);
+    use_huge_pages_.store(options.use_huge_pages, std::memory_order_relaxed);
+    populate_.store(options.populate, std::memory_order_relaxed);
+  }
+
+  BufferAllocator::LargeBufferOptions get() const {
+    BufferAllocator::LargeBufferOptions options;
+    options.mmap_threshold = mmap_threshold_.load(std::memory_order_relaxed);
+    options.use_transparent_huge_pages = use_transparent_huge_pages_.load(std::memory_order_relaxed);
+    options.use_huge_pages = use_huge_pages_.load(std::memory_order_relaxed);
+    options.populate = populate_.load(std::memory_order_relaxed);
+    return options;
+  }
+
+ private:
+  std::atomic<size_t> mmap_threshold_{0};
+  std::atomic<bool> use_transparent_huge_pages_{false};
+  std::atomic<bool> use_huge_pages_{false};
+  std::atomic<bool> populate_{false};
+};
+
+LargeBufferOptionsStorage large_buffer_options;
+
+// returns nullptr if the memory can't be mapped
+char *map_buffer_raw_memory(size_t data_size, const BufferAllocator::LargeBufferOptions &options,
+                            BufferBacking &backing) {
+  if (get_page_size() == 0) {
+    return nullptr;
+  }
+  if (options.use_huge_pages && get_huge_page_size() != 0) {
+    auto r_memory = map_anonymous_memory(get_buffer_raw_size(data_size, BufferBacking::HugePages), true,
+                                         options.populate);
+    if (r_memory.is_ok()) {
+      backing = BufferBacking::HugePages;
+      return r_memory.ok().data();
+    }
+    LOG(DEBUG) << "Failed to allocate a buffer in huge pages: " << r_memory.error();
+  }
+
+  auto size = get_buffer_raw_size(data_size, BufferBacking::Mmap);
+  // pages must be populated after they are marked as eligible for transparent huge pages
+  auto r_memory = map_anonymous_memory(size, false, options.populate && !options.use_transparent_huge_pages);
+  if (r_memory.is_error()) {
+    LOG(DEBUG) << "Failed to map a buffer: " << r_memory.error();
+    return nullptr;
+  }
+  auto memory = r_memory.move_as_ok();
+  backing = BufferBacking::Mmap;
+  if (options.use_transparent_huge_pages) {
+    if (advise_transparent_huge_pages(memory).is_ok()) {
+      backing = BufferBacking::TransparentHugePages;
+    }
+    if (options.populate) {
+      populate_memory(memory).ignore();
+    }
+  }
+  return memory.data();
+}
+
+class BufferMagazines;
+
+class BufferDepot {
+ public:
+  // moves at most n blocks to blocks; returns their number
+  size_t pop(size_t size_class, char **blocks, size_t n) {
+    auto &free_blocks = size_classes_[size_class];
+    std::lock_guard<std::mutex> guard(free_blocks.mutex);
+    n = min(n, free_blocks.blocks.size());
+    for (size_t i = 0; i < n; i++) {
+      blocks[i] = free_blocks.blocks.back();
+      free_blocks.blocks.pop_back();
+    }
+    cached_mem_.fetch_sub(static_cast<int64>(n * get_size_class_block_size(size_class)), std::memory_order_relaxed);
+    return n;
+  }
+
+  void push(size_t size_class, char **blocks, size_t n) {
+    auto block_size = get_size_class_block_size(size_class);
+    auto max_size = max(DEPOT_SIZE_CLASS_MEMORY / block_size, 2 * get_magazine_capacity(size_class));
+    auto &free_blocks = size_classes_[size_class];
+    size_t pushed_n;
+    {
+      std::lock_guard<std::mutex> guard(free_blocks.mutex);
+      pushed_n = min(n, max_size - min(max_size, free_blocks.blocks.size()));
+      free_blocks.blocks.insert(free_blocks.blocks.end(), blocks, blocks + pushed_n);
+    }
+    cached_mem_.fetch_add(static_cast<int64>(pushed_n * block_size), std::memory_order_relaxed);
+    for (size_t i = pushed_n; i < n; i++) {
+      delete[] blocks[i];
+    }
+  }
+
+  size_t trim() {
+    size_t result = 0;
+    for (size_t size_class = 0; size_class < BUFFER_SIZE_CLASSES_N; size_class++) {
+      vector<char *> blocks;
+      {
+        std::lock_guard<std::mutex> guard(size_classes_[size_class].mutex);
+        blocks = std::move(size_classes_[size_class].blocks);
+        size_classes_[size_class].blocks = {};
+      }
+      for (auto *block : blocks) {
+        delete[] block;
+      }
+      result += blocks.size() * get_size_class_block_size(size_class);
+    }
+    cached_mem_.fetch_sub(static_cast<int64>(result), std::memory_order_relaxed);
+    return result;
+  }
+
+  void register_magazines(BufferMagazines *magazines) {
+    std::lock_guard<std::mutex> guard(magazines_mutex_);
+    magazines_.push_back(magazines);
+  }
+
+  void unregister_magazines(BufferMagazines *magazines) {
+    std::lock_guard<std::mutex> guard(magazines_mutex_);
+    auto it = std::find(magazines_.begin(), magazines_.end(), magazines);
+    CHECK(it != magazines_.end());
+    *it = magazines_.back();
+    magazines_.pop_back();
+  }
+
+  int64 get_cached_mem();
+
+ private:
+  struct FreeBlocks {
+    std::mutex mutex;
+    vector<char *> blocks;
+  };
+  FreeBlocks size_classes_[BUFFER_SIZE_CLASSES_N];
+  std::atomic<int64> cached_mem_{0};
+
+  std::mutex magazines_mutex_;
+  vector<BufferMagazines *> magazines_;
+};
+
+BufferDepot &get_buffer_depot() {
+  // never destroyed, because buffers can be released during destruction of other static objects
+  static auto *depot = new BufferDepot();
+  return *depot;
+}
+
+class BufferMagazines {
+ public:
+  BufferMagazines() {
+    get_buffer_depot().register_magazines(this);
+  }
+  BufferMagazines(const BufferMagazines &) = delete;
+  BufferMagazines &operator=(const BufferMagazines &) = delete;
+  BufferMagazines(BufferMagazines &&) = delete;
+  BufferMagazines &operator=(BufferMagazines &&) = delete;
+  ~BufferMagazines() {
+    flush();
+    get_buffer_depot().unregister_magazines(this);
+  }
+
+  int64 get_cached_mem() const {
+    return cached_mem_.load(std::memory_order_relaxed);
+  }
+
+  // returns nullptr if there are no cached blocks
+  char *pop(size_t size_class) {
+    auto &magazine = magazines_[size_class];
+    if (magazine.size == 0) {
+      magazine.size = get_buffer_depot().pop(size_class, magazine.blocks, get_magazine_capacity(size_class) / 2);
+      if (magazine.size == 0) {
+        return nullptr;
+      }
+      add_cached_mem(magazine.size, size_class);
+    }
+    add_cached_mem(-1, size_class);
+    return magazine.blocks[--magazine.size];
+  }
+
+  void push(size_t size_class, char *block) {
+    auto &magazine = magazines_[size_class];
+    auto capacity = get_magazine_capacity(size_class);
+    if (magazine.size == capacity) {
+      // the oldest blocks are moved to the depot
+      auto half = capacity / 2;
+      get_buffer_depot().push(size_class, magazine.blocks, half);
+      std::move(magazine.blocks + half, magazine.blocks + capacity, magazine.blocks);
+      magazine.size -= half;
+      add_cached_mem(-static_cast<int64>(half), size_class);
+    }
+    magazine.blocks[magazine.size++] = block;
+    add_cached_mem(1, size_class);
+  }
+
+  void flush() {
+    for (size_t size_class = 0; size_class < BUFFER_SIZE_CLASSES_N; size_class++) {
+      auto &magazine = magazines_[size_class];
+      if (magazine.size != 0) {
+        get_buffer_depot().push(size_class, magazine.blocks, magazine.size);
+        add_cached_mem(-static_cast<int64>(magazine.size), size_class);
+        magazine.size = 0;
+      }
+    }
+  }
+
+ private:
+  struct Magazine {
+    size_t size{0};
+    char *blocks[MAX_MAGAZINE_SIZE];
+  };
+  Magazine magazines_[BUFFER_SIZE_CLASSES_N];
+
+  // changed only by the owning thread, so no atomic read-modify-write operations are needed
+  std::atomic<int64> cached_mem_{0};
+
+  void add_cached_mem(int64 blocks_n, size_t size_class) {
+    cached_mem_.store(cached_mem_.load(std::memory_order_relaxed) +
+                          blocks_n * static_cast<int64>(get_size_class_block_size(size_class)),
+                      std::memory_order_relaxed);
+  }
+};
+
+int64 BufferDepot::get_cached_mem() {
+  auto result = cached_mem_.load(std::memory_order_relaxed);
+  std::lock_guard<std::mutex> guard(magazines_mutex_);
+  for (auto *magazines : magazines_) {
+    result += magazines->get_cached_mem();
+  }
+  return result;
+}
+
+TD_THREAD_LOCAL bool is_buffer_raw_tls_destroyed;  // static zero-initialized
+
+constexpr size_t MAX_BUFFER_TAGS = BufferAllocator::MAX_TAGS;
+
+enum BufferTagCounter : size_t { LiveBytes, AllocatedBytes, AllocationCount, BufferTagCountersN };
+
+class BufferTagCounters;
+
+// Counters are kept per thread and are changed only by the owning thread, so updates are as cheap as
+// non-atomic increments. Counters of exited threads and of threads without a thread-local state are global.
+class BufferTagRegistry {
+ public:
+  BufferTagRegistry() {
+    names_.emplace_back("other");
+  }
+
+  int32 register_tag(Slice name) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    for (size_t i = 0; i < names_.size(); i++) {
+      if (names_[i] == name) {
+        return static_cast<int32>(i);
+      }
+    }
+    CHECK(names_.size() < MAX_BUFFER_TAGS);
+    names_.push_back(name.str());
+    return static_cast<int32>(names_.size() - 1);
+  }
+
+  void add(uint8 tag, BufferTagCounter counter, int64 diff) {
+    counters_[tag * BufferTagCountersN + counter].fetch_add(diff, std::memory_order_relaxed);
+  }
+
+  void register_counters(BufferTagCounters *counters) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    thread_counters_.push_back(counters);
+  }
+
+  void unregister_counters(BufferTagCounters *counters) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    auto it = std::find(thread_counters_.begin(), thread_counters_.end(), counters);
+    CHECK(it != thread_counters_.end());
+    *it = thread_counters_.back();
+    thread_counters_.pop_back();
+  }
+
+  vector<BufferAllocator::TagStats> get_stats() const;
+
+ private:
+  mutable std::mutex mutex_;
+  vector<string> names_;
+  vector<BufferTagCounters *> thread_counters_;
+  std::atomic<int64> counters_[MAX_BUFFER_TAGS * BufferTagCountersN]{};
+};
+
+BufferTagRegistry &get_buffer_tag_registry() {
+  // never destroyed, because buffers can be released during destruction of other static objects
+  static auto *registry = new BufferTagRegistry();
+  return *registry;
+}
+
+class BufferTagCounters {
+ public:
+  BufferTagCounters() {
+    get_buffer_tag_registry().register_counters(this);
+  }
+  BufferTagCounters(const BufferTagCounters &) = delete;
+  BufferTagCounters &operator=(const BufferTagCounters &) = delete;
+  BufferTagCounters(BufferTagCounters &&) = delete;
+  BufferTagCounters &operator=(BufferTagCounters &&) = delete;
+  ~BufferTagCounters() {
+    auto &registry = get_buffer_tag_registry();
+    registry.unregister_counters(this);
+    for (size_t i = 0; i < MAX_BUFFER_TAGS * BufferTagCountersN; i++) {
+      auto value = counters_[i].load(std::memory_order_relaxed);
+      if (value != 0) {
+        registry.add(static_cast<uint8>(i / BufferTagCountersN), static_cast<BufferTagCounter>(i % BufferTagCountersN),
+                     value);
+      }
+    }
+  }
+
+  void add(uint8 tag, BufferTagCounter counter, int64 diff) {
+    auto &value = counters_[tag * BufferTagCountersN + counter];
+    value.store(value.load(std::memory_order_relaxed) + diff, std::memory_order_relaxed);
+  }
+
+  int64 get(size_t tag, BufferTagCounter counter) const {
+    return counters_[tag * BufferTagCountersN + counter].load(std::memory_order_relaxed);
+  }
+
+ private:
+  std::atomic<int64> counters_[MAX_BUFFER_TAGS * BufferTagCountersN]{};
+};
+
+vector<BufferAllocator::TagStats> BufferTagRegistry::get_stats() const {
+  std::lock_guard<std::mutex> guard(mutex_);
+  vector<BufferAllocator::TagStats> result(names_.size());
+  for (size_t i = 0; i < names_.size(); i++) {
+    auto get = [&](BufferTagCounter counter) {
+      auto value = counters_[i * BufferTagCountersN + counter].load(std::memory_order_relaxed);
+      for (auto *thread_counters : thread_counters_) {
+        value += thread_counters->get(i, counter);
+      }
+      return value;
+    };
+    auto &stats = result[i];
+    stats.tag = static_cast<int32>(i);
+    stats.name = names_[i];
+    stats.live_bytes = get(LiveBytes);
+    stats.allocated_bytes = get(AllocatedBytes);
+    stats.allocation_count = get(AllocationCount);
+  }
+  return result;
+}
+}  // namespace
+
+// memory of destroyed ChainBufferNode objects
+class ChainBufferNodeCache {
+ public:
+  ChainBufferNodeCache() = default;
+  ChainBufferNodeCache(const ChainBufferNodeCache &) = delete;
+  ChainBufferNodeCache &operator=(const ChainBufferNodeCache &) = delete;
+  ChainBufferNodeCache(ChainBufferNodeCache &&) = delete;
+  ChainBufferNodeCache &operator=(ChainBufferNodeCache &&) = delete;
+  ~ChainBufferNodeCache() {
+    while (size_ > 0) {
+      ::operator delete(nodes_[--size_]);
+    }
+  }
+
+  // returns nullptr if the cache is empty
+  void *pop() {
+    if (size_ == 0) {
+      return nullptr;
+    }
+    return nodes_[--size_];
+  }
+
+  // returns false if the cache is full
+  bool push(void *node) {
+    if (size_ == MAX_SIZE) {
+      return false;
+    }
+    nodes_[size_++] = node;
+    return true;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+ private:
+  static constexpr size_t MAX_SIZE = 512;
+  size_t size_{0};
+  void *nodes_[MAX_SIZE];
+};
+
+namespace {
+TD_THREAD_LOCAL bool is_magazines_flush_guard_destroyed;  // static zero-initialized
+
+// thread locals of threads, which weren't created by td::thread, for example, of the main thread, are never destroyed,
+// so blocks cached in their magazines are flushed to the depot at exit of the thread
+class MagazinesFlushGuard {
+ public:
+  MagazinesFlushGuard() = default;
+  MagazinesFlushGuard(const MagazinesFlushGuard &) = delete;
+  MagazinesFlushGuard &operator=(const MagazinesFlushGuard &) = delete;
+  MagazinesFlushGuard(MagazinesFlushGuard &&) = delete;
+  MagazinesFlushGuard &operator=(MagazinesFlushGuard &&) = delete;
+  ~MagazinesFlushGuard() {
+    is_magazines_flush_guard_destroyed = true;
+    BufferAllocator::clear_thread_local();
+  }
+
+  void init() {
+  }
+};
+
+thread_local MagazinesFlushGuard magazines_flush_guard;
+}  // namespace
+
+struct BufferAllocator::BufferRawTls {
+  // destroyed last, after all buffers of the thread are released
+  BufferTagCounters tag_counters;
+  BufferMagazines magazines;
+  ChainBufferNodeCache chain_buffer_nodes;
+  std::unique_ptr<BufferRaw, BufferRawDeleter> buffer_raw;
+
+  BufferRawTls() {
+    is_buffer_raw_tls_destroyed = false;
+    if (!is_magazines_flush_guard_destroyed) {
+      // constructs the guard in the current thread
+      magazines_flush_guard.init();
+    }
+  }
+  BufferRawTls(const BufferRawTls &) = delete;
+  BufferRawTls &operator=(const BufferRawTls &) = delete;
+  BufferRawTls(BufferRawTls &&) = delete;
+  BufferRawTls &operator=(BufferRawTls &&) = delete;
+  ~BufferRawTls() {
+    // the buffer is returned to the magazines, which are then flushed to the depot
+    buffer_raw.reset();
+    is_buffer_raw_tls_destroyed = true;
+  }
+};
+
 TD_THREAD_LOCAL BufferAllocator::BufferRawTls *BufferAllocator::buffer_raw_tls;  // static zero-initialized
 
+TD_THREAD_LOCAL uint8 BufferAllocator::current_tag_;  // static zero-initialized
+
+constexpr int32 BufferAllocator::MAX_TAGS;
+
 std::atomic<size_t> BufferAllocator::buffer_mem;
 
-static ThreadSafeCounter buffer_slice_size_;
+size_t BufferAllocator::get_buffer_mem() {
+  return buffer_mem;
+}
+
+int32 BufferAllocator::register_tag(Slice name) {
+  return get_buffer_tag_registry().register_tag(name);
+}
+
+vector<BufferAllocator::TagStats> BufferAllocator::get_tag_stats() {
+  return get_buffer_tag_registry().get_stats();
+}
 
-int64 BufferAllocator::get_buffer_slice_size() {
-  return buffer_slice_size_.sum();
+int64 BufferAllocator::get_cached_buffer_mem() {
+  return get_buffer_depot().get_cached_mem();
 }
 
-void BufferAllocator::track_buffer_slice(int64 size) {
-  if (size == 0) {
+void BufferAllocator::clear_thread_local() {
+  if (buffer_raw_tls == nullptr) {
     return;
   }
+  buffer_raw_tls->buffer_raw.reset();
+  buffer_raw_tls->magazines.flush();
+}
 
-  buffer_slice_size_.add(size);
+void BufferAllocator::set_large_buffer_options(const LargeBufferOptions &options) {
+  large_buffer_options.set(options);
 }
 
-size_t BufferAllocator::get_buffer_mem() {
-  return buffer_mem;
+BufferAllocator::LargeBufferOptions BufferAllocator::get_large_buffer_options() {
+  return large_buffer_options.get();
+}
+
+size_t BufferAllocator::trim_cached_memory() {
+  if (buffer_raw_tls != nullptr) {
+    buffer_raw_tls->magazines.flush();
+  }
+  auto result = get_buffer_depot().trim();
+#if TD_LINUX && defined(__GLIBC__)
+  // glibc keeps freed memory in its arenas otherwise
+  malloc_trim(0);
+#endif
+  return result;
 }
 
 BufferAllocator::WriterPtr BufferAllocator::create_writer(size_t size) {
@@ -45,7 +591,10 @@ BufferAllocator::WriterPtr BufferAllocator::create_writer(size_t size) {
 }
 
 BufferAllocator::WriterPtr BufferAllocator::create_writer_exact(size_t size) {
-  return WriterPtr(create_buffer_raw(size));
+  auto *buffer_raw = create_buffer_raw(size);
+  add_tag_counter(current_tag_, AllocatedBytes, static_cast<int64>(size));
+  add_tag_counter(current_tag_, AllocationCount, 1);
+  return WriterPtr(buffer_raw);
 }
 
 BufferAllocator::WriterPtr BufferAllocator::create_writer(size_t size, size_t prepend, size_t append) {
@@ -68,6 +617,8 @@ BufferAllocator::ReaderPtr BufferAllocator::create_reader_fast(size_t size) {
   size = (size + 7) & -8;
 
   init_thread_local<BufferRawTls>(buffer_raw_tls);
+  add_tag_counter(current_tag_, AllocatedBytes, static_cast<int64>(size));
+  add_tag_counter(current_tag_, AllocationCount, 1);
 
   auto buffer_raw = buffer_raw_tls->buffer_raw.get();
   if (buffer_raw == nullptr || buffer_raw->data_size_ - buffer_raw->end_.load(std::memory_order_relaxed) < size) {
@@ -90,26 +641,102 @@ BufferAllocator::ReaderPtr BufferAllocator::create_reader(const ReaderPtr &raw)
   return ReaderPtr(raw.get());
 }
 
+void BufferAllocator::add_tag_counter(uint8 tag, size_t counter, int64 diff) {
+  if (buffer_raw_tls != nullptr) {
+    buffer_raw_tls->tag_counters.add(tag, static_cast<BufferTagCounter>(counter), diff);
+  } else {
+    // the thread is exiting
+    get_buffer_tag_registry().add(tag, static_cast<BufferTagCounter>(counter), diff);
+  }
+}
+
 void BufferAllocator::dec_ref_cnt(BufferRaw *ptr) {
   int left = ptr->ref_cnt_.fetch_sub(1, std::memory_order_acq_rel);
   if (left == 1) {
-    auto buf_size = max(sizeof(BufferRaw), TD_OFFSETOF(BufferRaw, data_) + ptr->data_size_);
+    auto data_size = ptr->data_size_;
+    auto backing = ptr->backing_;
+    auto buf_size = get_buffer_raw_size(data_size, backing);
     buffer_mem -= buf_size;
+    if (buffer_raw_tls == nullptr && !is_buffer_raw_tls_destroyed) {
+      init_thread_local<BufferRawTls>(buffer_raw_tls);
+    }
+    add_tag_counter(ptr->tag_, LiveBytes, -static_cast<int64>(buf_size));
     ptr->~BufferRaw();
-    delete[] ptr;
+
+    auto *memory = reinterpret_cast<char *>(ptr);
+    if (backing != BufferBacking::Heap) {
+      unmap_memory(MutableSlice(memory, buf_size));
+      return;
+    }
+    if (data_size > MAX_POOLED_DATA_SIZE) {
+      delete[] memory;
+      return;
+    }
+    auto size_class = get_size_class(data_size);
+    if (buffer_raw_tls == nullptr) {
+      // the thread is exiting
+      get_buffer_depot().push(size_class, &memory, 1);
+      return;
+    }
+    buffer_raw_tls->magazines.push(size_class, memory);
   }
 }
 
 BufferRaw *BufferAllocator::create_buffer_raw(size_t size) {
   size = (size + 7) & -8;
 
-  auto buf_size = TD_OFFSETOF(BufferRaw, data_) + size;
-  if (buf_size < sizeof(BufferRaw)) {
-    buf_size = sizeof(BufferRaw);
+  if (buffer_raw_tls == nullptr && !is_buffer_raw_tls_destroyed) {
+    init_thread_local<BufferRawTls>(buffer_raw_tls);
+  }
+  char *memory = nullptr;
+  auto backing = BufferBacking::Heap;
+  if (size <= MAX_POOLED_DATA_SIZE) {
+    if (buffer_raw_tls != nullptr) {
+      memory = buffer_raw_tls->magazines.pop(get_size_class(size));
+    }
+  } else {
+    auto options = get_large_buffer_options();
+    if (options.mmap_threshold != 0 && size >= options.mmap_threshold) {
+      memory = map_buffer_raw_memory(size, options, backing);
+    }
+  }
+  auto buf_size = get_buffer_raw_size(size, backing);
+  if (memory == nullptr) {
+    memory = new char[buf_size];
   }
   buffer_mem += buf_size;
-  auto *buffer_raw = reinterpret_cast<BufferRaw *>(new char[buf_size]);
-  return new (buffer_raw) BufferRaw(size);
+  add_tag_counter(current_tag_, LiveBytes, static_cast<int64>(buf_size));
+
+  auto *result = new (memory) BufferRaw(size, backing);
+  result->tag_ = current_tag_;
+  return result;
+}
+
+void *ChainBufferNodeAllocator::allocate() {
+  auto *&buffer_raw_tls = BufferAllocator::buffer_raw_tls;
+  if (buffer_raw_tls == nullptr && !is_buffer_raw_tls_destroyed) {
+    init_thread_local<BufferAllocator::BufferRawTls>(buffer_raw_tls);
+  }
+  if (buffer_raw_tls != nullptr) {
+    auto *node = buffer_raw_tls->chain_buffer_nodes.pop();
+    if (node != nullptr) {
+      return node;
+    }
+  }
+  return ::operator new(sizeof(ChainBufferNode));
+}
+
+void ChainBufferNodeAllocator::destroy(ChainBufferNode *ptr) {
+  ptr->~ChainBufferNode();
+  auto *buffer_raw_tls = BufferAllocator::buffer_raw_tls;
+  if (buffer_raw_tls == nullptr || !buffer_raw_tls->chain_buffer_nodes.push(ptr)) {
+    ::operator delete(ptr);
+  }
+}
+
+size_t ChainBufferNodeAllocator::get_cached_node_count() {
+  auto *buffer_raw_tls = BufferAllocator::buffer_raw_tls;
+  return buffer_raw_tls == nullptr ? 0 : buffer_raw_tls->chain_buffer_nodes.size();
 }
 
 void BufferBuilder::append(BufferSlice slice) {
@@ -152,6 +779,58 @@ BufferSlice BufferBuilder::extract() {
   return writer.as_buffer_slice();
 }
 
+size_t ChainBufferWriter::prepare_append_io_slices(MutableSpan<IoSlice> slices, size_t size) {
+  CHECK(!empty());
+  size_t slice_count = 0;
+  size_t prepared_size = 0;
+  auto ready = prepare_append_inplace();
+  if (!ready.empty() && !slices.empty()) {
+    slices[slice_count++] = as_io_slice(ready);
+    prepared_size += ready.size();
+  }
+  for (size_t i = 0; prepared_size < size && slice_count < slices.size(); i++) {
+    if (i == next_writers_.size()) {
+      // the size is split between the remaining slices, so a short read doesn't keep a single huge buffer
+      auto left_slice_count = slices.size() - slice_count;
+      next_writers_.emplace_back(max((size - prepared_size) / left_slice_count, static_cast<size_t>(1 << 12)));
+    }
+    ready = next_writers_[i].prepare_append();
+    slices[slice_count++] = as_io_slice(ready);
+    prepared_size += ready.size();
+  }
+  return slice_count;
+}
+
+void ChainBufferWriter::confirm_append_io_slices(size_t size) {
+  CHECK(!empty());
+  auto inplace_size = min(size, prepare_append_inplace().size());
+  confirm_append(inplace_size);
+  size -= inplace_size;
+
+  size_t used_writer_count = 0;
+  while (size > 0) {
+    CHECK(used_writer_count < next_writers_.size());
+    auto &next_writer = next_writers_[used_writer_count++];
+    auto next_size = min(size, next_writer.prepare_append().size());
+    next_writer.confirm_append(next_size);
+    append_writer(std::move(next_writer));
+    size -= next_size;
+  }
+  // unused buffers are released immediately, so an idle reader doesn't keep them allocated
+  next_writers_.clear();
+}
+
+vector<IoSlice> BufferBuilder::as_io_slices() const {
+  vector<IoSlice> result;
+  result.reserve(to_prepend_.size() + 1 + to_append_.size());
+  for_each([&](Slice slice) {
+    if (!slice.empty()) {
+      result.push_back(as_io_slice(slice));
+    }
+  });
+  return result;
+}
+
 size_t BufferBuilder::size() const {
   size_t total_size = 0;
   for_each([&](auto &&slice) { total_size += slice.size(); });
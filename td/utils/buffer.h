@@ -1,8 +1,10 @@
 #pragma once
 
 #include "td/utils/common.h"
+#include "td/utils/port/IoSlice.h"
 #include "td/utils/port/thread_local.h"
 #include "td/utils/Slice.h"
+#include "td/utils/Span.h"
 
 #include <atomic>
 #include <limits>
@@ -10,8 +12,11 @@
 
 namespace td {
 
+// memory, in which a buffer is allocated
+enum class BufferBacking : int8 { Heap, Mmap, TransparentHugePages, HugePages };
+
 struct BufferRaw {
-  explicit BufferRaw(size_t size) : data_size_(size) {
+  explicit BufferRaw(size_t size, BufferBacking backing = BufferBacking::Heap) : data_size_(size), backing_(backing) {
   }
   size_t data_size_;
 
@@ -27,6 +32,9 @@ struct BufferRaw {
   mutable std::atomic<int32> ref_cnt_{1};
   std::atomic<bool> has_writer_{true};
   bool was_reader_{false};
+  BufferBacking backing_;
+  // owner of the buffer for memory accounting
+  uint8 tag_{0};
 
   alignas(4) unsigned char data_[1];
 };
@@ -61,14 +69,77 @@ class BufferAllocator {
   static ReaderPtr create_reader(const ReaderPtr &raw);
 
   static size_t get_buffer_mem();
-  static int64 get_buffer_slice_size();
 
+  // Buffer memory is accounted per tag. Tag 0 is used by default; at most MAX_TAGS tags can be registered.
+  // A buffer is attributed to the tag of the thread that created it. Small readers share 16 KB buffers,
+  // so their memory belongs to the tag that was active when the shared buffer was created.
+  // returns identifier of the tag with the given name
+  static int32 register_tag(Slice name);
+
+  static constexpr int32 MAX_TAGS = 64;
+
+  // allocations made by the current thread while the guard is alive are attributed to the tag
+  class TagGuard {
+   public:
+    explicit TagGuard(int32 tag) : old_tag_(current_tag_) {
+      CHECK(0 <= tag && tag < MAX_TAGS);
+      current_tag_ = static_cast<uint8>(tag);
+    }
+    TagGuard(const TagGuard &) = delete;
+    TagGuard &operator=(const TagGuard &) = delete;
+    TagGuard(TagGuard &&) = delete;
+    TagGuard &operator=(TagGuard &&) = delete;
+    ~TagGuard() {
+      current_tag_ = old_tag_;
+    }
+
+   private:
+    uint8 old_tag_;
+  };
+
+  static int32 get_current_tag() {
+    return current_tag_;
+  }
+
+  struct TagStats {
+    int32 tag = 0;
+    string name;
+    // size of memory of alive buffers
+    int64 live_bytes = 0;
+    // total size and number of allocation requests; allocation rate is the difference between two snapshots
+    int64 allocated_bytes = 0;
+    int64 allocation_count = 0;
+  };
+  static vector<TagStats> get_tag_stats();
+
+  // returns size of memory of free buffers, cached for reuse
+  static int64 get_cached_buffer_mem();
+
+  // releases the buffer used by the current thread for small readers and moves buffers cached by the thread
+  // to the global cache
   static void clear_thread_local();
 
+  // returns memory from the global cache and the cache of the current thread to the system; returns its size
+  static size_t trim_cached_memory();
+
+  // buffers with at least mmap_threshold bytes are allocated directly with mmap instead of the heap
+  struct LargeBufferOptions {
+    // 0 disables mmap allocation; buffers smaller than 64 KB are always allocated from the heap
+    // disabled by default, because the heap reuses already faulted-in memory for repeatedly allocated buffers
+    size_t mmap_threshold = 0;
+    // ask the system to back the buffers with transparent huge pages
+    bool use_transparent_huge_pages = true;
+    // allocate the buffers from explicitly reserved huge pages; falls back to ordinary pages if there are none
+    bool use_huge_pages = false;
+    // allocate physical pages on buffer creation instead of the first access
+    bool populate = false;
+  };
+  static void set_large_buffer_options(const LargeBufferOptions &options);
+  static LargeBufferOptions get_large_buffer_options();
+
  private:
   friend class BufferSlice;
-
-  static void track_buffer_slice(int64 size);
+  friend class ChainBufferNodeAllocator;
 
   static ReaderPtr create_reader_fast(size_t size);
 
@@ -79,14 +150,16 @@ class BufferAllocator {
       dec_ref_cnt(ptr);
     }
   };
-  struct BufferRawTls {
-    std::unique_ptr<BufferRaw, BufferRawDeleter> buffer_raw;
-  };
+  struct BufferRawTls;
 
   static TD_THREAD_LOCAL BufferRawTls *buffer_raw_tls;
 
+  static TD_THREAD_LOCAL uint8 current_tag_;
+
   static void dec_ref_cnt(BufferRaw *ptr);
 
+  static void add_tag_counter(uint8 tag, size_t counter, int64 diff);
+
   static BufferRaw *create_buffer_raw(size_t size);
 
   static std::atomic<size_t> buffer_mem;
@@ -108,18 +181,15 @@ class BufferSlice {
   }
   BufferSlice(BufferReaderPtr buffer_ptr, size_t begin, size_t end)
       : buffer_(std::move(buffer_ptr)), begin_(begin), end_(end) {
-    debug_track();
   }
   BufferSlice(const BufferSlice &other) = delete;
   BufferSlice &operator=(const BufferSlice &other) = delete;
   BufferSlice(BufferSlice &&other) : BufferSlice(std::move(other.buffer_), other.begin_, other.end_) {
-    debug_untrack();  // yes, debug_untrack
   }
   BufferSlice &operator=(BufferSlice &&other) {
     if (this == &other) {
       return *this;
     }
-    debug_untrack();
     buffer_ = std::move(other.buffer_);
     begin_ = other.begin_;
     end_ = other.end_;
@@ -130,7 +200,6 @@ class BufferSlice {
     end_ = buffer_->end_.load(std::memory_order_relaxed);
     begin_ = end_ - ((size + 7) & -8);
     end_ = begin_ + size;
-    debug_track();
   }
 
   explicit BufferSlice(Slice slice) : BufferSlice(slice.size()) {
@@ -140,17 +209,6 @@ class BufferSlice {
   BufferSlice(const char *ptr, size_t size) : BufferSlice(Slice(ptr, size)) {
   }
 
-  ~BufferSlice() {
-    debug_untrack();
-  }
-
-  void debug_track() const {
-    BufferAllocator::track_buffer_slice(static_cast<int64>(size()));
-  }
-  void debug_untrack() const {
-    BufferAllocator::track_buffer_slice(-static_cast<int64>(size()));
-  }
-
   BufferSlice clone() const {
     if (is_null()) {
       return BufferSlice(BufferReaderPtr(), begin_, end_);
@@ -194,27 +252,21 @@ class BufferSlice {
   }
 
   bool confirm_read(size_t size) {
-    debug_untrack();
     begin_ += size;
     CHECK(begin_ <= end_);
-    debug_track();
     return begin_ == end_;
   }
 
   void truncate(size_t limit) {
     if (size() > limit) {
-      debug_untrack();
       end_ = begin_ + limit;
-      debug_track();
     }
   }
 
   BufferSlice from_slice(Slice slice) const {
     auto res = BufferSlice(BufferAllocator::create_reader(buffer_));
-    res.debug_untrack();
     res.begin_ = static_cast<size_t>(slice.ubegin() - buffer_->data_);
     res.end_ = static_cast<size_t>(slice.uend() - buffer_->data_);
-    res.debug_track();
     CHECK(buffer_->begin_ <= res.begin_);
     CHECK(res.begin_ <= res.end_);
     CHECK(res.end_ <= buffer_->end_.load(std::memory_order_relaxed));
@@ -240,6 +292,13 @@ class BufferSlice {
     return !buffer_;
   }
 
+  BufferBacking get_backing() const {
+    if (is_null()) {
+      return BufferBacking::Heap;
+    }
+    return buffer_->backing_;
+  }
+
   size_t size() const {
     if (is_null()) {
       return 0;
@@ -252,13 +311,19 @@ class BufferSlice {
     return size();
   }
 
+  // returns the slice extended to writer's end_ without changing it
+  Slice as_synced_slice() const {
+    if (is_null()) {
+      return Slice();
+    }
+    return Slice(buffer_->data_ + begin_, buffer_->data_ + buffer_->end_.load(std::memory_order_acquire));
+  }
+
   // set end_ into writer's end_
   size_t sync_with_writer() {
-    debug_untrack();
     CHECK(!is_null());
     auto old_end = end_;
     end_ = buffer_->end_.load(std::memory_order_acquire);
-    debug_track();
     return end_ - old_end;
   }
   bool is_writer_alive() const {
@@ -266,7 +331,6 @@ class BufferSlice {
     return buffer_->has_writer_.load(std::memory_order_acquire);
   }
   void clear() {
-    debug_untrack();
     begin_ = 0;
     end_ = 0;
     buffer_ = nullptr;
@@ -421,23 +485,19 @@ struct ChainBufferNode {
       ptr = std::move(ptr->next_);
     }
   }
-  static void dec_ref_cnt(ChainBufferNode *ptr) {
-    int left = --ptr->ref_cnt_;
-    if (left == 0) {
-      clear_nonrecursive(std::move(ptr->next_));
-      // TODO(refact): move memory management into allocator (?)
-      delete ptr;
-    }
-  }
+  static void dec_ref_cnt(ChainBufferNode *ptr);
 };
 
 using ChainBufferNodeWriterPtr = ChainBufferNode::WriterPtr;
 using ChainBufferNodeReaderPtr = ChainBufferNode::ReaderPtr;
 
+// Memory of destroyed nodes is cached per thread and reused for new nodes.
+// Nodes are usually destroyed by the reader after it has consumed them, so long-lived connections,
+// which are read and written by the same thread, reuse the same nodes.
 class ChainBufferNodeAllocator {
  public:
   static ChainBufferNodeWriterPtr create(BufferSlice slice, bool sync_flag) {
-    auto *ptr = new ChainBufferNode(std::move(slice), sync_flag);
+    auto *ptr = new (allocate()) ChainBufferNode(std::move(slice), sync_flag);
     return ChainBufferNode::make_writer_ptr(ptr);
   }
   static ChainBufferNodeReaderPtr clone(const ChainBufferNodeReaderPtr &ptr) {
@@ -452,8 +512,25 @@ class ChainBufferNodeAllocator {
     }
     return ChainBufferNode::make_reader_ptr(ptr.get());
   }
+
+  // returns number of nodes cached by the current thread
+  static size_t get_cached_node_count();
+
+ private:
+  friend struct ChainBufferNode;
+
+  static void *allocate();
+  static void destroy(ChainBufferNode *ptr);
 };
 
+inline void ChainBufferNode::dec_ref_cnt(ChainBufferNode *ptr) {
+  int left = --ptr->ref_cnt_;
+  if (left == 0) {
+    clear_nonrecursive(std::move(ptr->next_));
+    ChainBufferNodeAllocator::destroy(ptr);
+  }
+}
+
 class ChainBufferIterator {
  public:
   ChainBufferIterator() = default;
@@ -553,6 +630,34 @@ class ChainBufferIterator {
     return skipped;
   }
 
+  // fills slices with no more than max_size next bytes without changing the iterator
+  // returns number of filled slices
+  size_t fill_io_slices(MutableSpan<IoSlice> slices, size_t max_size) const {
+    const ChainBufferNode *node = head_.get();
+    if (node == nullptr) {
+      return 0;
+    }
+    Slice ready = need_sync_ ? reader_.as_synced_slice() : reader_.as_slice();
+    size_t slice_count = 0;
+    while (slice_count < slices.size() && max_size > 0) {
+      if (!ready.empty()) {
+        ready.truncate(max_size);
+        slices[slice_count++] = as_io_slice(ready);
+        max_size -= ready.size();
+        if (slice_count == slices.size() || max_size == 0) {
+          break;
+        }
+      }
+      // all max_size bytes are already written, so the node can't have a writer
+      node = node->next_.get();
+      if (node == nullptr) {
+        break;
+      }
+      ready = node->sync_flag_ ? node->slice_.as_synced_slice() : node->slice_.as_slice();
+    }
+    return slice_count;
+  }
+
  private:
   ChainBufferNodeReaderPtr head_;
   BufferSlice reader_;      // copy of head_->slice_
@@ -612,6 +717,12 @@ class ChainBufferReader {
   size_t size() const {
     return end_.offset() - begin_.offset();
   }
+
+  // fills slices with the data of the reader without copying it
+  // returns number of filled slices, which is less than slices.size() only if all the data fit
+  size_t fill_io_slices(MutableSpan<IoSlice> slices) const {
+    return begin_.fill_io_slices(slices, size());
+  }
   bool empty() const {
     return size() == 0;
   }
@@ -709,11 +820,7 @@ class ChainBufferWriter {
     if (hint < (1 << 10)) {
       hint = 1 << 12;
     }
-    BufferWriter new_writer(hint);
-    auto new_tail = ChainBufferNodeAllocator::create(new_writer.as_buffer_slice(), true);
-    tail_->next_ = ChainBufferNodeAllocator::clone(new_tail);
-    writer_ = std::move(new_writer);
-    tail_ = std::move(new_tail);  // release tail_
+    append_writer(BufferWriter(hint));
     return writer_.prepare_append();
   }
   void confirm_append(size_t size) {
@@ -721,6 +828,13 @@ class ChainBufferWriter {
     writer_.confirm_append(size);
   }
 
+  // prepares space for append of at least size bytes in no more than slices.size() buffers
+  // returns number of filled slices; confirm_append_io_slices must be called after the data is written to them
+  size_t prepare_append_io_slices(MutableSpan<IoSlice> slices, size_t size);
+  // confirms append of size bytes, written to the slices returned by the last prepare_append_io_slices;
+  // the prepared buffers, which weren't written to, are released
+  void confirm_append_io_slices(size_t size);
+
   void append(Slice slice, size_t hint = 0) {
     while (!slice.empty()) {
       auto ready = prepare_append(td::max(slice.size(), hint));
@@ -766,9 +880,18 @@ class ChainBufferWriter {
     return !tail_;
   }
 
+  void append_writer(BufferWriter &&new_writer) {
+    auto new_tail = ChainBufferNodeAllocator::create(new_writer.as_buffer_slice(), true);
+    tail_->next_ = ChainBufferNodeAllocator::clone(new_tail);
+    writer_ = std::move(new_writer);
+    tail_ = std::move(new_tail);  // release tail_
+  }
+
   ChainBufferNodeReaderPtr head_;
   ChainBufferNodeWriterPtr tail_;
   BufferWriter writer_;
+  // buffers, prepared by prepare_append_io_slices, which will be appended after writer_
+  vector<BufferWriter> next_writers_;
 };
 
 class BufferBuilder {
@@ -812,6 +935,9 @@ class BufferBuilder {
   }
   size_t size() const;
 
+  // returns slices of the whole content without copying it; the slices are valid until the builder is changed
+  vector<IoSlice> as_io_slices() const;
+
   BufferSlice extract();
 
  private:
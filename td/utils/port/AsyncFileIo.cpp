@@ -0,0 +1,302 @@
+#include "td/utils/port/AsyncFileIo.h"
+
+char disable_linker_warning_about_empty_file_async_file_io_cpp TD_UNUSED;
+
+#if !TD_THREAD_UNSUPPORTED && !TD_EVENTFD_UNSUPPORTED
+
+#include "td/utils/logging.h"
+#include "td/utils/port/detail/IoUring.h"
+#include "td/utils/VectorQueue.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <utility>
+
+namespace td {
+namespace detail {
+
+class AsyncFileIoImpl {
+ public:
+  AsyncFileIoImpl() = default;
+  AsyncFileIoImpl(const AsyncFileIoImpl &) = delete;
+  AsyncFileIoImpl &operator=(const AsyncFileIoImpl &) = delete;
+  AsyncFileIoImpl(AsyncFileIoImpl &&) = delete;
+  AsyncFileIoImpl &operator=(AsyncFileIoImpl &&) = delete;
+  ~AsyncFileIoImpl() {
+    close();
+  }
+
+  void init(size_t thread_count, bool is_thread_pool_forced) {
+    event_fd_.init();
+#ifdef TD_HAS_IO_URING
+    if (!is_thread_pool_forced) {
+      auto status = ring_.init(1024, static_cast<uint32>(MAX_RING_REQUEST_COUNT));
+      if (status.is_ok()) {
+        status = ring_.register_event_fd(event_fd_.get_poll_info().native_fd().fd());
+      }
+      if (status.is_ok()) {
+        return;
+      }
+      ring_.close();
+      LOG(WARNING) << "Can't use io_uring, falling back to threads: " << status;
+    }
+#endif
+    CHECK(thread_count > 0);
+    for (size_t i = 0; i < thread_count; i++) {
+      threads_.emplace_back([this] { run_worker(); });
+    }
+  }
+
+  void close() {
+#ifdef TD_HAS_IO_URING
+    if (!ring_.empty()) {
+      while (pending_count_ > 0) {
+        submit_delayed_requests();
+        auto status = ring_.submit_and_wait(1, -1);
+        LOG_IF(FATAL, status.is_error()) << status;
+        auto completed_count = ring_.for_each_cqe([](const io_uring_cqe &) {});
+        ring_request_count_ -= completed_count;
+        pending_count_ -= completed_count;
+      }
+      new_requests_.clear();
+      ring_.close();
+    }
+#endif
+    if (!threads_.empty()) {
+      flush();
+      {
+        std::lock_guard<std::mutex> guard(mutex_);
+        is_closing_ = true;
+      }
+      condition_.notify_all();
+      for (auto &thread : threads_) {
+        thread.join();
+      }
+      threads_.clear();
+    }
+    pending_count_ = 0;
+    if (!event_fd_.empty()) {
+      event_fd_.close();
+    }
+  }
+
+  void add_request(FileFd &fd, char *data, size_t size, int64 offset, bool is_write, uint64 token) {
+    pending_count_++;
+#ifdef TD_HAS_IO_URING
+    if (!ring_.empty() && new_requests_.empty() && ring_request_count_ < MAX_RING_REQUEST_COUNT) {
+      add_ring_request(Request{&fd, data, size, offset, is_write, token});
+      return;
+    }
+#endif
+    new_requests_.push_back(Request{&fd, data, size, offset, is_write, token});
+  }
+
+  void flush() {
+#ifdef TD_HAS_IO_URING
+    if (!ring_.empty()) {
+      auto status = ring_.submit_and_wait(0, 0);
+      LOG_IF(FATAL, status.is_error()) << status;
+      return;
+    }
+#endif
+    if (new_requests_.empty()) {
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      for (auto &request : new_requests_) {
+        requests_.push(request);
+      }
+    }
+    if (new_requests_.size() == 1) {
+      condition_.notify_one();
+    } else {
+      condition_.notify_all();
+    }
+    new_requests_.clear();
+  }
+
+  size_t reap(vector<AsyncFileIo::Completion> &completions) {
+    event_fd_.acquire();
+    size_t result = 0;
+#ifdef TD_HAS_IO_URING
+    if (!ring_.empty()) {
+      result = ring_.for_each_cqe([&](const io_uring_cqe &cqe) {
+        if (cqe.res >= 0) {
+          completions.push_back({cqe.user_data, static_cast<size_t>(cqe.res)});
+        } else {
+          completions.push_back({cqe.user_data, Status::PosixError(-cqe.res, "Asynchronous file I/O has failed")});
+        }
+      });
+      ring_request_count_ -= result;
+      pending_count_ -= result;
+      if (!new_requests_.empty()) {
+        submit_delayed_requests();
+        auto status = ring_.submit_and_wait(0, 0);
+        LOG_IF(FATAL, status.is_error()) << status;
+      }
+      return result;
+    }
+#endif
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      std::swap(completions_, reaped_completions_);
+    }
+    result = reaped_completions_.size();
+    for (auto &completion : reaped_completions_) {
+      completions.push_back(std::move(completion));
+    }
+    reaped_completions_.clear();
+    pending_count_ -= result;
+    return result;
+  }
+
+  size_t get_pending_count() const {
+    return pending_count_;
+  }
+
+  EventFd &get_event_fd() {
+    return event_fd_;
+  }
+
+  bool is_io_uring_used() const {
+#ifdef TD_HAS_IO_URING
+    return !ring_.empty();
+#else
+    return false;
+#endif
+  }
+
+ private:
+  // requests submitted to the ring can't have more completions, than the completion queue can hold, because
+  // overflowed completions aren't returned without an io_uring_enter; other requests wait in new_requests_
+  static constexpr size_t MAX_RING_REQUEST_COUNT = 1 << 14;
+
+  struct Request {
+    FileFd *fd;
+    char *data;
+    size_t size;
+    int64 offset;
+    bool is_write;
+    uint64 token;
+  };
+
+  EventFd event_fd_;
+  size_t pending_count_ = 0;
+
+#ifdef TD_HAS_IO_URING
+  IoUringRing ring_;
+  size_t ring_request_count_ = 0;  // requests submitted to the ring, which hasn't been reaped yet
+
+  void add_ring_request(const Request &request) {
+    ring_request_count_++;
+    IoUringRing::prepare_rw(ring_.get_sqe(), request.is_write, request.fd->get_native_fd().fd(), request.data,
+                            request.size, static_cast<uint64>(request.offset), request.token);
+  }
+
+  // adds to the ring requests, for which there is enough space in the completion queue
+  void submit_delayed_requests() {
+    size_t added_count = 0;
+    while (added_count < new_requests_.size() && ring_request_count_ < MAX_RING_REQUEST_COUNT) {
+      add_ring_request(new_requests_[added_count++]);
+    }
+    new_requests_.erase(new_requests_.begin(), new_requests_.begin() + added_count);
+  }
+#endif
+
+  // requests, which weren't passed to the thread pool or couldn't be added to the ring yet
+  vector<Request> new_requests_;
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  VectorQueue<Request> requests_;
+  vector<AsyncFileIo::Completion> completions_;
+  vector<AsyncFileIo::Completion> reaped_completions_;
+  bool is_closing_ = false;
+  vector<thread> threads_;
+
+  void run_worker() {
+    std::unique_lock<std::mutex> guard(mutex_);
+    while (true) {
+      condition_.wait(guard, [&] { return !requests_.empty() || is_closing_; });
+      if (requests_.empty()) {
+        return;
+      }
+      auto request = requests_.pop();
+      guard.unlock();
+
+      Result<size_t> result;
+      if (request.is_write) {
+        result = request.fd->pwrite(Slice(request.data, request.size), request.offset);
+      } else {
+        result = request.fd->pread(MutableSlice(request.data, request.size), request.offset);
+      }
+
+      guard.lock();
+      // the EventFd needs to be signaled only if there are no unreaped completions
+      bool need_signal = completions_.empty();
+      completions_.push_back({request.token, std::move(result)});
+      if (need_signal) {
+        event_fd_.release();
+      }
+    }
+  }
+};
+
+}  // namespace detail
+
+AsyncFileIo::AsyncFileIo() = default;
+AsyncFileIo::AsyncFileIo(AsyncFileIo &&) = default;
+AsyncFileIo &AsyncFileIo::operator=(AsyncFileIo &&) = default;
+AsyncFileIo::~AsyncFileIo() = default;
+
+void AsyncFileIo::init(size_t thread_count) {
+  CHECK(empty());
+  impl_ = make_unique<detail::AsyncFileIoImpl>();
+  impl_->init(thread_count, is_thread_pool_forced_);
+}
+
+void AsyncFileIo::close() {
+  impl_.reset();
+}
+
+bool AsyncFileIo::empty() const {
+  return impl_ == nullptr;
+}
+
+void AsyncFileIo::read(FileFd &fd, MutableSlice slice, int64 offset, uint64 token) {
+  CHECK(offset >= 0);
+  impl_->add_request(fd, slice.begin(), slice.size(), offset, false, token);
+}
+
+void AsyncFileIo::write(FileFd &fd, Slice slice, int64 offset, uint64 token) {
+  CHECK(offset >= 0);
+  impl_->add_request(fd, const_cast<char *>(slice.begin()), slice.size(), offset, true, token);
+}
+
+void AsyncFileIo::flush() {
+  impl_->flush();
+}
+
+size_t AsyncFileIo::reap(vector<Completion> &completions) {
+  return impl_->reap(completions);
+}
+
+size_t AsyncFileIo::get_pending_count() const {
+  return impl_->get_pending_count();
+}
+
+EventFd &AsyncFileIo::get_event_fd() {
+  return impl_->get_event_fd();
+}
+
+bool AsyncFileIo::is_io_uring_used() const {
+  return impl_->is_io_uring_used();
+}
+
+void AsyncFileIo::force_thread_pool() {
+  is_thread_pool_forced_ = true;
+}
+
+}  // namespace td
+
+#endif
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "td/utils/port/config.h"
+#include "td/utils/port/thread.h"
+
+#if !TD_THREAD_UNSUPPORTED && !TD_EVENTFD_UNSUPPORTED
+
+#include "td/utils/common.h"
+#include "td/utils/port/EventFd.h"
+#include "td/utils/port/FileFd.h"
+#include "td/utils/Slice.h"
+#include "td/utils/Status.h"
+
+namespace td {
+namespace detail {
+class AsyncFileIoImpl;
+}  // namespace detail
+
+// Batched asynchronous reading and writing of files at given offsets
+// Requests are executed by io_uring if possible, or by a small pool of threads otherwise.
+// Added requests are submitted together by flush. Completions are signaled through an EventFd,
+// which can be subscribed to a Poll, and are returned by reap.
+// Like pread and pwrite, a request can transfer less bytes than requested, in particular at most 0x7ffff000 bytes.
+// The object must be used from one thread. Files and memory passed to a request must stay valid until its completion.
+class AsyncFileIo {
+ public:
+  struct Completion {
+    uint64 token;
+    Result<size_t> result;
+  };
+
+  AsyncFileIo();
+  AsyncFileIo(const AsyncFileIo &) = delete;
+  AsyncFileIo &operator=(const AsyncFileIo &) = delete;
+  AsyncFileIo(AsyncFileIo &&);
+  AsyncFileIo &operator=(AsyncFileIo &&);
+  ~AsyncFileIo();
+
+  // thread_count is used only if io_uring can't be used
+  void init(size_t thread_count = 4);
+
+  // waits for all pending requests and discards their results
+  void close();
+
+  bool empty() const;
+
+  void read(FileFd &fd, MutableSlice slice, int64 offset, uint64 token);
+  void write(FileFd &fd, Slice slice, int64 offset, uint64 token);
+
+  // submits all added requests; with io_uring no more than 16384 requests are executed at once,
+  // and the other requests are submitted by reap as previous requests complete
+  void flush();
+
+  // appends results of completed requests to completions without blocking; returns the number of added completions
+  size_t reap(vector<Completion> &completions);
+
+  // returns the number of added requests, which hasn't been reaped yet
+  size_t get_pending_count() const;
+
+  // becomes readable when there are completions to reap
+  EventFd &get_event_fd();
+
+  // returns false if the thread pool is used instead of io_uring
+  bool is_io_uring_used() const;
+
+  // makes the next init use the thread pool; for testing purposes
+  void force_thread_pool();
+
+ private:
+  unique_ptr<detail::AsyncFileIoImpl> impl_;
+  bool is_thread_pool_forced_ = false;
+};
+
+}  // namespace td
+
+#endif
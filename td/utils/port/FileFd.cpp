@@ -25,6 +25,7 @@
 
 #include <fcntl.h>
 #include <sys/file.h>
+#include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/uio.h>
 #include <unistd.h>
@@ -253,6 +254,7 @@ Result<size_t> FileFd::write(Slice slice) {
 Result<size_t> FileFd::writev(Span<IoSlice> slices) {
 #if TD_PORT_POSIX
   auto native_fd = get_native_fd().fd();
+  slices.truncate(MAX_IO_SLICES);
   TRY_RESULT(slices_size, narrow_cast_safe<int>(slices.size()));
   auto bytes_written = detail::skip_eintr([&] { return ::writev(native_fd, slices.begin(), slices_size); });
   bool success = bytes_written >= 0;
@@ -301,6 +303,61 @@ Result<size_t> FileFd::read(MutableSlice slice) {
   return OS_ERROR(PSLICE() << "Read from " << get_native_fd() << " has failed");
 }
 
+Result<size_t> FileFd::readv(Span<IoSlice> slices) {
+#if TD_PORT_POSIX
+  auto native_fd = get_native_fd().fd();
+  slices.truncate(MAX_IO_SLICES);
+  size_t total_size = 0;
+  for (auto io_slice : slices) {
+    total_size += io_slice.iov_len;
+  }
+  TRY_RESULT(slices_size, narrow_cast_safe<int>(slices.size()));
+  auto bytes_read = detail::skip_eintr([&] { return ::readv(native_fd, slices.begin(), slices_size); });
+  bool success = bytes_read >= 0;
+  if (!success) {
+    auto read_errno = errno;
+    if (read_errno == EAGAIN
+#if EAGAIN != EWOULDBLOCK
+        || read_errno == EWOULDBLOCK
+#endif
+    ) {
+      success = true;
+      bytes_read = 0;
+    }
+  }
+  if (success) {
+    if (narrow_cast<size_t>(bytes_read) < total_size) {
+      get_poll_info().clear_flags(PollFlags::Read());
+    }
+    return static_cast<size_t>(bytes_read);
+  }
+  return OS_ERROR(PSLICE() << "Readv from " << get_native_fd() << " has failed");
+#else
+  size_t res = 0;
+  for (auto slice : slices) {
+    MutableSlice dest(const_cast<char *>(slice.data()), slice.size());
+    TRY_RESULT(size, read(dest));
+    res += size;
+    if (size < dest.size()) {
+      break;
+    }
+  }
+  return res;
+#endif
+}
+
+Result<size_t> FileFd::get_pending_read_size() {
+#if TD_PORT_POSIX
+  int pending_size = 0;
+  if (ioctl(get_native_fd().fd(), FIONREAD, &pending_size) == -1) {
+    return OS_ERROR(PSLICE() << "Failed to get pending read size of " << get_native_fd());
+  }
+  return static_cast<size_t>(max(pending_size, 0));
+#else
+  return 0;
+#endif
+}
+
 Result<size_t> FileFd::pwrite(Slice slice, int64 offset) {
   if (offset < 0) {
     return Status::Error("Offset must be non-negative");
@@ -32,8 +32,14 @@ class FileFd {
   static FileFd from_native_fd(NativeFd fd) TD_WARN_UNUSED_RESULT;
 
   Result<size_t> write(Slice slice) TD_WARN_UNUSED_RESULT;
+  // writes data from no more than MAX_IO_SLICES first slices
   Result<size_t> writev(Span<IoSlice> slices) TD_WARN_UNUSED_RESULT;
   Result<size_t> read(MutableSlice slice) TD_WARN_UNUSED_RESULT;
+  // reads data to no more than MAX_IO_SLICES first slices
+  Result<size_t> readv(Span<IoSlice> slices) TD_WARN_UNUSED_RESULT;
+
+  // returns number of bytes, which can be read without blocking, or 0 if unknown
+  Result<size_t> get_pending_read_size() TD_WARN_UNUSED_RESULT;
 
   Result<size_t> pwrite(Slice slice, int64 offset) TD_WARN_UNUSED_RESULT;
   Result<size_t> pread(MutableSlice slice, int64 offset) const TD_WARN_UNUSED_RESULT;
@@ -0,0 +1,73 @@
+#include "td/utils/port/Futex.h"
+
+#if TD_FUTEX_LINUX
+#include <climits>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace td {
+
+#if TD_FUTEX_LINUX
+
+static long futex(std::atomic<uint32> &value, int op, uint32 arg) {
+  static_assert(sizeof(std::atomic<uint32>) == sizeof(uint32), "");
+  return syscall(SYS_futex, reinterpret_cast<uint32 *>(&value), op, arg, nullptr, nullptr, 0);
+}
+
+Futex::~Futex() = default;
+
+void Futex::wait(uint32 expected_value) {
+  // EAGAIN and EINTR are spurious wakeups
+  futex(value_, FUTEX_WAIT_PRIVATE, expected_value);
+}
+
+void Futex::wake_one() {
+  futex(value_, FUTEX_WAKE_PRIVATE, 1);
+}
+
+void Futex::wake_all() {
+  futex(value_, FUTEX_WAKE_PRIVATE, INT_MAX);
+}
+
+void Futex::store_and_wake_one(uint32 value) {
+  value_.store(value);
+  // if the Futex is already destroyed, then the system call does nothing or causes a spurious wakeup
+  futex(value_, FUTEX_WAKE_PRIVATE, 1);
+}
+
+#else
+
+Futex::~Futex() {
+  // waits until a concurrent store_and_wake_one releases the mutex
+  std::lock_guard<std::mutex> guard(mutex_);
+}
+
+void Futex::wait(uint32 expected_value) {
+  std::unique_lock<std::mutex> guard(mutex_);
+  if (value_.load() == expected_value) {
+    condition_variable_.wait(guard);
+  }
+}
+
+void Futex::wake_one() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  condition_variable_.notify_one();
+}
+
+void Futex::wake_all() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  condition_variable_.notify_all();
+}
+
+void Futex::store_and_wake_one(uint32 value) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  value_.store(value);
+  condition_variable_.notify_one();
+}
+
+#endif
+
+}  // namespace td
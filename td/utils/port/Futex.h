@@ -0,0 +1,60 @@
+#pragma once
+
+#include "td/utils/port/config.h"
+
+#include "td/utils/common.h"
+
+#include <atomic>
+
+#if !TD_FUTEX_LINUX
+#include <condition_variable>
+#include <mutex>
+#endif
+
+namespace td {
+
+// 32-bit value, which threads can wait on until it changes
+// Uses futex on Linux, and mutex with condition variable elsewhere
+class Futex {
+ public:
+  explicit Futex(uint32 value = 0) : value_(value) {
+  }
+  Futex(const Futex &) = delete;
+  Futex &operator=(const Futex &) = delete;
+  Futex(Futex &&) = delete;
+  Futex &operator=(Futex &&) = delete;
+  ~Futex();
+
+  uint32 load(std::memory_order order = std::memory_order_seq_cst) const {
+    return value_.load(order);
+  }
+  void store(uint32 value, std::memory_order order = std::memory_order_seq_cst) {
+    value_.store(value, order);
+  }
+  uint32 exchange(uint32 value, std::memory_order order = std::memory_order_seq_cst) {
+    return value_.exchange(value, order);
+  }
+  uint32 fetch_add(uint32 value, std::memory_order order = std::memory_order_seq_cst) {
+    return value_.fetch_add(value, order);
+  }
+
+  // blocks while the value is equal to expected_value; spurious wakeups are possible
+  void wait(uint32 expected_value);
+
+  // wakes up threads waiting in wait; must be called after the value is changed
+  void wake_one();
+  void wake_all();
+
+  // stores the value and wakes up one waiting thread
+  // unlike store followed by wake_one, can be used if the woken thread destroys the Futex right after it sees the value
+  void store_and_wake_one(uint32 value);
+
+ private:
+  std::atomic<uint32> value_;
+#if !TD_FUTEX_LINUX
+  std::mutex mutex_;
+  std::condition_variable condition_variable_;
+#endif
+};
+
+}  // namespace td
@@ -1,8 +1,11 @@
 #pragma once
 
+#include "td/utils/port/config.h"
+
 #include "td/utils/Slice.h"
 
 #if TD_PORT_POSIX
+#include <climits>
 #include <sys/uio.h>
 #endif
 
@@ -12,6 +15,13 @@ namespace td {
 
 using IoSlice = struct iovec;
 
+// maximum number of slices, which can be written by a single writev call
+#ifdef IOV_MAX
+constexpr size_t MAX_IO_SLICES = IOV_MAX;
+#else
+constexpr size_t MAX_IO_SLICES = 1024;
+#endif
+
 inline IoSlice as_io_slice(Slice slice) {
   IoSlice res;
   res.iov_len = slice.size();
@@ -27,6 +37,8 @@ inline Slice as_slice(const IoSlice io_slice) {
 
 using IoSlice = Slice;
 
+constexpr size_t MAX_IO_SLICES = 1024;
+
 inline IoSlice as_io_slice(Slice slice) {
   return slice;
 }
@@ -0,0 +1,214 @@
+#include "td/utils/port/ReactorGroup.h"
+
+char disable_linker_warning_about_empty_file_reactor_group_cpp TD_UNUSED;
+
+#if TD_POLL_EPOLL && !TD_THREAD_UNSUPPORTED
+
+#include "td/utils/Hash.h"
+#include "td/utils/logging.h"
+#include "td/utils/port/thread_local.h"
+
+#include <algorithm>
+
+namespace td {
+
+namespace {
+TD_THREAD_LOCAL ReactorGroup::Reactor *current_reactor;
+}  // namespace
+
+class ReactorGroup::Reactor::Listener final : public Handler {
+ public:
+  Listener(ServerSocketFd server_fd, AcceptCallback *callback)
+      : server_fd_(std::move(server_fd)), callback_(callback) {
+  }
+
+  ServerSocketFd &get_server_fd() {
+    return server_fd_;
+  }
+
+  void on_ready(Reactor &reactor) final {
+    sync_with_poll(server_fd_);
+    while (can_read_local(server_fd_)) {
+      auto r_socket_fd = server_fd_.accept();
+      if (r_socket_fd.is_error()) {
+        if (r_socket_fd.error().code() != -1) {
+          LOG(ERROR) << r_socket_fd.error();
+        }
+        continue;
+      }
+      callback_->on_accept(reactor, r_socket_fd.move_as_ok());
+    }
+  }
+
+ private:
+  ServerSocketFd server_fd_;
+  AcceptCallback *callback_;
+};
+
+void ReactorGroup::Handler::notify() {
+  CHECK(reactor_ != nullptr);
+  reactor_->schedule(this);
+}
+
+ReactorGroup::Reactor::Reactor(size_t id) : id_(id) {
+  poll_.init();
+  queue_.init();
+}
+
+ReactorGroup::Reactor::~Reactor() {
+  poll_.clear();
+  queue_.destroy();
+}
+
+void ReactorGroup::Reactor::post_task(unique_ptr<Task> task) {
+  queue_.writer_put(std::move(task));
+}
+
+void ReactorGroup::Reactor::subscribe(PollableFdInfo &poll_info, PollFlags flags, Handler *handler) {
+  DCHECK(get_current() == this);
+  CHECK(handler->reactor_ == nullptr);
+  handler->reactor_ = this;
+  poll_.subscribe(poll_info.extract_pollable_fd(handler), flags);
+}
+
+void ReactorGroup::Reactor::unsubscribe(PollableFdInfo &poll_info, Handler *handler) {
+  DCHECK(get_current() == this);
+  CHECK(handler->reactor_ == this);
+  poll_.unsubscribe(poll_info.get_pollable_fd_ref());
+  handler->reactor_ = nullptr;
+  if (handler->is_scheduled_) {
+    handler->is_scheduled_ = false;
+    ready_handlers_.erase(std::find(ready_handlers_.begin(), ready_handlers_.end(), handler));
+  }
+  // the handler can be unsubscribed from on_ready of another handler
+  std::replace(running_handlers_.begin(), running_handlers_.end(), handler, static_cast<Handler *>(nullptr));
+}
+
+void ReactorGroup::Reactor::schedule(Handler *handler) {
+  DCHECK(get_current() == this);
+  if (!handler->is_scheduled_) {
+    handler->is_scheduled_ = true;
+    ready_handlers_.push_back(handler);
+  }
+}
+
+ReactorGroup::Reactor *ReactorGroup::Reactor::get_current() {
+  return current_reactor;
+}
+
+void ReactorGroup::Reactor::run_loop() {
+  current_reactor = this;
+  auto &event_fd = queue_.reader_get_event_fd();
+  poll_.subscribe(event_fd.get_poll_info().extract_pollable_fd(nullptr), PollFlags::Read());
+
+  while (true) {
+    run_tasks();
+    if (is_closing_) {
+      break;
+    }
+    run_handlers();
+    // the poll doesn't block if some handlers were scheduled by other handlers
+    poll_.run(ready_handlers_.empty() ? -1 : 0);
+    run_handlers();
+  }
+
+  for (auto &listener : listeners_) {
+    unsubscribe(listener->get_server_fd().get_poll_info(), listener.get());
+  }
+  listeners_.clear();
+  poll_.unsubscribe(event_fd.get_poll_info().get_pollable_fd_ref());
+  current_reactor = nullptr;
+}
+
+void ReactorGroup::Reactor::run_tasks() {
+  // the queue must be emptied, so that the EventFd is signaled for the next task
+  while (true) {
+    auto ready_count = queue_.reader_wait_nonblock();
+    if (ready_count == 0) {
+      break;
+    }
+    for (int i = 0; i < ready_count; i++) {
+      auto task = queue_.reader_get_unsafe();
+      task->run(*this);
+    }
+  }
+}
+
+void ReactorGroup::Reactor::run_handlers() {
+  CHECK(running_handlers_.empty());
+  std::swap(ready_handlers_, running_handlers_);
+  for (size_t i = 0; i < running_handlers_.size(); i++) {
+    auto *handler = running_handlers_[i];
+    if (handler == nullptr) {
+      continue;
+    }
+    handler->is_scheduled_ = false;
+    handler->on_ready(*this);
+  }
+  running_handlers_.clear();
+}
+
+void ReactorGroup::Reactor::add_listener(ServerSocketFd server_fd, AcceptCallback *callback) {
+  listeners_.push_back(make_unique<Listener>(std::move(server_fd), callback));
+  auto *listener = listeners_.back().get();
+  listener->reactor_ = this;
+  poll_.subscribe_exclusive(listener->get_server_fd().get_poll_info().extract_pollable_fd(listener),
+                            PollFlags::Read());
+}
+
+ReactorGroup::ReactorGroup(size_t reactor_count) {
+  CHECK(reactor_count > 0);
+  for (size_t i = 0; i < reactor_count; i++) {
+    reactors_.push_back(make_unique<Reactor>(i));
+  }
+  for (auto &reactor : reactors_) {
+    reactor->thread_ = td::thread([reactor = reactor.get()] { reactor->run_loop(); });
+  }
+}
+
+ReactorGroup::~ReactorGroup() {
+  close();
+}
+
+ReactorGroup::Reactor &ReactorGroup::choose_reactor(uint64 key) {
+  return get_reactor(Hash<uint64>()(key) % reactors_.size());
+}
+
+Status ReactorGroup::add_shared_listener(ServerSocketFd server_fd, unique_ptr<AcceptCallback> callback) {
+  CHECK(!is_closed_);
+  vector<ServerSocketFd> server_fds;
+  for (size_t i = 1; i < reactors_.size(); i++) {
+    TRY_RESULT(duplicated_fd, server_fd.duplicate());
+    server_fds.push_back(std::move(duplicated_fd));
+  }
+  server_fds.push_back(std::move(server_fd));
+
+  auto *callback_ptr = callback.get();
+  accept_callbacks_.push_back(std::move(callback));
+  for (size_t i = 0; i < reactors_.size(); i++) {
+    reactors_[i]->post([server_fd = std::move(server_fds[i]), callback_ptr](Reactor &reactor) mutable {
+      reactor.add_listener(std::move(server_fd), callback_ptr);
+    });
+  }
+  return Status::OK();
+}
+
+void ReactorGroup::close() {
+  if (is_closed_) {
+    return;
+  }
+  is_closed_ = true;
+  CHECK(Reactor::get_current() == nullptr);
+  for (auto &reactor : reactors_) {
+    reactor->post([](Reactor &reactor) { reactor.is_closing_ = true; });
+  }
+  for (auto &reactor : reactors_) {
+    reactor->thread_.join();
+  }
+  reactors_.clear();
+  accept_callbacks_.clear();
+}
+
+}  // namespace td
+
+#endif
@@ -0,0 +1,188 @@
+#pragma once
+
+#include "td/utils/port/config.h"
+#include "td/utils/port/thread.h"
+
+#if TD_POLL_EPOLL && !TD_THREAD_UNSUPPORTED
+
+#include "td/utils/common.h"
+#include "td/utils/MpscPollableQueue.h"
+#include "td/utils/Observer.h"
+#include "td/utils/port/detail/Epoll.h"
+#include "td/utils/port/detail/PollableFd.h"
+#include "td/utils/port/PollFlags.h"
+#include "td/utils/port/ServerSocketFd.h"
+#include "td/utils/port/SocketFd.h"
+#include "td/utils/Status.h"
+
+#include <atomic>
+#include <type_traits>
+#include <utility>
+
+namespace td {
+
+// Group of event loop threads, each of which owns an Epoll
+//
+// Fds are sharded between reactors: an fd is subscribed to and used only from the thread of the reactor,
+// to which it was assigned by round-robin or by a hash. Tasks are posted to a reactor from any thread
+// through its MpscPollableQueue. A listening socket can be shared by all reactors; it is subscribed
+// with EPOLLEXCLUSIVE, so a new connection wakes up only one of them.
+class ReactorGroup {
+ public:
+  class Reactor;
+
+  class Task {
+   public:
+    Task() = default;
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
+    Task(Task &&) = delete;
+    Task &operator=(Task &&) = delete;
+    virtual ~Task() = default;
+
+    virtual void run(Reactor &reactor) = 0;
+  };
+
+  // an object, which handles events of fds subscribed through Reactor::subscribe
+  class Handler : private ObserverBase {
+   public:
+    // called from the reactor thread after a poll run, if new poll flags were added to a subscribed fd
+    // or Reactor::schedule was called; all available events must be handled, because the handler
+    // isn't called again until the next new flags
+    virtual void on_ready(Reactor &reactor) = 0;
+
+   private:
+    friend class Reactor;
+    Reactor *reactor_ = nullptr;
+    bool is_scheduled_ = false;
+
+    void notify() final;
+  };
+
+  // called from the thread of the reactor, which accepted the connection; must be thread-safe
+  class AcceptCallback {
+   public:
+    AcceptCallback() = default;
+    AcceptCallback(const AcceptCallback &) = delete;
+    AcceptCallback &operator=(const AcceptCallback &) = delete;
+    AcceptCallback(AcceptCallback &&) = delete;
+    AcceptCallback &operator=(AcceptCallback &&) = delete;
+    virtual ~AcceptCallback() = default;
+
+    virtual void on_accept(Reactor &reactor, SocketFd socket_fd) = 0;
+  };
+
+  class Reactor {
+   public:
+    explicit Reactor(size_t id);
+    Reactor(const Reactor &) = delete;
+    Reactor &operator=(const Reactor &) = delete;
+    Reactor(Reactor &&) = delete;
+    Reactor &operator=(Reactor &&) = delete;
+    ~Reactor();
+
+    size_t get_id() const {
+      return id_;
+    }
+
+    // the poll must be used only from the thread of the reactor
+    detail::Epoll &get_poll() {
+      return poll_;
+    }
+
+    // can be called from any thread
+    template <class F>
+    void post(F &&f) {
+      post_task(make_unique<LambdaTask<std::decay_t<F>>>(std::forward<F>(f)));
+    }
+
+    void post_task(unique_ptr<Task> task);
+
+    // the following methods must be called from the thread of the reactor
+    void subscribe(PollableFdInfo &poll_info, PollFlags flags, Handler *handler);
+    void unsubscribe(PollableFdInfo &poll_info, Handler *handler);
+
+    // makes the reactor call handler->on_ready after the current iteration
+    void schedule(Handler *handler);
+
+    // returns the reactor, to which the current thread belongs, or nullptr
+    static Reactor *get_current();
+
+   private:
+    friend class ReactorGroup;
+
+    template <class F>
+    class LambdaTask final : public Task {
+     public:
+      template <class FromF>
+      explicit LambdaTask(FromF &&f) : f_(std::forward<FromF>(f)) {
+      }
+      void run(Reactor &reactor) final {
+        f_(reactor);
+      }
+
+     private:
+      F f_;
+    };
+
+    class Listener;
+
+    size_t id_;
+    detail::Epoll poll_;
+    MpscPollableQueue<unique_ptr<Task>> queue_;
+    vector<Handler *> ready_handlers_;
+    vector<Handler *> running_handlers_;
+    vector<unique_ptr<Listener>> listeners_;
+    bool is_closing_ = false;
+    td::thread thread_;
+
+    void run_loop();
+
+    void run_tasks();
+
+    void run_handlers();
+
+    void add_listener(ServerSocketFd server_fd, AcceptCallback *callback);
+  };
+
+  explicit ReactorGroup(size_t reactor_count);
+  ReactorGroup(const ReactorGroup &) = delete;
+  ReactorGroup &operator=(const ReactorGroup &) = delete;
+  ReactorGroup(ReactorGroup &&) = delete;
+  ReactorGroup &operator=(ReactorGroup &&) = delete;
+  ~ReactorGroup();
+
+  size_t get_reactor_count() const {
+    return reactors_.size();
+  }
+
+  Reactor &get_reactor(size_t id) {
+    return *reactors_[id];
+  }
+
+  // chooses reactors in turn; can be called from any thread
+  Reactor &choose_reactor() {
+    return get_reactor(next_reactor_id_.fetch_add(1, std::memory_order_relaxed) % reactors_.size());
+  }
+
+  // always chooses the same reactor for the same key
+  Reactor &choose_reactor(uint64 key);
+
+  // subscribes the listening socket to all reactors; accepted connections are passed to the callback
+  // in the thread of the reactor, which accepted them
+  Status add_shared_listener(ServerSocketFd server_fd, unique_ptr<AcceptCallback> callback) TD_WARN_UNUSED_RESULT;
+
+  // runs all already posted tasks, closes shared listeners and stops all threads
+  // all other fds must be unsubscribed before the call
+  void close();
+
+ private:
+  vector<unique_ptr<Reactor>> reactors_;
+  vector<unique_ptr<AcceptCallback>> accept_callbacks_;
+  std::atomic<size_t> next_reactor_id_{0};
+  bool is_closed_ = false;
+};
+
+}  // namespace td
+
+#endif
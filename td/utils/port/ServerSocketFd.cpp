@@ -308,6 +308,19 @@ bool ServerSocketFd::empty() const {
   return !impl_;
 }
 
+Result<ServerSocketFd> ServerSocketFd::duplicate() const {
+  CHECK(!empty());
+#if TD_PORT_POSIX
+  NativeFd fd{dup(get_native_fd().socket())};
+  if (!fd) {
+    return OS_ERROR("Failed to duplicate a listening socket");
+  }
+  return ServerSocketFd(make_unique<detail::ServerSocketFdImpl>(std::move(fd)));
+#elif TD_PORT_WINDOWS
+  return Status::Error("Listening socket duplication is unsupported");
+#endif
+}
+
 Result<ServerSocketFd> ServerSocketFd::open(int32 port, CSlice addr) {
   IPAddress address;
   TRY_STATUS(address.init_ipv4_port(addr, port));
@@ -29,6 +29,9 @@ class ServerSocketFd {
 
   static Result<ServerSocketFd> open(int32 port, CSlice addr = CSlice("0.0.0.0")) TD_WARN_UNUSED_RESULT;
 
+  // returns another file descriptor for the same listening socket, which can be subscribed to another poll
+  Result<ServerSocketFd> duplicate() const TD_WARN_UNUSED_RESULT;
+
   PollableFdInfo &get_poll_info();
   const PollableFdInfo &get_poll_info() const;
 
@@ -1,17 +1,18 @@
 #include "td/utils/port/SocketFd.h"
 
+#include "td/utils/buffer.h"
 #include "td/utils/common.h"
 #include "td/utils/format.h"
 #include "td/utils/logging.h"
 #include "td/utils/misc.h"
 #include "td/utils/port/detail/skip_eintr.h"
 #include "td/utils/port/PollFlags.h"
+#include "td/utils/Time.h"
+#include "td/utils/VectorQueue.h"
 
 #if TD_PORT_WINDOWS
-#include "td/utils/buffer.h"
 #include "td/utils/port/detail/Iocp.h"
 #include "td/utils/SpinLock.h"
-#include "td/utils/VectorQueue.h"
 #endif
 
 #if TD_PORT_POSIX
@@ -21,13 +22,23 @@
 #include <fcntl.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
+
+#if TD_LINUX
+#include <linux/errqueue.h>
+#endif
+
+#if TD_LINUX && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+#define TD_HAS_ZERO_COPY_SEND 1
+#endif
 #endif
 
 #include <atomic>
 #include <cstring>
+#include <mutex>
 
 namespace td {
 namespace detail {
@@ -129,6 +140,27 @@ class SocketFdImpl : private Iocp::Callback {
     return res;
   }
 
+  Result<size_t> readv(Span<IoSlice> slices) {
+    size_t total_size = 0;
+    for (auto io_slice : slices) {
+      MutableSlice slice(const_cast<char *>(io_slice.data()), io_slice.size());
+      if (slice.empty()) {
+        continue;
+      }
+      TRY_RESULT(size, read(slice));
+      total_size += size;
+      if (size < slice.size()) {
+        break;
+      }
+    }
+    return total_size;
+  }
+
+  Result<size_t> get_pending_read_size() {
+    input_reader_.sync_with_writer();
+    return input_reader_.size();
+  }
+
   Status get_pending_error() {
     Status res;
     {
@@ -380,6 +412,7 @@ class SocketFdImpl {
   }
   Result<size_t> writev(Span<IoSlice> slices) {
     int native_fd = get_native_fd().socket();
+    slices.truncate(MAX_IO_SLICES);
     auto write_res =
         detail::skip_eintr([&] { return ::writev(native_fd, slices.begin(), narrow_cast<int>(slices.size())); });
     return write_finish(write_res);
@@ -435,6 +468,20 @@ class SocketFdImpl {
     int native_fd = get_native_fd().socket();
     CHECK(slice.size() > 0);
     auto read_res = detail::skip_eintr([&] { return ::read(native_fd, slice.begin(), slice.size()); });
+    return read_finish(read_res);
+  }
+  Result<size_t> readv(Span<IoSlice> slices) {
+    if (get_poll_info().get_flags_local().has_pending_error()) {
+      TRY_STATUS(get_pending_error());
+    }
+    int native_fd = get_native_fd().socket();
+    CHECK(!slices.empty());
+    slices.truncate(MAX_IO_SLICES);
+    auto read_res =
+        detail::skip_eintr([&] { return ::readv(native_fd, slices.begin(), narrow_cast<int>(slices.size())); });
+    return read_finish(read_res);
+  }
+  Result<size_t> read_finish(ssize_t read_res) {
     auto read_errno = errno;
     if (read_res >= 0) {
       if (read_res == 0) {
@@ -475,17 +522,278 @@ class SocketFdImpl {
         return std::move(error);
     }
   }
+  Result<size_t> get_pending_read_size() {
+    int pending_size = 0;
+    if (ioctl(get_native_fd().socket(), FIONREAD, &pending_size) == -1) {
+      return OS_SOCKET_ERROR(PSLICE() << "Failed to get pending read size of " << get_native_fd());
+    }
+    return static_cast<size_t>(max(pending_size, 0));
+  }
   Status get_pending_error() {
     if (!get_poll_info().get_flags_local().has_pending_error()) {
       return Status::OK();
     }
+    if (zero_copy_min_size_ != 0) {
+      // zero-copy completions in the error queue also make the socket report an error
+      TRY_STATUS(process_zero_copy_completions());
+    }
     TRY_STATUS(detail::get_socket_pending_error(get_native_fd()));
     get_poll_info().clear_flags(PollFlags::Error());
     return Status::OK();
   }
+
+  Status enable_zero_copy(size_t min_size) {
+    CHECK(min_size > 0);
+#ifdef TD_HAS_ZERO_COPY_SEND
+    int flags = 1;
+    if (setsockopt(get_native_fd().socket(), SOL_SOCKET, SO_ZEROCOPY, &flags, sizeof(flags)) != 0) {
+      return OS_SOCKET_ERROR("Failed to set SO_ZEROCOPY");
+    }
+    zero_copy_min_size_ = min_size;
+    return Status::OK();
+#else
+    return Status::Error("Zero-copy sending is unsupported");
+#endif
+  }
+
+  bool can_write_zero_copy(size_t size) const {
+    return zero_copy_min_size_ != 0 && size >= zero_copy_min_size_;
+  }
+
+  Result<size_t> write_zero_copy(const BufferSlice &slice) {
+#ifdef TD_HAS_ZERO_COPY_SEND
+    if (can_write_zero_copy(slice.size())) {
+      int native_fd = get_native_fd().socket();
+      auto write_res =
+          detail::skip_eintr([&] { return ::send(native_fd, slice.data(), slice.size(), MSG_ZEROCOPY); });
+      if (write_res >= 0 || errno != ENOBUFS) {
+        TRY_RESULT(result, write_finish(write_res));
+        if (write_res >= 0) {
+          // every successful send with MSG_ZEROCOPY gets the next identifier
+          zero_copy_stats_.zero_copy_write_count++;
+          zero_copy_pending_writes_.push(ZeroCopyWrite{next_zero_copy_write_id_++, false, slice.clone()});
+        }
+        return result;
+      }
+      // the limit of pinned memory is exceeded
+    }
+#endif
+    zero_copy_stats_.copied_write_count++;
+    return write(slice.as_slice());
+  }
+
+  Result<size_t> process_zero_copy_completions() {
+    size_t result = 0;
+#ifdef TD_HAS_ZERO_COPY_SEND
+    int native_fd = get_native_fd().socket();
+    while (true) {
+      char control[CMSG_SPACE(sizeof(sock_extended_err) + sizeof(sockaddr_storage))];
+      msghdr message;
+      std::memset(&message, 0, sizeof(message));
+      message.msg_control = control;
+      message.msg_controllen = sizeof(control);
+      auto recv_res = detail::skip_eintr([&] { return ::recvmsg(native_fd, &message, MSG_ERRQUEUE); });
+      if (recv_res < 0) {
+        auto recv_errno = errno;
+        if (recv_errno == EAGAIN
+#if EAGAIN != EWOULDBLOCK
+            || recv_errno == EWOULDBLOCK
+#endif
+        ) {
+          break;
+        }
+        return Status::PosixError(recv_errno, PSLICE() << "Failed to read error queue of " << get_native_fd());
+      }
+      for (auto *cmsg = CMSG_FIRSTHDR(&message); cmsg != nullptr; cmsg = CMSG_NXTHDR(&message, cmsg)) {
+        if (!(cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_RECVERR) &&
+            !(cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)) {
+          continue;
+        }
+        sock_extended_err error;
+        std::memcpy(&error, CMSG_DATA(cmsg), sizeof(error));
+        if (error.ee_origin != SO_EE_ORIGIN_ZEROCOPY || error.ee_errno != 0) {
+          continue;
+        }
+        // writes with identifiers from ee_info to ee_data inclusive are completed
+        auto completed_count = on_zero_copy_writes_completed(error.ee_info, error.ee_data);
+        if ((error.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) != 0) {
+          zero_copy_stats_.kernel_copied_write_count += completed_count;
+        }
+        result += completed_count;
+      }
+    }
+#endif
+    return result;
+  }
+
+  SocketFd::ZeroCopyStats get_zero_copy_stats() const {
+    auto result = zero_copy_stats_;
+    result.pending_write_count = zero_copy_pending_writes_.size();
+    return result;
+  }
+
+  // processes available completions and returns true if some zero-copy writes are still pending
+  bool has_pending_zero_copy_writes() {
+    if (zero_copy_pending_writes_.empty()) {
+      return false;
+    }
+    auto r_completed_count = process_zero_copy_completions();
+    if (r_completed_count.is_error()) {
+      LOG(WARNING) << r_completed_count.error();
+    }
+    return !zero_copy_pending_writes_.empty();
+  }
+
+ private:
+  struct ZeroCopyWrite {
+    uint32 id;
+    bool is_completed;
+    BufferSlice buffer;
+  };
+  size_t zero_copy_min_size_ = 0;
+  uint32 next_zero_copy_write_id_ = 0;
+  VectorQueue<ZeroCopyWrite> zero_copy_pending_writes_;
+  SocketFd::ZeroCopyStats zero_copy_stats_;
+
+  size_t on_zero_copy_writes_completed(uint32 first_id, uint32 last_id) {
+    size_t result = 0;
+    if (zero_copy_pending_writes_.empty()) {
+      return result;
+    }
+    // the writes are stored in the order of their identifiers, but completions can be reordered
+    auto front_id = zero_copy_pending_writes_.front().id;
+    auto *writes = zero_copy_pending_writes_.data();
+    for (uint32 id = first_id;; id++) {
+      auto pos = static_cast<uint32>(id - front_id);
+      if (pos < zero_copy_pending_writes_.size() && !writes[pos].is_completed) {
+        writes[pos].is_completed = true;
+        writes[pos].buffer = BufferSlice();
+        result++;
+      }
+      if (id == last_id) {
+        break;
+      }
+    }
+    while (!zero_copy_pending_writes_.empty() && zero_copy_pending_writes_.front().is_completed) {
+      zero_copy_pending_writes_.pop();
+    }
+    zero_copy_stats_.completed_write_count += result;
+    return result;
+  }
 };
 
+#ifdef TD_HAS_ZERO_COPY_SEND
+// closed sockets with pending zero-copy writes; the kernel can still send data from buffers of the writes,
+// so the sockets are kept open to receive completions and are destroyed after all their writes are completed;
+// sockets, which haven't completed their writes before the deadline, are reset, which drops the unsent data
+class ClosedZeroCopySockets {
+ public:
+  void add(SocketFdImpl *impl) {
+    auto deadline = Time::now() + close_timeout_.load(std::memory_order_relaxed);
+    std::lock_guard<std::mutex> guard(mutex_);
+    sockets_.push_back(ClosedSocket{impl, deadline});
+    size_.store(sockets_.size(), std::memory_order_relaxed);
+  }
+
+  void set_close_timeout(double timeout) {
+    close_timeout_.store(timeout, std::memory_order_relaxed);
+  }
+
+  // the sockets are checked by only one thread at a time and without the lock;
+  // returns the number of sockets, which are still kept open
+  size_t process(bool force) {
+    if (size_.load(std::memory_order_relaxed) == 0) {
+      return 0;
+    }
+    auto now = Time::now();
+    if (!force && now < next_process_time_.load(std::memory_order_relaxed)) {
+      return size_.load(std::memory_order_relaxed);
+    }
+    if (is_processing_.exchange(true, std::memory_order_acquire)) {
+      return size_.load(std::memory_order_relaxed);
+    }
+    next_process_time_.store(now + PROCESS_INTERVAL, std::memory_order_relaxed);
+
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      std::swap(sockets_, processed_sockets_);
+    }
+    td::remove_if(processed_sockets_, [now](const ClosedSocket &socket) {
+      if (socket.impl->has_pending_zero_copy_writes()) {
+        if (now < socket.deadline) {
+          return false;
+        }
+        LOG(WARNING) << "Reset " << socket.impl->get_native_fd() << " with unfinished zero-copy writes";
+        abort_connection(socket.impl->get_native_fd());
+      }
+      delete socket.impl;
+      return true;
+    });
+
+    size_t result;
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      append(sockets_, std::move(processed_sockets_));
+      result = sockets_.size();
+      size_.store(result, std::memory_order_relaxed);
+    }
+    processed_sockets_.clear();
+    is_processing_.store(false, std::memory_order_release);
+    return result;
+  }
+
+ private:
+  static constexpr double PROCESS_INTERVAL = 0.01;
+
+  struct ClosedSocket {
+    SocketFdImpl *impl;
+    double deadline;
+  };
+
+  std::mutex mutex_;
+  vector<ClosedSocket> sockets_;
+  std::atomic<size_t> size_{0};
+  std::atomic<double> close_timeout_{10.0};
+  std::atomic<double> next_process_time_{0.0};
+  std::atomic<bool> is_processing_{false};
+  vector<ClosedSocket> processed_sockets_;  // owned by the processing thread
+
+  // makes close reset the connection, which frees all queued data without waiting for its sending
+  static void abort_connection(const NativeFd &fd) {
+    linger value;
+    value.l_onoff = 1;
+    value.l_linger = 0;
+    if (setsockopt(fd.socket(), SOL_SOCKET, SO_LINGER, &value, sizeof(value)) != 0) {
+      LOG(ERROR) << OS_SOCKET_ERROR(PSLICE() << "Failed to set SO_LINGER for " << fd);
+    }
+  }
+};
+
+constexpr double ClosedZeroCopySockets::PROCESS_INTERVAL;
+
+static ClosedZeroCopySockets &get_closed_zero_copy_sockets() {
+  static ClosedZeroCopySockets closed_sockets;
+  return closed_sockets;
+}
+#endif
+
+void process_closed_zero_copy_sockets() {
+#ifdef TD_HAS_ZERO_COPY_SEND
+  get_closed_zero_copy_sockets().process(false);
+#endif
+}
+
 void SocketFdImplDeleter::operator()(SocketFdImpl *impl) {
+#ifdef TD_HAS_ZERO_COPY_SEND
+  if (impl->has_pending_zero_copy_writes()) {
+    // the peer receives all sent data and then the end of the stream, as if the socket was closed
+    if (::shutdown(impl->get_native_fd().socket(), SHUT_WR) != 0) {
+      LOG(INFO) << OS_SOCKET_ERROR(PSLICE() << "Failed to shutdown " << impl->get_native_fd());
+    }
+    get_closed_zero_copy_sockets().add(impl);
+    return;
+  }
+#endif
   delete impl;
 }
 
@@ -614,4 +922,105 @@ Result<size_t> SocketFd::read(MutableSlice slice) {
   return impl_->read(slice);
 }
 
+Result<size_t> SocketFd::readv(Span<IoSlice> slices) {
+  return impl_->readv(slices);
+}
+
+Result<size_t> SocketFd::get_pending_read_size() {
+  return impl_->get_pending_read_size();
+}
+
+constexpr size_t SocketFd::DEFAULT_ZERO_COPY_MIN_SIZE;
+
+#if TD_PORT_POSIX
+Status SocketFd::enable_zero_copy(size_t min_size) {
+  return impl_->enable_zero_copy(min_size);
+}
+
+bool SocketFd::can_write_zero_copy(size_t size) const {
+  return impl_->can_write_zero_copy(size);
+}
+
+Result<size_t> SocketFd::write_zero_copy(const BufferSlice &slice) {
+  return impl_->write_zero_copy(slice);
+}
+
+Result<size_t> SocketFd::process_zero_copy_completions() {
+  return impl_->process_zero_copy_completions();
+}
+
+SocketFd::ZeroCopyStats SocketFd::get_zero_copy_stats() const {
+  return impl_->get_zero_copy_stats();
+}
+
+size_t SocketFd::process_closed_zero_copy_sockets() {
+#ifdef TD_HAS_ZERO_COPY_SEND
+  return detail::get_closed_zero_copy_sockets().process(true);
+#else
+  return 0;
+#endif
+}
+
+#ifdef TD_HAS_ZERO_COPY_SEND
+void SocketFd::set_zero_copy_close_timeout(double timeout) {
+  detail::get_closed_zero_copy_sockets().set_close_timeout(timeout);
+}
+#else
+void SocketFd::set_zero_copy_close_timeout(double) {
+}
+#endif
+#elif TD_PORT_WINDOWS
+Status SocketFd::enable_zero_copy(size_t) {
+  return Status::Error("Zero-copy sending is unsupported");
+}
+
+bool SocketFd::can_write_zero_copy(size_t) const {
+  return false;
+}
+
+Result<size_t> SocketFd::write_zero_copy(const BufferSlice &slice) {
+  return write(slice.as_slice());
+}
+
+Result<size_t> SocketFd::process_zero_copy_completions() {
+  return 0;
+}
+
+SocketFd::ZeroCopyStats SocketFd::get_zero_copy_stats() const {
+  return ZeroCopyStats();
+}
+
+size_t SocketFd::process_closed_zero_copy_sockets() {
+  return 0;
+}
+
+void SocketFd::set_zero_copy_close_timeout(double) {
+}
+#endif
+
+#if TD_LINUX && defined(SO_BUSY_POLL)
+Status SocketFd::set_busy_poll(int32 busy_poll_us, bool prefer_busy_poll) {
+  auto sock = get_native_fd().socket();
+  int value = busy_poll_us;
+  if (setsockopt(sock, SOL_SOCKET, SO_BUSY_POLL, &value, sizeof(value)) != 0) {
+    return OS_SOCKET_ERROR("Failed to set SO_BUSY_POLL");
+  }
+  if (prefer_busy_poll) {
+#ifdef SO_PREFER_BUSY_POLL
+    value = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_PREFER_BUSY_POLL, &value, sizeof(value)) != 0) {
+      return OS_SOCKET_ERROR("Failed to set SO_PREFER_BUSY_POLL");
+    }
+#else
+    return Status::Error("SO_PREFER_BUSY_POLL is unsupported");
+#endif
+  }
+  return Status::OK();
+}
+#else
+Status SocketFd::set_busy_poll(int32, bool) {
+  return Status::Error("Busy polling is unsupported");
+}
+#endif
+
 }  // namespace td
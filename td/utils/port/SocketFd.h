@@ -14,6 +14,8 @@
 
 namespace td {
 
+class BufferSlice;
+
 namespace detail {
 class SocketFdImpl;
 class SocketFdImplDeleter {
@@ -39,8 +41,56 @@ class SocketFd {
   Status get_pending_error() TD_WARN_UNUSED_RESULT;
 
   Result<size_t> write(Slice slice) TD_WARN_UNUSED_RESULT;
+  // writes data from no more than MAX_IO_SLICES first slices
   Result<size_t> writev(Span<IoSlice> slices) TD_WARN_UNUSED_RESULT;
   Result<size_t> read(MutableSlice slice) TD_WARN_UNUSED_RESULT;
+  // reads data to no more than MAX_IO_SLICES first slices
+  Result<size_t> readv(Span<IoSlice> slices) TD_WARN_UNUSED_RESULT;
+
+  // returns number of bytes, which can be read without blocking, or 0 if unknown
+  Result<size_t> get_pending_read_size() TD_WARN_UNUSED_RESULT;
+
+  static constexpr size_t DEFAULT_ZERO_COPY_MIN_SIZE = 1 << 14;
+
+  // enables sending with MSG_ZEROCOPY by write_zero_copy for writes of at least min_size bytes;
+  // smaller writes are copied, because page pinning and completion handling cost more than the copy;
+  // supported only on Linux
+  Status enable_zero_copy(size_t min_size = DEFAULT_ZERO_COPY_MIN_SIZE) TD_WARN_UNUSED_RESULT;
+
+  // returns true if write_zero_copy of size bytes will not copy them
+  bool can_write_zero_copy(size_t size) const;
+
+  // writes the data without copying it to the kernel if possible; a reference to the buffer is kept until
+  // the kernel reports through the socket error queue that the buffer is no longer used
+  Result<size_t> write_zero_copy(const BufferSlice &slice) TD_WARN_UNUSED_RESULT;
+
+  // reads zero-copy completions from the socket error queue, which is signaled by PollFlags::Error,
+  // and releases completed buffers; returns the number of completed writes
+  // is also called by get_pending_error
+  Result<size_t> process_zero_copy_completions() TD_WARN_UNUSED_RESULT;
+
+  struct ZeroCopyStats {
+    uint64 zero_copy_write_count = 0;  // writes sent with MSG_ZEROCOPY
+    uint64 copied_write_count = 0;     // writes, which were copied because of their small size or an error
+    uint64 completed_write_count = 0;
+    uint64 kernel_copied_write_count = 0;  // completed writes, for which the kernel had to copy the data anyway
+    size_t pending_write_count = 0;        // writes, whose buffers are still referenced
+  };
+  ZeroCopyStats get_zero_copy_stats() const;
+
+  // a socket closed with pending zero-copy writes is shut down for writing, but is kept open and keeps
+  // references to their buffers until the writes are completed or the close timeout expires, after which
+  // the connection is reset; such sockets are checked by every run of Epoll and IoUring and by this function,
+  // which returns the number of sockets, which are still kept open, and must be called periodically if no poll
+  // is run; to release the socket and the buffers immediately, wait until pending_write_count is 0 before closing
+  static size_t process_closed_zero_copy_sockets();
+
+  // sets the maximum time in seconds for which sockets closed later are kept open; 10 seconds by default
+  static void set_zero_copy_close_timeout(double timeout);
+
+  // sets SO_BUSY_POLL, so that blocking receives busy poll the device queue for up to busy_poll_us microseconds,
+  // and SO_PREFER_BUSY_POLL if prefer_busy_poll is true; supported only on Linux
+  Status set_busy_poll(int32 busy_poll_us, bool prefer_busy_poll) TD_WARN_UNUSED_RESULT;
 
   const NativeFd &get_native_fd() const;
   static Result<SocketFd> from_native_fd(NativeFd fd);
@@ -54,6 +104,9 @@ class SocketFd {
 };
 
 namespace detail {
+// checks sockets closed with pending zero-copy writes at most once per 10 milliseconds; called by polls
+void process_closed_zero_copy_sockets();
+
 #if TD_PORT_POSIX
 Status get_socket_pending_error(const NativeFd &fd);
 #elif TD_PORT_WINDOWS
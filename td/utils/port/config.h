@@ -42,6 +42,16 @@
 
 #if TD_LINUX
   #define TD_HAS_MMSG 1
+  #if defined(__has_include)
+    // can be undefined by td/utils/port/detail/IoUring.h if the header is too old
+    #if __has_include(<linux/io_uring.h>)
+      #define TD_HAS_IO_URING 1
+    #endif
+  #endif
+#endif
+
+#if TD_LINUX || TD_ANDROID
+  #define TD_FUTEX_LINUX 1
 #endif
 
 // clang-format on
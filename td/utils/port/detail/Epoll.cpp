@@ -6,9 +6,12 @@ char disable_linker_warning_about_empty_file_epoll_cpp TD_UNUSED;
 
 #include "td/utils/format.h"
 #include "td/utils/logging.h"
+#include "td/utils/port/Clocks.h"
+#include "td/utils/port/SocketFd.h"
 #include "td/utils/Status.h"
 
 #include <cerrno>
+#include <utility>
 
 #include <unistd.h>
 
@@ -38,11 +41,26 @@ void Epoll::clear() {
 }
 
 void Epoll::subscribe(PollableFd fd, PollFlags flags) {
+  do_subscribe(std::move(fd), flags, false);
+}
+
+void Epoll::subscribe_exclusive(PollableFd fd, PollFlags flags) {
+  do_subscribe(std::move(fd), flags, true);
+}
+
+void Epoll::do_subscribe(PollableFd fd, PollFlags flags, bool is_exclusive) {
   epoll_event event;
   event.events = EPOLLHUP | EPOLLERR | EPOLLET;
+  if (is_exclusive) {
+    // EPOLLRDHUP can't be combined with EPOLLEXCLUSIVE
+#ifdef EPOLLEXCLUSIVE
+    event.events |= EPOLLEXCLUSIVE;
+#endif
+  } else {
 #ifdef EPOLLRDHUP
-  event.events |= EPOLLRDHUP;
+    event.events |= EPOLLRDHUP;
 #endif
+  }
   if (flags.can_read()) {
     event.events |= EPOLLIN;
   }
@@ -74,11 +92,45 @@ void Epoll::unsubscribe_before_close(PollableFdRef fd) {
   unsubscribe(fd);
 }
 
-void Epoll::run(int timeout_ms) {
+void Epoll::set_busy_poll(int32 max_spin_us) {
+  CHECK(max_spin_us >= 0);
+  max_spin_us_ = max_spin_us;
+  spin_us_ = max_spin_us;
+}
+
+int Epoll::wait(int timeout_ms) {
   int ready_n = epoll_wait(epoll_fd_.fd(), &events_[0], static_cast<int>(events_.size()), timeout_ms);
   auto epoll_wait_errno = errno;
   LOG_IF(FATAL, ready_n == -1 && epoll_wait_errno != EINTR)
       << Status::PosixError(epoll_wait_errno, "epoll_wait failed");
+  return ready_n;
+}
+
+int Epoll::busy_wait(int timeout_ms) {
+  busy_poll_stats_.spin_count++;
+  auto start_time = Clocks::monotonic();
+  auto end_time = start_time + spin_us_ * 1e-6;
+  // at least one check is done even if spin_us_ has decayed to zero, so that the spin time can grow again
+  do {
+    int ready_n = wait(0);
+    if (ready_n > 0) {
+      busy_poll_stats_.spin_success_count++;
+      spin_us_ = min(max(spin_us_, static_cast<int32>(1)) * 2, max_spin_us_);
+      return ready_n;
+    }
+  } while (Clocks::monotonic() < end_time);
+  spin_us_ /= 2;
+
+  busy_poll_stats_.block_count++;
+  if (timeout_ms > 0) {
+    auto spent_ms = static_cast<int>((Clocks::monotonic() - start_time) * 1000);
+    timeout_ms = max(timeout_ms - spent_ms, 0);
+  }
+  return wait(timeout_ms);
+}
+
+void Epoll::run(int timeout_ms) {
+  int ready_n = max_spin_us_ > 0 && timeout_ms != 0 ? busy_wait(timeout_ms) : wait(timeout_ms);
 
   for (int i = 0; i < ready_n; i++) {
     PollFlags flags;
@@ -113,6 +165,8 @@ void Epoll::run(int timeout_ms) {
     pollable_fd.add_flags(flags);
     pollable_fd.release_as_list_node();
   }
+
+  process_closed_zero_copy_sockets();
 }
 }  // namespace detail
 }  // namespace td
@@ -31,6 +31,10 @@ class Epoll final : public PollBase {
 
   void subscribe(PollableFd fd, PollFlags flags) override;
 
+  // subscribes with EPOLLEXCLUSIVE, so only one of the polls waiting for the same file is woken up by an event;
+  // intended for listening sockets, shared between several polls; closing isn't reported
+  void subscribe_exclusive(PollableFd fd, PollFlags flags);
+
   void unsubscribe(PollableFdRef fd) override;
 
   void unsubscribe_before_close(PollableFdRef fd) override;
@@ -41,10 +45,38 @@ class Epoll final : public PollBase {
     return true;
   }
 
+  // in busy-poll mode run checks for events without blocking for up to spin_us microseconds before it blocks;
+  // spin_us is halved after every spin, which found nothing, and doubled up to max_spin_us after every successful one
+  // max_spin_us == 0 disables the mode
+  void set_busy_poll(int32 max_spin_us);
+
+  struct BusyPollStats {
+    uint64 spin_count = 0;          // number of runs, which started with spinning
+    uint64 spin_success_count = 0;  // number of runs, in which events were found by spinning, i.e. saved wakeups
+    uint64 block_count = 0;         // number of runs, which blocked after spinning
+
+    double get_saved_wakeup_ratio() const {
+      return spin_count == 0 ? 0.0 : static_cast<double>(spin_success_count) / static_cast<double>(spin_count);
+    }
+  };
+  const BusyPollStats &get_busy_poll_stats() const {
+    return busy_poll_stats_;
+  }
+
  private:
   NativeFd epoll_fd_;
   vector<struct epoll_event> events_;
   ListNode list_root_;
+
+  int32 max_spin_us_ = 0;
+  int32 spin_us_ = 0;
+  BusyPollStats busy_poll_stats_;
+
+  int wait(int timeout_ms);
+
+  int busy_wait(int timeout_ms);
+
+  void do_subscribe(PollableFd fd, PollFlags flags, bool is_exclusive);
 };
 
 }  // namespace detail
@@ -0,0 +1,471 @@
+#include "td/utils/port/detail/IoUring.h"
+
+char disable_linker_warning_about_empty_file_io_uring_cpp TD_UNUSED;
+
+#ifdef TD_HAS_IO_URING
+
+#include "td/utils/logging.h"
+#include "td/utils/port/SocketFd.h"
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace td {
+namespace detail {
+
+constexpr size_t IoUringRing::MAX_RW_SIZE;
+constexpr size_t IoUring::MIN_READ_SIZE;
+constexpr size_t IoUring::MAX_READ_SIZE;
+
+IoUringRing::~IoUringRing() {
+  close();
+}
+
+Status IoUringRing::init(uint32 entries, uint32 completion_entries) {
+  CHECK(empty());
+  io_uring_params params;
+  std::memset(&params, 0, sizeof(params));
+  params.flags = IORING_SETUP_CQSIZE;
+  params.cq_entries = completion_entries;
+  auto ring_fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+  if (ring_fd < 0) {
+    return OS_ERROR("io_uring_setup failed");
+  }
+  ring_fd_ = NativeFd(ring_fd);
+
+  // IORING_FEAT_RSRC_TAGS was added in the same kernel version as multishot poll requests
+  constexpr uint32 REQUIRED_FEATURES =
+      IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG | IORING_FEAT_RSRC_TAGS;
+  if ((params.features & REQUIRED_FEATURES) != REQUIRED_FEATURES) {
+    close();
+    return Status::Error(PSLICE() << "Unsupported io_uring features " << params.features);
+  }
+
+  // with IORING_FEAT_SINGLE_MMAP both queues are mapped at once
+  sq_ring_size_ = max(params.sq_off.array + params.sq_entries * sizeof(uint32),
+                      params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+  sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+                  IORING_OFF_SQ_RING);
+  if (sq_ring_ == MAP_FAILED) {
+    auto status = OS_ERROR("Failed to map io_uring queues");
+    sq_ring_ = nullptr;
+    close();
+    return status;
+  }
+  cq_ring_ = sq_ring_;
+
+  sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+  auto *sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    auto status = OS_ERROR("Failed to map io_uring submission entries");
+    close();
+    return status;
+  }
+  sqes_ = static_cast<io_uring_sqe *>(sqes);
+
+  auto *sq_ring = static_cast<char *>(sq_ring_);
+  sq_head_ = reinterpret_cast<uint32 *>(sq_ring + params.sq_off.head);
+  sq_tail_ = reinterpret_cast<uint32 *>(sq_ring + params.sq_off.tail);
+  sq_array_ = reinterpret_cast<uint32 *>(sq_ring + params.sq_off.array);
+  sq_mask_ = *reinterpret_cast<uint32 *>(sq_ring + params.sq_off.ring_mask);
+  sq_entries_ = params.sq_entries;
+  sqe_tail_ = *sq_tail_;
+
+  auto *cq_ring = static_cast<char *>(cq_ring_);
+  cq_head_ = reinterpret_cast<uint32 *>(cq_ring + params.cq_off.head);
+  cq_tail_ = reinterpret_cast<uint32 *>(cq_ring + params.cq_off.tail);
+  cqes_ = reinterpret_cast<io_uring_cqe *>(cq_ring + params.cq_off.cqes);
+  cq_mask_ = *reinterpret_cast<uint32 *>(cq_ring + params.cq_off.ring_mask);
+  return Status::OK();
+}
+
+void IoUringRing::close() {
+  if (sqes_ != nullptr) {
+    munmap(sqes_, sqes_size_);
+    sqes_ = nullptr;
+  }
+  if (sq_ring_ != nullptr) {
+    munmap(sq_ring_, sq_ring_size_);
+    sq_ring_ = nullptr;
+    cq_ring_ = nullptr;
+  }
+  ring_fd_.close();
+}
+
+Status IoUringRing::register_event_fd(int event_fd) {
+  CHECK(!empty());
+  if (syscall(__NR_io_uring_register, ring_fd_.fd(), IORING_REGISTER_EVENTFD, &event_fd, 1) < 0) {
+    return OS_ERROR("Failed to register eventfd in io_uring");
+  }
+  return Status::OK();
+}
+
+io_uring_sqe *IoUringRing::get_sqe() {
+  CHECK(!empty());
+  if (sqe_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) == sq_entries_) {
+    // the submission queue is full
+    auto status = submit_and_wait(0, 0);
+    LOG_IF(FATAL, status.is_error()) << status;
+    CHECK(sqe_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) < sq_entries_);
+  }
+  auto index = sqe_tail_ & sq_mask_;
+  auto *sqe = &sqes_[index];
+  std::memset(sqe, 0, sizeof(*sqe));
+  sq_array_[index] = index;
+  sqe_tail_++;
+  return sqe;
+}
+
+void IoUringRing::prepare_rw(io_uring_sqe *sqe, bool is_write, int fd, char *data, size_t size, uint64 offset,
+                             uint64 user_data) {
+  sqe->opcode = is_write ? IORING_OP_WRITE : IORING_OP_READ;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<uint64>(data);
+  sqe->len = static_cast<uint32>(min(size, MAX_RW_SIZE));
+  sqe->off = offset;
+  sqe->user_data = user_data;
+}
+
+Status IoUringRing::submit_and_wait(uint32 wait_nr, int timeout_ms) {
+  CHECK(!empty());
+  __atomic_store_n(sq_tail_, sqe_tail_, __ATOMIC_RELEASE);
+  uint32 to_submit = sqe_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+  if (to_submit == 0 && wait_nr == 0) {
+    return Status::OK();
+  }
+
+  uint32 flags = 0;
+  io_uring_getevents_arg arg;
+  std::memset(&arg, 0, sizeof(arg));
+  struct timespec timeout;
+  if (wait_nr > 0) {
+    flags |= IORING_ENTER_GETEVENTS;
+    if (timeout_ms >= 0) {
+      timeout.tv_sec = timeout_ms / 1000;
+      timeout.tv_nsec = static_cast<long>(timeout_ms % 1000) * 1000000;
+      arg.ts = reinterpret_cast<uint64>(&timeout);
+      flags |= IORING_ENTER_EXT_ARG;
+    }
+  }
+  bool has_arg = (flags & IORING_ENTER_EXT_ARG) != 0;
+
+  enter_count_++;
+  auto result = syscall(__NR_io_uring_enter, ring_fd_.fd(), to_submit, wait_nr, flags, has_arg ? &arg : nullptr,
+                        has_arg ? sizeof(arg) : 0);
+  if (result < 0) {
+    auto io_uring_enter_errno = errno;
+    // ETIME means that the timeout has expired; EBUSY and EAGAIN mean that completions must be processed first
+    if (io_uring_enter_errno == ETIME || io_uring_enter_errno == EINTR || io_uring_enter_errno == EBUSY ||
+        io_uring_enter_errno == EAGAIN) {
+      return Status::OK();
+    }
+    return Status::PosixError(io_uring_enter_errno, "io_uring_enter failed");
+  }
+  return Status::OK();
+}
+
+void IoUring::init() {
+  CHECK(ring_.empty() && epoll_ == nullptr);
+  if (!is_epoll_forced_) {
+    // the completion queue must be big enough to avoid overflows, which terminate multishot poll requests
+    auto status = ring_.init(4096, 1 << 16);
+    if (status.is_ok()) {
+      return;
+    }
+    LOG(WARNING) << "Can't use io_uring, falling back to epoll: " << status;
+  }
+  epoll_ = make_unique<Epoll>();
+  epoll_->init();
+}
+
+void IoUring::clear() {
+  if (epoll_ != nullptr) {
+    epoll_->clear();
+    epoll_.reset();
+    return;
+  }
+  if (ring_.empty()) {
+    return;
+  }
+
+  // the kernel must stop writing to the input writers before they can be destroyed
+  bool has_active_reads = false;
+  for (auto &it : subscriptions_) {
+    auto *subscription = it.second.get();
+    subscription->is_unsubscribed = true;
+    if (subscription->is_read_active) {
+      submit_cancel(subscription, Operation::Read);
+      has_active_reads = true;
+    }
+  }
+  while (has_active_reads) {
+    auto status = ring_.submit_and_wait(1, -1);
+    LOG_IF(FATAL, status.is_error()) << status;
+    process_completions();
+    has_active_reads = false;
+    for (auto &it : subscriptions_) {
+      if (it.second->is_read_active) {
+        has_active_reads = true;
+      }
+    }
+  }
+
+  ring_.close();
+  subscriptions_.clear();
+  list_node_to_subscription_id_.clear();
+
+  for (auto *list_node = list_root_.next; list_node != &list_root_;) {
+    auto pollable_fd = PollableFd::from_list_node(list_node);
+    list_node = list_node->next;
+  }
+}
+
+IoUring::Subscription *IoUring::do_subscribe(PollableFd fd, uint32 poll_events) {
+  auto subscription = make_unique<Subscription>();
+  subscription->id = ++last_subscription_id_;
+  subscription->native_fd = fd.native_fd().fd();
+  subscription->poll_events = poll_events;
+  auto *list_node = fd.release_as_list_node();
+  list_root_.put(list_node);
+  subscription->list_node = list_node;
+
+  auto *result = subscription.get();
+  list_node_to_subscription_id_[get_list_node_key(list_node)] = result->id;
+  subscriptions_[result->id] = std::move(subscription);
+  return result;
+}
+
+void IoUring::subscribe(PollableFd fd, PollFlags flags) {
+  if (epoll_ != nullptr) {
+    return epoll_->subscribe(std::move(fd), flags);
+  }
+
+  uint32 poll_events = EPOLLHUP | EPOLLERR | EPOLLRDHUP | EPOLLET;
+  if (flags.can_read()) {
+    poll_events |= EPOLLIN;
+  }
+  if (flags.can_write()) {
+    poll_events |= EPOLLOUT;
+  }
+  submit_poll(do_subscribe(std::move(fd), poll_events));
+}
+
+bool IoUring::subscribe_with_completion_read(PollableFd fd, PollFlags flags, ChainBufferWriter *input_writer) {
+  CHECK(input_writer != nullptr);
+  if (epoll_ != nullptr) {
+    epoll_->subscribe(std::move(fd), flags);
+    return false;
+  }
+
+  // hang-ups and errors are reported by the reads, so they aren't reported before all preceding data is read
+  uint32 poll_events = 0;
+  if (flags.can_write()) {
+    poll_events |= EPOLLOUT | EPOLLET;
+  }
+  auto *subscription = do_subscribe(std::move(fd), poll_events);
+  subscription->input_writer = input_writer;
+  if (poll_events != 0) {
+    submit_poll(subscription);
+  }
+  submit_read(subscription, MIN_READ_SIZE);
+  return true;
+}
+
+void IoUring::do_unsubscribe(PollableFdRef fd_ref) {
+  auto fd = fd_ref.lock();
+  auto *list_node = fd.release_as_list_node();
+  fd = PollableFd::from_list_node(list_node);
+
+  auto id_it = list_node_to_subscription_id_.find(get_list_node_key(list_node));
+  CHECK(id_it != list_node_to_subscription_id_.end());
+  auto subscription_it = subscriptions_.find(id_it->second);
+  list_node_to_subscription_id_.erase(id_it);
+  CHECK(subscription_it != subscriptions_.end());
+  auto *subscription = subscription_it->second.get();
+  subscription->is_unsubscribed = true;
+
+  if (subscription->is_poll_active) {
+    submit_cancel(subscription, Operation::Poll);
+  }
+  if (subscription->is_read_active) {
+    submit_cancel(subscription, Operation::Read);
+  }
+  // the cancellation is submitted immediately to release the kernel's reference to the file
+  auto status = ring_.submit_and_wait(0, 0);
+  LOG_IF(FATAL, status.is_error()) << status;
+
+  // the kernel must stop writing to the input writer before it can be destroyed
+  while (subscription->is_read_active) {
+    status = ring_.submit_and_wait(1, -1);
+    LOG_IF(FATAL, status.is_error()) << status;
+    process_completions();
+  }
+
+  // completions of the canceled poll request will be ignored
+  subscriptions_.erase(subscription->id);
+}
+
+void IoUring::unsubscribe(PollableFdRef fd_ref) {
+  if (epoll_ != nullptr) {
+    return epoll_->unsubscribe(fd_ref);
+  }
+  do_unsubscribe(fd_ref);
+}
+
+void IoUring::unsubscribe_before_close(PollableFdRef fd_ref) {
+  if (epoll_ != nullptr) {
+    return epoll_->unsubscribe_before_close(fd_ref);
+  }
+  do_unsubscribe(fd_ref);
+}
+
+void IoUring::submit_poll(Subscription *subscription) {
+  auto *sqe = ring_.get_sqe();
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = subscription->native_fd;
+  sqe->len = IORING_POLL_ADD_MULTI;
+  sqe->poll32_events = subscription->poll_events;
+  sqe->user_data = get_user_data(subscription, Operation::Poll);
+  subscription->is_poll_active = true;
+}
+
+void IoUring::submit_read(Subscription *subscription, size_t read_size) {
+  auto slice_count = subscription->input_writer->prepare_append_io_slices(
+      MutableSpan<IoSlice>(subscription->read_slices, MAX_READ_SLICES), read_size);
+  subscription->prepared_read_size = 0;
+  for (size_t i = 0; i < slice_count; i++) {
+    subscription->prepared_read_size += as_slice(subscription->read_slices[i]).size();
+  }
+  auto *sqe = ring_.get_sqe();
+  sqe->opcode = IORING_OP_READV;
+  sqe->fd = subscription->native_fd;
+  sqe->addr = reinterpret_cast<uint64>(subscription->read_slices);
+  sqe->len = static_cast<uint32>(slice_count);
+  sqe->off = static_cast<uint64>(-1);
+  sqe->user_data = get_user_data(subscription, Operation::Read);
+  subscription->is_read_active = true;
+}
+
+void IoUring::submit_cancel(Subscription *subscription, Operation operation) {
+  auto *sqe = ring_.get_sqe();
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = get_user_data(subscription, operation);
+  sqe->user_data = get_user_data(subscription, Operation::Cancel);
+}
+
+void IoUring::run(int timeout_ms) {
+  if (epoll_ != nullptr) {
+    return epoll_->run(timeout_ms);
+  }
+
+  auto status = ring_.submit_and_wait(timeout_ms == 0 ? 0 : 1, timeout_ms);
+  LOG_IF(FATAL, status.is_error()) << status;
+  process_completions();
+  process_closed_zero_copy_sockets();
+}
+
+void IoUring::process_completions() {
+  ring_.for_each_cqe([&](const io_uring_cqe &cqe) {
+    auto operation = static_cast<Operation>(cqe.user_data & 3);
+    if (operation == Operation::Cancel) {
+      return;
+    }
+    auto it = subscriptions_.find(cqe.user_data >> 2);
+    if (it == subscriptions_.end()) {
+      // the fd has already been unsubscribed
+      return;
+    }
+    if (operation == Operation::Poll) {
+      on_poll_completed(it->second.get(), cqe);
+    } else {
+      on_read_completed(it->second.get(), cqe);
+    }
+  });
+}
+
+void IoUring::add_flags(Subscription *subscription, PollFlags flags) {
+  auto pollable_fd = PollableFd::from_list_node(subscription->list_node);
+  pollable_fd.add_flags(flags);
+  pollable_fd.release_as_list_node();
+}
+
+void IoUring::on_poll_completed(Subscription *subscription, const io_uring_cqe &cqe) {
+  if ((cqe.flags & IORING_CQE_F_MORE) == 0) {
+    subscription->is_poll_active = false;
+  }
+  if (subscription->is_unsubscribed) {
+    return;
+  }
+  if (cqe.res < 0) {
+    if (cqe.res != -ECANCELED) {
+      LOG(ERROR) << Status::PosixError(-cqe.res, "Poll request failed") << ", fd = " << subscription->native_fd;
+      add_flags(subscription, PollFlags::Error());
+    }
+    return;
+  }
+
+  auto events = static_cast<uint32>(cqe.res);
+  PollFlags flags;
+  if (events & EPOLLIN) {
+    flags = flags | PollFlags::Read();
+  }
+  if (events & EPOLLOUT) {
+    flags = flags | PollFlags::Write();
+  }
+  if (events & (EPOLLRDHUP | EPOLLHUP)) {
+    flags = flags | PollFlags::Close();
+  }
+  if (events & EPOLLERR) {
+    flags = flags | PollFlags::Error();
+  }
+  add_flags(subscription, flags);
+
+  if (!subscription->is_poll_active) {
+    // the kernel has terminated the multishot request, for example, because of completion queue overflow
+    submit_poll(subscription);
+  }
+}
+
+void IoUring::on_read_completed(Subscription *subscription, const io_uring_cqe &cqe) {
+  subscription->is_read_active = false;
+  subscription->input_writer->confirm_append_io_slices(cqe.res > 0 ? static_cast<size_t>(cqe.res) : 0);
+  if (subscription->is_unsubscribed) {
+    return;
+  }
+
+  if (cqe.res > 0) {
+    // the buffers are grown if they were filled and shrunk if they were mostly unused, like in BufferedFd
+    auto read_size = static_cast<size_t>(cqe.res);
+    auto is_full = read_size == subscription->prepared_read_size;
+    if (is_full) {
+      if (subscription->prepared_read_size >= subscription->read_size) {
+        subscription->read_size = min(max(subscription->read_size, read_size) * 2, MAX_READ_SIZE);
+      }
+    } else if (read_size < subscription->read_size / 4) {
+      subscription->read_size = max(subscription->read_size / 2, MIN_READ_SIZE);
+    }
+    add_flags(subscription, PollFlags::Read());
+    // after a short read the socket is likely to be drained, so the next read can wait for data for a long time;
+    // it is submitted with minimal buffers to avoid keeping large buffers allocated for idle connections
+    submit_read(subscription, is_full ? subscription->read_size : MIN_READ_SIZE);
+  } else if (cqe.res == 0) {
+    add_flags(subscription, PollFlags::Close());
+  } else if (cqe.res == -EINTR || cqe.res == -EAGAIN) {
+    submit_read(subscription, MIN_READ_SIZE);
+  } else if (cqe.res != -ECANCELED) {
+    VLOG(fd) << Status::PosixError(-cqe.res, "Read request failed") << ", fd = " << subscription->native_fd;
+    add_flags(subscription, PollFlags::Error() | PollFlags::Close());
+  }
+}
+
+}  // namespace detail
+}  // namespace td
+
+#endif
@@ -0,0 +1,213 @@
+#pragma once
+
+#include "td/utils/port/config.h"
+
+#ifdef TD_HAS_IO_URING
+#include <linux/io_uring.h>
+
+// the implementation uses the kernel API of Linux 5.13, including multishot poll requests and extended arguments
+// of io_uring_enter, so io_uring isn't used with older kernel headers
+#ifndef IORING_POLL_ADD_MULTI
+#undef TD_HAS_IO_URING
+#endif
+#endif
+
+#ifdef TD_HAS_IO_URING
+
+#include "td/utils/buffer.h"
+#include "td/utils/common.h"
+#include "td/utils/FlatHashMap.h"
+#include "td/utils/List.h"
+#include "td/utils/port/detail/Epoll.h"
+#include "td/utils/port/detail/NativeFd.h"
+#include "td/utils/port/detail/PollableFd.h"
+#include "td/utils/port/IoSlice.h"
+#include "td/utils/port/PollBase.h"
+#include "td/utils/port/PollFlags.h"
+#include "td/utils/Status.h"
+
+#include <cstdint>
+
+namespace td {
+namespace detail {
+
+// Submission and completion queues of an io_uring instance
+class IoUringRing {
+ public:
+  IoUringRing() = default;
+  IoUringRing(const IoUringRing &) = delete;
+  IoUringRing &operator=(const IoUringRing &) = delete;
+  IoUringRing(IoUringRing &&) = delete;
+  IoUringRing &operator=(IoUringRing &&) = delete;
+  ~IoUringRing();
+
+  // fails if io_uring isn't supported by the kernel or is forbidden by the sandbox
+  Status init(uint32 entries, uint32 completion_entries) TD_WARN_UNUSED_RESULT;
+
+  void close();
+
+  bool empty() const {
+    return !ring_fd_;
+  }
+
+  // the eventfd will be signaled after every posted completion
+  Status register_event_fd(int event_fd) TD_WARN_UNUSED_RESULT;
+
+  // returns a zeroed entry, which will be submitted by the next call to submit_and_wait
+  io_uring_sqe *get_sqe();
+
+  // the kernel transfers at most MAX_RW_SIZE bytes by one read or write
+  static constexpr size_t MAX_RW_SIZE = 0x7ffff000;
+
+  // fills a zeroed entry with a read or a write at the given offset; bigger requests are limited to MAX_RW_SIZE
+  // bytes and complete partially
+  static void prepare_rw(io_uring_sqe *sqe, bool is_write, int fd, char *data, size_t size, uint64 offset,
+                         uint64 user_data);
+
+  // submits all prepared entries and waits for at least wait_nr completions;
+  // waits no longer than timeout_ms milliseconds if timeout_ms is non-negative
+  Status submit_and_wait(uint32 wait_nr, int timeout_ms) TD_WARN_UNUSED_RESULT;
+
+  // calls f(const io_uring_cqe &) for all available completions; returns the number of completions
+  template <class F>
+  size_t for_each_cqe(F &&f) {
+    auto head = *cq_head_;
+    auto tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    size_t result = tail - head;
+    for (; head != tail; head++) {
+      f(cqes_[head & cq_mask_]);
+      // the completion can be overwritten by the kernel after the head is advanced
+      __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+    }
+    return result;
+  }
+
+  // returns total number of io_uring_enter system calls
+  uint64 get_enter_count() const {
+    return enter_count_;
+  }
+
+ private:
+  NativeFd ring_fd_;
+
+  void *sq_ring_ = nullptr;
+  size_t sq_ring_size_ = 0;
+  void *cq_ring_ = nullptr;
+  size_t cq_ring_size_ = 0;
+  io_uring_sqe *sqes_ = nullptr;
+  size_t sqes_size_ = 0;
+
+  uint32 *sq_head_ = nullptr;
+  uint32 *sq_tail_ = nullptr;
+  uint32 *sq_array_ = nullptr;
+  uint32 sq_mask_ = 0;
+  uint32 sq_entries_ = 0;
+  uint32 sqe_tail_ = 0;
+
+  uint32 *cq_head_ = nullptr;
+  uint32 *cq_tail_ = nullptr;
+  io_uring_cqe *cqes_ = nullptr;
+  uint32 cq_mask_ = 0;
+
+  uint64 enter_count_ = 0;
+};
+
+// Poll based on multishot poll requests of io_uring, which can also read data from sockets directly to ChainBufferWriter
+// If io_uring can't be used, then Epoll is used instead
+class IoUring final : public PollBase {
+ public:
+  IoUring() = default;
+  IoUring(const IoUring &) = delete;
+  IoUring &operator=(const IoUring &) = delete;
+  IoUring(IoUring &&) = delete;
+  IoUring &operator=(IoUring &&) = delete;
+  ~IoUring() override = default;
+
+  void init() override;
+
+  void clear() override;
+
+  void subscribe(PollableFd fd, PollFlags flags) override;
+
+  void unsubscribe(PollableFdRef fd) override;
+
+  void unsubscribe_before_close(PollableFdRef fd) override;
+
+  void run(int timeout_ms) override;
+
+  // Completion-based reading: data is read to input_writer as soon as it arrives, after which PollFlags::Read()
+  // is added to the fd, so BufferedFd::set_completion_read must be enabled. End of the stream is reported as
+  // PollFlags::Close(). The writer must be used only from the thread calling run and must not be destroyed
+  // before the fd is unsubscribed. Returns false and subscribes the fd as usual if io_uring isn't used.
+  bool subscribe_with_completion_read(PollableFd fd, PollFlags flags, ChainBufferWriter *input_writer);
+
+  // returns false if Epoll is used instead of io_uring
+  bool is_io_uring_used() const {
+    return !ring_.empty();
+  }
+
+  // makes the next init use Epoll; for testing purposes
+  void force_epoll_fallback() {
+    is_epoll_forced_ = true;
+  }
+
+  static bool is_edge_triggered() {
+    return true;
+  }
+
+ private:
+  static constexpr size_t MAX_READ_SLICES = 8;
+  static constexpr size_t MIN_READ_SIZE = 1 << 12;
+  static constexpr size_t MAX_READ_SIZE = 1 << 20;
+
+  enum class Operation : uint64 { Poll, Read, Cancel };
+
+  struct Subscription {
+    uint64 id = 0;
+    int native_fd = -1;
+    ListNode *list_node = nullptr;
+    uint32 poll_events = 0;
+    bool is_poll_active = false;
+    bool is_unsubscribed = false;
+
+    // used only in completion-based reading mode
+    ChainBufferWriter *input_writer = nullptr;
+    bool is_read_active = false;
+    size_t read_size = MIN_READ_SIZE;
+    size_t prepared_read_size = 0;
+    IoSlice read_slices[MAX_READ_SLICES];
+  };
+
+  IoUringRing ring_;
+  unique_ptr<Epoll> epoll_;
+  bool is_epoll_forced_ = false;
+
+  ListNode list_root_;
+  uint64 last_subscription_id_ = 0;
+  FlatHashMap<uint64, unique_ptr<Subscription>> subscriptions_;
+  FlatHashMap<uint64, uint64> list_node_to_subscription_id_;
+
+  Subscription *do_subscribe(PollableFd fd, uint32 poll_events);
+  void do_unsubscribe(PollableFdRef fd_ref);
+
+  void submit_poll(Subscription *subscription);
+  void submit_read(Subscription *subscription, size_t read_size);
+  void submit_cancel(Subscription *subscription, Operation operation);
+
+  void process_completions();
+  void on_poll_completed(Subscription *subscription, const io_uring_cqe &cqe);
+  void on_read_completed(Subscription *subscription, const io_uring_cqe &cqe);
+  static void add_flags(Subscription *subscription, PollFlags flags);
+
+  static uint64 get_user_data(const Subscription *subscription, Operation operation) {
+    return (subscription->id << 2) | static_cast<uint64>(operation);
+  }
+  static uint64 get_list_node_key(const ListNode *list_node) {
+    return static_cast<uint64>(reinterpret_cast<std::uintptr_t>(list_node));
+  }
+};
+
+}  // namespace detail
+}  // namespace td
+
+#endif
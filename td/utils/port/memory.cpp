@@ -0,0 +1,159 @@
+#include "td/utils/port/memory.h"
+
+#include "td/utils/port/config.h"
+
+#include "td/utils/logging.h"
+#include "td/utils/misc.h"
+#include "td/utils/port/FileFd.h"
+#include "td/utils/ScopeGuard.h"
+
+#if TD_PORT_POSIX
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace td {
+
+size_t get_page_size() {
+#if TD_PORT_POSIX
+  static const size_t page_size = [] {
+    auto page_size = sysconf(_SC_PAGESIZE);
+    return page_size > 0 ? static_cast<size_t>(page_size) : static_cast<size_t>(4096);
+  }();
+  return page_size;
+#else
+  return 0;
+#endif
+}
+
+#if TD_LINUX && defined(MAP_HUGETLB)
+// MAP_HUGETLB uses huge pages of the default size, which depends on the architecture and the kernel command line
+static Result<size_t> read_default_huge_page_size() {
+  TRY_RESULT(fd, FileFd::open("/proc/meminfo", FileFd::Read));
+  SCOPE_EXIT {
+    fd.close();
+  };
+
+  constexpr size_t MEMINFO_SIZE = 1 << 14;
+  char meminfo[MEMINFO_SIZE];
+  TRY_RESULT(size, fd.read(MutableSlice(meminfo, MEMINFO_SIZE)));
+
+  Slice name("Hugepagesize:");
+  for (auto line : full_split(Slice(meminfo, size), '\n')) {
+    if (begins_with(line, name)) {
+      line.remove_prefix(name.size());
+      line = trim(line);
+      if (!ends_with(line, " kB")) {
+        break;
+      }
+      line.remove_suffix(3);
+      TRY_RESULT(huge_page_size_kb, to_integer_safe<size_t>(line));
+      return huge_page_size_kb << 10;
+    }
+  }
+  return Status::Error("Hugepagesize not found in /proc/meminfo");
+}
+#endif
+
+size_t get_huge_page_size() {
+#if TD_LINUX && defined(MAP_HUGETLB)
+  static const size_t huge_page_size = [] {
+    auto r_huge_page_size = read_default_huge_page_size();
+    if (r_huge_page_size.is_error()) {
+      LOG(INFO) << "Can't get huge page size: " << r_huge_page_size.error();
+      return static_cast<size_t>(0);
+    }
+    auto huge_page_size = r_huge_page_size.ok();
+    if (huge_page_size == 0 || (huge_page_size & (huge_page_size - 1)) != 0) {
+      return static_cast<size_t>(0);
+    }
+    return huge_page_size;
+  }();
+  return huge_page_size;
+#else
+  return 0;
+#endif
+}
+
+Result<MutableSlice> map_anonymous_memory(size_t size, bool use_huge_pages, bool populate) {
+#if TD_PORT_POSIX
+  CHECK(size > 0);
+  int flags = MAP_PRIVATE | MAP_ANON;
+  if (use_huge_pages) {
+#if TD_LINUX && defined(MAP_HUGETLB)
+    auto huge_page_size = get_huge_page_size();
+    if (huge_page_size == 0) {
+      return Status::Error("Huge pages are unsupported");
+    }
+    CHECK(size % huge_page_size == 0);
+    flags |= MAP_HUGETLB;
+#else
+    return Status::Error("Huge pages are unsupported");
+#endif
+  }
+  if (populate) {
+#if TD_LINUX && defined(MAP_POPULATE)
+    flags |= MAP_POPULATE;
+#endif
+  }
+  auto *ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+  if (ptr == MAP_FAILED) {
+    return OS_ERROR(PSLICE() << "mmap of " << size << " bytes failed");
+  }
+  return MutableSlice(static_cast<char *>(ptr), size);
+#else
+  return Status::Error("Anonymous memory mappings are unsupported");
+#endif
+}
+
+void unmap_memory(MutableSlice memory) {
+#if TD_PORT_POSIX
+  if (munmap(memory.data(), memory.size()) != 0) {
+    auto error = OS_ERROR("munmap failed");
+    LOG(FATAL) << error;
+  }
+#else
+  UNREACHABLE();
+#endif
+}
+
+Status advise_transparent_huge_pages(MutableSlice memory) {
+#if TD_LINUX && defined(MADV_HUGEPAGE)
+  if (madvise(memory.data(), memory.size(), MADV_HUGEPAGE) != 0) {
+    return OS_ERROR("madvise(MADV_HUGEPAGE) failed");
+  }
+  return Status::OK();
+#else
+  return Status::Error("Transparent huge pages are unsupported");
+#endif
+}
+
+Status populate_memory(MutableSlice memory) {
+#if TD_LINUX && defined(MADV_POPULATE_WRITE)
+  if (madvise(memory.data(), memory.size(), MADV_POPULATE_WRITE) == 0) {
+    return Status::OK();
+  }
+#endif
+  auto page_size = get_page_size();
+  if (page_size == 0) {
+    return Status::Error("Memory pages are unsupported");
+  }
+  // write to every page; the memory is expected to be zero-filled, so the content doesn't change
+  for (size_t i = 0; i < memory.size(); i += page_size) {
+    reinterpret_cast<volatile char *>(memory.data())[i] = 0;
+  }
+  return Status::OK();
+}
+
+Status release_memory_pages(MutableSlice memory) {
+#if TD_PORT_POSIX
+  if (madvise(memory.data(), memory.size(), MADV_DONTNEED) != 0) {
+    return OS_ERROR("madvise(MADV_DONTNEED) failed");
+  }
+  return Status::OK();
+#else
+  return Status::Error("Unsupported");
+#endif
+}
+
+}  // namespace td
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "td/utils/common.h"
+#include "td/utils/Slice.h"
+#include "td/utils/Status.h"
+
+namespace td {
+
+// returns size of a memory page or 0 if anonymous memory mappings aren't supported
+size_t get_page_size();
+
+// returns size of a huge page used for explicit huge page mappings or 0 if they aren't supported
+size_t get_huge_page_size();
+
+// maps size bytes of zero-initialized anonymous memory
+// size must be a multiple of the page size, or of the huge page size if use_huge_pages is true
+// if populate is true, page tables are filled before return
+Result<MutableSlice> map_anonymous_memory(size_t size, bool use_huge_pages = false,
+                                          bool populate = false) TD_WARN_UNUSED_RESULT;
+
+void unmap_memory(MutableSlice memory);
+
+// asks the system to back the memory with transparent huge pages
+Status advise_transparent_huge_pages(MutableSlice memory) TD_WARN_UNUSED_RESULT;
+
+// allocates physical pages for the whole memory without waiting for page faults
+Status populate_memory(MutableSlice memory) TD_WARN_UNUSED_RESULT;
+
+// returns physical pages of the memory to the system; the memory is zero-filled on the next access
+Status release_memory_pages(MutableSlice memory) TD_WARN_UNUSED_RESULT;
+
+}  // namespace td
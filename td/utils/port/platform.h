@@ -107,4 +107,8 @@
 #define TD_HAVE_INT128 1
 #endif
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TD_HAVE_SSE2 1
+#endif
+
 // clang-format on
@@ -0,0 +1,302 @@
+#include "td/utils/tests.h"
+
+#include "td/utils/common.h"
+#include "td/utils/logging.h"
+#include "td/utils/port/AsyncFileIo.h"
+#include "td/utils/port/FileFd.h"
+#include "td/utils/port/memory.h"
+#include "td/utils/port/path.h"
+#include "td/utils/port/Poll.h"
+#include "td/utils/port/PollFlags.h"
+#include "td/utils/Random.h"
+#include "td/utils/Slice.h"
+#include "td/utils/Status.h"
+#include "td/utils/Time.h"
+
+#if !TD_THREAD_UNSUPPORTED && !TD_EVENTFD_UNSUPPORTED && TD_POLL_EPOLL
+
+using namespace td;
+
+namespace {
+FileFd create_test_file(CSlice name) {
+  unlink(name).ignore();
+  return FileFd::open(name, FileFd::Read | FileFd::Write | FileFd::Create | FileFd::Truncate).move_as_ok();
+}
+
+// waits for completions using a Poll, to which the EventFd of the AsyncFileIo is subscribed
+void wait_completions(Poll &poll, AsyncFileIo &io, vector<AsyncFileIo::Completion> &completions) {
+  auto &event_fd = io.get_event_fd();
+  while (io.get_pending_count() > 0) {
+    poll.run(1000);
+    event_fd.get_poll_info().sync_with_poll();
+    if (event_fd.get_poll_info().get_flags_local().can_read()) {
+      io.reap(completions);
+    }
+  }
+}
+}  // namespace
+
+TEST(AsyncFileIo, simple) {
+  CSlice name = "async_file_io_test_file";
+  constexpr size_t BLOCK_SIZE = 1000;
+  constexpr size_t BLOCK_COUNT = 100;
+
+  for (auto force_thread_pool : {false, true}) {
+    AsyncFileIo io;
+    if (force_thread_pool) {
+      io.force_thread_pool();
+    }
+    io.init(2);
+    if (force_thread_pool) {
+      ASSERT_TRUE(!io.is_io_uring_used());
+    } else if (!io.is_io_uring_used()) {
+      LOG(WARNING) << "io_uring can't be used";
+    }
+
+    Poll poll;
+    poll.init();
+    poll.subscribe(io.get_event_fd().get_poll_info().extract_pollable_fd(nullptr), PollFlags::Read());
+
+    auto fd = create_test_file(name);
+    string data(BLOCK_SIZE * BLOCK_COUNT, '\0');
+    for (auto &c : data) {
+      c = static_cast<char>(Random::fast(0, 255));
+    }
+
+    // blocks are written in the reverse order to check that offsets are honored
+    for (size_t i = 0; i < BLOCK_COUNT; i++) {
+      auto block = BLOCK_COUNT - 1 - i;
+      io.write(fd, Slice(data).substr(block * BLOCK_SIZE, BLOCK_SIZE), static_cast<int64>(block * BLOCK_SIZE),
+               block);
+    }
+    ASSERT_EQ(BLOCK_COUNT, io.get_pending_count());
+    io.flush();
+
+    vector<AsyncFileIo::Completion> completions;
+    wait_completions(poll, io, completions);
+    ASSERT_EQ(BLOCK_COUNT, completions.size());
+    vector<bool> is_completed(BLOCK_COUNT);
+    for (auto &completion : completions) {
+      ASSERT_TRUE(completion.token < BLOCK_COUNT);
+      ASSERT_TRUE(!is_completed[completion.token]);
+      is_completed[completion.token] = true;
+      ASSERT_EQ(BLOCK_SIZE, completion.result.ok());
+    }
+    ASSERT_EQ(static_cast<int64>(data.size()), fd.get_size().move_as_ok());
+
+    string read_data(data.size() + BLOCK_SIZE, '\0');
+    for (size_t i = 0; i <= BLOCK_COUNT; i++) {
+      io.read(fd, MutableSlice(read_data).substr(i * BLOCK_SIZE, BLOCK_SIZE), static_cast<int64>(i * BLOCK_SIZE), i);
+    }
+    io.flush();
+    completions.clear();
+    wait_completions(poll, io, completions);
+    ASSERT_EQ(BLOCK_COUNT + 1, completions.size());
+    for (auto &completion : completions) {
+      // the last read is beyond the end of file
+      ASSERT_EQ(completion.token == BLOCK_COUNT ? 0u : BLOCK_SIZE, completion.result.ok());
+    }
+    ASSERT_TRUE(Slice(read_data).substr(0, data.size()) == data);
+
+    // errors are reported through completions
+    auto read_only_fd = FileFd::open(name, FileFd::Read).move_as_ok();
+    io.write(read_only_fd, Slice("a"), 0, 12345);
+    io.flush();
+    completions.clear();
+    wait_completions(poll, io, completions);
+    ASSERT_EQ(1u, completions.size());
+    ASSERT_EQ(12345u, completions[0].token);
+    ASSERT_TRUE(completions[0].result.is_error());
+
+    // requests of 4 GiB or more complete partially; only the bytes till the end of file are read into the buffer
+    if (sizeof(size_t) > 4) {
+      auto r_memory = map_anonymous_memory((static_cast<size_t>(1) << 32) + get_page_size());
+      if (r_memory.is_ok()) {
+        auto memory = r_memory.move_as_ok();
+        io.read(fd, memory, 0, 54321);
+        io.flush();
+        completions.clear();
+        wait_completions(poll, io, completions);
+        ASSERT_EQ(1u, completions.size());
+        ASSERT_EQ(54321u, completions[0].token);
+        ASSERT_EQ(data.size(), completions[0].result.ok());
+        ASSERT_TRUE(memory.substr(0, data.size()) == data);
+        unmap_memory(memory);
+      }
+    }
+
+    poll.unsubscribe(io.get_event_fd().get_poll_info().get_pollable_fd_ref());
+    poll.clear();
+    io.close();
+    read_only_fd.close();
+    fd.close();
+    unlink(name).ensure();
+  }
+}
+
+// there are more requests than completions, which can be held by the io_uring completion queue
+TEST(AsyncFileIo, many_requests) {
+  CSlice name = "async_file_io_test_file";
+  constexpr size_t REQUEST_COUNT = 20000;
+  for (auto force_thread_pool : {false, true}) {
+    auto fd = create_test_file(name);
+    string data(1000, '\0');
+    for (size_t i = 0; i < data.size(); i++) {
+      data[i] = static_cast<char>(i % 251);
+    }
+    ASSERT_EQ(data.size(), fd.pwrite(data, 0).move_as_ok());
+
+    AsyncFileIo io;
+    if (force_thread_pool) {
+      io.force_thread_pool();
+    }
+    io.init(2);
+    Poll poll;
+    poll.init();
+    poll.subscribe(io.get_event_fd().get_poll_info().extract_pollable_fd(nullptr), PollFlags::Read());
+
+    string read_data(REQUEST_COUNT, '\0');
+    for (size_t i = 0; i < REQUEST_COUNT; i++) {
+      io.read(fd, MutableSlice(read_data).substr(i, 1), static_cast<int64>(i % data.size()), i);
+    }
+    ASSERT_EQ(REQUEST_COUNT, io.get_pending_count());
+    io.flush();
+
+    vector<AsyncFileIo::Completion> completions;
+    wait_completions(poll, io, completions);
+    ASSERT_EQ(REQUEST_COUNT, completions.size());
+    for (auto &completion : completions) {
+      ASSERT_EQ(1u, completion.result.ok());
+    }
+    for (size_t i = 0; i < REQUEST_COUNT; i++) {
+      ASSERT_EQ(data[i % data.size()], read_data[i]);
+    }
+
+    poll.unsubscribe(io.get_event_fd().get_poll_info().get_pollable_fd_ref());
+    poll.clear();
+    io.close();
+    fd.close();
+    unlink(name).ensure();
+  }
+}
+
+TEST(AsyncFileIo, close_with_pending_requests) {
+  CSlice name = "async_file_io_test_file";
+  for (auto force_thread_pool : {false, true}) {
+    auto fd = create_test_file(name);
+    string data(1 << 16, 'a');
+    AsyncFileIo io;
+    if (force_thread_pool) {
+      io.force_thread_pool();
+    }
+    io.init(2);
+    for (int i = 0; i < 16; i++) {
+      io.write(fd, data, i * static_cast<int64>(data.size()), i);
+    }
+    io.flush();
+    io.close();
+    ASSERT_EQ(static_cast<int64>(16 * data.size()), fd.get_size().move_as_ok());
+    fd.close();
+    unlink(name).ensure();
+  }
+}
+
+namespace {
+constexpr size_t BENCHMARK_FILE_SIZE = 64 << 20;
+constexpr size_t BENCHMARK_READ_SIZE = 4096;
+constexpr size_t BENCHMARK_BATCH_SIZE = 256;
+constexpr size_t BENCHMARK_READ_COUNT = 200000;
+
+int64 get_random_offset() {
+  return static_cast<int64>(Random::fast(0, static_cast<int>(BENCHMARK_FILE_SIZE / BENCHMARK_READ_SIZE) - 1) *
+                            BENCHMARK_READ_SIZE);
+}
+
+void report_iops(Slice mode, double passed_time) {
+  LOG(ERROR) << "Random " << BENCHMARK_READ_SIZE << "-byte reads with " << mode << ": "
+             << static_cast<double>(BENCHMARK_READ_COUNT) / passed_time << " IOPS";
+}
+
+void run_sync_read_benchmark(FileFd &fd) {
+  string buffer(BENCHMARK_READ_SIZE, '\0');
+  auto start_time = Time::now();
+  for (size_t i = 0; i < BENCHMARK_READ_COUNT; i++) {
+    CHECK(fd.pread(buffer, get_random_offset()).move_as_ok() == BENCHMARK_READ_SIZE);
+  }
+  report_iops("pread", Time::now() - start_time);
+}
+
+void run_async_read_benchmark(FileFd &fd, bool force_thread_pool) {
+  AsyncFileIo io;
+  if (force_thread_pool) {
+    io.force_thread_pool();
+  }
+  io.init();
+  if (!force_thread_pool && !io.is_io_uring_used()) {
+    LOG(ERROR) << "Skip benchmark of io_uring, because it can't be used";
+    return;
+  }
+
+  Poll poll;
+  poll.init();
+  poll.subscribe(io.get_event_fd().get_poll_info().extract_pollable_fd(nullptr), PollFlags::Read());
+
+  // up to BENCHMARK_BATCH_SIZE reads are kept in flight
+  string buffer(BENCHMARK_READ_SIZE * BENCHMARK_BATCH_SIZE, '\0');
+  vector<uint64> free_tokens;
+  for (size_t i = 0; i < BENCHMARK_BATCH_SIZE; i++) {
+    free_tokens.push_back(i);
+  }
+  vector<AsyncFileIo::Completion> completions;
+  size_t submitted_count = 0;
+  size_t completed_count = 0;
+  auto start_time = Time::now();
+  while (completed_count < BENCHMARK_READ_COUNT) {
+    while (!free_tokens.empty() && submitted_count < BENCHMARK_READ_COUNT) {
+      auto token = free_tokens.back();
+      free_tokens.pop_back();
+      io.read(fd, MutableSlice(buffer).substr(static_cast<size_t>(token) * BENCHMARK_READ_SIZE, BENCHMARK_READ_SIZE),
+              get_random_offset(), token);
+      submitted_count++;
+    }
+    io.flush();
+
+    poll.run(1000);
+    auto &poll_info = io.get_event_fd().get_poll_info();
+    poll_info.sync_with_poll();
+    if (!poll_info.get_flags_local().can_read()) {
+      continue;
+    }
+    completions.clear();
+    io.reap(completions);
+    for (auto &completion : completions) {
+      CHECK(completion.result.ok() == BENCHMARK_READ_SIZE);
+      free_tokens.push_back(completion.token);
+    }
+    completed_count += completions.size();
+  }
+  report_iops(force_thread_pool ? Slice("thread pool") : Slice("io_uring"), Time::now() - start_time);
+
+  poll.unsubscribe(io.get_event_fd().get_poll_info().get_pollable_fd_ref());
+  poll.clear();
+}
+}  // namespace
+
+TEST(AsyncFileIo, Benchmark) {
+  CSlice name = "async_file_io_benchmark_file";
+  auto fd = create_test_file(name);
+  string data(1 << 20, 'a');
+  for (size_t offset = 0; offset < BENCHMARK_FILE_SIZE; offset += data.size()) {
+    CHECK(fd.pwrite(data, static_cast<int64>(offset)).move_as_ok() == data.size());
+  }
+
+  // the file is likely to be in the page cache, so mostly the overhead of request submission is measured
+  run_sync_read_benchmark(fd);
+  run_async_read_benchmark(fd, false);
+  run_async_read_benchmark(fd, true);
+
+  fd.close();
+  unlink(name).ensure();
+}
+
+#endif
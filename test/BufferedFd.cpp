@@ -0,0 +1,393 @@
+#include "td/utils/tests.h"
+
+#include "td/utils/buffer.h"
+#include "td/utils/BufferedFd.h"
+#include "td/utils/common.h"
+#include "td/utils/logging.h"
+#include "td/utils/port/IoSlice.h"
+#include "td/utils/port/IPAddress.h"
+#include "td/utils/port/PollFlags.h"
+#include "td/utils/port/ServerSocketFd.h"
+#include "td/utils/port/sleep.h"
+#include "td/utils/port/SocketFd.h"
+#include "td/utils/Random.h"
+#include "td/utils/Slice.h"
+#include "td/utils/Span.h"
+#include "td/utils/Status.h"
+#include "td/utils/StringBuilder.h"
+#include "td/utils/Time.h"
+
+#include <utility>
+
+#if TD_PORT_POSIX
+
+#include <sys/resource.h>
+
+using namespace td;
+
+// counts system calls used for reading
+class CountingSocketFd : public SocketFd {
+ public:
+  static size_t syscall_count;
+
+  CountingSocketFd() = default;
+  explicit CountingSocketFd(SocketFd &&fd) : SocketFd(std::move(fd)) {
+  }
+
+  Result<size_t> read(MutableSlice slice) TD_WARN_UNUSED_RESULT {
+    syscall_count++;
+    return SocketFd::read(slice);
+  }
+  Result<size_t> readv(Span<IoSlice> slices) TD_WARN_UNUSED_RESULT {
+    syscall_count++;
+    return SocketFd::readv(slices);
+  }
+  Result<size_t> get_pending_read_size() TD_WARN_UNUSED_RESULT {
+    syscall_count++;
+    return SocketFd::get_pending_read_size();
+  }
+};
+
+size_t CountingSocketFd::syscall_count = 0;
+
+static std::pair<SocketFd, SocketFd> create_loopback_socket_pair() {
+  while (true) {
+    auto port = Random::fast(20000, 60000);
+    auto r_server_fd = ServerSocketFd::open(port, "127.0.0.1");
+    if (r_server_fd.is_error()) {
+      continue;
+    }
+    auto server_fd = r_server_fd.move_as_ok();
+    IPAddress address;
+    address.init_ipv4_port("127.0.0.1", port).ensure();
+    auto client_fd = SocketFd::open(address).move_as_ok();
+    while (true) {
+      auto r_socket_fd = server_fd.accept();
+      if (r_socket_fd.is_ok()) {
+        return {std::move(client_fd), r_socket_fd.move_as_ok()};
+      }
+      usleep_for(1000);
+    }
+  }
+}
+
+static char get_stream_byte(size_t pos) {
+  return static_cast<char>(pos % 251);
+}
+
+enum class ReadMode : int32 { Simple, Adaptive, AdaptiveWithPendingSize };
+
+static StringBuilder &operator<<(StringBuilder &sb, ReadMode mode) {
+  switch (mode) {
+    case ReadMode::Simple:
+      return sb << "read";
+    case ReadMode::Adaptive:
+      return sb << "adaptive readv";
+    case ReadMode::AdaptiveWithPendingSize:
+      return sb << "adaptive readv with FIONREAD";
+    default:
+      UNREACHABLE();
+      return sb;
+  }
+}
+
+// sends total_size bytes through a loopback TCP connection; returns number of read system calls
+static size_t transfer(ReadMode mode, size_t total_size, bool check_data) {
+  auto socket_pair = create_loopback_socket_pair();
+  auto &write_fd = socket_pair.first;
+  BufferedFd<CountingSocketFd> read_fd(CountingSocketFd(std::move(socket_pair.second)));
+  if (mode != ReadMode::Simple) {
+    read_fd.set_adaptive_read(true, mode == ReadMode::AdaptiveWithPendingSize);
+  }
+
+  string data(1 << 16, '\0');
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = get_stream_byte(i);
+  }
+  CountingSocketFd::syscall_count = 0;
+  size_t sent_size = 0;
+  size_t received_size = 0;
+  while (received_size < total_size) {
+    write_fd.get_poll_info().add_flags(PollFlags::Write());
+    while (sent_size < total_size) {
+      // offset in data must be equal to sent_size modulo 251
+      auto offset = sent_size % (251 * 261);
+      auto written_size =
+          write_fd.write(Slice(data).substr(offset, min(total_size - sent_size, data.size() - offset))).move_as_ok();
+      if (written_size == 0) {
+        break;
+      }
+      sent_size += written_size;
+    }
+
+    read_fd.get_poll_info().add_flags(PollFlags::Read());
+    read_fd.flush_read().ensure();
+    auto &input = read_fd.input_buffer();
+    if (check_data) {
+      while (!input.empty()) {
+        auto slice = input.prepare_read();
+        for (size_t i = 0; i < slice.size(); i++) {
+          CHECK(slice[i] == get_stream_byte(received_size + i));
+        }
+        received_size += slice.size();
+        input.confirm_read(slice.size());
+      }
+    } else {
+      received_size += input.size();
+      input.advance(input.size());
+    }
+  }
+  CHECK(received_size == total_size);
+  return CountingSocketFd::syscall_count;
+}
+
+TEST(BufferedFd, adaptive_read) {
+  for (auto mode : {ReadMode::Simple, ReadMode::Adaptive, ReadMode::AdaptiveWithPendingSize}) {
+    for (auto total_size : {1, 1000, 100000, 10000000}) {
+      transfer(mode, total_size, true);
+    }
+  }
+}
+
+TEST(BufferedFd, Benchmark) {
+  constexpr size_t TOTAL_SIZE = 1 << 28;
+  for (auto mode : {ReadMode::Simple, ReadMode::Adaptive, ReadMode::AdaptiveWithPendingSize}) {
+    auto start = Time::now();
+    auto syscall_count = transfer(mode, TOTAL_SIZE, false);
+    auto passed_time = Time::now() - start;
+    LOG(ERROR) << "Loopback transfer with " << mode << ": "
+               << static_cast<double>(syscall_count) / static_cast<double>(TOTAL_SIZE >> 20) << " system calls per MB, "
+               << static_cast<double>(TOTAL_SIZE >> 20) / passed_time << " MB/s";
+  }
+}
+
+static void check_stream(ChainBufferReader &input, size_t &received_size) {
+  while (!input.empty()) {
+    auto slice = input.prepare_read();
+    for (size_t i = 0; i < slice.size(); i++) {
+      CHECK(slice[i] == get_stream_byte(received_size + i));
+    }
+    received_size += slice.size();
+    input.confirm_read(slice.size());
+  }
+}
+
+TEST(BufferedFd, zero_copy_write) {
+  constexpr size_t MIN_ZERO_COPY_SIZE = 1 << 14;
+  auto socket_pair = create_loopback_socket_pair();
+  BufferedFd<SocketFd> write_fd(std::move(socket_pair.first));
+  BufferedFd<SocketFd> read_fd(std::move(socket_pair.second));
+  auto status = write_fd.enable_zero_copy(MIN_ZERO_COPY_SIZE);
+  if (status.is_error()) {
+    LOG(WARNING) << "Zero-copy sending can't be used: " << status;
+  }
+  bool is_zero_copy_enabled = status.is_ok();
+  ASSERT_EQ(is_zero_copy_enabled, write_fd.can_write_zero_copy(MIN_ZERO_COPY_SIZE));
+  ASSERT_TRUE(!write_fd.can_write_zero_copy(MIN_ZERO_COPY_SIZE - 1));
+
+  // large buffers are sent without copying, small ones are copied
+  size_t total_size = 0;
+  for (auto size : {100, 1 << 20, 1000, 1 << 14, 1 << 16, 10}) {
+    BufferSlice buffer(static_cast<size_t>(size));
+    for (size_t i = 0; i < buffer.size(); i++) {
+      buffer.as_slice()[i] = get_stream_byte(total_size + i);
+    }
+    total_size += buffer.size();
+    write_fd.output_buffer().append(std::move(buffer));
+  }
+
+  size_t received_size = 0;
+  while (received_size < total_size) {
+    write_fd.get_poll_info().add_flags(PollFlags::Write());
+    write_fd.flush_write_zero_copy().ensure();
+    read_fd.get_poll_info().add_flags(PollFlags::Read());
+    read_fd.flush_read().ensure();
+    check_stream(read_fd.input_buffer(), received_size);
+  }
+  ASSERT_EQ(0u, write_fd.left_unwritten());
+
+  auto stats = write_fd.get_zero_copy_stats();
+  if (is_zero_copy_enabled) {
+    ASSERT_TRUE(stats.zero_copy_write_count >= 3);
+  } else {
+    ASSERT_EQ(0u, stats.zero_copy_write_count);
+  }
+
+  // all sent buffers are released after completions are read from the error queue
+  auto end_time = Time::now() + 10;
+  while (write_fd.get_zero_copy_stats().pending_write_count != 0) {
+    ASSERT_TRUE(Time::now() < end_time);
+    usleep_for(1000);
+    write_fd.get_poll_info().add_flags(PollFlags::Error());
+    write_fd.get_pending_error().ensure();
+  }
+  stats = write_fd.get_zero_copy_stats();
+  ASSERT_EQ(stats.zero_copy_write_count, stats.completed_write_count);
+}
+
+TEST(BufferedFd, zero_copy_close_with_pending_writes) {
+  constexpr size_t BUFFER_SIZE = 1 << 16;
+  auto socket_pair = create_loopback_socket_pair();
+  auto &write_fd = socket_pair.first;
+  BufferedFd<SocketFd> read_fd(std::move(socket_pair.second));
+  auto status = write_fd.enable_zero_copy(BUFFER_SIZE);
+  if (status.is_error()) {
+    LOG(WARNING) << "Zero-copy sending can't be used: " << status;
+    return;
+  }
+
+  // the peer doesn't read, so the last writes can't be completed until the socket is closed
+  size_t total_size = 0;
+  while (true) {
+    BufferSlice buffer(BUFFER_SIZE);
+    for (size_t i = 0; i < buffer.size(); i++) {
+      buffer.as_slice()[i] = get_stream_byte(total_size + i);
+    }
+    write_fd.get_poll_info().add_flags(PollFlags::Write());
+    auto written_size = write_fd.write_zero_copy(buffer).move_as_ok();
+    total_size += written_size;
+    if (written_size < buffer.size()) {
+      break;
+    }
+  }
+  ASSERT_TRUE(write_fd.get_zero_copy_stats().pending_write_count > 0);
+  write_fd.close();
+  ASSERT_EQ(1u, SocketFd::process_closed_zero_copy_sockets());
+
+  // the peer receives all the data and then the end of the stream
+  size_t received_size = 0;
+  auto end_time = Time::now() + 10;
+  while (!can_close_local(read_fd)) {
+    ASSERT_TRUE(Time::now() < end_time);
+    read_fd.get_poll_info().add_flags(PollFlags::Read());
+    read_fd.flush_read().ensure();
+    check_stream(read_fd.input_buffer(), received_size);
+  }
+  ASSERT_EQ(total_size, received_size);
+
+  // the closed socket and the buffers are released after the writes are completed
+  while (SocketFd::process_closed_zero_copy_sockets() != 0) {
+    ASSERT_TRUE(Time::now() < end_time);
+    usleep_for(1000);
+  }
+}
+
+TEST(BufferedFd, zero_copy_close_timeout) {
+  constexpr size_t BUFFER_SIZE = 1 << 16;
+  auto socket_pair = create_loopback_socket_pair();
+  auto &write_fd = socket_pair.first;
+  auto &read_fd = socket_pair.second;
+  auto status = write_fd.enable_zero_copy(BUFFER_SIZE);
+  if (status.is_error()) {
+    LOG(WARNING) << "Zero-copy sending can't be used: " << status;
+    return;
+  }
+
+  BufferSlice buffer(BUFFER_SIZE);
+  while (true) {
+    write_fd.get_poll_info().add_flags(PollFlags::Write());
+    if (write_fd.write_zero_copy(buffer).move_as_ok() < buffer.size()) {
+      break;
+    }
+  }
+  ASSERT_TRUE(write_fd.get_zero_copy_stats().pending_write_count > 0);
+
+  // the peer never reads, so the connection is reset after the timeout
+  SocketFd::set_zero_copy_close_timeout(0.1);
+  write_fd.close();
+  SocketFd::set_zero_copy_close_timeout(10.0);
+  ASSERT_EQ(1u, SocketFd::process_closed_zero_copy_sockets());
+  auto end_time = Time::now() + 10;
+  while (SocketFd::process_closed_zero_copy_sockets() != 0) {
+    ASSERT_TRUE(Time::now() < end_time);
+    usleep_for(1000);
+  }
+
+  string data(BUFFER_SIZE, '\0');
+  while (true) {
+    ASSERT_TRUE(Time::now() < end_time);
+    read_fd.get_poll_info().add_flags(PollFlags::Read());
+    auto r_size = read_fd.read(data);
+    if (r_size.is_error()) {
+      break;
+    }
+  }
+}
+
+static double get_cpu_time() {
+  struct rusage usage;
+  CHECK(getrusage(RUSAGE_SELF, &usage) == 0);
+  return static_cast<double>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+         static_cast<double>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+}
+
+// sends total_size bytes from a few large buffers through a loopback TCP connection
+static void run_zero_copy_benchmark(bool use_zero_copy, size_t total_size) {
+  constexpr size_t BUFFER_SIZE = 1 << 20;
+  constexpr size_t MAX_UNSENT_SIZE = 8 * BUFFER_SIZE;
+  auto socket_pair = create_loopback_socket_pair();
+  BufferedFd<SocketFd> write_fd(std::move(socket_pair.first));
+  auto &read_fd = socket_pair.second;
+  if (use_zero_copy) {
+    auto status = write_fd.enable_zero_copy();
+    if (status.is_error()) {
+      LOG(ERROR) << "Skip benchmark of zero-copy sending: " << status;
+      return;
+    }
+  }
+
+  vector<BufferSlice> buffers;
+  for (size_t i = 0; i < 16; i++) {
+    buffers.emplace_back(BUFFER_SIZE);
+    buffers.back().as_slice().fill(static_cast<char>('a' + i));
+  }
+  string read_buffer(BUFFER_SIZE, '\0');
+
+  auto start_time = Time::now();
+  auto start_cpu_time = get_cpu_time();
+  size_t queued_size = 0;
+  size_t sent_size = 0;
+  size_t received_size = 0;
+  while (received_size < total_size) {
+    while (queued_size < total_size && queued_size - sent_size < MAX_UNSENT_SIZE) {
+      // the buffers are shared, not copied, by the output buffer
+      write_fd.output_buffer().append(buffers[(queued_size / BUFFER_SIZE) % buffers.size()].clone());
+      queued_size += BUFFER_SIZE;
+    }
+    write_fd.get_poll_info().add_flags(PollFlags::Write());
+    if (use_zero_copy) {
+      sent_size += write_fd.flush_write_zero_copy().move_as_ok();
+      write_fd.get_poll_info().add_flags(PollFlags::Error());
+      write_fd.get_pending_error().ensure();
+    } else {
+      sent_size += write_fd.flush_write().move_as_ok();
+    }
+
+    read_fd.get_poll_info().add_flags(PollFlags::Read());
+    while (true) {
+      auto read_size = read_fd.read(read_buffer).move_as_ok();
+      if (read_size == 0) {
+        break;
+      }
+      received_size += read_size;
+    }
+  }
+  auto cpu_time = get_cpu_time() - start_cpu_time;
+  auto passed_time = Time::now() - start_time;
+
+  auto gigabytes = static_cast<double>(total_size) / static_cast<double>(1 << 30);
+  auto stats = write_fd.get_zero_copy_stats();
+  LOG(ERROR) << "Loopback transfer of " << BUFFER_SIZE << "-byte buffers with " << (use_zero_copy ? "MSG_ZEROCOPY" : "copying")
+             << ": " << cpu_time / gigabytes << " CPU seconds per GB, " << gigabytes / passed_time << " GB/s, "
+             << stats.zero_copy_write_count << " zero-copy writes, " << stats.copied_write_count
+             << " copied writes, " << stats.kernel_copied_write_count << " of " << stats.completed_write_count
+             << " completed writes were copied by the kernel";
+}
+
+TEST(BufferedFd, ZeroCopyBenchmark) {
+  constexpr size_t TOTAL_SIZE = static_cast<size_t>(1) << 31;
+  run_zero_copy_benchmark(false, TOTAL_SIZE);
+  run_zero_copy_benchmark(true, TOTAL_SIZE);
+}
+
+#endif
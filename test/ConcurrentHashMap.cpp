@@ -1,12 +1,17 @@
 #include "td/utils/benchmark.h"
 #include "td/utils/ConcurrentHashTable.h"
+#include "td/utils/Hash.h"
 #include "td/utils/misc.h"
 #include "td/utils/port/thread.h"
+#include "td/utils/Random.h"
 #include "td/utils/SpinLock.h"
 #include "td/utils/tests.h"
 
 #include <atomic>
+#include <functional>
+#include <map>
 #include <mutex>
+#include <utility>
 
 #if !TD_THREAD_UNSUPPORTED
 
@@ -77,13 +82,17 @@ class ConcurrentHashMapMutex {
     }
     return it->second;
   }
+  size_t erase(KeyT key) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return hash_map_.erase(key);
+  }
 
  private:
   std::mutex mutex_;
 #if TD_HAVE_ABSL
-  absl::flat_hash_map<KeyT, ValueT> hash_map_;
+  absl::flat_hash_map<KeyT, ValueT, td::Hash<KeyT>> hash_map_;
 #else
-  std::unordered_map<KeyT, ValueT> hash_map_;
+  std::unordered_map<KeyT, ValueT, td::Hash<KeyT>> hash_map_;
 #endif
 };
 
@@ -107,13 +116,17 @@ class ConcurrentHashMapSpinlock {
     }
     return it->second;
   }
+  size_t erase(KeyT key) {
+    auto guard = spinlock_.lock();
+    return hash_map_.erase(key);
+  }
 
  private:
   SpinLock spinlock_;
 #if TD_HAVE_ABSL
-  absl::flat_hash_map<KeyT, ValueT> hash_map_;
+  absl::flat_hash_map<KeyT, ValueT, td::Hash<KeyT>> hash_map_;
 #else
-  std::unordered_map<KeyT, ValueT> hash_map_;
+  std::unordered_map<KeyT, ValueT, td::Hash<KeyT>> hash_map_;
 #endif
 };
 
@@ -170,6 +183,241 @@ class ConcurrentHashMapJunction {
 
 }  // namespace td
 
+TEST(ConcurrentHashMap, simple) {
+  td::Random::Xorshift128plus rnd(123);
+  td::ConcurrentHashMap<td::string, int> map(1);
+  std::map<td::string, int> ref;
+  for (int i = 0; i < 300000; i++) {
+    auto key = td::to_string(rnd() % 3000);
+    auto value = static_cast<int>(rnd() % 3);  // any value can be stored
+    switch (rnd() % 3) {
+      case 0: {
+        auto it = ref.emplace(key, value).first;
+        ASSERT_EQ(it->second, map.insert(key, value));
+        break;
+      }
+      case 1: {
+        auto it = ref.find(key);
+        ASSERT_EQ(it == ref.end() ? -1 : it->second, map.find(key, -1));
+        break;
+      }
+      case 2:
+        ASSERT_EQ(ref.erase(key), map.erase(key));
+        break;
+    }
+  }
+
+  std::map<td::string, int> values;
+  map.for_each([&](const td::string &key, int value) { CHECK(values.emplace(key, value).second); });
+  ASSERT_TRUE(ref == values);
+
+  td::ConcurrentHashMap<std::pair<int, int>, td::uint64> pair_map;
+  for (int i = 0; i < 100; i++) {
+    for (int j = 0; j < 100; j++) {
+      pair_map.insert(std::make_pair(i, j), static_cast<td::uint64>(i * j));
+    }
+  }
+  ASSERT_EQ(static_cast<td::uint64>(99 * 98), pair_map.find(std::make_pair(99, 98), 0));
+  ASSERT_EQ(1u, pair_map.erase(std::make_pair(99, 98)));
+  ASSERT_EQ(static_cast<td::uint64>(7), pair_map.find(std::make_pair(99, 98), 7));
+}
+
+TEST(ConcurrentHashMap, stress) {
+  td::ConcurrentHashMap<td::uint64, td::uint64> map;
+  int threads_n = 8;
+  int keys_n = 10000;
+  std::vector<td::thread> threads;
+  for (int thread_id = 0; thread_id < threads_n; thread_id++) {
+    threads.emplace_back([&, thread_id] {
+      td::Random::Xorshift128plus rnd(thread_id);
+      std::vector<td::uint64> values(keys_n, 0);
+      for (int i = 0; i < 1000000; i++) {
+        auto key_id = static_cast<int>(rnd() % keys_n);
+        // keys of different threads are interleaved, so the same slots are accessed concurrently
+        auto key = static_cast<td::uint64>(key_id * threads_n + thread_id);
+        auto &value = values[key_id];
+        switch (rnd() % 4) {
+          case 0:
+            if (value == 0) {
+              value = rnd() | 1;
+            }
+            ASSERT_EQ(value, map.insert(key, value));
+            break;
+          case 1:
+            ASSERT_EQ(value, map.find(key, 0));
+            break;
+          case 2:
+            ASSERT_EQ(value == 0 ? 0u : 1u, map.erase(key));
+            value = 0;
+            break;
+          case 3:
+            // shared key, which is inserted and erased by all threads
+            if (map.insert(static_cast<td::uint64>(-1), key) == key) {
+              ASSERT_EQ(1u, map.erase(static_cast<td::uint64>(-1)));
+            }
+            break;
+        }
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+
+TEST(ConcurrentHashMap, erase_churn) {
+  // after all keys are erased, the table is full of tombstones, while the number of live keys is small
+  td::ConcurrentHashMap<td::uint64, td::uint64> map;
+  td::uint64 keys_n = 100000;
+  for (td::uint64 key = 1; key <= keys_n; key++) {
+    ASSERT_EQ(key, map.insert(key, key));
+  }
+  for (td::uint64 key = 1; key <= keys_n; key++) {
+    ASSERT_EQ(1u, map.erase(key));
+  }
+  // fresh keys are inserted and erased in batches, so there are always some live keys
+  for (td::uint64 key = keys_n + 1; key <= 10 * keys_n; key++) {
+    ASSERT_EQ(key, map.insert(key, key));
+    if (key % 1000 == 0) {
+      for (auto erased_key = key - 999; erased_key <= key; erased_key++) {
+        ASSERT_EQ(erased_key, map.find(erased_key, 0));
+        ASSERT_EQ(1u, map.erase(erased_key));
+      }
+    }
+  }
+
+  int threads_n = 8;
+  std::vector<td::thread> threads;
+  for (int thread_id = 0; thread_id < threads_n; thread_id++) {
+    threads.emplace_back([&, thread_id] {
+      for (td::uint64 i = 1; i <= keys_n; i++) {
+        auto key = i * threads_n + thread_id;
+        ASSERT_EQ(i, map.insert(key, i));
+        if (i % 1000 == 0) {
+          // erase all keys inserted since the previous erasure
+          for (auto j = i - 999; j <= i; j++) {
+            ASSERT_EQ(1u, map.erase(j * threads_n + thread_id));
+          }
+        }
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  size_t values_n = 0;
+  map.for_each([&](td::uint64, td::uint64) { values_n++; });
+  ASSERT_EQ(0u, values_n);
+}
+
+TEST(ConcurrentHashMap, modify_in_for_each) {
+  td::ConcurrentHashMap<td::uint64, td::uint64> map(1);
+  td::ConcurrentHashMap<td::uint64, td::uint64> other_map(1);
+  td::uint64 keys_n = 1000;
+  for (td::uint64 key = 1; key <= keys_n; key++) {
+    ASSERT_EQ(key, map.insert(key, key));
+  }
+  // every key is replaced with a new one, so the table is migrated during the iteration
+  map.for_each([&](td::uint64 key, td::uint64 value) {
+    CHECK(key == value);
+    if (key > keys_n) {
+      return;
+    }
+    CHECK(map.find(key, 0) == key);
+    CHECK(map.erase(key) == 1);
+    CHECK(map.insert(key + keys_n, key + keys_n) == key + keys_n);
+    CHECK(other_map.insert(key, key) == key);
+  });
+  // entries moved by the migration to a table, which isn't visited, can be skipped
+  td::uint64 replaced_n = 0;
+  for (td::uint64 key = 1; key <= keys_n; key++) {
+    if (other_map.find(key, 0) == key) {
+      ASSERT_EQ(0u, map.find(key, 0));
+      ASSERT_EQ(key + keys_n, map.find(key + keys_n, 0));
+      replaced_n++;
+    } else {
+      ASSERT_EQ(key, map.find(key, 0));
+      ASSERT_EQ(0u, map.find(key + keys_n, 0));
+    }
+  }
+  ASSERT_TRUE(replaced_n > 0);
+}
+
+TEST(ConcurrentHashMap, colliding_keys) {
+  // all keys have equal hash, so they occupy consecutive slots, and keys, which don't fit, are kept in overflow list
+  struct BadHash {
+    td::uint32 operator()(td::uint64) const {
+      return 12345;
+    }
+  };
+  td::ConcurrentHashMap<td::uint64, td::uint64, BadHash> map(1);
+  for (td::uint64 round = 0; round < 100; round++) {
+    auto keys_n = round % 100 * 3 + 1;
+    for (td::uint64 key = 1; key <= keys_n; key++) {
+      ASSERT_EQ(key + round, map.insert(key * 1000 + round, key + round));
+      ASSERT_EQ(key + round, map.insert(key * 1000 + round, 0));
+    }
+    for (td::uint64 key = 1; key <= keys_n; key++) {
+      ASSERT_EQ(key + round, map.find(key * 1000 + round, 0));
+      ASSERT_EQ(1u, map.erase(key * 1000 + round));
+      ASSERT_EQ(0u, map.find(key * 1000 + round, 0));
+      ASSERT_EQ(0u, map.erase(key * 1000 + round));
+    }
+  }
+  for (td::uint64 key = 1; key <= 1000; key++) {
+    ASSERT_EQ(key, map.insert(key, key));
+  }
+  size_t values_n = 0;
+  map.for_each([&](td::uint64 key, td::uint64 value) {
+    CHECK(key == value);
+    values_n++;
+  });
+  ASSERT_EQ(1000u, values_n);
+}
+
+TEST(ConcurrentHashMap, colliding_keys_stress) {
+  // odd keys have equal hash, while even keys make the table grow, so keys are moved between the tables
+  // and the overflow list concurrently
+  struct BadHash {
+    td::uint64 operator()(td::uint64 key) const {
+      return key % 2 == 0 ? td::Hash<td::uint64>()(key) : 12345;
+    }
+  };
+  td::ConcurrentHashMap<td::uint64, td::uint64, BadHash> map(1);
+  int threads_n = 8;
+  td::uint64 keys_n = 200;
+  std::vector<td::thread> threads;
+  for (int thread_id = 0; thread_id < threads_n; thread_id++) {
+    threads.emplace_back([&, thread_id] {
+      td::Random::Xorshift128plus rnd(thread_id);
+      std::vector<td::uint64> values(keys_n, 0);
+      for (int i = 0; i < 100000; i++) {
+        auto key_id = rnd() % keys_n;
+        auto key = key_id * threads_n + thread_id;
+        auto &value = values[key_id];
+        switch (rnd() % 3) {
+          case 0:
+            if (value == 0) {
+              value = rnd() | 1;
+            }
+            ASSERT_EQ(value, map.insert(key, value));
+            break;
+          case 1:
+            ASSERT_EQ(value, map.find(key, 0));
+            break;
+          case 2:
+            ASSERT_EQ(value == 0 ? 0u : 1u, map.erase(key));
+            value = 0;
+            break;
+        }
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+
 template <class HashMap>
 class HashMapBenchmark : public td::Benchmark {
   struct Query {
@@ -233,6 +481,86 @@ static void bench_hash_map() {
   td::bench(HashMapBenchmark<HashMap>(1));
 }
 
+template <class HashMap, class KeyT>
+class HashMapMixedBenchmark : public td::Benchmark {
+ public:
+  HashMapMixedBenchmark(size_t threads_n, size_t keys_n, std::function<KeyT(size_t)> gen_key)
+      : threads_n_(threads_n), keys_n_(keys_n), gen_key_(std::move(gen_key)) {
+  }
+  std::string get_description() const override {
+    return PSTRING() << HashMap::get_name() << " 90% find " << threads_n_ << " threads";
+  }
+  void start_up() override {
+    keys_.clear();
+    for (size_t i = 0; i < keys_n_; i++) {
+      keys_.push_back(gen_key_(i));
+    }
+    hash_map_ = td::make_unique<HashMap>(keys_n_);
+    for (size_t i = 0; i < keys_n_; i += 2) {
+      hash_map_->insert(keys_[i], static_cast<int>(i + 1));
+    }
+  }
+
+  void run(int n) override {
+    std::vector<td::thread> threads;
+    for (size_t i = 0; i < threads_n_; i++) {
+      threads.emplace_back([&, thread_id = i] {
+        td::Random::Xorshift128plus rnd(thread_id);
+        int res = 0;
+        for (int i = 0; i < n; i++) {
+          auto r = rnd();
+          auto &key = keys_[r % keys_n_];
+          auto op = (r >> 32) % 20;
+          if (op == 0) {
+            hash_map_->insert(key, i + 1);
+          } else if (op == 1) {
+            hash_map_->erase(key);
+          } else {
+            res += hash_map_->find(key, 0);
+          }
+        }
+        td::do_not_optimize_away(res);
+      });
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+  }
+
+  void tear_down() override {
+    hash_map_.reset();
+  }
+
+ private:
+  size_t threads_n_;
+  size_t keys_n_;
+  std::function<KeyT(size_t)> gen_key_;
+  std::vector<KeyT> keys_;
+  td::unique_ptr<HashMap> hash_map_;
+};
+
+template <class HashMap, class KeyT>
+static void bench_hash_map_scaling(std::function<KeyT(size_t)> gen_key) {
+  for (size_t threads_n = 1; threads_n <= 64; threads_n *= 2) {
+    td::bench(HashMapMixedBenchmark<HashMap, KeyT>(threads_n, 100000, gen_key));
+  }
+}
+
+TEST(ConcurrentHashMap, scaling_benchmark) {
+  auto gen_int = [](size_t i) {
+    return static_cast<int>(i * 7273 + 1);
+  };
+  bench_hash_map_scaling<td::ConcurrentHashMap<int, int>, int>(gen_int);
+  bench_hash_map_scaling<td::ConcurrentHashMapSpinlock<int, int>, int>(gen_int);
+  bench_hash_map_scaling<td::ConcurrentHashMapMutex<int, int>, int>(gen_int);
+
+  auto gen_string = [](size_t i) {
+    return PSTRING() << "key_" << i;
+  };
+  bench_hash_map_scaling<td::ConcurrentHashMap<td::string, int>, td::string>(gen_string);
+  bench_hash_map_scaling<td::ConcurrentHashMapMutex<td::string, int>, td::string>(gen_string);
+}
+
 TEST(ConcurrentHashMap, Benchmark) {
   bench_hash_map<td::ConcurrentHashMap<int, int>>();
   bench_hash_map<td::ArrayHashMap<int, int>>();
@@ -0,0 +1,179 @@
+#include "td/utils/tests.h"
+
+#include "td/utils/common.h"
+#include "td/utils/format.h"
+#include "td/utils/logging.h"
+#include "td/utils/port/Clocks.h"
+#include "td/utils/port/detail/Epoll.h"
+#include "td/utils/port/EventFd.h"
+#include "td/utils/port/IPAddress.h"
+#include "td/utils/port/PollFlags.h"
+#include "td/utils/port/ServerSocketFd.h"
+#include "td/utils/port/sleep.h"
+#include "td/utils/port/SocketFd.h"
+#include "td/utils/port/thread.h"
+#include "td/utils/Random.h"
+#include "td/utils/Slice.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#ifdef TD_POLL_EPOLL
+
+using namespace td;
+
+TEST(Epoll, busy_poll) {
+  EventFd event_fd;
+  event_fd.init();
+  detail::Epoll poll;
+  poll.init();
+  poll.subscribe(event_fd.get_poll_info().extract_pollable_fd(nullptr), PollFlags::Read());
+  poll.set_busy_poll(1000);
+
+  // no spinning without timeout
+  poll.run(0);
+  ASSERT_EQ(0u, poll.get_busy_poll_stats().spin_count);
+
+  // nothing is found by spinning
+  poll.run(1);
+  ASSERT_EQ(1u, poll.get_busy_poll_stats().spin_count);
+  ASSERT_EQ(0u, poll.get_busy_poll_stats().spin_success_count);
+  ASSERT_EQ(1u, poll.get_busy_poll_stats().block_count);
+
+  // spinning saves a wakeup
+  event_fd.release();
+  poll.run(1000);
+  ASSERT_EQ(2u, poll.get_busy_poll_stats().spin_count);
+  ASSERT_EQ(1u, poll.get_busy_poll_stats().spin_success_count);
+  ASSERT_EQ(1u, poll.get_busy_poll_stats().block_count);
+  ASSERT_EQ(0.5, poll.get_busy_poll_stats().get_saved_wakeup_ratio());
+  event_fd.acquire();
+
+  // after many failures the spin time decays, so the run takes not much more than the timeout
+  for (int i = 0; i < 20; i++) {
+    poll.run(1);
+  }
+  auto start_time = Clocks::monotonic();
+  poll.run(1);
+  ASSERT_TRUE(Clocks::monotonic() - start_time < 0.5);
+
+  poll.unsubscribe(event_fd.get_poll_info().get_pollable_fd_ref());
+  poll.clear();
+  event_fd.close();
+}
+
+#if !TD_THREAD_UNSUPPORTED
+namespace {
+std::pair<SocketFd, SocketFd> create_loopback_socket_pair() {
+  while (true) {
+    auto port = Random::fast(20000, 60000);
+    auto r_server_fd = ServerSocketFd::open(port, "127.0.0.1");
+    if (r_server_fd.is_error()) {
+      continue;
+    }
+    auto server_fd = r_server_fd.move_as_ok();
+    IPAddress address;
+    address.init_ipv4_port("127.0.0.1", port).ensure();
+    auto client_fd = SocketFd::open(address).move_as_ok();
+    while (true) {
+      auto r_socket_fd = server_fd.accept();
+      if (r_socket_fd.is_ok()) {
+        return {std::move(client_fd), r_socket_fd.move_as_ok()};
+      }
+      usleep_for(1000);
+    }
+  }
+}
+
+// reads exactly slice.size() bytes, waiting for them in the poll
+void read_exact(detail::Epoll &poll, SocketFd &fd, MutableSlice slice) {
+  while (!slice.empty()) {
+    sync_with_poll(fd);
+    if (!can_read_local(fd)) {
+      poll.run(1000);
+      continue;
+    }
+    auto read_size = fd.read(slice).move_as_ok();
+    slice.remove_prefix(read_size);
+  }
+}
+
+void write_exact(SocketFd &fd, Slice slice) {
+  sync_with_poll(fd);
+  CHECK(fd.write(slice).move_as_ok() == slice.size());
+}
+
+// measures the round trip time of a message sent to another thread over loopback and echoed back;
+// both threads wait for the message in an Epoll
+void run_ping_pong_benchmark(int32 max_spin_us) {
+  constexpr size_t ROUND_TRIP_COUNT = 20000;
+  auto socket_pair = create_loopback_socket_pair();
+  auto client_fd = std::move(socket_pair.first);
+  auto server_fd = std::move(socket_pair.second);
+  if (max_spin_us > 0) {
+    auto status = client_fd.set_busy_poll(max_spin_us, false);
+    if (status.is_ok()) {
+      status = server_fd.set_busy_poll(max_spin_us, false);
+    }
+    if (status.is_error()) {
+      LOG(INFO) << "Can't enable socket busy polling: " << status;
+    }
+  }
+
+  double server_saved_wakeup_ratio = 0.0;
+  td::thread server_thread([&] {
+    detail::Epoll poll;
+    poll.init();
+    poll.set_busy_poll(max_spin_us);
+    poll.subscribe(server_fd.get_poll_info().extract_pollable_fd(nullptr), PollFlags::ReadWrite());
+    char message[sizeof(double)];
+    for (size_t i = 0; i < ROUND_TRIP_COUNT; i++) {
+      read_exact(poll, server_fd, MutableSlice(message, sizeof(message)));
+      write_exact(server_fd, Slice(message, sizeof(message)));
+    }
+    server_saved_wakeup_ratio = poll.get_busy_poll_stats().get_saved_wakeup_ratio();
+    poll.unsubscribe(server_fd.get_poll_info().get_pollable_fd_ref());
+    poll.clear();
+  });
+
+  detail::Epoll poll;
+  poll.init();
+  poll.set_busy_poll(max_spin_us);
+  poll.subscribe(client_fd.get_poll_info().extract_pollable_fd(nullptr), PollFlags::ReadWrite());
+  vector<double> round_trip_times;
+  round_trip_times.reserve(ROUND_TRIP_COUNT);
+  auto start_time = Clocks::monotonic();
+  for (size_t i = 0; i < ROUND_TRIP_COUNT; i++) {
+    auto sent_time = Clocks::monotonic();
+    char message[sizeof(double)];
+    std::memcpy(message, &sent_time, sizeof(message));
+    write_exact(client_fd, Slice(message, sizeof(message)));
+    read_exact(poll, client_fd, MutableSlice(message, sizeof(message)));
+    std::memcpy(&sent_time, message, sizeof(message));
+    round_trip_times.push_back(Clocks::monotonic() - sent_time);
+  }
+  auto passed_time = Clocks::monotonic() - start_time;
+  server_thread.join();
+
+  std::sort(round_trip_times.begin(), round_trip_times.end());
+  LOG(ERROR) << "Ping-pong over loopback with " << (max_spin_us == 0 ? "blocking epoll" : "busy poll") << " "
+             << tag("max_spin_us", max_spin_us) << ": " << static_cast<double>(ROUND_TRIP_COUNT) / passed_time
+             << " round trips/s, p50 " << format::as_time(round_trip_times[ROUND_TRIP_COUNT / 2]) << ", p99 "
+             << format::as_time(round_trip_times[ROUND_TRIP_COUNT * 99 / 100]) << ", saved wakeups: client "
+             << poll.get_busy_poll_stats().get_saved_wakeup_ratio() * 100 << "%, server "
+             << server_saved_wakeup_ratio * 100 << "%";
+
+  poll.unsubscribe(client_fd.get_poll_info().get_pollable_fd_ref());
+  poll.clear();
+}
+}  // namespace
+
+TEST(Epoll, Benchmark) {
+  for (auto max_spin_us : {0, 20, 200}) {
+    run_ping_pong_benchmark(max_spin_us);
+  }
+}
+#endif
+
+#endif
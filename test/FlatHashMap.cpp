@@ -0,0 +1,221 @@
+#include "td/utils/benchmark.h"
+#include "td/utils/common.h"
+#include "td/utils/FlatHashMap.h"
+#include "td/utils/FlatHashSet.h"
+#include "td/utils/HashMap.h"
+#include "td/utils/HashSet.h"
+#include "td/utils/misc.h"
+#include "td/utils/Random.h"
+#include "td/utils/tests.h"
+
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <unordered_map>
+#include <utility>
+
+template <class T>
+static td::vector<typename T::key_type> extract_keys(const T &table) {
+  td::vector<typename T::key_type> result;
+  for (auto &it : table) {
+    result.push_back(it.first);
+  }
+  std::sort(result.begin(), result.end());
+  return result;
+}
+
+TEST(FlatHashMap, basic) {
+  td::FlatHashMap<int, int> map;
+  ASSERT_TRUE(map.empty());
+  ASSERT_TRUE(map.begin() == map.end());
+  ASSERT_TRUE(map.find(1) == map.end());
+  ASSERT_EQ(0u, map.erase(1));
+
+  map[1] = 2;
+  ASSERT_EQ(1u, map.size());
+  ASSERT_EQ(2, map[1]);
+  ASSERT_TRUE(!map.emplace(1, 3).second);
+  ASSERT_EQ(2, map.find(1)->second);
+  ASSERT_TRUE(map.insert({2, 3}).second);
+  ASSERT_EQ(1u, map.count(2));
+  ASSERT_EQ(0u, map.count(3));
+
+  map.erase(map.find(1));
+  ASSERT_EQ(1u, map.size());
+  ASSERT_EQ(0u, map.count(1));
+
+  td::FlatHashMap<td::string, td::string, std::hash<td::string>> string_map = {{"a", "b"}, {"c", "d"}};
+  ASSERT_EQ(2u, string_map.size());
+  ASSERT_EQ("b", string_map["a"]);
+  auto copy = string_map;
+  string_map.clear();
+  ASSERT_TRUE(string_map.empty());
+  ASSERT_EQ("d", copy["c"]);
+  string_map = std::move(copy);
+  ASSERT_EQ("b", string_map["a"]);
+
+  td::FlatHashSet<int> set{1, 2, 3};
+  ASSERT_EQ(3u, set.size());
+  ASSERT_TRUE(!set.insert(1).second);
+  ASSERT_EQ(1u, set.erase(2));
+  ASSERT_EQ(1u, set.remove_if([](int x) { return x == 3; }));
+  ASSERT_EQ(1, *set.begin());
+
+  td::HashMap<td::int64, int> hash_map;
+  hash_map[5] = 6;
+  td::HashSet<td::int64> hash_set;
+  hash_set.insert(5);
+  ASSERT_EQ(1u, hash_map.size() + hash_set.size() - 1);
+}
+
+TEST(FlatHashMap, reserve) {
+  td::FlatHashMap<int, int> map;
+  map.reserve(1000);
+  auto bucket_count = map.bucket_count();
+  for (int i = 0; i < 1000; i++) {
+    map[i] = i;
+  }
+  ASSERT_EQ(bucket_count, map.bucket_count());
+
+  map.remove_if([](auto &it) { return it.first >= 10; });
+  ASSERT_EQ(10u, map.size());
+  map.rehash(0);
+  ASSERT_TRUE(map.bucket_count() < bucket_count);
+  for (int i = 0; i < 10; i++) {
+    ASSERT_EQ(i, map[i]);
+  }
+}
+
+TEST(FlatHashMap, stress_test) {
+  td::Random::Xorshift128plus rnd(123);
+  size_t max_key = 1000;
+  td::FlatHashMap<td::uint64, td::uint64> map;
+  std::map<td::uint64, td::uint64> ref;
+
+  auto gen_key = [&] {
+    auto key = rnd() % max_key;
+    if (rnd() % 2 == 0) {
+      key <<= 40;  // keys with equal lower bits
+    }
+    return key;
+  };
+
+  td::RandomSteps steps({{[&] {
+                            auto key = gen_key();
+                            auto value = rnd();
+                            map[key] = value;
+                            ref[key] = value;
+                          },
+                          1000},
+                         {[&] {
+                            auto key = gen_key();
+                            auto it = map.find(key);
+                            auto ref_it = ref.find(key);
+                            ASSERT_EQ(ref_it == ref.end(), it == map.end());
+                            if (it != map.end()) {
+                              ASSERT_EQ(ref_it->second, it->second);
+                            }
+                          },
+                          1000},
+                         {[&] {
+                            auto key = gen_key();
+                            ASSERT_EQ(ref.erase(key), map.erase(key));
+                          },
+                          800},
+                         {[&] {
+                            auto mod = rnd() % 5 + 2;
+                            auto removed = map.remove_if([&](auto &it) { return it.second % mod == 0; });
+                            size_t ref_removed = 0;
+                            for (auto it = ref.begin(); it != ref.end();) {
+                              if (it->second % mod == 0) {
+                                it = ref.erase(it);
+                                ref_removed++;
+                              } else {
+                                ++it;
+                              }
+                            }
+                            ASSERT_EQ(ref_removed, removed);
+                          },
+                          2},
+                         {[&] {
+                            ASSERT_EQ(ref.size(), map.size());
+                            ASSERT_EQ(td::transform(ref, [](auto &it) { return it.first; }), extract_keys(map));
+                          },
+                          10}});
+
+  for (int i = 0; i < 1000000; i++) {
+    steps.step(rnd);
+  }
+}
+
+template <class TableT>
+class HashTableBenchmark : public td::Benchmark {
+ public:
+  using KeyT = typename TableT::key_type;
+
+  HashTableBenchmark(td::string name, std::function<KeyT(td::uint64)> gen_key, size_t n)
+      : name_(std::move(name)), gen_key_(std::move(gen_key)), n_(n) {
+  }
+
+  td::string get_description() const override {
+    return name_;
+  }
+
+  void start_up() override {
+    keys_.clear();
+    for (size_t i = 0; i < n_; i++) {
+      keys_.push_back(gen_key_(i));
+    }
+    table_ = TableT();
+    for (size_t i = 0; i < n_; i += 2) {
+      table_[keys_[i]] = i;
+    }
+  }
+
+  void run(int n) override {
+    size_t res = 0;
+    size_t pos = 0;
+    for (int i = 0; i < n; i++) {
+      // every second key is absent, every 16-th key is reinserted
+      auto it = table_.find(keys_[pos]);
+      if (it != table_.end()) {
+        res += it->second;
+      }
+      if ((i & 15) == 0) {
+        table_.erase(keys_[pos]);
+        table_[keys_[pos]] = i;
+      }
+      if (++pos == n_) {
+        pos = 0;
+      }
+    }
+    td::do_not_optimize_away(res);
+  }
+
+ private:
+  td::string name_;
+  std::function<KeyT(td::uint64)> gen_key_;
+  size_t n_;
+  td::vector<KeyT> keys_;
+  TableT table_;
+};
+
+template <class KeyT, class HashT>
+static void bench_hash_tables(td::string key_name, std::function<KeyT(td::uint64)> gen_key) {
+  for (size_t n : {100, 10000, 1000000}) {
+    auto suffix = PSTRING() << '<' << key_name << "> " << n;
+    td::bench(HashTableBenchmark<td::FlatHashMap<KeyT, size_t, HashT>>("FlatHashMap" + suffix, gen_key, n));
+    td::bench(HashTableBenchmark<std::unordered_map<KeyT, size_t, HashT>>("std::unordered_map" + suffix, gen_key, n));
+  }
+}
+
+TEST(FlatHashMap, Benchmark) {
+  bench_hash_tables<td::int64, td::Hash<td::int64>>("int64", [](td::uint64) {
+    return static_cast<td::int64>(td::Random::fast_uint64());
+  });
+  bench_hash_tables<td::int64, td::Hash<td::int64>>("sequential int64",
+                                                    [](td::uint64 i) { return static_cast<td::int64>(i); });
+  bench_hash_tables<td::string, std::hash<td::string>>("string", [](td::uint64) {
+    return PSTRING() << "key_" << td::Random::fast_uint64();
+  });
+}
@@ -1,6 +1,9 @@
+#include "td/utils/benchmark.h"
 #include "td/utils/common.h"
+#include "td/utils/ConcurrentHashTable.h"
 #include "td/utils/HazardPointers.h"
 #include "td/utils/logging.h"
+#include "td/utils/MpmcQueue.h"
 #include "td/utils/port/thread.h"
 #include "td/utils/Random.h"
 #include "td/utils/Slice.h"
@@ -51,4 +54,164 @@ TEST(HazardPointers, stress) {
   }
   CHECK(hazard_pointers.to_delete_size_unsafe() == 0);
 }
+
+TEST(HazardPointers, scan_threshold) {
+  td::HazardPointers<int> hazard_pointers(2, 4);
+  std::atomic<int *> ptr{new int(0)};
+  decltype(hazard_pointers)::Holder holder(hazard_pointers, 1, 0);
+  auto *protected_ptr = holder.protect(ptr);
+  hazard_pointers.retire(0, protected_ptr);
+  for (int i = 1; i < 3; i++) {
+    hazard_pointers.retire(0, new int(i));
+    ASSERT_EQ(static_cast<size_t>(i + 1), hazard_pointers.to_delete_size_unsafe());
+  }
+  // the fourth retired pointer triggers a scan, which frees everything except the protected pointer
+  hazard_pointers.retire(0, new int(3));
+  ASSERT_EQ(1u, hazard_pointers.to_delete_size_unsafe());
+  hazard_pointers.retire(0);
+  ASSERT_EQ(1u, hazard_pointers.to_delete_size_unsafe());
+
+  // the pointer left by the previous scan doesn't count towards the threshold
+  for (int i = 4; i < 7; i++) {
+    hazard_pointers.retire(0, new int(i));
+  }
+  ASSERT_EQ(4u, hazard_pointers.to_delete_size_unsafe());
+  hazard_pointers.retire(0, new int(7));
+  ASSERT_EQ(1u, hazard_pointers.to_delete_size_unsafe());
+
+  holder.clear();
+  hazard_pointers.retire(0);
+  ASSERT_EQ(0u, hazard_pointers.to_delete_size_unsafe());
+}
+
+class ThreadsBenchmark : public td::Benchmark {
+ public:
+  explicit ThreadsBenchmark(size_t threads_n) : threads_n_(threads_n) {
+  }
+
+  void run(int n) override {
+    std::vector<td::thread> threads;
+    for (size_t i = 0; i < threads_n_; i++) {
+      threads.emplace_back([&, i] { run_thread(i, static_cast<int>((n + threads_n_ - 1) / threads_n_)); });
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+  }
+
+ protected:
+  size_t threads_n_;
+
+  virtual void run_thread(size_t thread_id, int n) = 0;
+};
+
+// every thread replaces randomly chosen shared pointers and retires the old values
+class HazardPointersRetireBenchmark final : public ThreadsBenchmark {
+ public:
+  using ThreadsBenchmark::ThreadsBenchmark;
+
+  std::string get_description() const override {
+    return PSTRING() << "HazardPointers retire " << threads_n_ << " threads";
+  }
+
+  void start_up() override {
+    hazard_pointers_ = td::make_unique<td::HazardPointers<int>>(threads_n_);
+    values_ = std::vector<std::atomic<int *>>(threads_n_);
+    for (auto &value : values_) {
+      value = new int(0);
+    }
+  }
+
+  void tear_down() override {
+    for (size_t i = 0; i < threads_n_; i++) {
+      hazard_pointers_->retire(i, values_[i].exchange(nullptr));
+      hazard_pointers_->retire(i);
+    }
+    CHECK(hazard_pointers_->to_delete_size_unsafe() == 0);
+    hazard_pointers_.reset();
+  }
+
+ private:
+  td::unique_ptr<td::HazardPointers<int>> hazard_pointers_;
+  std::vector<std::atomic<int *>> values_;
+
+  void run_thread(size_t thread_id, int n) final {
+    td::HazardPointers<int>::Holder holder(*hazard_pointers_, thread_id, 0);
+    for (int i = 0; i < n; i++) {
+      auto &value = values_[td::Random::fast(0, static_cast<int>(threads_n_) - 1)];
+      auto *old_ptr = holder.protect(value);
+      td::do_not_optimize_away(*old_ptr);
+      holder.clear();
+      auto *new_ptr = new int(i);
+      if (value.compare_exchange_strong(old_ptr, new_ptr)) {
+        hazard_pointers_->retire(thread_id, old_ptr);
+      } else {
+        delete new_ptr;
+      }
+    }
+  }
+};
+
+// every thread pushes and pops values; small blocks make the queue retire a block every 64 values
+class MpmcQueueRetireBenchmark final : public ThreadsBenchmark {
+ public:
+  using ThreadsBenchmark::ThreadsBenchmark;
+
+  std::string get_description() const override {
+    return PSTRING() << "MpmcQueue push/pop " << threads_n_ << " threads";
+  }
+
+  void start_up() override {
+    queue_ = td::make_unique<td::MpmcQueue<int>>(64, threads_n_);
+  }
+
+  void tear_down() override {
+    queue_.reset();
+  }
+
+ private:
+  td::unique_ptr<td::MpmcQueue<int>> queue_;
+
+  void run_thread(size_t thread_id, int n) final {
+    for (int i = 0; i < n; i++) {
+      queue_->push(i + 1, thread_id);
+      td::do_not_optimize_away(queue_->pop(thread_id));
+    }
+  }
+};
+
+// every thread inserts keys into a map, which starts small, so replaced tables are retired during migration
+class ConcurrentHashMapRetireBenchmark final : public ThreadsBenchmark {
+ public:
+  using ThreadsBenchmark::ThreadsBenchmark;
+
+  std::string get_description() const override {
+    return PSTRING() << "ConcurrentHashMap growing insert " << threads_n_ << " threads";
+  }
+
+  void start_up() override {
+    map_ = td::make_unique<td::ConcurrentHashMap<td::uint64, td::uint64>>(1);
+  }
+
+  void tear_down() override {
+    map_.reset();
+  }
+
+ private:
+  td::unique_ptr<td::ConcurrentHashMap<td::uint64, td::uint64>> map_;
+
+  void run_thread(size_t thread_id, int n) final {
+    for (int i = 0; i < n; i++) {
+      map_->insert(static_cast<td::uint64>(thread_id) << 32 | static_cast<td::uint64>(i + 1), i + 1);
+    }
+  }
+};
+
+TEST(HazardPointers, Benchmark) {
+  for (size_t threads_n : {1, 8, 64, 128}) {
+    td::bench(HazardPointersRetireBenchmark(threads_n));
+    td::bench(MpmcQueueRetireBenchmark(threads_n));
+    td::bench(ConcurrentHashMapRetireBenchmark(threads_n));
+  }
+}
 #endif  //!TD_THREAD_UNSUPPORTED
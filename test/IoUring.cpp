@@ -0,0 +1,384 @@
+#include "td/utils/tests.h"
+
+#include "td/utils/buffer.h"
+#include "td/utils/BufferedFd.h"
+#include "td/utils/common.h"
+#include "td/utils/format.h"
+#include "td/utils/logging.h"
+#include "td/utils/Observer.h"
+#include "td/utils/port/detail/Epoll.h"
+#include "td/utils/port/detail/IoUring.h"
+#include "td/utils/port/IoSlice.h"
+#include "td/utils/port/IPAddress.h"
+#include "td/utils/port/PollBase.h"
+#include "td/utils/port/PollFlags.h"
+#include "td/utils/port/ServerSocketFd.h"
+#include "td/utils/port/sleep.h"
+#include "td/utils/port/SocketFd.h"
+#include "td/utils/Random.h"
+#include "td/utils/Slice.h"
+#include "td/utils/Span.h"
+#include "td/utils/Status.h"
+#include "td/utils/StringBuilder.h"
+#include "td/utils/Time.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#ifdef TD_HAS_IO_URING
+
+#include <sys/resource.h>
+
+using namespace td;
+
+namespace {
+// counts system calls used for reading and writing
+class SyscallCountingSocketFd : public SocketFd {
+ public:
+  static size_t syscall_count;
+
+  SyscallCountingSocketFd() = default;
+  explicit SyscallCountingSocketFd(SocketFd &&fd) : SocketFd(std::move(fd)) {
+  }
+
+  Result<size_t> read(MutableSlice slice) TD_WARN_UNUSED_RESULT {
+    syscall_count++;
+    return SocketFd::read(slice);
+  }
+  Result<size_t> writev(Span<IoSlice> slices) TD_WARN_UNUSED_RESULT {
+    syscall_count++;
+    return SocketFd::writev(slices);
+  }
+};
+
+size_t SyscallCountingSocketFd::syscall_count = 0;
+
+class LoopbackListener {
+ public:
+  LoopbackListener() {
+    while (true) {
+      port_ = Random::fast(20000, 60000);
+      auto r_server_fd = ServerSocketFd::open(port_, "127.0.0.1");
+      if (r_server_fd.is_ok()) {
+        server_fd_ = r_server_fd.move_as_ok();
+        break;
+      }
+    }
+    address_.init_ipv4_port("127.0.0.1", port_).ensure();
+  }
+
+  std::pair<SocketFd, SocketFd> create_socket_pair() {
+    auto client_fd = SocketFd::open(address_).move_as_ok();
+    while (true) {
+      auto r_socket_fd = server_fd_.accept();
+      if (r_socket_fd.is_ok()) {
+        return {std::move(client_fd), r_socket_fd.move_as_ok()};
+      }
+      usleep_for(1000);
+    }
+  }
+
+ private:
+  int32 port_ = 0;
+  ServerSocketFd server_fd_;
+  IPAddress address_;
+};
+
+// runs the poll until the condition is satisfied
+template <class F>
+void run_poll_until(PollBase &poll, F &&condition) {
+  auto end_time = Time::now() + 10;
+  while (!condition()) {
+    CHECK(Time::now() < end_time);
+    poll.run(10);
+  }
+}
+}  // namespace
+
+TEST(IoUring, simple) {
+  LoopbackListener listener;
+  for (auto force_epoll : {false, true}) {
+    detail::IoUring poll;
+    if (force_epoll) {
+      poll.force_epoll_fallback();
+    }
+    poll.init();
+    if (force_epoll) {
+      ASSERT_TRUE(!poll.is_io_uring_used());
+    } else if (!poll.is_io_uring_used()) {
+      LOG(WARNING) << "io_uring can't be used";
+    }
+
+    auto socket_pair = listener.create_socket_pair();
+    auto client_fd = std::move(socket_pair.first);
+    BufferedFd<SocketFd> server_fd(std::move(socket_pair.second));
+    poll.subscribe(server_fd.get_poll_info().extract_pollable_fd(nullptr), PollFlags::ReadWrite());
+
+    run_poll_until(poll, [&] {
+      server_fd.sync_with_poll();
+      return can_write_local(server_fd);
+    });
+
+    ASSERT_EQ(5u, client_fd.write("hello").move_as_ok());
+    run_poll_until(poll, [&] {
+      server_fd.sync_with_poll();
+      return can_read_local(server_fd);
+    });
+    server_fd.flush_read().ensure();
+    ASSERT_EQ("hello", server_fd.input_buffer().move_as_buffer_slice().as_slice());
+
+    client_fd.close();
+    run_poll_until(poll, [&] {
+      server_fd.sync_with_poll();
+      return can_close_local(server_fd);
+    });
+
+    poll.unsubscribe_before_close(server_fd.get_poll_info().get_pollable_fd_ref());
+    server_fd.close();
+    poll.clear();
+  }
+}
+
+// reads and writes bigger than the kernel limit are truncated, so that their size fits in the entry
+TEST(IoUring, rw_size) {
+  io_uring_sqe sqe;
+  std::memset(&sqe, 0, sizeof(sqe));
+  char data[1];
+  detail::IoUringRing::prepare_rw(&sqe, false, 1, data, (static_cast<size_t>(1) << 32) + 1, 0, 0);
+  ASSERT_EQ(static_cast<uint32>(detail::IoUringRing::MAX_RW_SIZE), sqe.len);
+  ASSERT_EQ(IORING_OP_READ, sqe.opcode);
+  detail::IoUringRing::prepare_rw(&sqe, true, 1, data, 1, 0, 0);
+  ASSERT_EQ(1u, sqe.len);
+  ASSERT_EQ(IORING_OP_WRITE, sqe.opcode);
+}
+
+TEST(IoUring, completion_read) {
+  LoopbackListener listener;
+  for (auto force_epoll : {false, true}) {
+    detail::IoUring poll;
+    if (force_epoll) {
+      poll.force_epoll_fallback();
+    }
+    poll.init();
+
+    auto socket_pair = listener.create_socket_pair();
+    auto client_fd = std::move(socket_pair.first);
+    BufferedFd<SocketFd> server_fd(std::move(socket_pair.second));
+    auto is_completion_read = poll.subscribe_with_completion_read(
+        server_fd.get_poll_info().extract_pollable_fd(nullptr), PollFlags::ReadWrite(), server_fd.get_input_writer());
+    ASSERT_EQ(poll.is_io_uring_used(), is_completion_read);
+    server_fd.set_completion_read(is_completion_read);
+
+    constexpr size_t TOTAL_SIZE = 10000000;
+    string data(1 << 16, '\0');
+    for (size_t i = 0; i < data.size(); i++) {
+      data[i] = static_cast<char>(i % 251);
+    }
+    size_t sent_size = 0;
+    size_t received_size = 0;
+    run_poll_until(poll, [&] {
+      client_fd.get_poll_info().add_flags(PollFlags::Write());
+      if (sent_size < TOTAL_SIZE) {
+        auto offset = sent_size % (251 * 261);
+        sent_size += client_fd.write(Slice(data).substr(offset, min(TOTAL_SIZE - sent_size, data.size() - offset)))
+                         .move_as_ok();
+      }
+
+      server_fd.sync_with_poll();
+      server_fd.flush_read().ensure();
+      auto &input = server_fd.input_buffer();
+      while (!input.empty()) {
+        auto slice = input.prepare_read();
+        for (size_t i = 0; i < slice.size(); i++) {
+          CHECK(slice[i] == static_cast<char>((received_size + i) % 251));
+        }
+        received_size += slice.size();
+        input.confirm_read(slice.size());
+      }
+      return received_size == TOTAL_SIZE;
+    });
+
+    client_fd.close();
+    run_poll_until(poll, [&] {
+      server_fd.sync_with_poll();
+      return can_close_local(server_fd);
+    });
+
+    poll.unsubscribe_before_close(server_fd.get_poll_info().get_pollable_fd_ref());
+    server_fd.close();
+    poll.clear();
+  }
+}
+
+namespace {
+enum class PollMode : int32 { Epoll, IoUringPoll, IoUringCompletionRead };
+
+StringBuilder &operator<<(StringBuilder &sb, PollMode mode) {
+  switch (mode) {
+    case PollMode::Epoll:
+      return sb << "epoll";
+    case PollMode::IoUringPoll:
+      return sb << "io_uring poll";
+    case PollMode::IoUringCompletionRead:
+      return sb << "io_uring completion read";
+    default:
+      UNREACHABLE();
+      return sb;
+  }
+}
+
+// a side of a loopback connection; adds itself to the ready list when notified by the poll
+class Endpoint final : public ObserverBase {
+ public:
+  Endpoint(SocketFd &&fd, size_t index, vector<size_t> *ready_endpoints)
+      : fd_(SyscallCountingSocketFd(std::move(fd))), index_(index), ready_endpoints_(ready_endpoints) {
+  }
+
+  void notify() final {
+    if (!is_ready_) {
+      is_ready_ = true;
+      ready_endpoints_->push_back(index_);
+    }
+  }
+
+  BufferedFd<SyscallCountingSocketFd> &fd() {
+    is_ready_ = false;
+    return fd_;
+  }
+
+ private:
+  BufferedFd<SyscallCountingSocketFd> fd_;
+  size_t index_;
+  vector<size_t> *ready_endpoints_;
+  bool is_ready_ = false;
+};
+
+// each message contains its sending time
+constexpr size_t ECHO_MESSAGE_SIZE = sizeof(double);
+
+// sends messages through random connections and waits for their echo; endpoints 2 * i and 2 * i + 1 are
+// the client and the server sides of the i-th connection
+void run_echo_benchmark(PollMode mode, size_t connection_count) {
+  unique_ptr<PollBase> poll;
+  detail::IoUring *io_uring = nullptr;
+  if (mode == PollMode::Epoll) {
+    poll = td::make_unique<detail::Epoll>();
+  } else {
+    auto io_uring_poll = td::make_unique<detail::IoUring>();
+    io_uring = io_uring_poll.get();
+    poll = std::move(io_uring_poll);
+  }
+  poll->init();
+  if (io_uring != nullptr && !io_uring->is_io_uring_used()) {
+    LOG(ERROR) << "Skip benchmark of " << mode << ", because io_uring can't be used";
+    poll->clear();
+    return;
+  }
+
+  LoopbackListener listener;
+  vector<size_t> ready_endpoints;
+  vector<unique_ptr<Endpoint>> endpoints;
+  for (size_t i = 0; i < connection_count; i++) {
+    auto socket_pair = listener.create_socket_pair();
+    endpoints.push_back(td::make_unique<Endpoint>(std::move(socket_pair.first), 2 * i, &ready_endpoints));
+    endpoints.push_back(td::make_unique<Endpoint>(std::move(socket_pair.second), 2 * i + 1, &ready_endpoints));
+  }
+  for (auto &endpoint : endpoints) {
+    auto &fd = endpoint->fd();
+    auto pollable_fd = fd.get_poll_info().extract_pollable_fd(endpoint.get());
+    if (mode == PollMode::IoUringCompletionRead) {
+      fd.set_completion_read(
+          io_uring->subscribe_with_completion_read(std::move(pollable_fd), PollFlags::ReadWrite(), fd.get_input_writer()));
+    } else {
+      poll->subscribe(std::move(pollable_fd), PollFlags::ReadWrite());
+    }
+  }
+  // wait until all sockets become writable
+  while (true) {
+    poll->run(10);
+    if (ready_endpoints.empty()) {
+      break;
+    }
+    for (auto index : ready_endpoints) {
+      endpoints[index]->fd().sync_with_poll();
+    }
+    ready_endpoints.clear();
+  }
+
+  constexpr size_t ROUND_COUNT = 200;
+  constexpr size_t BATCH_SIZE = 1000;
+  vector<double> latencies;
+  latencies.reserve(ROUND_COUNT * BATCH_SIZE);
+  SyscallCountingSocketFd::syscall_count = 0;
+  size_t run_count = 0;
+  auto start_time = Time::now();
+  for (size_t round = 0; round < ROUND_COUNT; round++) {
+    for (size_t i = 0; i < BATCH_SIZE; i++) {
+      auto &fd = endpoints[2 * Random::fast(0, static_cast<int>(connection_count) - 1)]->fd();
+      auto now = Time::now();
+      char message[ECHO_MESSAGE_SIZE];
+      std::memcpy(message, &now, ECHO_MESSAGE_SIZE);
+      fd.output_buffer().append(Slice(message, ECHO_MESSAGE_SIZE));
+      fd.sync_with_poll();
+      fd.flush_write().ensure();
+    }
+
+    size_t received_count = 0;
+    while (received_count < BATCH_SIZE) {
+      poll->run(1000);
+      run_count++;
+      auto ready = std::move(ready_endpoints);
+      ready_endpoints.clear();
+      for (auto index : ready) {
+        auto &fd = endpoints[index]->fd();
+        fd.sync_with_poll();
+        fd.flush_read().ensure();
+        auto &input = fd.input_buffer();
+        if (index % 2 == 1) {
+          fd.output_buffer().append(input.cut_head(input.size()));
+          fd.flush_write().ensure();
+          continue;
+        }
+        fd.flush_write().ensure();
+        while (input.size() >= ECHO_MESSAGE_SIZE) {
+          char message[ECHO_MESSAGE_SIZE];
+          input.advance(ECHO_MESSAGE_SIZE, MutableSlice(message, ECHO_MESSAGE_SIZE));
+          double sent_time;
+          std::memcpy(&sent_time, message, ECHO_MESSAGE_SIZE);
+          latencies.push_back(Time::now() - sent_time);
+          received_count++;
+        }
+      }
+    }
+  }
+  auto passed_time = Time::now() - start_time;
+
+  std::sort(latencies.begin(), latencies.end());
+  auto syscall_count = static_cast<double>(SyscallCountingSocketFd::syscall_count + run_count);
+  auto message_count = static_cast<double>(latencies.size());
+  LOG(ERROR) << "Echo through " << connection_count << " connections with " << mode << ": "
+             << message_count / passed_time << " messages/s, " << syscall_count / passed_time << " system calls/s, "
+             << syscall_count / message_count << " system calls per message, p50 latency "
+             << format::as_time(latencies[latencies.size() / 2]) << ", p99 latency "
+             << format::as_time(latencies[latencies.size() * 99 / 100]);
+
+  for (auto &endpoint : endpoints) {
+    poll->unsubscribe_before_close(endpoint->fd().get_poll_info().get_pollable_fd_ref());
+  }
+  endpoints.clear();
+  poll->clear();
+}
+}  // namespace
+
+TEST(IoUring, Benchmark) {
+  // two file descriptors are needed for every connection
+  struct rlimit limit;
+  CHECK(getrlimit(RLIMIT_NOFILE, &limit) == 0);
+  auto connection_count = min(static_cast<size_t>(10000), static_cast<size_t>(limit.rlim_cur - 100) / 2);
+  for (auto mode : {PollMode::Epoll, PollMode::IoUringPoll, PollMode::IoUringCompletionRead}) {
+    run_echo_benchmark(mode, connection_count);
+  }
+}
+
+#endif
@@ -0,0 +1,76 @@
+#include "td/utils/common.h"
+#include "td/utils/MonotonicArena.h"
+#include "td/utils/Random.h"
+#include "td/utils/tests.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <utility>
+#include <vector>
+
+TEST(MonotonicArena, simple) {
+  td::MonotonicArena arena(256);
+  ASSERT_EQ(0u, arena.get_reserved_size());
+  td::vector<std::pair<char *, size_t>> allocations;
+  for (int i = 0; i < 10000; i++) {
+    size_t size = td::Random::fast(0, 10) == 0 ? td::Random::fast(0, 100000) : td::Random::fast(0, 100);
+    size_t alignment = static_cast<size_t>(1) << td::Random::fast(0, 6);
+    auto *ptr = static_cast<char *>(arena.allocate(size, alignment));
+    ASSERT_EQ(0u, reinterpret_cast<std::uintptr_t>(ptr) % alignment);
+    std::fill(ptr, ptr + size, static_cast<char>(i));
+    allocations.emplace_back(ptr, size);
+  }
+  for (size_t i = 0; i < allocations.size(); i++) {
+    for (size_t j = 0; j < allocations[i].second; j++) {
+      ASSERT_EQ(static_cast<char>(i), allocations[i].first[j]);
+    }
+  }
+  ASSERT_TRUE(arena.get_reserved_size() >= arena.get_allocated_size());
+
+  auto reserved_size = arena.get_reserved_size();
+  arena.reset();
+  ASSERT_EQ(0u, arena.get_allocated_size());
+  ASSERT_TRUE(arena.get_reserved_size() < reserved_size);
+  ASSERT_TRUE(arena.get_reserved_size() > 0);
+
+  auto copy = arena.copy("abacaba");
+  ASSERT_EQ("abacaba", copy);
+  auto *value = arena.create<std::pair<int, double>>(1, 2.5);
+  ASSERT_EQ(1, value->first);
+  ASSERT_EQ(2.5, value->second);
+
+  // a dedicated chunk of a huge allocation isn't kept by reset
+  arena.allocate(10 << 20);
+  ASSERT_TRUE(arena.get_reserved_size() > (10 << 20));
+  arena.reset();
+  ASSERT_TRUE(arena.get_reserved_size() <= (1 << 20));
+  ASSERT_TRUE(arena.get_reserved_size() > 0);
+}
+
+TEST(MonotonicArena, allocator) {
+  td::MonotonicArena arena;
+  {
+    std::vector<int, td::ArenaAllocator<int>> v{td::ArenaAllocator<int>(&arena)};
+    for (int i = 0; i < 1000; i++) {
+      v.push_back(i);
+    }
+    ASSERT_EQ(999, v.back());
+    ASSERT_TRUE(arena.get_allocated_size() >= 1000 * sizeof(int));
+
+    using MapAllocator = td::ArenaAllocator<std::pair<const int, int>>;
+    std::map<int, int, std::less<int>, MapAllocator> m{MapAllocator(&arena)};
+    for (int i = 0; i < 1000; i++) {
+      m[i] = i * i;
+    }
+    ASSERT_EQ(998001, m[999]);
+  }
+
+  // a default allocator uses the heap
+  auto allocated_size = arena.get_allocated_size();
+  std::vector<int, td::ArenaAllocator<int>> v(100, 5);
+  ASSERT_EQ(allocated_size, arena.get_allocated_size());
+  ASSERT_TRUE(td::ArenaAllocator<int>() != td::ArenaAllocator<int>(&arena));
+  ASSERT_TRUE(td::ArenaAllocator<char>(&arena) == td::ArenaAllocator<int>(&arena));
+}
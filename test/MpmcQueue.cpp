@@ -1,10 +1,12 @@
 #include "td/utils/common.h"
 #include "td/utils/logging.h"
 #include "td/utils/MpmcQueue.h"
+#include "td/utils/MpmcWaiter.h"
 #include "td/utils/port/thread.h"
 #include "td/utils/tests.h"
 
 #include <algorithm>
+#include <atomic>
 #include <tuple>
 
 TEST(OneValue, simple) {
@@ -122,7 +124,68 @@ TEST(MpmcQueue, simple) {
   }
 }
 
+TEST(MpmcQueue, push_n) {
+  td::MpmcQueue<int> q(1);
+  // batches cross block boundaries
+  std::vector<int> values;
+  for (int i = 0; i < 3000; i += 300) {
+    values.clear();
+    for (int j = i; j < i + 300; j++) {
+      values.push_back(j);
+    }
+    q.push_n(values.data(), values.size(), 0);
+  }
+  for (int i = 0; i < 3000; i++) {
+    int x = q.pop(0);
+    LOG_CHECK(x == i) << x << " expected " << i;
+  }
+  int x;
+  CHECK(!q.try_pop(x, 0));
+}
+
 #if !TD_THREAD_UNSUPPORTED
+TEST(MpmcQueue, multi_thread_push_n) {
+  size_t readers_n = 4;
+  int values_n = 1000000;
+  td::MpmcQueue<int> q(readers_n + 1);
+  std::atomic<int> popped_n{0};
+  std::atomic<td::int64> popped_sum{0};
+  std::vector<td::thread> readers;
+  for (size_t thread_id = 0; thread_id < readers_n; thread_id++) {
+    readers.emplace_back([&, thread_id] {
+      td::int64 sum = 0;
+      while (true) {
+        int x;
+        // readers take positions reserved by the writer before the values are stored there
+        if (!q.try_pop(x, thread_id)) {
+          continue;
+        }
+        if (x == -1) {
+          break;
+        }
+        sum += x;
+        popped_n++;
+      }
+      popped_sum += sum;
+    });
+  }
+  std::vector<int> values;
+  for (int i = 0; i < values_n; i += 100) {
+    values.clear();
+    for (int j = i; j < i + 100; j++) {
+      values.push_back(j);
+    }
+    q.push_n(values.data(), values.size(), readers_n);
+  }
+  values.assign(readers_n, -1);
+  q.push_n(values.data(), values.size(), readers_n);
+  for (auto &reader : readers) {
+    reader.join();
+  }
+  ASSERT_EQ(values_n, popped_n.load());
+  ASSERT_EQ(static_cast<td::int64>(values_n) * (values_n - 1) / 2, popped_sum.load());
+}
+
 TEST(MpmcQueue, multi_thread) {
   size_t n = 10;
   size_t m = 10;
@@ -198,4 +261,47 @@ TEST(MpmcQueue, multi_thread) {
   }
   LOG_CHECK(q.hazard_pointers_to_delele_size_unsafe() == 0) << q.hazard_pointers_to_delele_size_unsafe();
 }
+TEST(MpmcQueue, multi_thread_waiter) {
+  size_t n = 4;
+  size_t m = 4;
+  size_t qn = 10000;
+  td::MpmcQueue<size_t> q(1024, n + m + 1);
+  td::MpmcWaiterSchedule schedule;
+  schedule.spin_rounds = 2;
+  schedule.yield_rounds = 2;
+  td::MpmcWaiter waiter(schedule);
+  std::atomic<size_t> sum{0};
+  std::vector<td::thread> threads;
+  for (size_t thread_id = 0; thread_id < m; thread_id++) {
+    threads.emplace_back([&, thread_id] {
+      td::MpmcWaiter::Slot slot;
+      waiter.init_slot(slot, static_cast<td::int32>(thread_id));
+      while (true) {
+        auto value = q.pop(thread_id, waiter, slot);
+        if (value == 0) {
+          return;
+        }
+        sum += value;
+      }
+    });
+  }
+  for (size_t thread_id = m; thread_id < n + m; thread_id++) {
+    threads.emplace_back([&, thread_id] {
+      for (size_t i = 1; i <= qn; i++) {
+        q.push(i, thread_id, waiter);
+      }
+    });
+  }
+  for (size_t i = m; i < n + m; i++) {
+    threads[i].join();
+  }
+  for (size_t i = 0; i < m; i++) {
+    q.push(0, n + m, waiter);
+  }
+  for (size_t i = 0; i < m; i++) {
+    threads[i].join();
+  }
+  waiter.close();
+  ASSERT_EQ(n * qn * (qn + 1) / 2, sum.load());
+}
 #endif  //!TD_THREAD_UNSUPPORTED
@@ -0,0 +1,357 @@
+#include "td/utils/benchmark.h"
+#include "td/utils/common.h"
+#include "td/utils/logging.h"
+#include "td/utils/MpmcQueue.h"
+#include "td/utils/MpmcRingQueue.h"
+#include "td/utils/port/thread.h"
+#include "td/utils/Random.h"
+#include "td/utils/tests.h"
+
+#include <algorithm>
+#include <tuple>
+
+TEST(MpmcRingQueue, simple) {
+  td::MpmcRingQueue<td::string> q(3);
+  ASSERT_EQ(4u, q.capacity());
+  td::string x;
+  ASSERT_TRUE(!q.try_pop(x));
+  for (int t = 0; t < 3; t++) {
+    for (int i = 0; i < 4; i++) {
+      x = td::to_string(i);
+      ASSERT_TRUE(q.try_push(x));
+      ASSERT_TRUE(x.empty());
+    }
+    x = "extra";
+    ASSERT_TRUE(!q.try_push(x));
+    ASSERT_EQ("extra", x);
+    for (int i = 0; i < 4; i++) {
+      ASSERT_TRUE(q.try_pop(x));
+      ASSERT_EQ(td::to_string(i), x);
+    }
+    ASSERT_TRUE(!q.try_pop(x));
+  }
+}
+
+TEST(MpmcRingQueue, batch) {
+  td::MpmcRingQueue<int> q(16);
+  td::Random::Xorshift128plus rnd(123);
+  int values[20];
+  int next_push = 0;
+  int next_pop = 0;
+  for (int i = 0; i < 100000; i++) {
+    auto n = static_cast<size_t>(rnd() % 20 + 1);
+    if (rnd() % 2 == 0) {
+      for (size_t j = 0; j < n; j++) {
+        values[j] = next_push + static_cast<int>(j);
+      }
+      auto pushed = q.try_push_n(values, n);
+      ASSERT_EQ(td::min(n, static_cast<size_t>(16 - (next_push - next_pop))), pushed);
+      next_push += static_cast<int>(pushed);
+    } else {
+      auto popped = q.try_pop_n(values, n);
+      ASSERT_EQ(td::min(n, static_cast<size_t>(next_push - next_pop)), popped);
+      for (size_t j = 0; j < popped; j++) {
+        ASSERT_EQ(next_pop++, values[j]);
+      }
+    }
+  }
+}
+
+#if !TD_THREAD_UNSUPPORTED
+static void test_ring_queue_multi_thread(bool is_blocking) {
+  size_t n = 10;
+  size_t m = 10;
+  struct Data {
+    size_t from{0};
+    size_t value{0};
+  };
+  struct ThreadData {
+    std::vector<Data> v;
+    char pad[64];
+  };
+  td::MpmcRingQueue<Data> q(64, is_blocking);
+  std::vector<td::thread> n_threads(n);
+  std::vector<td::thread> m_threads(m);
+  std::vector<ThreadData> thread_data(m);
+  size_t thread_id = 0;
+  for (auto &thread : m_threads) {
+    thread = td::thread([&, thread_id] {
+      td::MpmcRingQueue<Data>::WaiterSlot slot;
+      if (is_blocking) {
+        q.init_slot(slot, static_cast<td::int32>(thread_id));
+      }
+      Data data[8];
+      while (true) {
+        size_t popped;
+        if (is_blocking) {
+          popped = q.pop_n(data, td::Random::fast(1, 8), slot);
+        } else {
+          popped = q.try_pop_n(data, td::Random::fast(1, 8));
+          if (popped == 0) {
+            td::this_thread::yield();
+          }
+        }
+        for (size_t i = 0; i < popped; i++) {
+          if (data[i].value == 0) {
+            // sentinels are pushed last, so only sentinels of other readers can follow; return them
+            for (size_t j = i + 1; j < popped; j++) {
+              ASSERT_EQ(0u, data[j].value);
+              if (is_blocking) {
+                q.push(data[j], slot);
+              } else {
+                while (!q.try_push(data[j])) {
+                  td::this_thread::yield();
+                }
+              }
+            }
+            return;
+          }
+          thread_data[thread_id].v.push_back(data[i]);
+        }
+      }
+    });
+    thread_id++;
+  }
+  size_t qn = 100000;
+  for (auto &thread : n_threads) {
+    thread = td::thread([&, thread_id] {
+      td::MpmcRingQueue<Data>::WaiterSlot slot;
+      if (is_blocking) {
+        q.init_slot(slot, static_cast<td::int32>(thread_id));
+      }
+      Data data[8];
+      for (size_t i = 0; i < qn;) {
+        size_t k = td::min(static_cast<size_t>(td::Random::fast(1, 8)), qn - i);
+        for (size_t j = 0; j < k; j++) {
+          data[j].from = thread_id - m;
+          data[j].value = i + j + 1;
+        }
+        if (is_blocking) {
+          q.push_n(data, k, slot);
+        } else {
+          auto pushed = q.try_push_n(data, k);
+          if (pushed == 0) {
+            td::this_thread::yield();
+          }
+          k = pushed;
+        }
+        i += k;
+      }
+    });
+    thread_id++;
+  }
+  for (auto &thread : n_threads) {
+    thread.join();
+  }
+  td::MpmcRingQueue<Data>::WaiterSlot slot;
+  if (is_blocking) {
+    q.init_slot(slot, static_cast<td::int32>(thread_id));
+  }
+  for (size_t i = 0; i < m; i++) {
+    Data data;
+    if (is_blocking) {
+      q.push(data, slot);
+    } else {
+      while (!q.try_push(data)) {
+        td::this_thread::yield();
+      }
+    }
+  }
+  for (auto &thread : m_threads) {
+    thread.join();
+  }
+  std::vector<Data> all;
+  for (size_t i = 0; i < m; i++) {
+    std::vector<size_t> from(n, 0);
+    for (auto &data : thread_data[i].v) {
+      all.push_back(data);
+      CHECK(data.value > from[data.from]);
+      from[data.from] = data.value;
+    }
+  }
+  LOG_CHECK(all.size() == n * qn) << all.size();
+  std::sort(all.begin(), all.end(),
+            [](const auto &a, const auto &b) { return std::tie(a.from, a.value) < std::tie(b.from, b.value); });
+  for (size_t i = 0; i < n * qn; i++) {
+    CHECK(all[i].from == i / qn);
+    CHECK(all[i].value == i % qn + 1);
+  }
+}
+
+TEST(MpmcRingQueue, multi_thread) {
+  test_ring_queue_multi_thread(false);
+}
+
+TEST(MpmcRingQueue, multi_thread_blocking) {
+  test_ring_queue_multi_thread(true);
+}
+
+// writers_n threads push n values each, readers_n threads pop them; values are pushed and popped in batches
+template <class QueueT>
+class QueueBenchmark : public td::Benchmark {
+ public:
+  QueueBenchmark(size_t writers_n, size_t readers_n, size_t batch_size)
+      : writers_n_(writers_n), readers_n_(readers_n), batch_size_(batch_size) {
+  }
+
+  std::string get_description() const override {
+    return PSTRING() << QueueT::get_name() << " " << writers_n_ << ":" << readers_n_ << " batch " << batch_size_;
+  }
+
+  void start_up() override {
+    queue_ = td::make_unique<QueueT>(writers_n_ + readers_n_ + 1);
+  }
+
+  void run(int n) override {
+    std::vector<td::thread> threads;
+    size_t thread_id = 0;
+    for (size_t i = 0; i < readers_n_; i++) {
+      threads.emplace_back([&, thread_id] {
+        std::vector<size_t> values(batch_size_);
+        size_t sum = 0;
+        while (true) {
+          auto popped = queue_->pop_n(values.data(), batch_size_, thread_id);
+          for (size_t j = 0; j < popped; j++) {
+            if (values[j] == 0) {
+              // return sentinels of other readers
+              if (j + 1 < popped) {
+                queue_->push_n(values.data() + j + 1, popped - j - 1, thread_id);
+              }
+              td::do_not_optimize_away(sum);
+              return;
+            }
+            sum += values[j];
+          }
+        }
+      });
+      thread_id++;
+    }
+    for (size_t i = 0; i < writers_n_; i++) {
+      threads.emplace_back([&, thread_id] {
+        std::vector<size_t> values(batch_size_);
+        for (int j = 0; j < n; j += static_cast<int>(batch_size_)) {
+          size_t k = td::min(batch_size_, static_cast<size_t>(n - j));
+          for (size_t t = 0; t < k; t++) {
+            values[t] = j + t + 1;
+          }
+          queue_->push_n(values.data(), k, thread_id);
+        }
+      });
+      thread_id++;
+    }
+    for (size_t i = readers_n_; i < threads.size(); i++) {
+      threads[i].join();
+    }
+    for (size_t i = 0; i < readers_n_; i++) {
+      size_t sentinel = 0;
+      queue_->push_n(&sentinel, 1, thread_id);
+    }
+    for (size_t i = 0; i < readers_n_; i++) {
+      threads[i].join();
+    }
+  }
+
+  void tear_down() override {
+    queue_.reset();
+  }
+
+ private:
+  size_t writers_n_;
+  size_t readers_n_;
+  size_t batch_size_;
+  td::unique_ptr<QueueT> queue_;
+};
+
+class MpmcQueueAdapter {
+ public:
+  explicit MpmcQueueAdapter(size_t threads_n) : queue_(threads_n) {
+  }
+  static std::string get_name() {
+    return "MpmcQueue";
+  }
+  void push_n(size_t *values, size_t n, size_t thread_id) {
+    for (size_t i = 0; i < n; i++) {
+      queue_.push(values[i], thread_id);
+    }
+  }
+  size_t pop_n(size_t *values, size_t n, size_t thread_id) {
+    values[0] = queue_.pop(thread_id);
+    size_t res = 1;
+    while (res < n && queue_.try_pop(values[res], thread_id)) {
+      res++;
+    }
+    return res;
+  }
+
+ private:
+  td::MpmcQueue<size_t> queue_;
+};
+
+class MpmcRingQueueAdapter {
+ public:
+  explicit MpmcRingQueueAdapter(size_t) : queue_(1024) {
+  }
+  static std::string get_name() {
+    return "MpmcRingQueue";
+  }
+  void push_n(size_t *values, size_t n, size_t) {
+    while (n > 0) {
+      auto pushed = queue_.try_push_n(values, n);
+      if (pushed == 0) {
+        td::this_thread::yield();
+      }
+      values += pushed;
+      n -= pushed;
+    }
+  }
+  size_t pop_n(size_t *values, size_t n, size_t) {
+    while (true) {
+      auto popped = queue_.try_pop_n(values, n);
+      if (popped != 0) {
+        return popped;
+      }
+      td::this_thread::yield();
+    }
+  }
+
+ private:
+  td::MpmcRingQueue<size_t> queue_;
+};
+
+class MpmcRingQueueBlockingAdapter {
+ public:
+  explicit MpmcRingQueueBlockingAdapter(size_t threads_n) : queue_(1024, true), slots_(threads_n) {
+    for (size_t i = 0; i < threads_n; i++) {
+      queue_.init_slot(slots_[i], static_cast<td::int32>(i));
+    }
+  }
+  static std::string get_name() {
+    return "MpmcRingQueue blocking";
+  }
+  void push_n(size_t *values, size_t n, size_t thread_id) {
+    queue_.push_n(values, n, slots_[thread_id]);
+  }
+  size_t pop_n(size_t *values, size_t n, size_t thread_id) {
+    return queue_.pop_n(values, n, slots_[thread_id]);
+  }
+
+ private:
+  td::MpmcRingQueue<size_t> queue_;
+  std::vector<td::MpmcRingQueue<size_t>::WaiterSlot> slots_;
+};
+
+template <class QueueT>
+static void bench_queue() {
+  for (auto threads : {std::make_tuple(1, 1), std::make_tuple(4, 4), std::make_tuple(8, 1), std::make_tuple(1, 8)}) {
+    for (size_t batch_size : {1, 16}) {
+      td::bench(QueueBenchmark<QueueT>(std::get<0>(threads), std::get<1>(threads), batch_size));
+    }
+  }
+}
+
+TEST(MpmcRingQueue, Benchmark) {
+  bench_queue<MpmcQueueAdapter>();
+  bench_queue<MpmcRingQueueAdapter>();
+  bench_queue<MpmcRingQueueBlockingAdapter>();
+}
+#endif  //!TD_THREAD_UNSUPPORTED
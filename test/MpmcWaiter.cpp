@@ -134,4 +134,65 @@ TEST(MpmcEagerWaiter, stress_multi) {
 TEST(MpmcSleepyWaiter, stress_multi) {
   test_waiter_stress<td::MpmcSleepyWaiter>();
 }
+
+static td::MpmcWaiterSchedule get_spinning_schedule() {
+  td::MpmcWaiterSchedule schedule;
+  schedule.spin_rounds = 3;
+  schedule.spin_pauses = 16;
+  schedule.yield_rounds = 3;
+  return schedule;
+}
+
+class MpmcSpinningWaiter final : public td::MpmcSleepyWaiter {
+ public:
+  MpmcSpinningWaiter() : td::MpmcSleepyWaiter(get_spinning_schedule()) {
+  }
+};
+
+TEST(MpmcSleepyWaiter, stress_multi_spinning) {
+  test_waiter_stress<MpmcSpinningWaiter>();
+}
+
+TEST(MpmcSleepyWaiter, schedule) {
+  td::MpmcWaiterSchedule schedule;
+  schedule.spin_rounds = 2;
+  schedule.yield_rounds = 3;
+  td::MpmcSleepyWaiter waiter(schedule);
+  td::MpmcSleepyWaiter::Slot slot;
+  waiter.init_slot(slot, 0);
+  // Work -> Search, 2 spins, 3 yields, and the last searcher registers as a sleeper without parking
+  for (int i = 0; i < 7; i++) {
+    waiter.wait(slot);
+  }
+  waiter.stop_wait(slot);
+  auto stats = waiter.get_stats();
+  ASSERT_EQ(2u, stats.spins);
+  ASSERT_EQ(3u, stats.yields);
+  ASSERT_EQ(0u, stats.parks);
+  ASSERT_EQ(0u, stats.wakeups);
+  waiter.close();
+}
+
+TEST(MpmcSleepyWaiter, park) {
+  td::MpmcSleepyWaiter waiter;
+  std::atomic<bool> flag{false};
+  td::thread thread([&] {
+    td::MpmcSleepyWaiter::Slot slot;
+    waiter.init_slot(slot, 1);
+    while (!flag.load()) {
+      waiter.wait(slot);
+    }
+    waiter.stop_wait(slot);
+  });
+  while (waiter.get_stats().parks == 0) {
+    td::this_thread::yield();
+  }
+  flag = true;
+  waiter.notify();
+  thread.join();
+  auto stats = waiter.get_stats();
+  ASSERT_EQ(1u, stats.parks);
+  ASSERT_EQ(1u, stats.wakeups);
+  waiter.close();
+}
 #endif  // !TD_THREAD_UNSUPPORTED
@@ -0,0 +1,212 @@
+#include "td/utils/benchmark.h"
+#include "td/utils/common.h"
+#include "td/utils/logging.h"
+#include "td/utils/MpmcQueue.h"
+#include "td/utils/ObjectPool.h"
+#include "td/utils/port/thread.h"
+#include "td/utils/Random.h"
+#include "td/utils/Slice.h"
+#include "td/utils/tests.h"
+
+#include <atomic>
+#include <thread>
+
+namespace {
+class Value {
+ public:
+  Value() = default;
+  explicit Value(td::int64 value) : value_(value) {
+  }
+
+  td::int64 get() const {
+    return value_;
+  }
+
+  void clear() {
+    value_ = 0;
+  }
+
+ private:
+  td::int64 value_ = 0;
+  char padding_[24] = {};
+};
+}  // namespace
+
+TEST(ObjectPool, simple) {
+  td::ObjectPool<Value> pool;
+  auto ptr = pool.create(1);
+  ASSERT_EQ(1, ptr->get());
+  auto weak_ptr = ptr.get_weak();
+  ASSERT_TRUE(weak_ptr.is_alive());
+  ASSERT_EQ(1, weak_ptr->get());
+  ptr.reset();
+  ASSERT_TRUE(!weak_ptr.is_alive());
+  ASSERT_TRUE(ptr.empty());
+
+  // the storage is reused, but the old weak pointer must stay dead
+  auto new_ptr = pool.create(2);
+  ASSERT_TRUE(!weak_ptr.is_alive());
+  ASSERT_TRUE(new_ptr.get_weak().is_alive());
+
+  td::vector<td::ObjectPool<Value>::OwnerPtr> ptrs;
+  for (int i = 0; i < 1000; i++) {
+    ptrs.push_back(pool.create(i));
+  }
+  auto storage_count = pool.get_storage_count();
+  ASSERT_TRUE(storage_count >= 1001);
+  ptrs.clear();
+  for (int i = 0; i < 1000; i++) {
+    ptrs.push_back(pool.create(i));
+  }
+  ASSERT_EQ(storage_count, pool.get_storage_count());
+}
+
+#if !TD_THREAD_UNSUPPORTED
+// objects are created in one thread and released in others
+TEST(ObjectPool, threads) {
+  constexpr size_t THREADS_N = 4;
+  constexpr int OBJECTS_N = 100000;
+  td::ObjectPool<Value> pool;
+  td::MpmcQueue<td::ObjectPool<Value>::OwnerPtr *> queue(THREADS_N + 1);
+  std::atomic<int> released_count{0};
+
+  td::vector<td::thread> threads;
+  for (size_t i = 0; i < THREADS_N; i++) {
+    threads.emplace_back([&, i] {
+      while (released_count.load() < OBJECTS_N) {
+        td::ObjectPool<Value>::OwnerPtr *ptr;
+        if (!queue.try_pop(ptr, i + 1)) {
+          td::this_thread::yield();
+          continue;
+        }
+        auto weak_ptr = ptr->get_weak();
+        CHECK(weak_ptr.is_alive());
+        CHECK((*ptr)->get() != 0);
+        delete ptr;
+        CHECK(!weak_ptr.is_alive());
+        // objects are created in released threads too
+        auto local_ptr = pool.create(1);
+        CHECK(local_ptr->get() == 1);
+        released_count++;
+      }
+    });
+  }
+  for (int i = 1; i <= OBJECTS_N; i++) {
+    queue.push(new td::ObjectPool<Value>::OwnerPtr(pool.create(i)), 0);
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  LOG(INFO) << pool.get_storage_count();
+}
+
+// threads, which weren't created by td::thread, have the same zero thread identifier
+TEST(ObjectPool, foreign_threads) {
+  constexpr size_t THREADS_N = 4;
+  constexpr int OBJECTS_N = 10000;
+  td::ObjectPool<Value> pool;
+  td::vector<td::vector<td::ObjectPool<Value>::OwnerPtr>> ptrs(THREADS_N);
+  for (auto &thread_ptrs : ptrs) {
+    for (int i = 1; i <= OBJECTS_N; i++) {
+      thread_ptrs.push_back(pool.create(i));
+    }
+  }
+
+  td::vector<std::thread> threads;
+  for (size_t i = 0; i < THREADS_N; i++) {
+    threads.emplace_back([&, i] {
+      for (auto &ptr : ptrs[i]) {
+        auto weak_ptr = ptr.get_weak();
+        CHECK(weak_ptr.is_alive());
+        ptr.reset();
+        CHECK(!weak_ptr.is_alive());
+        auto local_ptr = pool.create(1);
+        CHECK(local_ptr->get() == 1);
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  ASSERT_TRUE(pool.get_storage_count() >= THREADS_N * OBJECTS_N);
+}
+
+namespace {
+class ThreadsBenchmark : public td::Benchmark {
+ public:
+  explicit ThreadsBenchmark(size_t threads_n) : threads_n_(threads_n) {
+  }
+
+  void run(int n) override {
+    td::vector<td::thread> threads;
+    for (size_t i = 0; i < threads_n_; i++) {
+      threads.emplace_back([&] { run_thread(static_cast<int>((n + threads_n_ - 1) / threads_n_)); });
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+  }
+
+ protected:
+  size_t threads_n_;
+
+  virtual void run_thread(int n) = 0;
+};
+
+// every thread keeps a window of live objects and replaces a random one of them
+class ObjectPoolBenchmark final : public ThreadsBenchmark {
+ public:
+  using ThreadsBenchmark::ThreadsBenchmark;
+
+  std::string get_description() const override {
+    return PSTRING() << "ObjectPool " << threads_n_ << " threads";
+  }
+
+  void start_up() override {
+    pool_ = td::make_unique<td::ObjectPool<Value>>();
+  }
+
+  void tear_down() override {
+    pool_.reset();
+  }
+
+ private:
+  td::unique_ptr<td::ObjectPool<Value>> pool_;
+
+  void run_thread(int n) final {
+    td::vector<td::ObjectPool<Value>::OwnerPtr> window(WINDOW_SIZE);
+    for (int i = 0; i < n; i++) {
+      window[td::Random::fast(0, WINDOW_SIZE - 1)] = pool_->create(i + 1);
+    }
+  }
+
+  static constexpr int WINDOW_SIZE = 256;
+};
+
+class MakeUniqueBenchmark final : public ThreadsBenchmark {
+ public:
+  using ThreadsBenchmark::ThreadsBenchmark;
+
+  std::string get_description() const override {
+    return PSTRING() << "make_unique " << threads_n_ << " threads";
+  }
+
+ private:
+  void run_thread(int n) final {
+    td::vector<td::unique_ptr<Value>> window(WINDOW_SIZE);
+    for (int i = 0; i < n; i++) {
+      window[td::Random::fast(0, WINDOW_SIZE - 1)] = td::make_unique<Value>(i + 1);
+    }
+  }
+
+  static constexpr int WINDOW_SIZE = 256;
+};
+}  // namespace
+
+TEST(ObjectPool, Benchmark) {
+  for (size_t threads_n : {1, 4, 16}) {
+    td::bench(ObjectPoolBenchmark(threads_n));
+    td::bench(MakeUniqueBenchmark(threads_n));
+  }
+}
+#endif
@@ -0,0 +1,233 @@
+#include "td/utils/benchmark.h"
+#include "td/utils/common.h"
+#include "td/utils/logging.h"
+#include "td/utils/port/RwMutex.h"
+#include "td/utils/port/thread.h"
+#include "td/utils/Random.h"
+#include "td/utils/RcuPtr.h"
+#include "td/utils/SpinLock.h"
+#include "td/utils/tests.h"
+
+#include <array>
+#include <atomic>
+
+namespace {
+std::atomic<int> alive_configs{0};
+
+struct Config {
+  td::int64 version{0};
+  td::int64 negated_version{0};
+  td::string name;
+
+  Config() {
+    alive_configs++;
+  }
+  Config(const Config &other) : version(other.version), negated_version(other.negated_version), name(other.name) {
+    alive_configs++;
+  }
+  Config &operator=(const Config &other) = delete;
+  ~Config() {
+    alive_configs--;
+  }
+};
+}  // namespace
+
+TEST(RcuPtr, simple) {
+  {
+    td::RcuPtr<Config> ptr(2, td::make_unique<Config>());
+    ASSERT_EQ(1, alive_configs.load());
+    {
+      auto snapshot = ptr.get_snapshot(0);
+      ASSERT_TRUE(static_cast<bool>(snapshot));
+      ASSERT_EQ(0, snapshot->version);
+    }
+
+    auto old_snapshot = ptr.get_snapshot(0);
+    ptr.update(1, [](Config &config) {
+      config.version = 1;
+      config.name = "one";
+    });
+    ASSERT_EQ(2, alive_configs.load());
+    // the old version is still visible through the old snapshot
+    ASSERT_EQ(0, old_snapshot->version);
+    ASSERT_EQ("", old_snapshot->name);
+    old_snapshot.reset();
+
+    auto snapshot = ptr.get_snapshot(0);
+    ASSERT_EQ(1, snapshot->version);
+    ASSERT_EQ("one", (*snapshot).name);
+    snapshot.reset();
+
+    ptr.set(1, td::make_unique<Config>());
+    ptr.synchronize(1);
+    ASSERT_EQ(0u, ptr.to_delete_size_unsafe());
+    ASSERT_EQ(1, alive_configs.load());
+    ASSERT_EQ(0, ptr.get_snapshot(0)->version);
+  }
+  ASSERT_EQ(0, alive_configs.load());
+
+  td::RcuPtr<Config> empty_ptr(1);
+  ASSERT_TRUE(!empty_ptr.get_snapshot(0));
+}
+
+#if !TD_THREAD_UNSUPPORTED
+TEST(RcuPtr, stress) {
+  size_t threads_n = 8;
+  {
+    auto config = td::make_unique<Config>();
+    config->name = "0";
+    td::RcuPtr<Config> ptr(threads_n, std::move(config));
+    std::vector<td::thread> threads;
+    for (size_t thread_id = 0; thread_id < threads_n; thread_id++) {
+      threads.emplace_back([&, thread_id] {
+        td::int64 last_version = 0;
+        for (int i = 0; i < 100000; i++) {
+          if (td::Random::fast(0, 99) == 0) {
+            ptr.update(thread_id, [](Config &config) {
+              config.version++;
+              config.negated_version--;
+              config.name = td::to_string(config.version);
+            });
+            continue;
+          }
+          auto snapshot = ptr.get_snapshot(thread_id);
+          CHECK(snapshot->version + snapshot->negated_version == 0);
+          CHECK(snapshot->name == td::to_string(snapshot->version));
+          // versions seen by a thread never go back
+          CHECK(snapshot->version >= last_version);
+          last_version = snapshot->version;
+        }
+      });
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+    LOG(INFO) << "Undeleted versions: " << ptr.to_delete_size_unsafe();
+    for (size_t thread_id = 0; thread_id < threads_n; thread_id++) {
+      ptr.synchronize(thread_id);
+    }
+    ASSERT_EQ(0u, ptr.to_delete_size_unsafe());
+    ASSERT_EQ(1, alive_configs.load());
+  }
+  ASSERT_EQ(0, alive_configs.load());
+}
+
+namespace {
+struct Table {
+  std::array<td::int64, 16> values{};
+};
+
+class RcuPtrTable {
+ public:
+  explicit RcuPtrTable(size_t threads_n) : ptr_(threads_n, td::make_unique<Table>()) {
+  }
+  static std::string get_name() {
+    return "RcuPtr";
+  }
+  td::int64 read(size_t thread_id, size_t i) {
+    return ptr_.get_snapshot(thread_id)->values[i];
+  }
+  void write(size_t thread_id, size_t i, td::int64 value) {
+    ptr_.update(thread_id, [&](Table &table) { table.values[i] = value; });
+  }
+
+ private:
+  td::RcuPtr<Table> ptr_;
+};
+
+class RwMutexTable {
+ public:
+  explicit RwMutexTable(size_t) {
+  }
+  static std::string get_name() {
+    return "RwMutex";
+  }
+  td::int64 read(size_t, size_t i) {
+    auto lock = mutex_.lock_read().move_as_ok();
+    return table_.values[i];
+  }
+  void write(size_t, size_t i, td::int64 value) {
+    auto lock = mutex_.lock_write().move_as_ok();
+    table_.values[i] = value;
+  }
+
+ private:
+  td::RwMutex mutex_;
+  Table table_;
+};
+
+class SpinLockTable {
+ public:
+  explicit SpinLockTable(size_t) {
+  }
+  static std::string get_name() {
+    return "SpinLock";
+  }
+  td::int64 read(size_t, size_t i) {
+    auto lock = spin_lock_.lock();
+    return table_.values[i];
+  }
+  void write(size_t, size_t i, td::int64 value) {
+    auto lock = spin_lock_.lock();
+    table_.values[i] = value;
+  }
+
+ private:
+  td::SpinLock spin_lock_;
+  Table table_;
+};
+}  // namespace
+
+// every thread does n / threads_n operations, 99% of them are reads
+template <class TableT>
+class ReadMostlyBenchmark final : public td::Benchmark {
+ public:
+  explicit ReadMostlyBenchmark(size_t threads_n) : threads_n_(threads_n) {
+  }
+
+  std::string get_description() const override {
+    return PSTRING() << TableT::get_name() << " 99% reads " << threads_n_ << " threads";
+  }
+
+  void start_up() override {
+    table_ = td::make_unique<TableT>(threads_n_);
+  }
+
+  void run(int n) override {
+    std::vector<td::thread> threads;
+    for (size_t thread_id = 0; thread_id < threads_n_; thread_id++) {
+      threads.emplace_back([&, thread_id] {
+        td::int64 sum = 0;
+        auto ops_n = static_cast<size_t>(n) / threads_n_ + 1;
+        for (size_t i = 0; i < ops_n; i++) {
+          if (i % 100 == 99) {
+            table_->write(thread_id, i % 16, static_cast<td::int64>(i));
+          } else {
+            sum += table_->read(thread_id, i % 16);
+          }
+        }
+        td::do_not_optimize_away(sum);
+      });
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+  }
+
+  void tear_down() override {
+    table_.reset();
+  }
+
+ private:
+  size_t threads_n_;
+  td::unique_ptr<TableT> table_;
+};
+
+TEST(RcuPtr, Benchmark) {
+  for (size_t threads_n : {1, 4, 16}) {
+    td::bench(ReadMostlyBenchmark<RcuPtrTable>(threads_n));
+    td::bench(ReadMostlyBenchmark<RwMutexTable>(threads_n));
+    td::bench(ReadMostlyBenchmark<SpinLockTable>(threads_n));
+  }
+}
+#endif  //!TD_THREAD_UNSUPPORTED
@@ -0,0 +1,271 @@
+#include "td/utils/tests.h"
+
+#include "td/utils/BufferedFd.h"
+#include "td/utils/common.h"
+#include "td/utils/logging.h"
+#include "td/utils/port/IPAddress.h"
+#include "td/utils/port/PollFlags.h"
+#include "td/utils/port/ReactorGroup.h"
+#include "td/utils/port/ServerSocketFd.h"
+#include "td/utils/port/sleep.h"
+#include "td/utils/port/SocketFd.h"
+#include "td/utils/Random.h"
+#include "td/utils/Slice.h"
+#include "td/utils/Status.h"
+#include "td/utils/Time.h"
+
+#include <atomic>
+#include <utility>
+
+#if TD_POLL_EPOLL && !TD_THREAD_UNSUPPORTED
+
+using namespace td;
+
+TEST(ReactorGroup, post) {
+  constexpr size_t REACTOR_COUNT = 3;
+  ReactorGroup group(REACTOR_COUNT);
+  ASSERT_EQ(REACTOR_COUNT, group.get_reactor_count());
+  ASSERT_TRUE(ReactorGroup::Reactor::get_current() == nullptr);
+
+  std::atomic<size_t> done_count{0};
+  std::atomic<size_t> wrong_reactor_count{0};
+  for (size_t i = 0; i < 3 * REACTOR_COUNT; i++) {
+    auto &reactor = group.choose_reactor();
+    ASSERT_EQ(i % REACTOR_COUNT, reactor.get_id());
+    reactor.post([&, i](ReactorGroup::Reactor &reactor) {
+      if (ReactorGroup::Reactor::get_current() != &reactor || reactor.get_id() != i % REACTOR_COUNT) {
+        wrong_reactor_count++;
+      }
+      // pass the task on to the next reactor
+      auto &next_reactor = group.get_reactor((reactor.get_id() + 1) % REACTOR_COUNT);
+      next_reactor.post([&, i](ReactorGroup::Reactor &reactor) {
+        if (ReactorGroup::Reactor::get_current() != &reactor || reactor.get_id() != (i + 1) % REACTOR_COUNT) {
+          wrong_reactor_count++;
+        }
+        done_count++;
+      });
+    });
+  }
+  for (uint64 key = 0; key < 100; key++) {
+    ASSERT_EQ(group.choose_reactor(key).get_id(), group.choose_reactor(key).get_id());
+  }
+  while (done_count.load() != 3 * REACTOR_COUNT) {
+    usleep_for(1000);
+  }
+  ASSERT_EQ(0u, wrong_reactor_count.load());
+  group.close();
+}
+
+namespace {
+// state of a reactor, which must be accessed only from its thread; message_count can be read from any thread
+struct ReactorState {
+  vector<unique_ptr<ReactorGroup::Handler>> connections;
+  std::atomic<uint64> message_count{0};
+};
+
+constexpr size_t ECHO_MESSAGE_SIZE = 64;
+
+// a client sends a message after it receives the echo of the previous one; a server echoes everything
+class EchoConnection final : public ReactorGroup::Handler {
+ public:
+  EchoConnection(SocketFd socket_fd, bool is_client, ReactorState *state)
+      : fd_(std::move(socket_fd)), is_client_(is_client), state_(state) {
+  }
+
+  void start(ReactorGroup::Reactor &reactor) {
+    reactor.subscribe(fd_.get_poll_info(), PollFlags::ReadWrite(), this);
+    if (is_client_) {
+      fd_.output_buffer().append(string(ECHO_MESSAGE_SIZE, 'a'));
+      reactor.schedule(this);
+    }
+  }
+
+  void on_ready(ReactorGroup::Reactor &reactor) final {
+    auto status = loop();
+    if (status.is_error() || can_close_local(fd_)) {
+      close(reactor);
+    }
+  }
+
+  void close(ReactorGroup::Reactor &reactor) {
+    reactor.unsubscribe(fd_.get_poll_info(), this);
+    auto &connections = state_->connections;
+    for (auto &connection : connections) {
+      if (connection.get() == this) {
+        // destroys this
+        std::swap(connection, connections.back());
+        connections.pop_back();
+        return;
+      }
+    }
+    UNREACHABLE();
+  }
+
+ private:
+  BufferedFd<SocketFd> fd_;
+  bool is_client_;
+  ReactorState *state_;
+
+  Status loop() {
+    sync_with_poll(fd_);
+    TRY_STATUS(fd_.flush_read());
+    auto &input = fd_.input_buffer();
+    if (is_client_) {
+      while (input.size() >= ECHO_MESSAGE_SIZE) {
+        input.advance(ECHO_MESSAGE_SIZE);
+        state_->message_count.fetch_add(1, std::memory_order_relaxed);
+        fd_.output_buffer().append(string(ECHO_MESSAGE_SIZE, 'a'));
+      }
+    } else {
+      fd_.output_buffer().append(input.cut_head(input.size()));
+    }
+    TRY_STATUS(fd_.flush_write());
+    return Status::OK();
+  }
+};
+
+void add_connection(ReactorGroup::Reactor &reactor, ReactorState &state, SocketFd socket_fd, bool is_client) {
+  auto connection = td::make_unique<EchoConnection>(std::move(socket_fd), is_client, &state);
+  auto *connection_ptr = connection.get();
+  state.connections.push_back(std::move(connection));
+  connection_ptr->start(reactor);
+}
+
+// assigns accepted connections to reactors in turn
+class EchoAcceptCallback final : public ReactorGroup::AcceptCallback {
+ public:
+  EchoAcceptCallback(ReactorGroup *group, vector<unique_ptr<ReactorState>> *states, std::atomic<size_t> *accept_count)
+      : group_(group), states_(states), accept_count_(accept_count) {
+  }
+
+  void on_accept(ReactorGroup::Reactor &, SocketFd socket_fd) final {
+    group_->choose_reactor().post([states = states_, socket_fd = std::move(socket_fd)](
+                                      ReactorGroup::Reactor &reactor) mutable {
+      add_connection(reactor, *(*states)[reactor.get_id()], std::move(socket_fd), false);
+    });
+    accept_count_->fetch_add(1, std::memory_order_release);
+  }
+
+ private:
+  ReactorGroup *group_;
+  vector<unique_ptr<ReactorState>> *states_;
+  std::atomic<size_t> *accept_count_;
+};
+
+vector<unique_ptr<ReactorState>> create_states(size_t count) {
+  vector<unique_ptr<ReactorState>> result;
+  for (size_t i = 0; i < count; i++) {
+    result.push_back(td::make_unique<ReactorState>());
+  }
+  return result;
+}
+
+// returns the number of closed connections for every reactor
+vector<size_t> close_connections(ReactorGroup &group, vector<unique_ptr<ReactorState>> &states) {
+  vector<size_t> result(group.get_reactor_count());
+  std::atomic<size_t> closed_count{0};
+  for (size_t i = 0; i < group.get_reactor_count(); i++) {
+    group.get_reactor(i).post([&](ReactorGroup::Reactor &reactor) {
+      auto &connections = states[reactor.get_id()]->connections;
+      result[reactor.get_id()] = connections.size();
+      while (!connections.empty()) {
+        static_cast<EchoConnection *>(connections.back().get())->close(reactor);
+      }
+      closed_count++;
+    });
+  }
+  while (closed_count.load() != group.get_reactor_count()) {
+    usleep_for(1000);
+  }
+  return result;
+}
+
+uint64 get_message_count(const vector<unique_ptr<ReactorState>> &states) {
+  uint64 result = 0;
+  for (auto &state : states) {
+    result += state->message_count.load(std::memory_order_relaxed);
+  }
+  return result;
+}
+
+struct EchoStats {
+  double accept_time;
+  double messages_per_second;
+  vector<size_t> server_connection_counts;
+};
+
+// clients are run by a separate group with the same number of threads
+EchoStats run_echo(size_t thread_count, size_t connection_count, double duration) {
+  ReactorGroup server_group(thread_count);
+  ReactorGroup client_group(thread_count);
+  auto server_states = create_states(thread_count);
+  auto client_states = create_states(thread_count);
+  std::atomic<size_t> accept_count{0};
+
+  int32 port;
+  while (true) {
+    port = Random::fast(20000, 60000);
+    auto r_server_fd = ServerSocketFd::open(port, "127.0.0.1");
+    if (r_server_fd.is_ok()) {
+      server_group
+          .add_shared_listener(r_server_fd.move_as_ok(),
+                               td::make_unique<EchoAcceptCallback>(&server_group, &server_states, &accept_count))
+          .ensure();
+      break;
+    }
+  }
+  IPAddress address;
+  address.init_ipv4_port("127.0.0.1", port).ensure();
+
+  auto start_time = Time::now();
+  for (size_t i = 0; i < thread_count; i++) {
+    auto client_count = connection_count / thread_count + (i < connection_count % thread_count ? 1 : 0);
+    client_group.get_reactor(i).post([&, client_count](ReactorGroup::Reactor &reactor) {
+      for (size_t j = 0; j < client_count; j++) {
+        add_connection(reactor, *client_states[reactor.get_id()], SocketFd::open(address).move_as_ok(), true);
+      }
+    });
+  }
+  while (accept_count.load(std::memory_order_acquire) != connection_count) {
+    CHECK(Time::now() < start_time + 60);
+    usleep_for(100);
+  }
+  EchoStats result;
+  result.accept_time = Time::now() - start_time;
+
+  auto begin_message_count = get_message_count(client_states);
+  auto begin_time = Time::now();
+  usleep_for(static_cast<int32>(duration * 1e6));
+  result.messages_per_second =
+      static_cast<double>(get_message_count(client_states) - begin_message_count) / (Time::now() - begin_time);
+
+  // all accepted connections were added to the server reactors before the tasks closing them
+  result.server_connection_counts = close_connections(server_group, server_states);
+  server_group.close();
+  close_connections(client_group, client_states);
+  client_group.close();
+  return result;
+}
+}  // namespace
+
+TEST(ReactorGroup, echo) {
+  constexpr size_t REACTOR_COUNT = 3;
+  auto stats = run_echo(REACTOR_COUNT, 3 * REACTOR_COUNT, 0.1);
+  ASSERT_TRUE(stats.messages_per_second > 0);
+  // accepted connections are assigned to reactors in turn
+  for (auto connection_count : stats.server_connection_counts) {
+    ASSERT_EQ(3u, connection_count);
+  }
+}
+
+TEST(ReactorGroup, Benchmark) {
+  constexpr size_t CONNECTION_COUNT = 1000;
+  for (size_t thread_count : {1, 2, 4, 8}) {
+    auto stats = run_echo(thread_count, CONNECTION_COUNT, 1.0);
+    LOG(ERROR) << "Reactor group with " << thread_count << " threads: "
+               << static_cast<double>(CONNECTION_COUNT) / stats.accept_time << " accepted connections/s, "
+               << stats.messages_per_second << " echo messages/s through " << CONNECTION_COUNT << " connections";
+  }
+}
+
+#endif
@@ -1,8 +1,16 @@
+#include "td/utils/benchmark.h"
 #include "td/utils/common.h"
+#include "td/utils/logging.h"
+#include "td/utils/MpmcQueue.h"
+#include "td/utils/port/thread.h"
+#include "td/utils/Random.h"
 #include "td/utils/SharedObjectPool.h"
+#include "td/utils/Slice.h"
 #include "td/utils/tests.h"
 
+#include <atomic>
 #include <memory>
+#include <thread>
 
 TEST(AtomicRefCnt, simple) {
   td::detail::AtomicRefCnt cnt{0};
@@ -97,3 +105,189 @@ TEST(SharedObjectPool, simple) {
   }
   CHECK(Node::cnt() == 0);
 }
+
+#if !TD_THREAD_UNSUPPORTED
+// objects are allocated in one thread and released in another, so they return to the allocating thread only
+// through full magazines in the depot
+TEST(SharedObjectPool, depot_exchange) {
+  constexpr size_t OBJECTS_N = 1000;
+  constexpr int ROUNDS_N = 10;
+  using Pool = td::SharedObjectPool<td::int64>;
+  Pool pool;
+  td::vector<Pool::Ptr> ptrs;
+  std::atomic<int> allocated_round{0};
+  std::atomic<int> released_round{0};
+
+  td::thread releaser([&] {
+    for (int round = 1; round <= ROUNDS_N; round++) {
+      while (allocated_round.load() != round) {
+        td::this_thread::yield();
+      }
+      for (auto &ptr : ptrs) {
+        CHECK(*ptr == round);
+        ptr.reset();
+      }
+      ptrs.clear();
+      released_round.store(round);
+    }
+  });
+  for (int round = 1; round <= ROUNDS_N; round++) {
+    for (size_t i = 0; i < OBJECTS_N; i++) {
+      ptrs.push_back(pool.alloc(round));
+    }
+    allocated_round.store(round);
+    while (released_round.load() != round) {
+      td::this_thread::yield();
+    }
+  }
+  releaser.join();
+
+  auto stats = pool.get_stats();
+  ASSERT_EQ(OBJECTS_N * ROUNDS_N, stats.alloc_count);
+  ASSERT_EQ(OBJECTS_N * ROUNDS_N, stats.free_count);
+  // the allocating thread never frees objects, so it reuses them only through magazines loaded from the depot
+  ASSERT_TRUE(stats.depot_alloc_count > 0);
+  ASSERT_EQ(stats.alloc_count, stats.local_alloc_count + stats.depot_alloc_count + pool.total_size());
+  // the releasing thread fills its magazines and passes them to the depot
+  ASSERT_TRUE(stats.local_free_count < stats.free_count);
+  // objects freed in the releasing thread are reused, except those left in its magazines
+  ASSERT_TRUE(pool.total_size() < 2 * OBJECTS_N);
+  ASSERT_EQ(pool.total_size(), pool.calc_free_size());
+}
+
+// threads, which weren't created by td::thread, have the same zero thread identifier
+TEST(SharedObjectPool, foreign_threads) {
+  constexpr size_t THREADS_N = 4;
+  constexpr size_t OBJECTS_N = 10000;
+  using Pool = td::SharedObjectPool<td::int64>;
+  Pool pool;
+  td::vector<td::vector<Pool::Ptr>> ptrs(THREADS_N);
+  for (size_t i = 0; i < THREADS_N; i++) {
+    for (size_t j = 0; j < OBJECTS_N; j++) {
+      ptrs[i].push_back(pool.alloc(static_cast<td::int64>(j)));
+    }
+  }
+
+  td::vector<std::thread> threads;
+  for (size_t i = 0; i < THREADS_N; i++) {
+    threads.emplace_back([&, i] {
+      for (size_t j = 0; j < OBJECTS_N; j++) {
+        CHECK(*ptrs[i][j] == static_cast<td::int64>(j));
+        ptrs[i][j].reset();
+        auto ptr = pool.alloc(static_cast<td::int64>(j));
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  auto stats = pool.get_stats();
+  ASSERT_EQ(2 * THREADS_N * OBJECTS_N, stats.alloc_count);
+  ASSERT_EQ(2 * THREADS_N * OBJECTS_N, stats.free_count);
+  ASSERT_EQ(THREADS_N * OBJECTS_N, pool.total_size());
+  ASSERT_EQ(pool.total_size(), pool.calc_free_size());
+}
+
+namespace {
+class SharedObjectPoolBenchmark final : public td::Benchmark {
+ public:
+  // if is_cross_thread, then objects are released by the next thread
+  SharedObjectPoolBenchmark(size_t threads_n, bool is_cross_thread)
+      : threads_n_(threads_n), is_cross_thread_(is_cross_thread) {
+  }
+
+  std::string get_description() const override {
+    return PSTRING() << "SharedObjectPool " << threads_n_ << " threads" << (is_cross_thread_ ? " cross-thread" : "");
+  }
+
+  void start_up() override {
+    pool_ = td::make_unique<Pool>();
+  }
+
+  void run(int n) override {
+    td::vector<td::unique_ptr<td::MpmcQueue<Pool::Ptr>>> queue_storage;
+    for (size_t i = 0; i < threads_n_; i++) {
+      queue_storage.push_back(td::make_unique<td::MpmcQueue<Pool::Ptr>>(2));
+    }
+    td::vector<td::thread> threads;
+    for (size_t i = 0; i < threads_n_; i++) {
+      threads.emplace_back([&, i] {
+        auto count = (n + threads_n_ - 1) / threads_n_;
+        if (is_cross_thread_) {
+          run_cross_thread(count, *queue_storage[i], *queue_storage[(i + 1) % threads_n_]);
+        } else {
+          run_thread(count);
+        }
+      });
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+  }
+
+  void tear_down() override {
+    stats_ = pool_->get_stats();
+    object_count_ = pool_->total_size();
+    pool_.reset();
+  }
+
+  // logs statistics of the last run
+  void log_stats() const {
+    LOG(ERROR) << get_description() << ": " << object_count_ << " objects, local allocation hit rate "
+               << static_cast<double>(stats_.local_alloc_count) / static_cast<double>(stats_.alloc_count)
+               << ", depot allocation hit rate "
+               << static_cast<double>(stats_.depot_alloc_count) / static_cast<double>(stats_.alloc_count)
+               << ", local free hit rate "
+               << static_cast<double>(stats_.local_free_count) / static_cast<double>(stats_.free_count);
+  }
+
+ private:
+  using Pool = td::SharedObjectPool<td::int64>;
+  td::unique_ptr<Pool> pool_;
+  size_t threads_n_;
+  bool is_cross_thread_;
+  Pool::Stats stats_;
+  size_t object_count_ = 0;
+
+  static constexpr size_t WINDOW_SIZE = 256;
+
+  // every thread keeps a window of live objects and replaces a random one of them
+  void run_thread(size_t n) {
+    td::vector<Pool::Ptr> window(WINDOW_SIZE);
+    for (size_t i = 0; i < n; i++) {
+      window[td::Random::fast(0, WINDOW_SIZE - 1)] = pool_->alloc(static_cast<td::int64>(i));
+    }
+  }
+
+  // every thread allocates batches of objects and passes them to the next thread, which releases them
+  void run_cross_thread(size_t n, td::MpmcQueue<Pool::Ptr> &in, td::MpmcQueue<Pool::Ptr> &out) {
+    size_t sent = 0;
+    size_t received = 0;
+    while (sent < n || received < n) {
+      for (size_t i = 0; i < WINDOW_SIZE && sent < n; i++, sent++) {
+        out.push(pool_->alloc(static_cast<td::int64>(i)), 0);
+      }
+      Pool::Ptr ptr;
+      while (received < n && in.try_pop(ptr, 1)) {
+        ptr.reset();
+        received++;
+      }
+      if (sent == n && received < n) {
+        td::this_thread::yield();
+      }
+    }
+  }
+};
+}  // namespace
+
+TEST(SharedObjectPool, Benchmark) {
+  for (size_t threads_n : {1, 4, 16}) {
+    for (bool is_cross_thread : {false, true}) {
+      SharedObjectPoolBenchmark benchmark(threads_n, is_cross_thread);
+      td::bench(benchmark);
+      benchmark.log_stats();
+    }
+  }
+}
+#endif
@@ -0,0 +1,180 @@
+#include "td/utils/benchmark.h"
+#include "td/utils/common.h"
+#include "td/utils/format.h"
+#include "td/utils/logging.h"
+#include "td/utils/port/sleep.h"
+#include "td/utils/port/Stat.h"
+#include "td/utils/port/thread.h"
+#include "td/utils/Random.h"
+#include "td/utils/StackAllocator.h"
+#include "td/utils/tests.h"
+
+#include <atomic>
+#include <cstdint>
+#include <utility>
+
+static void check_stack_allocator_memory(size_t size, size_t depth, td::vector<std::pair<char *, size_t>> &checks) {
+  auto ptr = td::StackAllocator::alloc(size);
+  auto slice = ptr.as_slice();
+  ASSERT_EQ(size, slice.size());
+  ASSERT_EQ(0u, reinterpret_cast<std::uintptr_t>(slice.data()) % 8);
+  slice.fill(static_cast<char>('a' + depth % 26));
+  checks.emplace_back(slice.data(), size);
+  if (depth > 0) {
+    check_stack_allocator_memory(static_cast<size_t>(td::Random::fast(0, 1 << 18)), depth - 1, checks);
+  }
+  for (size_t i = 0; i < size; i++) {
+    ASSERT_EQ(static_cast<char>('a' + depth % 26), slice[i]);
+  }
+}
+
+TEST(StackAllocator, simple) {
+  auto used_size = td::StackAllocator::get_thread_stats().used_size;
+  for (int t = 0; t < 100; t++) {
+    td::vector<std::pair<char *, size_t>> checks;
+    check_stack_allocator_memory(static_cast<size_t>(td::Random::fast(0, 100)), 20, checks);
+    ASSERT_EQ(used_size, td::StackAllocator::get_thread_stats().used_size);
+  }
+
+  {
+    // much more memory than the first segment
+    auto ptr = td::StackAllocator::alloc(10 << 20);
+    ptr.as_slice().fill('a');
+    auto stats = td::StackAllocator::get_thread_stats();
+    ASSERT_TRUE(stats.used_size >= (10 << 20));
+    ASSERT_TRUE(stats.high_water_size >= stats.used_size);
+    ASSERT_TRUE(stats.reserved_size >= stats.used_size);
+    auto small_ptr = td::StackAllocator::alloc(0);
+    ASSERT_EQ(0u, small_ptr.as_slice().size());
+  }
+  ASSERT_EQ(used_size, td::StackAllocator::get_thread_stats().used_size);
+
+  auto total_stats = td::StackAllocator::get_total_stats();
+  ASSERT_TRUE(total_stats.high_water_size >= (10 << 20));
+  ASSERT_TRUE(total_stats.reserved_size > 0);
+}
+
+#if !TD_THREAD_UNSUPPORTED
+TEST(StackAllocator, release) {
+  td::thread thread([] {
+    {
+      auto ptr = td::StackAllocator::alloc(3 << 20);
+      ptr.as_slice().fill('a');
+    }
+    auto stats = td::StackAllocator::get_thread_stats();
+    ASSERT_EQ(0u, stats.used_size);
+    ASSERT_TRUE(stats.high_water_size >= (3 << 20));
+    auto reserved_size = stats.reserved_size;
+    ASSERT_TRUE(reserved_size >= (3 << 20));
+
+    // the big allocation isn't repeated for a long time, so its memory is released
+    for (int i = 0; i < 1000; i++) {
+      auto ptr = td::StackAllocator::alloc(1000);
+      ptr.as_slice().fill('b');
+    }
+    stats = td::StackAllocator::get_thread_stats();
+    ASSERT_EQ(0u, stats.used_size);
+#if TD_PORT_POSIX
+    ASSERT_TRUE(stats.reserved_size < reserved_size || stats.released_size > 0);
+#endif
+    auto released_size = stats.released_size;
+
+    {
+      auto ptr = td::StackAllocator::alloc(1 << 19);
+      ptr.as_slice().fill('c');
+      {
+        auto other_ptr = td::StackAllocator::alloc(1 << 20);
+        other_ptr.as_slice().fill('d');
+      }
+      td::StackAllocator::release_unused_memory();
+      ASSERT_TRUE(td::StackAllocator::get_thread_stats().used_size >= (1 << 19));
+      for (auto c : ptr.as_slice()) {
+        ASSERT_EQ('c', c);
+      }
+    }
+    td::StackAllocator::release_unused_memory();
+    stats = td::StackAllocator::get_thread_stats();
+    ASSERT_EQ(0u, stats.used_size);
+#if TD_PORT_POSIX
+    ASSERT_TRUE(stats.released_size > released_size);
+#endif
+  });
+  thread.join();
+}
+#endif
+
+class StackAllocatorBenchmark final : public td::Benchmark {
+ public:
+  std::string get_description() const override {
+    return "StackAllocator alloc and free";
+  }
+
+  void run(int n) override {
+    for (int i = 0; i < n; i++) {
+      auto ptr = td::StackAllocator::alloc(4096);
+      ptr.as_slice()[0] = 'a';
+      td::do_not_optimize_away(ptr.as_slice().data());
+    }
+  }
+};
+
+class LogBenchmark final : public td::Benchmark {
+ public:
+  std::string get_description() const override {
+    return "LOG to NullLog";
+  }
+
+  void run(int n) override {
+    td::NullLog null_log;
+    td::LogOptions options(VERBOSITY_NAME(ERROR), false, true);
+    for (int i = 0; i < n; i++) {
+      LOG_IMPL_FULL(null_log, options, ERROR, VERBOSITY_NAME(ERROR), true, td::Slice()) << "message " << i;
+    }
+  }
+};
+
+#if !TD_THREAD_UNSUPPORTED
+// returns increase of resident memory size, when the given number of threads have logged a message
+static td::uint64 get_threads_resident_size(size_t threads_n) {
+  auto get_resident_size = [] {
+    auto r_mem_stat = td::mem_stat();
+    return r_mem_stat.is_ok() ? r_mem_stat.ok().resident_size_ : 0;
+  };
+  std::atomic<size_t> ready_n{0};
+  std::atomic<bool> can_exit{false};
+  td::vector<td::thread> threads;
+  auto old_resident_size = get_resident_size();
+  for (size_t i = 0; i < threads_n; i++) {
+    threads.emplace_back([&] {
+      td::NullLog null_log;
+      td::LogOptions options(VERBOSITY_NAME(ERROR), false, true);
+      LOG_IMPL_FULL(null_log, options, ERROR, VERBOSITY_NAME(ERROR), true, td::Slice()) << "message";
+      ready_n++;
+      while (!can_exit) {
+        td::usleep_for(1000);
+      }
+    });
+  }
+  while (ready_n != threads_n) {
+    td::usleep_for(1000);
+  }
+  auto new_resident_size = get_resident_size();
+  can_exit = true;
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  return new_resident_size - old_resident_size;
+}
+#endif
+
+TEST(StackAllocator, Benchmark) {
+  td::bench(StackAllocatorBenchmark());
+  td::bench(LogBenchmark());
+  auto stats = td::StackAllocator::get_thread_stats();
+  LOG(ERROR) << "Used: " << stats.used_size << ", high water: " << stats.high_water_size
+             << ", reserved: " << stats.reserved_size << ", released: " << stats.released_size;
+#if !TD_THREAD_UNSUPPORTED
+  LOG(ERROR) << "Resident memory of 1000 threads, which logged a message: "
+             << td::format::as_size(get_threads_resident_size(1000));
+#endif
+}
@@ -5,6 +5,7 @@
 #include "td/utils/MpmcQueue.h"
 #include "td/utils/port/thread.h"
 #include "td/utils/Random.h"
+#include "td/utils/Span.h"
 #include "td/utils/StealingQueue.h"
 #include "td/utils/tests.h"
 
@@ -19,6 +20,49 @@ TEST(StealingQueue, very_simple) {
   ASSERT_EQ(1, x);
 }
 
+TEST(StealingQueue, overflow_batch) {
+  td::StealingQueue<int, 8> q;
+  for (int i = 0; i < 8; i++) {
+    q.local_push(i, [](auto) { UNREACHABLE(); });
+  }
+  td::vector<int> overflow;
+  int overflow_calls = 0;
+  q.local_push(8, [&](td::Span<int> values) {
+    overflow_calls++;
+    overflow.insert(overflow.end(), values.begin(), values.end());
+  });
+  ASSERT_EQ(1, overflow_calls);
+  ASSERT_EQ(td::vector<int>({0, 1, 2, 3, 4, 8}), overflow);
+  for (int i = 5; i < 8; i++) {
+    int x;
+    CHECK(q.local_pop(x));
+    ASSERT_EQ(i, x);
+  }
+  int x;
+  CHECK(!q.local_pop(x));
+}
+
+TEST(StealingQueue, steal_n) {
+  td::StealingQueue<int, 8> q;
+  td::StealingQueue<int, 8> thief;
+  for (int i = 0; i < 7; i++) {
+    q.local_push(i, [](auto) { UNREACHABLE(); });
+  }
+  int buf[8];
+  auto stolen = thief.steal_n(td::MutableSpan<int>(buf, 2), q);
+  ASSERT_EQ(td::vector<int>({0, 1}), td::vector<int>(stolen.begin(), stolen.end()));
+  stolen = thief.steal_n(buf, q);
+  ASSERT_EQ(td::vector<int>({2, 3, 4}), td::vector<int>(stolen.begin(), stolen.end()));
+
+  int x;
+  CHECK(thief.steal(x, q));
+  ASSERT_EQ(5, x);
+  CHECK(thief.steal(x, q));
+  ASSERT_EQ(6, x);
+  CHECK(!thief.steal(x, q));
+  CHECK(!thief.local_pop(x));
+}
+
 TEST(AtomicRead, simple) {
   td::Stage run;
   td::Stage check;
@@ -153,12 +197,15 @@ TEST(StealingQueue, simple) {
           }
           //LOG(ERROR) << x << " " << got_sum.load() << " " << sum;
           got_sum.fetch_add(x, std::memory_order_relaxed);
-          lq[id].local_push(x - 1, [&](auto y) {
+          auto overflow_f = [&](auto values) {
             //LOG(ERROR) << "OVERFLOW";
-            gq.push(y, id);
-          });
+            for (auto y : values) {
+              gq.push(y, id);
+            }
+          };
+          lq[id].local_push(x - 1, overflow_f);
           if (x > 1) {
-            lq[id].local_push(x - 2, [&](auto y) { gq.push(y, id); });
+            lq[id].local_push(x - 2, overflow_f);
           }
         }
         check.wait(round * threads_n);
@@ -169,3 +216,122 @@ TEST(StealingQueue, simple) {
     thread.join();
   }
 }
+
+#if !TD_THREAD_UNSUPPORTED
+// the owner pushes and pops values, while thieves steal them; every value must be taken exactly once
+TEST(StealingQueue, stress) {
+  constexpr size_t N = 64;
+  size_t thieves_n = 6;
+  int values_n = 1000000;
+  td::StealingQueue<int, N> q;
+  td::vector<td::StealingQueue<int, N>> thief_queues(thieves_n);
+  td::vector<std::atomic<td::uint8>> taken(values_n + 1);
+  std::atomic<int> taken_n{0};
+
+  auto take = [&](int value) {
+    CHECK(1 <= value && value <= values_n);
+    LOG_CHECK(taken[value]++ == 0) << value;
+    taken_n++;
+  };
+
+  td::vector<td::thread> threads;
+  for (size_t i = 0; i < thieves_n; i++) {
+    threads.emplace_back([&, i] {
+      td::Random::Xorshift128plus rnd(i);
+      int buf[N];
+      while (taken_n.load(std::memory_order_relaxed) != values_n) {
+        if (rnd() % 2 == 0) {
+          for (auto value : thief_queues[i].steal_n(td::MutableSpan<int>(buf, rnd() % N + 1), q)) {
+            take(value);
+          }
+        } else {
+          int value;
+          if (thief_queues[i].steal(value, q)) {
+            take(value);
+            while (thief_queues[i].local_pop(value)) {
+              take(value);
+            }
+          }
+        }
+      }
+    });
+  }
+
+  td::Random::Xorshift128plus rnd(123);
+  for (int i = 1; i <= values_n; i++) {
+    q.local_push(i, [&](auto values) {
+      for (auto value : values) {
+        take(value);
+      }
+    });
+    if (rnd() % 4 == 0) {
+      int value;
+      if (q.local_pop(value)) {
+        take(value);
+      }
+    }
+  }
+  int value;
+  while (q.local_pop(value)) {
+    take(value);
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  ASSERT_EQ(values_n, taken_n.load());
+}
+
+// the owner pushes n values, thieves_n threads steal them with steal_n
+class StealingQueueBenchmark : public td::Benchmark {
+ public:
+  StealingQueueBenchmark(size_t thieves_n, size_t batch_size) : thieves_n_(thieves_n), batch_size_(batch_size) {
+  }
+
+  std::string get_description() const override {
+    return PSTRING() << "StealingQueue " << thieves_n_ << " thieves, batch " << batch_size_;
+  }
+
+  void run(int n) override {
+    td::StealingQueue<int> q;
+    std::atomic<int> taken_n{0};
+    td::vector<td::thread> threads;
+    for (size_t i = 0; i < thieves_n_; i++) {
+      threads.emplace_back([&] {
+        td::StealingQueue<int> thief;
+        td::vector<int> buf(batch_size_);
+        td::int64 sum = 0;
+        while (taken_n.load(std::memory_order_relaxed) != n) {
+          auto stolen = thief.steal_n(buf, q);
+          for (auto value : stolen) {
+            sum += value;
+          }
+          if (stolen.empty()) {
+            td::this_thread::yield();
+          } else {
+            taken_n.fetch_add(static_cast<int>(stolen.size()), std::memory_order_relaxed);
+          }
+        }
+        td::do_not_optimize_away(sum);
+      });
+    }
+    for (int i = 0; i < n; i++) {
+      q.local_push(i, [&](auto values) { taken_n.fetch_add(static_cast<int>(values.size())); });
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+  }
+
+ private:
+  size_t thieves_n_;
+  size_t batch_size_;
+};
+
+TEST(StealingQueue, Benchmark) {
+  for (size_t thieves_n : {1, 3, 7, 15}) {
+    for (size_t batch_size : {1, 16, 256}) {
+      td::bench(StealingQueueBenchmark(thieves_n, batch_size));
+    }
+  }
+}
+#endif  // !TD_THREAD_UNSUPPORTED
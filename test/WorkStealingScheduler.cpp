@@ -0,0 +1,228 @@
+#include "td/utils/benchmark.h"
+#include "td/utils/common.h"
+#include "td/utils/format.h"
+#include "td/utils/logging.h"
+#include "td/utils/port/Clocks.h"
+#include "td/utils/port/thread.h"
+#include "td/utils/tests.h"
+#include "td/utils/WorkStealingScheduler.h"
+
+#include <algorithm>
+#include <atomic>
+
+#if !TD_THREAD_UNSUPPORTED
+TEST(WorkStealingScheduler, simple) {
+  std::atomic<int> counter{0};
+  td::WorkStealingScheduler scheduler(4);
+  ASSERT_EQ(4u, scheduler.get_threads_n());
+  ASSERT_EQ(td::WorkStealingScheduler::NO_AFFINITY, scheduler.get_worker_id());
+  for (int i = 0; i < 10000; i++) {
+    scheduler.post([&] { counter++; });
+  }
+  scheduler.close();
+  ASSERT_EQ(10000, counter.load());
+  scheduler.close();
+}
+
+static td::uint64 fib(int n) {
+  return n < 2 ? n : fib(n - 1) + fib(n - 2);
+}
+
+static void spawn_fib(td::WorkStealingScheduler &scheduler, int n, std::atomic<td::uint64> &sum) {
+  if (n < 2) {
+    sum += n;
+    return;
+  }
+  scheduler.post([&scheduler, n, &sum] { spawn_fib(scheduler, n - 1, sum); });
+  scheduler.post([&scheduler, n, &sum] { spawn_fib(scheduler, n - 2, sum); });
+}
+
+TEST(WorkStealingScheduler, fork_join) {
+  for (size_t threads_n : {1, 3, 8}) {
+    std::atomic<td::uint64> sum{0};
+    td::WorkStealingScheduler scheduler(threads_n);
+    scheduler.post([&] { spawn_fib(scheduler, 22, sum); });
+    // close must wait for all tasks posted by other tasks
+    scheduler.close();
+    ASSERT_EQ(fib(22), sum.load());
+  }
+}
+
+TEST(WorkStealingScheduler, affinity) {
+  size_t threads_n = 4;
+  td::WorkStealingScheduler scheduler(threads_n);
+  std::atomic<int> counter{0};
+  std::atomic<int> bad_worker_id{0};
+  for (int i = 0; i < 1000; i++) {
+    auto affinity = i % static_cast<int>(threads_n + 1) - 1;
+    scheduler.post(
+        [&, affinity] {
+          auto worker_id = scheduler.get_worker_id();
+          if (worker_id < 0 || worker_id >= static_cast<td::int32>(threads_n)) {
+            bad_worker_id++;
+          }
+          // posts with the own affinity go to the local queue
+          scheduler.post([&] { counter++; }, worker_id);
+          scheduler.post([&] { counter++; }, affinity);
+        },
+        affinity);
+  }
+  scheduler.close();
+  ASSERT_EQ(0, bad_worker_id.load());
+  ASSERT_EQ(2000, counter.load());
+}
+
+TEST(WorkStealingScheduler, overflow) {
+  // a single task fills the local queue, so the rest goes to the global queue and can be stolen
+  td::WorkStealingScheduler scheduler(4);
+  std::atomic<int> counter{0};
+  scheduler.post([&] {
+    for (int i = 0; i < 100000; i++) {
+      scheduler.post([&] { counter++; });
+    }
+  });
+  scheduler.close();
+  ASSERT_EQ(100000, counter.load());
+}
+
+TEST(WorkStealingScheduler, many_posting_threads) {
+  // thread identifiers of the posting threads aren't limited, because all the threads run simultaneously
+  constexpr int THREADS_N = 200;
+  td::WorkStealingScheduler scheduler(2);
+  std::atomic<int> started_count{0};
+  std::atomic<int> counter{0};
+  td::vector<td::thread> threads;
+  for (int i = 0; i < THREADS_N; i++) {
+    threads.emplace_back([&] {
+      started_count++;
+      while (started_count.load() != THREADS_N) {
+        td::this_thread::yield();
+      }
+      scheduler.post([&] { counter++; });
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  scheduler.close();
+  ASSERT_EQ(THREADS_N, counter.load());
+}
+
+class SchedulerBenchmark : public td::Benchmark {
+ public:
+  explicit SchedulerBenchmark(size_t threads_n) : threads_n_(threads_n) {
+  }
+
+  void start_up() override {
+    scheduler_ = td::make_unique<td::WorkStealingScheduler>(threads_n_);
+  }
+
+  void tear_down() override {
+    scheduler_.reset();
+  }
+
+ protected:
+  size_t threads_n_;
+  td::unique_ptr<td::WorkStealingScheduler> scheduler_;
+  std::atomic<int> done_{0};
+
+  void wait_done(int n) {
+    while (done_.load(std::memory_order_acquire) != n) {
+      td::this_thread::yield();
+    }
+  }
+};
+
+// recursively splits n leaf tasks into two halves
+class ForkJoinBenchmark final : public SchedulerBenchmark {
+ public:
+  using SchedulerBenchmark::SchedulerBenchmark;
+
+  std::string get_description() const override {
+    return PSTRING() << "WorkStealingScheduler fork-join " << threads_n_ << " threads";
+  }
+
+  void run(int n) override {
+    done_ = 0;
+    scheduler_->post([this, n] { spawn(0, n); });
+    wait_done(n);
+  }
+
+ private:
+  void spawn(int l, int r) {
+    while (r - l > 1) {
+      auto m = l + (r - l) / 2;
+      scheduler_->post([this, m, r] { spawn(m, r); });
+      r = m;
+    }
+    done_.fetch_add(1, std::memory_order_release);
+  }
+};
+
+// chains_n messages are passed from worker to worker through affinity hints, n hops in total
+class MessagePassingBenchmark final : public SchedulerBenchmark {
+ public:
+  MessagePassingBenchmark(size_t threads_n, int chains_n) : SchedulerBenchmark(threads_n), chains_n_(chains_n) {
+  }
+
+  std::string get_description() const override {
+    return PSTRING() << "WorkStealingScheduler " << chains_n_ << " message chains " << threads_n_ << " threads";
+  }
+
+  void run(int n) override {
+    done_ = 0;
+    auto hops = (n + chains_n_ - 1) / chains_n_;
+    for (int i = 0; i < chains_n_; i++) {
+      scheduler_->post([this, hops] { pass(hops); }, i);
+    }
+    wait_done(chains_n_);
+  }
+
+ private:
+  int chains_n_;
+
+  void pass(int hops) {
+    if (hops == 0) {
+      done_.fetch_add(1, std::memory_order_release);
+      return;
+    }
+    auto next_worker = (scheduler_->get_worker_id() + 1) % static_cast<td::int32>(threads_n_);
+    scheduler_->post([this, hops] { pass(hops - 1); }, next_worker);
+  }
+};
+
+// measures the time from posting of a task by a non-worker thread to the start of the task, when all workers are idle
+static void run_post_latency_benchmark(size_t threads_n) {
+  constexpr size_t TASKS_N = 10000;
+  td::WorkStealingScheduler scheduler(threads_n);
+  td::vector<double> latencies;
+  latencies.reserve(TASKS_N);
+  std::atomic<bool> is_done{false};
+  for (size_t i = 0; i < TASKS_N; i++) {
+    is_done.store(false, std::memory_order_relaxed);
+    auto post_time = td::Clocks::monotonic();
+    scheduler.post([&, post_time] {
+      latencies.push_back(td::Clocks::monotonic() - post_time);
+      is_done.store(true, std::memory_order_release);
+    });
+    while (!is_done.load(std::memory_order_acquire)) {
+      td::this_thread::yield();
+    }
+  }
+  scheduler.close();
+
+  std::sort(latencies.begin(), latencies.end());
+  LOG(ERROR) << "WorkStealingScheduler post-to-run latency with " << threads_n << " threads: p50 "
+             << td::format::as_time(latencies[TASKS_N / 2]) << ", p99 "
+             << td::format::as_time(latencies[TASKS_N * 99 / 100]) << ", max " << td::format::as_time(latencies.back());
+}
+
+TEST(WorkStealingScheduler, Benchmark) {
+  for (size_t threads_n : {1, 2, 4, 8, 16}) {
+    td::bench(ForkJoinBenchmark(threads_n));
+    td::bench(MessagePassingBenchmark(threads_n, 1));
+    td::bench(MessagePassingBenchmark(threads_n, static_cast<int>(threads_n * 4)));
+    run_post_latency_benchmark(threads_n);
+  }
+}
+#endif  // !TD_THREAD_UNSUPPORTED
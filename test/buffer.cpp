@@ -1,7 +1,19 @@
 #include "td/utils/tests.h"
 
+#include "td/utils/benchmark.h"
 #include "td/utils/buffer.h"
+#include "td/utils/format.h"
+#include "td/utils/logging.h"
+#include "td/utils/MpmcRingQueue.h"
+#include "td/utils/port/IoSlice.h"
+#include "td/utils/port/memory.h"
+#include "td/utils/port/Stat.h"
+#include "td/utils/port/thread.h"
 #include "td/utils/Random.h"
+#include "td/utils/Span.h"
+
+#include <cstring>
+#include <thread>
 
 using namespace td;
 
@@ -47,6 +59,559 @@ TEST(Buffer, buffer_builder) {
         }
       }
     }
+    string io_slices_content;
+    for (auto &io_slice : builder.as_io_slices()) {
+      io_slices_content += as_slice(io_slice).str();
+    }
+    ASSERT_EQ(str, io_slices_content);
     ASSERT_EQ(builder.extract().as_slice(), str);
   }
 }
+
+static string get_io_slices_content(Span<IoSlice> slices) {
+  string result;
+  for (auto &io_slice : slices) {
+    ASSERT_TRUE(!as_slice(io_slice).empty());
+    result += as_slice(io_slice).str();
+  }
+  return result;
+}
+
+TEST(Buffer, chain_buffer_io_slices) {
+  ChainBufferWriter writer;
+  auto reader = writer.extract_reader();
+  IoSlice slices[4];
+  ASSERT_EQ(0u, reader.fill_io_slices(slices));
+
+  string str = rand_string('a', 'z', 100000);
+  auto splitted_str = rand_split(str);
+  size_t writer_pos = 0;
+  size_t reader_pos = 0;
+  for (auto &part : splitted_str) {
+    if (Random::fast(0, 1) == 1) {
+      writer.append(BufferSlice(part));
+    } else {
+      writer.append(part);
+    }
+    writer_pos += part.size();
+    if (Random::fast(0, 2) == 0) {
+      continue;
+    }
+    reader.sync_with_writer();
+    ASSERT_EQ(writer_pos - reader_pos, reader.size());
+
+    auto slice_count = reader.fill_io_slices(slices);
+    auto content = get_io_slices_content(Span<IoSlice>(slices, slice_count));
+    if (slice_count < 4) {
+      ASSERT_EQ(reader.size(), content.size());
+    }
+    ASSERT_EQ(str.substr(reader_pos, content.size()), content);
+
+    auto to_read = static_cast<size_t>(Random::fast(0, static_cast<int>(content.size())));
+    reader.advance(to_read);
+    reader_pos += to_read;
+  }
+
+  reader.sync_with_writer();
+  ASSERT_TRUE(!reader.empty());
+  ASSERT_EQ(0u, reader.fill_io_slices(MutableSpan<IoSlice>()));
+  ASSERT_EQ(0u, reader.fill_io_slices(MutableSpan<IoSlice>(slices, 0)));
+  ASSERT_EQ(0u, reader.begin().fill_io_slices(slices, 0));
+  ASSERT_EQ(1u, reader.begin().fill_io_slices(slices, 1));
+  ASSERT_EQ(1u, as_slice(slices[0]).size());
+
+  vector<IoSlice> all_slices(splitted_str.size() + 1);
+  auto slice_count = reader.fill_io_slices(all_slices);
+  ASSERT_EQ(str.substr(reader_pos), get_io_slices_content(Span<IoSlice>(all_slices.data(), slice_count)));
+}
+
+TEST(Buffer, chain_buffer_prepared_io_slices) {
+  ChainBufferWriter writer;
+  auto reader = writer.extract_reader();
+  writer.append("a");
+  auto buffer_mem = BufferAllocator::get_buffer_mem();
+
+  IoSlice slices[8];
+  for (size_t read_size : {0, 1, 5000, 100000}) {
+    auto slice_count = writer.prepare_append_io_slices(slices, 1 << 20);
+    ASSERT_TRUE(slice_count > 0);
+    ASSERT_TRUE(BufferAllocator::get_buffer_mem() >= buffer_mem + (1 << 19));
+    size_t left = read_size;
+    for (size_t i = 0; i < slice_count && left > 0; i++) {
+      auto slice = as_slice(slices[i]);
+      auto size = min(slice.size(), left);
+      MutableSlice(const_cast<char *>(slice.data()), size).fill('b');
+      left -= size;
+    }
+    writer.confirm_append_io_slices(read_size);
+
+    // unused buffers must be released, so only the buffers with data are kept
+    if (read_size <= 1) {
+      ASSERT_EQ(buffer_mem, BufferAllocator::get_buffer_mem());
+    } else {
+      ASSERT_TRUE(BufferAllocator::get_buffer_mem() <= buffer_mem + max(read_size, static_cast<size_t>(1 << 18)));
+    }
+    reader.sync_with_writer();
+    ASSERT_EQ(read_size + 1, reader.size());
+    string content(reader.size(), '\0');
+    reader.advance(reader.size(), content);
+    ASSERT_EQ("a" + string(read_size, 'b'), content);
+    writer.append("a");
+    buffer_mem = BufferAllocator::get_buffer_mem();
+  }
+}
+
+TEST(Buffer, pool) {
+  BufferAllocator::clear_thread_local();
+  BufferAllocator::trim_cached_memory();
+  ASSERT_EQ(0, BufferAllocator::get_cached_buffer_mem());
+  auto buffer_mem = BufferAllocator::get_buffer_mem();
+
+  for (size_t size = 1; size < 100000; size += size / 8 + 7) {
+    BufferWriter writer(size);
+    auto dest = writer.prepare_append();
+    ASSERT_TRUE(dest.size() >= size);
+    dest.fill('a');
+    writer.confirm_append(dest.size());
+    auto slice = writer.as_buffer_slice();
+    ASSERT_EQ(string(dest.size(), 'a'), slice.as_slice().str());
+  }
+  ASSERT_EQ(buffer_mem, BufferAllocator::get_buffer_mem());
+  auto cached_mem = BufferAllocator::get_cached_buffer_mem();
+  ASSERT_TRUE(cached_mem > 0);
+
+  // released blocks are reused
+  {
+    BufferWriter writer(1000);
+    ASSERT_TRUE(BufferAllocator::get_cached_buffer_mem() < cached_mem);
+  }
+  ASSERT_EQ(cached_mem, BufferAllocator::get_cached_buffer_mem());
+
+#if !TD_THREAD_UNSUPPORTED
+  // blocks released by another thread are returned through the global cache
+  std::vector<BufferSlice> slices;
+  td::thread thread([&] {
+    for (int i = 0; i < 1000; i++) {
+      slices.emplace_back(static_cast<size_t>(Random::fast(1, 10000)));
+    }
+  });
+  thread.join();
+  slices.clear();
+  ASSERT_EQ(buffer_mem, BufferAllocator::get_buffer_mem());
+
+  // magazines of threads, which weren't created by td::thread, are flushed to the depot at thread exit
+  std::thread([] {
+    for (int i = 0; i < 1000; i++) {
+      BufferSlice slice(static_cast<size_t>(Random::fast(1, 10000)));
+    }
+  }).join();
+  ASSERT_EQ(buffer_mem, BufferAllocator::get_buffer_mem());
+#endif
+
+  ASSERT_TRUE(BufferAllocator::trim_cached_memory() > 0);
+  ASSERT_EQ(0, BufferAllocator::get_cached_buffer_mem());
+}
+
+TEST(Buffer, large) {
+  auto old_options = BufferAllocator::get_large_buffer_options();
+  auto buffer_mem = BufferAllocator::get_buffer_mem();
+  ASSERT_TRUE(BufferSlice().get_backing() == BufferBacking::Heap);
+
+  for (bool use_transparent_huge_pages : {false, true}) {
+    for (bool populate : {false, true}) {
+      BufferAllocator::LargeBufferOptions options;
+      options.mmap_threshold = 1 << 17;
+      options.use_transparent_huge_pages = use_transparent_huge_pages;
+      options.populate = populate;
+      BufferAllocator::set_large_buffer_options(options);
+
+      ASSERT_TRUE(BufferSlice(1 << 16).get_backing() == BufferBacking::Heap);
+      for (size_t size : {(1 << 17) - 7, 1 << 17, 3000000}) {
+        BufferWriter writer(size);
+        auto dest = writer.prepare_append();
+        ASSERT_TRUE(dest.size() >= size);
+        // mapped memory is zero-initialized
+        ASSERT_EQ(string(dest.size(), '\0'), dest.str());
+        dest.fill('b');
+        writer.confirm_append(dest.size());
+        auto slice = writer.as_buffer_slice();
+        auto backing = slice.get_backing();
+#if TD_PORT_POSIX
+        if (use_transparent_huge_pages) {
+          ASSERT_TRUE(backing == BufferBacking::TransparentHugePages || backing == BufferBacking::Mmap);
+        } else {
+          ASSERT_TRUE(backing == BufferBacking::Mmap);
+        }
+        ASSERT_TRUE(BufferAllocator::get_buffer_mem() >= buffer_mem + size);
+#endif
+        ASSERT_EQ(string(dest.size(), 'b'), slice.as_slice().str());
+      }
+      ASSERT_EQ(buffer_mem, BufferAllocator::get_buffer_mem());
+    }
+  }
+
+  BufferAllocator::LargeBufferOptions options;
+  options.mmap_threshold = 1 << 17;
+  options.use_huge_pages = true;
+  BufferAllocator::set_large_buffer_options(options);
+  ASSERT_EQ(options.mmap_threshold, BufferAllocator::get_large_buffer_options().mmap_threshold);
+  ASSERT_TRUE(BufferAllocator::get_large_buffer_options().use_huge_pages);
+
+  // the huge page size is the default size used by the system, not a hard-coded constant
+  auto huge_page_size = get_huge_page_size();
+  LOG(INFO) << "Huge page size: " << huge_page_size;
+  ASSERT_TRUE(huge_page_size == 0 ||
+              (huge_page_size > get_page_size() && (huge_page_size & (huge_page_size - 1)) == 0));
+  {
+    // succeeds even if there are no reserved huge pages
+    BufferSlice slice(1 << 20);
+    LOG(INFO) << "Backing with huge pages: " << static_cast<int>(slice.get_backing());
+    slice.as_slice().fill('c');
+  }
+  ASSERT_EQ(buffer_mem, BufferAllocator::get_buffer_mem());
+
+  options.mmap_threshold = 0;
+  BufferAllocator::set_large_buffer_options(options);
+  ASSERT_TRUE(BufferSlice(3000000).get_backing() == BufferBacking::Heap);
+  ASSERT_EQ(buffer_mem, BufferAllocator::get_buffer_mem());
+
+  BufferAllocator::set_large_buffer_options(old_options);
+}
+
+static BufferAllocator::TagStats get_tag_stats(int32 tag) {
+  for (auto &stats : BufferAllocator::get_tag_stats()) {
+    if (stats.tag == tag) {
+      return stats;
+    }
+  }
+  UNREACHABLE();
+  return {};
+}
+
+TEST(Buffer, tags) {
+  auto tag = BufferAllocator::register_tag("test");
+  ASSERT_TRUE(tag > 0);
+  ASSERT_EQ(tag, BufferAllocator::register_tag("test"));
+  auto other_tag = BufferAllocator::register_tag("test other");
+  ASSERT_TRUE(other_tag != tag);
+  ASSERT_EQ("test", get_tag_stats(tag).name);
+  ASSERT_EQ("other", get_tag_stats(0).name);
+
+  auto old_stats = get_tag_stats(tag);
+  ASSERT_EQ(0, BufferAllocator::get_current_tag());
+  {
+    BufferAllocator::TagGuard guard(tag);
+    ASSERT_EQ(tag, BufferAllocator::get_current_tag());
+    BufferWriter writer(10000);
+    auto stats = get_tag_stats(tag);
+    ASSERT_TRUE(stats.live_bytes >= old_stats.live_bytes + 10000);
+    ASSERT_EQ(old_stats.allocated_bytes + 10000, stats.allocated_bytes);
+    ASSERT_EQ(old_stats.allocation_count + 1, stats.allocation_count);
+
+    {
+      BufferAllocator::TagGuard other_guard(other_tag);
+      ASSERT_EQ(other_tag, BufferAllocator::get_current_tag());
+      BufferSlice slice(5000);
+      ASSERT_TRUE(get_tag_stats(other_tag).live_bytes >= 5000);
+    }
+    ASSERT_EQ(0, get_tag_stats(other_tag).live_bytes);
+    ASSERT_EQ(tag, BufferAllocator::get_current_tag());
+
+    // a buffer released by another thread is still accounted to its tag
+    auto slice = writer.as_buffer_slice();
+#if !TD_THREAD_UNSUPPORTED
+    td::thread thread([slice = std::move(slice)]() mutable { slice = BufferSlice(); });
+    thread.join();
+#endif
+  }
+  ASSERT_EQ(0, BufferAllocator::get_current_tag());
+  auto stats = get_tag_stats(tag);
+  ASSERT_EQ(old_stats.live_bytes, stats.live_bytes);
+  ASSERT_EQ(old_stats.allocation_count + 1, stats.allocation_count);
+
+  {
+    // small readers are counted as separate allocations
+    BufferAllocator::TagGuard guard(tag);
+    for (int i = 0; i < 10; i++) {
+      BufferSlice slice(10);
+    }
+  }
+  stats = get_tag_stats(tag);
+  ASSERT_EQ(old_stats.allocation_count + 11, stats.allocation_count);
+  ASSERT_EQ(old_stats.allocated_bytes + 10000 + 10 * 16, stats.allocated_bytes);
+}
+
+TEST(Buffer, chain_buffer_node_cache) {
+  ChainBufferWriter writer;
+  auto reader = writer.extract_reader();
+  string expected;
+  for (int i = 0; i < 100; i++) {
+    // every slice gets its own node
+    BufferSlice slice(static_cast<size_t>(1000 + i));
+    slice.as_slice().fill(static_cast<char>('a' + i % 26));
+    expected += slice.as_slice().str();
+    writer.append(std::move(slice));
+  }
+  reader.sync_with_writer();
+  ASSERT_EQ(expected, reader.move_as_buffer_slice().as_slice().str());
+  auto cached_node_count = ChainBufferNodeAllocator::get_cached_node_count();
+  ASSERT_TRUE(cached_node_count >= 99);
+
+  {
+    // new nodes are taken from the cache
+    ChainBufferWriter other_writer;
+    auto other_reader = other_writer.extract_reader();
+    for (int i = 0; i < 10; i++) {
+      other_writer.append(BufferSlice(1000));
+    }
+    ASSERT_TRUE(ChainBufferNodeAllocator::get_cached_node_count() + 10 < cached_node_count);
+  }
+  ASSERT_EQ(cached_node_count, ChainBufferNodeAllocator::get_cached_node_count());
+}
+
+// allocates and frees writers of random sizes as ChainBufferWriter and BufferBuilder do
+class BufferWriterBenchmark final : public Benchmark {
+ public:
+  std::string get_description() const override {
+    return "BufferWriter allocation";
+  }
+
+  void start_up() override {
+    for (auto &size : sizes_) {
+      size = Random::fast(1 << 9, 1 << 14);
+    }
+  }
+
+  void run(int n) override {
+    for (int i = 0; i < n; i++) {
+      BufferWriter writer(sizes_[i & 63]);
+      do_not_optimize_away(writer.prepare_append().data());
+    }
+  }
+
+ private:
+  int sizes_[64];
+};
+
+// emulates BufferedFd echo: a message is read into the input chain of a connection,
+// moved to the output chain of the same connection and written out
+class EchoBenchmark final : public Benchmark {
+ public:
+  EchoBenchmark(size_t connections_n, size_t message_size)
+      : connections_n_(connections_n), message_size_(message_size) {
+  }
+
+  std::string get_description() const override {
+    return PSTRING() << "Echo " << connections_n_ << " connections, message size " << message_size_;
+  }
+
+  void start_up() override {
+    connections_.resize(connections_n_);
+    for (auto &connection : connections_) {
+      connection.input_reader = connection.input.extract_reader();
+      connection.output_reader = connection.output.extract_reader();
+    }
+  }
+
+  void run(int n) override {
+    for (int i = 0; i < n; i++) {
+      auto &connection = connections_[Random::fast(0, static_cast<int>(connections_n_) - 1)];
+      auto left = message_size_;
+      while (left > 0) {
+        auto dest = connection.input.prepare_append();
+        auto size = min(dest.size(), left);
+        dest.truncate(size).fill('a');
+        connection.input.confirm_append(size);
+        left -= size;
+      }
+      connection.input_reader.sync_with_writer();
+      connection.output.append(connection.input_reader.cut_head(message_size_));
+      connection.output_reader.sync_with_writer();
+      connection.output_reader.advance(connection.output_reader.size());
+    }
+  }
+
+  void tear_down() override {
+    connections_.clear();
+  }
+
+ private:
+  struct Connection {
+    ChainBufferWriter input;
+    ChainBufferReader input_reader;
+    ChainBufferWriter output;
+    ChainBufferReader output_reader;
+  };
+  size_t connections_n_;
+  size_t message_size_;
+  std::vector<Connection> connections_;
+};
+
+// many long-lived connections receive data at a low rate: every operation appends a packet to the input chain
+// of a random connection, which is then read and consumed, so chain nodes are constantly created and drained
+class ChainBufferConnectionsBenchmark final : public Benchmark {
+ public:
+  ChainBufferConnectionsBenchmark(size_t connections_n, size_t packet_size)
+      : connections_n_(connections_n), packet_size_(packet_size) {
+  }
+
+  std::string get_description() const override {
+    return PSTRING() << "ChainBuffer " << connections_n_ << " connections, packet size " << packet_size_;
+  }
+
+  void start_up() override {
+    connections_.resize(connections_n_);
+    for (auto &connection : connections_) {
+      connection.reader = connection.writer.extract_reader();
+    }
+  }
+
+  void run(int n) override {
+    for (int i = 0; i < n; i++) {
+      auto &connection = connections_[Random::fast(0, static_cast<int>(connections_n_) - 1)];
+      auto left = packet_size_;
+      while (left > 0) {
+        auto dest = connection.writer.prepare_append();
+        auto size = min(dest.size(), left);
+        dest.truncate(size).fill('a');
+        connection.writer.confirm_append(size);
+        left -= size;
+      }
+      connection.reader.sync_with_writer();
+      while (!connection.reader.empty()) {
+        auto slice = connection.reader.prepare_read();
+        do_not_optimize_away(slice[0]);
+        connection.reader.confirm_read(slice.size());
+      }
+    }
+  }
+
+  void tear_down() override {
+    connections_.clear();
+  }
+
+ private:
+  struct Connection {
+    ChainBufferWriter writer;
+    ChainBufferReader reader;
+  };
+  size_t connections_n_;
+  size_t packet_size_;
+  std::vector<Connection> connections_;
+};
+
+#if !TD_THREAD_UNSUPPORTED
+// buffers are allocated by one thread and released by another
+class CrossThreadBufferBenchmark final : public Benchmark {
+ public:
+  std::string get_description() const override {
+    return "BufferSlice released by another thread";
+  }
+
+  void run(int n) override {
+    MpmcRingQueue<BufferSlice> queue(1024);
+    td::thread producer([&] {
+      for (int i = 0; i < n; i++) {
+        BufferSlice slice(static_cast<size_t>(Random::fast(1 << 9, 1 << 13)));
+        while (!queue.try_push(slice)) {
+          td::this_thread::yield();
+        }
+      }
+    });
+    for (int i = 0; i < n;) {
+      BufferSlice slice;
+      if (queue.try_pop(slice)) {
+        i++;
+      } else {
+        td::this_thread::yield();
+      }
+    }
+    producer.join();
+  }
+};
+#endif
+
+// allocates a large buffer and fills it as read_file does
+class LargeBufferBenchmark final : public Benchmark {
+ public:
+  LargeBufferBenchmark(size_t size, string name, BufferAllocator::LargeBufferOptions options)
+      : size_(size), name_(std::move(name)), options_(options) {
+  }
+
+  std::string get_description() const override {
+    return PSTRING() << "Fill " << format::as_size(size_) << " buffer, " << name_;
+  }
+
+  void start_up() override {
+    old_options_ = BufferAllocator::get_large_buffer_options();
+    BufferAllocator::set_large_buffer_options(options_);
+  }
+
+  void run(int n) override {
+    for (int i = 0; i < n; i++) {
+      BufferWriter writer(size_);
+      auto dest = writer.prepare_append();
+      std::memset(dest.data(), 'a', dest.size());
+      writer.confirm_append(dest.size());
+      do_not_optimize_away(writer.as_buffer_slice().as_slice()[size_ / 2]);
+    }
+  }
+
+  void tear_down() override {
+    BufferAllocator::set_large_buffer_options(old_options_);
+  }
+
+ private:
+  size_t size_;
+  string name_;
+  BufferAllocator::LargeBufferOptions options_;
+  BufferAllocator::LargeBufferOptions old_options_;
+};
+
+static void log_buffer_memory() {
+  auto r_mem_stat = mem_stat();
+  LOG(ERROR) << "Buffer memory: " << format::as_size(BufferAllocator::get_buffer_mem())
+             << ", cached: " << format::as_size(static_cast<uint64>(BufferAllocator::get_cached_buffer_mem()))
+             << ", resident memory: " << format::as_size(r_mem_stat.is_ok() ? r_mem_stat.ok().resident_size_ : 0);
+}
+
+TEST(Buffer, Benchmark) {
+  bench(BufferWriterBenchmark());
+  log_buffer_memory();
+  for (size_t connections_n : {1, 1000}) {
+    for (size_t message_size : {100, 3000, 20000}) {
+      bench(EchoBenchmark(connections_n, message_size));
+      log_buffer_memory();
+    }
+  }
+  // 64 KB/s per connection in packets of 1300 bytes
+  for (size_t connections_n : {1000, 50000}) {
+    bench(ChainBufferConnectionsBenchmark(connections_n, 1300));
+    log_buffer_memory();
+  }
+#if !TD_THREAD_UNSUPPORTED
+  bench(CrossThreadBufferBenchmark());
+  log_buffer_memory();
+#endif
+  BufferAllocator::trim_cached_memory();
+  log_buffer_memory();
+
+  for (size_t size : {1 << 20, 16 << 20}) {
+    BufferAllocator::LargeBufferOptions options;
+    options.mmap_threshold = 0;
+    bench(LargeBufferBenchmark(size, "heap", options));
+    options.mmap_threshold = 1 << 17;
+    options.use_transparent_huge_pages = false;
+    bench(LargeBufferBenchmark(size, "mmap", options));
+    options.populate = true;
+    bench(LargeBufferBenchmark(size, "mmap + populate", options));
+    options.use_transparent_huge_pages = true;
+    options.populate = false;
+    bench(LargeBufferBenchmark(size, "transparent huge pages", options));
+    options.populate = true;
+    bench(LargeBufferBenchmark(size, "transparent huge pages + populate", options));
+    options.use_huge_pages = true;
+    bench(LargeBufferBenchmark(size, "huge pages + populate", options));
+  }
+  log_buffer_memory();
+}
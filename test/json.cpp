@@ -1,7 +1,10 @@
 #include "td/utils/tests.h"
 
+#include "td/utils/benchmark.h"
+#include "td/utils/format.h"
 #include "td/utils/JsonBuilder.h"
 #include "td/utils/logging.h"
+#include "td/utils/MonotonicArena.h"
 #include "td/utils/Slice.h"
 #include "td/utils/StringBuilder.h"
 
@@ -24,6 +27,12 @@ static void decode_encode(string str, string result = "") {
     result = str;
   }
   ASSERT_EQ(result, new_str);
+
+  MonotonicArena arena;
+  str_copy = str;
+  auto r_arena_value = json_decode(str_copy, arena);
+  ASSERT_TRUE(r_arena_value.is_ok());
+  ASSERT_EQ(result, json_encode<string>(*r_arena_value.ok()));
 }
 
 TEST(JSON, array) {
@@ -86,3 +95,90 @@ TEST(JSON, kphp) {
       "{\"keyboard\":[[\"\\u2022 abcdefg\"],[\"\\u2022 hijklmnop\"],[\"\\u2022 "
       "qrstuvwxyz\"]],\"one_time_keyboard\":true}");
 }
+
+TEST(JSON, arena) {
+  MonotonicArena arena;
+  string str = "{\"a\":[1,2,{\"b\":null}],\"c\":\"d\"}";
+  auto r_value = json_decode(MutableSlice(str), arena);
+  ASSERT_TRUE(r_value.is_ok());
+  auto &object = r_value.ok()->get_object();
+  ASSERT_EQ(2u, object.size());
+  ASSERT_TRUE(object.get_allocator().get_arena() == &arena);
+  auto &array = object[0].second.get_array();
+  ASSERT_EQ(3u, array.size());
+  ASSERT_TRUE(array.get_allocator().get_arena() == &arena);
+  ASSERT_TRUE(array[2].get_object()[0].second.type() == JsonValue::Type::Null);
+  ASSERT_TRUE(arena.get_allocated_size() > 0);
+
+  string bad_str = "[1,2";
+  ASSERT_TRUE(json_decode(MutableSlice(bad_str), arena).is_error());
+  bad_str = "[1,2] 3";
+  ASSERT_TRUE(json_decode(MutableSlice(bad_str), arena).is_error());
+  arena.reset();
+  ASSERT_EQ(0u, arena.get_allocated_size());
+}
+
+TEST(JSON, create_from_vector) {
+  std::vector<JsonValue> array;
+  array.push_back(JsonValue::create_boolean(true));
+  array.push_back(JsonValue());
+  std::vector<std::pair<MutableSlice, JsonValue>> object;
+  object.emplace_back(MutableSlice(), JsonValue::create_array(std::move(array)));
+  auto value = JsonValue::make_object(std::move(object));
+  ASSERT_EQ("{\"\":[true,null]}", json_encode<string>(value));
+  ASSERT_TRUE(value.get_object()[0].second.get_array().get_allocator().get_arena() == nullptr);
+}
+
+static string get_json_benchmark_string() {
+  string result = "[";
+  for (int i = 0; i < 5000; i++) {
+    if (i != 0) {
+      result += ',';
+    }
+    result += PSTRING() << "{\"id\":" << i << ",\"name\":\"user" << i
+                        << "\",\"is_bot\":false,\"tags\":[\"a\",\"b\",\"c\"],\"score\":" << i * 0.5
+                        << ",\"photo\":{\"small\":\"file" << i << "\",\"big\":\"file" << i << "\"}}";
+  }
+  result += ']';
+  return result;
+}
+
+class JsonDecodeBenchmark final : public Benchmark {
+ public:
+  explicit JsonDecodeBenchmark(bool use_arena) : use_arena_(use_arena) {
+  }
+
+  string get_description() const override {
+    return PSTRING() << "json_decode " << format::as_size(json_.size()) << (use_arena_ ? " into arena" : "");
+  }
+
+  void start_up() override {
+    json_ = get_json_benchmark_string();
+  }
+
+  void run(int n) override {
+    MonotonicArena arena;
+    for (int i = 0; i < n; i++) {
+      auto json = json_;
+      if (use_arena_) {
+        auto r_value = json_decode(json, arena);
+        CHECK(r_value.is_ok());
+        do_not_optimize_away(r_value.ok()->get_array().size());
+        arena.reset();
+      } else {
+        auto r_value = json_decode(json);
+        CHECK(r_value.is_ok());
+        do_not_optimize_away(r_value.ok().get_array().size());
+      }
+    }
+  }
+
+ private:
+  bool use_arena_;
+  string json_;
+};
+
+TEST(JSON, Benchmark) {
+  bench(JsonDecodeBenchmark(false));
+  bench(JsonDecodeBenchmark(true));
+}
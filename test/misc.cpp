@@ -1,5 +1,6 @@
 #include "td/utils/as.h"
 #include "td/utils/base64.h"
+#include "td/utils/benchmark.h"
 #include "td/utils/BigNum.h"
 #include "td/utils/bits.h"
 #include "td/utils/CancellationToken.h"
@@ -25,6 +26,7 @@
 #include "td/utils/Status.h"
 #include "td/utils/StringBuilder.h"
 #include "td/utils/tests.h"
+#include "td/utils/ThreadSafeCounter.h"
 #include "td/utils/Time.h"
 #include "td/utils/translit.h"
 #include "td/utils/uint128.h"
@@ -33,6 +35,8 @@
 
 #include <atomic>
 #include <clocale>
+#include <cmath>
+#include <functional>
 #include <limits>
 #include <locale>
 #include <unordered_map>
@@ -939,6 +943,52 @@ TEST(Misc, Time) {
     thread.join();
   }
 }
+
+TEST(Misc, ThreadSafeCounter) {
+  // more simultaneously running threads than the storage had slots before
+  size_t threads_n = 300;
+  Stage stage;
+  ThreadSafeCounter counter;
+  NamedThreadSafeCounter named_counter;
+  auto counter_ref = named_counter.get_counter("a");
+  std::atomic<int32> max_thread_id{0};
+  for (int round = 0; round < 2; round++) {
+    std::vector<thread> threads;
+    for (size_t i = 0; i < threads_n; i++) {
+      threads.emplace_back([&] {
+        auto thread_id = get_thread_id();
+        auto old_max_thread_id = max_thread_id.load();
+        while (old_max_thread_id < thread_id && !max_thread_id.compare_exchange_weak(old_max_thread_id, thread_id)) {
+        }
+        counter.add(1);
+        counter_ref.add(2);
+        stage.wait(threads_n * (round + 1));
+      });
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+  }
+  ASSERT_EQ(static_cast<int64>(2 * threads_n), counter.sum());
+  ASSERT_EQ(static_cast<int64>(4 * threads_n), counter_ref.sum());
+  // identifiers of finished threads are reused
+  ASSERT_TRUE(max_thread_id.load() <= static_cast<int32>(threads_n));
+
+  ThreadLocalStorage<int32> storage;
+  storage.get(1000) = 5;
+  int32 sum = 0;
+  size_t values_n = 0;
+  storage.for_each_with_thread_id([&](int32 thread_id, int32 &value) {
+    if (value != 0) {
+      ASSERT_EQ(1000, thread_id);
+    }
+    sum += value;
+    values_n++;
+  });
+  ASSERT_EQ(5, sum);
+  // only the segment containing the value is allocated
+  ASSERT_EQ(512u, values_n);
+}
 #endif
 
 TEST(Misc, uint128) {
@@ -1135,8 +1185,8 @@ static void test_hash() {
   test_hash<HashT, ValueA>({ValueA{1}, ValueA{2}}).ensure();
   test_hash<HashT, ValueB>({ValueB{1}, ValueB{2}}).ensure();
   test_hash<HashT, std::pair<int, int>>({{1, 1}, {1, 2}}).ensure();
-  // FIXME: use some better hash
-  //test_hash<HashT, std::pair<int, int>>({{1, 1}, {1, 2}, {2, 1}, {2, 2}}).ensure();
+  test_hash<HashT, std::pair<int, int>>({{1, 1}, {1, 2}, {2, 1}, {2, 2}}).ensure();
+  test_hash<HashT, string>({"", "a", "b", "ab", "ba", string(32, 'a'), string(33, 'a')}).ensure();
 }
 
 TEST(Misc, Hasher) {
@@ -1146,6 +1196,116 @@ TEST(Misc, Hasher) {
 #endif
 }
 
+TEST(Misc, HasherQuality) {
+  ASSERT_EQ(Hash<string>()(string("abacaba")), Hash<Slice>()(Slice("abacaba")));
+
+  auto check_distribution = [](const vector<size_t> &hashes) {
+    std::unordered_map<size_t, int> full;
+    std::unordered_map<size_t, int> buckets;
+    for (auto hash : hashes) {
+      full[hash]++;
+      buckets[hash & 0xFFFF]++;
+    }
+    ASSERT_EQ(hashes.size(), full.size());
+    // compare number of used buckets with the expected one for random hashes
+    auto expected = 0x10000 * (1 - std::pow(1 - 1.0 / 0x10000, static_cast<double>(hashes.size())));
+    ASSERT_TRUE(static_cast<double>(buckets.size()) >= expected * 0.95);
+  };
+
+  vector<size_t> hashes;
+  for (int64 i = 0; i < 0x10000; i++) {
+    hashes.push_back(Hash<int64>()(i));
+  }
+  check_distribution(hashes);
+
+  hashes.clear();
+  for (int i = 0; i < 256; i++) {
+    for (int j = 0; j < 256; j++) {
+      hashes.push_back(Hash<std::pair<int, int>>()(std::make_pair(i, j)));
+    }
+  }
+  check_distribution(hashes);
+
+  hashes.clear();
+  string str(100, 'a');
+  for (size_t len = 0; len <= str.size(); len++) {
+    hashes.push_back(Hash<string>()(str.substr(0, len)));
+  }
+  for (size_t i = 0; i < str.size(); i++) {
+    for (int c = 0; c < 256; c++) {
+      if (c != 'a') {
+        auto s = str;
+        s[i] = static_cast<char>(c);
+        hashes.push_back(Hash<string>()(s));
+      }
+    }
+  }
+  check_distribution(hashes);
+}
+
+template <class KeyT>
+class HashMapBenchmark : public Benchmark {
+ public:
+  HashMapBenchmark(string name, std::function<KeyT(int)> gen_key) : name_(std::move(name)), gen_key_(std::move(gen_key)) {
+  }
+  string get_description() const override {
+    return PSTRING() << "HashMap<" << name_ << ">";
+  }
+  void start_up_n(int n) override {
+    keys_.clear();
+    for (int i = 0; i < n; i++) {
+      keys_.push_back(gen_key_(i));
+    }
+  }
+  void run(int n) override {
+    HashMap<KeyT, int> hash_map;
+    for (int i = 0; i < n; i++) {
+      hash_map[keys_[i]] = i;
+    }
+    int res = 0;
+    for (int i = 0; i < n; i++) {
+      res += hash_map[keys_[i]];
+    }
+    do_not_optimize_away(res);
+  }
+
+ private:
+  string name_;
+  std::function<KeyT(int)> gen_key_;
+  vector<KeyT> keys_;
+};
+
+TEST(Misc, hash_benchmark) {
+  class HashBytesBenchmark : public Benchmark {
+   public:
+    explicit HashBytesBenchmark(size_t size) : str_(size, 'a') {
+    }
+    string get_description() const override {
+      return PSTRING() << "Hash<string> of " << str_.size() << " bytes";
+    }
+    void run(int n) override {
+      size_t res = 0;
+      for (int i = 0; i < n; i++) {
+        str_[0] = static_cast<char>(i);
+        res += Hash<string>()(str_);
+      }
+      do_not_optimize_away(res);
+    }
+
+   private:
+    string str_;
+  };
+  for (size_t size : {8, 32, 100, 1000, 100000}) {
+    bench(HashBytesBenchmark(size));
+  }
+
+  bench(HashMapBenchmark<int64>("sequential int64", [](int i) { return static_cast<int64>(i); }));
+  bench(HashMapBenchmark<int64>("random int64", [](int) { return static_cast<int64>(Random::fast_uint64()); }));
+  bench(HashMapBenchmark<std::pair<int32, int32>>("pair<int32, int32>",
+                                                  [](int i) { return std::make_pair(i >> 10, i & 1023); }));
+  bench(HashMapBenchmark<string>("string", [](int i) { return PSTRING() << "key_" << i; }));
+}
+
 TEST(Misc, CancellationToken) {
   CancellationTokenSource source;
   source.cancel();
@@ -3,6 +3,7 @@
 #include "td/utils/misc.h"
 #include "td/utils/port/EventFd.h"
 #include "td/utils/port/FileFd.h"
+#include "td/utils/port/Futex.h"
 #include "td/utils/port/IoSlice.h"
 #include "td/utils/port/path.h"
 #include "td/utils/port/signals.h"
@@ -133,6 +134,55 @@ TEST(Port, Writev) {
   ASSERT_EQ(expected_content, content);
 }
 
+TEST(Port, WritevMaxSlices) {
+  CSlice test_file_path = "test.txt";
+  unlink(test_file_path).ignore();
+  auto fd = FileFd::open(test_file_path, FileFd::Write | FileFd::CreateNew).move_as_ok();
+  std::vector<IoSlice> vec(MAX_IO_SLICES + 10, as_io_slice("a"));
+  ASSERT_EQ(MAX_IO_SLICES, fd.writev(vec).move_as_ok());
+  fd.close();
+  unlink(test_file_path).ensure();
+}
+
+#if !TD_THREAD_UNSUPPORTED
+TEST(Port, Futex) {
+  Futex futex;
+  futex.wait(1);  // returns immediately, because the value differs
+  std::atomic<int> woken{0};
+  vector<td::thread> threads;
+  for (int i = 0; i < 3; i++) {
+    threads.emplace_back([&] {
+      while (futex.load() == 0) {
+        futex.wait(0);
+      }
+      woken++;
+    });
+  }
+  usleep_for(1000);
+  ASSERT_EQ(0, woken.load());
+  futex.store(1);
+  futex.wake_all();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  ASSERT_EQ(3, woken.load());
+
+  // the woken thread destroys the Futex as soon as it sees the new value
+  for (int i = 0; i < 1000; i++) {
+    auto flag = make_unique<Futex>();
+    auto flag_ptr = flag.get();
+    td::thread waiter([&flag] {
+      while (flag->load() == 0) {
+        flag->wait(0);
+      }
+      flag.reset();
+    });
+    flag_ptr->store_and_wake_one(1);
+    waiter.join();
+  }
+}
+#endif
+
 #if TD_PORT_POSIX && !TD_THREAD_UNSUPPORTED
 #include <signal.h>
 #include <sys/syscall.h>